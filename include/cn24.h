@@ -25,6 +25,8 @@
 #include "cn24/util/KITTIData.h"
 #include "cn24/util/Init.h"
 #include "cn24/util/GradientTester.h"
+#include "cn24/util/FastMath.h"
+#include "cn24/util/ThreadPool.h"
 
 #include "cn24/net/Layer.h"
 #include "cn24/net/InputLayer.h"
@@ -35,7 +37,10 @@
 #include "cn24/net/ResizeLayer.h"
 #include "cn24/net/ConvolutionLayer.h"
 #include "cn24/net/MaxPoolingLayer.h"
+#include "cn24/net/AveragePoolingLayer.h"
 #include "cn24/net/UpscaleLayer.h"
+#include "cn24/net/BilinearUpscaleLayer.h"
+#include "cn24/net/DeconvolutionLayer.h"
 #include "cn24/net/LossFunctionLayer.h"
 #include "cn24/net/ErrorLayer.h"
 #include "cn24/net/StatLayer.h"
@@ -16,6 +16,7 @@
 #define CONV_CONFIGURABLEFACTORY_H
 
 #include <iostream>
+#include <string>
 
 #include "Trainer.h"
 #include "Net.h"
@@ -95,6 +96,17 @@ private:
   int factorx = 1;
   int factory = 1;
 
+  // Size of the im2col workspace in KiB, zero for the layer's default
+  unsigned int workspace_kb_ = 0;
+
+  // "zero" or "mirror" to pad in every convolutional layer instead of
+  // adding a ResizeLayer in front of an FCN, empty otherwise
+  std::string padding_;
+
+  // "bilinear" or "deconvolution" to scale the output of an FCN up with a
+  // BilinearUpscaleLayer or a DeconvolutionLayer instead of an UpscaleLayer
+  std::string upscaling_;
+
   unsigned int seed_ = 0;
   TrainerSettings optimal_settings_;
 };
@@ -0,0 +1,76 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file AveragePoolingLayer.h
+ * @class AveragePoolingLayer
+ * @brief Layer that sends the mean of a specified region to the next.
+ *
+ * Unlike MaxPoolingLayer, this doesn't have to remember anything for
+ * backpropagation.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_AVERAGEPOOLINGLAYER_H
+#define CONV_AVERAGEPOOLINGLAYER_H
+
+#include "Tensor.h"
+#include "SimpleLayer.h"
+
+
+namespace Conv {
+
+class AveragePoolingLayer : public SimpleLayer {
+public:
+  /**
+   * @brief Constructs an average-pooling Layer.
+   *
+   * @param region_width Width of the pooling regions
+   * @param region_height Height of the pooling regions
+   */
+  AveragePoolingLayer(const unsigned int region_width,
+                      const unsigned int region_height);
+
+  /**
+   * @brief Sets the distance between neighbouring regions. The default is
+   *   the region size. Regions overlap if this is smaller.
+   *
+   * Call this before the layer is added to a net. The input dimensions
+   * minus the region dimensions have to be divisible by the stride.
+   */
+  void SetStride (const unsigned int stride_width,
+                  const unsigned int stride_height);
+
+  // Implementations for SimpleLayer
+  bool CreateOutputs (const std::vector< CombinedTensor* >& inputs, std::vector< CombinedTensor* >& outputs);
+  bool Connect (const CombinedTensor* input, CombinedTensor* output);
+  void FeedForward();
+  void BackPropagate();
+
+  inline unsigned int Gain() {
+    return gain / (region_width_ * region_height_);
+  }
+
+  inline bool NeedsOutputData() { return false; }
+
+private:
+  // Settings
+  unsigned int region_width_ = 0;
+  unsigned int region_height_ = 0;
+  unsigned int stride_width_ = 0;
+  unsigned int stride_height_ = 0;
+
+  // Feature map dimensions
+  unsigned int input_width_ = 0;
+  unsigned int input_height_ = 0;
+
+  unsigned int maps_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+
+/**
+ * @file BilinearUpscaleLayer.h
+ * @class BilinearUpscaleLayer
+ * @brief Layer that scales samples up by bilinear interpolation.
+ *
+ * Like UpscaleLayer, but every output pixel is interpolated between the
+ * four nearest input pixel centers instead of copied from one of them.
+ * Pixels closer to the border than half an input pixel use the border
+ * pixels.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_BILINEARUPSCALELAYER_H
+#define CONV_BILINEARUPSCALELAYER_H
+
+#include <vector>
+
+#include "Tensor.h"
+#include "SimpleLayer.h"
+
+namespace Conv {
+
+class BilinearUpscaleLayer : public SimpleLayer {
+public:
+  /**
+   * @brief Creates a BilinearUpscaleLayer.
+   *
+   * @param region_width Horizontal scaling factor
+   * @param region_height Vertical scaling factor
+   */
+  BilinearUpscaleLayer(const unsigned int region_width,
+                       const unsigned int region_height);
+
+  // Implementations for SimpleLayer
+  bool CreateOutputs (const std::vector< CombinedTensor* >& inputs, std::vector< CombinedTensor* >& outputs);
+  bool Connect (const CombinedTensor* input, CombinedTensor* output);
+  void FeedForward();
+  void BackPropagate();
+
+  inline bool NeedsOutputData() { return false; }
+
+private:
+  // Settings
+  unsigned int region_width_ = 0;
+  unsigned int region_height_ = 0;
+
+  // Feature map dimensions
+  unsigned int input_width_ = 0;
+  unsigned int input_height_ = 0;
+  unsigned int output_width_ = 0;
+  unsigned int output_height_ = 0;
+
+  unsigned int maps_ = 0;
+
+  // For every output column and row, the two input pixels it is
+  // interpolated from and the weight of the second one
+  std::vector<unsigned int> first_x_;
+  std::vector<unsigned int> second_x_;
+  std::vector<datum> weight_x_;
+  std::vector<unsigned int> first_y_;
+  std::vector<unsigned int> second_y_;
+  std::vector<datum> weight_y_;
+
+  // Input scaled up horizontally only, and its gradient
+  Tensor horizontal_;
+};
+
+}
+#endif
@@ -15,13 +15,38 @@
 #ifndef CONV_CONVOLUTIONLAYER_H
 #define CONV_CONVOLUTIONLAYER_H
 
+#include <cstddef>
 #include <random>
+#include <vector>
 
 #include "Layer.h"
 #include "SimpleLayer.h"
 
 namespace Conv {
 
+struct ConvolutionShape;
+class WinogradConvolution;
+class Im2ColConvolution;
+
+enum ConvolutionAlgorithm {
+  CONV_ALGORITHM_GEMM,
+  CONV_ALGORITHM_DIRECT,
+  CONV_ALGORITHM_WINOGRAD,
+  CONV_ALGORITHM_DEPTHWISE
+};
+
+enum ConvolutionActivation {
+  CONV_ACTIVATION_NONE,
+  CONV_ACTIVATION_RELU,
+  CONV_ACTIVATION_SIGMOID,
+  CONV_ACTIVATION_TANH
+};
+
+enum ConvolutionPadding {
+  CONV_PADDING_ZERO,
+  CONV_PADDING_MIRROR
+};
+
 class ConvolutionLayer : public SimpleLayer {
 public:
   /**
@@ -34,6 +59,7 @@ public:
    */
   ConvolutionLayer(const unsigned int kwidth, const unsigned int kheight,
                    const unsigned int output_maps, const int seed = 0);
+  ~ConvolutionLayer();
   
   // Implementations for SimpleLayer
   bool CreateOutputs (const std::vector< CombinedTensor* >& inputs,
@@ -45,33 +71,287 @@ public:
   void OnLayerConnect (Layer* next_layer);
   
   inline unsigned int Gain() {
-    return kernel_width_ * kernel_height_ * input_maps_;
+    return kernel_width_ * kernel_height_ * input_maps_ / groups_;
   }
   
   bool IsOpenCLAware();
+
+  // Only a fused activation function needs the output for backpropagation
+  inline bool NeedsOutputData() {
+    return activation_ != CONV_ACTIVATION_NONE;
+  }
+
+  /**
+   * @brief Sets the size of the im2col workspace. Call this before the
+   *   layer is connected.
+   *
+   * @param workspace_size Size in bytes
+   */
+  inline void SetWorkspaceSize (const std::size_t workspace_size) {
+    workspace_size_ = workspace_size;
+  }
+
+  /**
+   * @brief Moves the kernel by more than one pixel at a time, which
+   *   shrinks the output by the same factor. Call this before the layer
+   *   is added to a net.
+   */
+  void SetStride (const unsigned int stride_x, const unsigned int stride_y);
+
+  /**
+   * @brief Spreads the kernel out over the input ("a trous" convolution),
+   *   leaving dilation - 1 pixels between neighboring taps. This grows the
+   *   receptive field without pooling. Call this before the layer is added
+   *   to a net.
+   */
+  void SetDilation (const unsigned int dilation_x,
+                    const unsigned int dilation_y);
+
+  /**
+   * @brief Pads the input inside of the convolution, like a ResizeLayer
+   *   in front of this layer would, but without a padded copy of the
+   *   input. Call this before the layer is added to a net.
+   *
+   * Use a border of dilation * (kernel size - 1) to keep the size of the
+   * input ('same' convolution).
+   *
+   * @param border_x Size of the complete horizontal border, half of it
+   *   (rounded down) is on the left
+   * @param border_y Size of the complete vertical border, half of it
+   *   (rounded down) is on the top
+   * @param padding Zeros or a mirror image of the input
+   */
+  void SetPadding (const unsigned int border_x, const unsigned int border_y,
+                   const ConvolutionPadding padding = CONV_PADDING_ZERO);
+
+  /**
+   * @brief Splits the input and output maps into groups. Every output map
+   *   is only connected to the input maps of its own group, which divides
+   *   the number of weights and the work by the number of groups. Call
+   *   this before the layer is added to a net.
+   *
+   * The number of input and output maps have to be multiples of groups.
+   */
+  void SetGroups (const unsigned int groups);
+
+  /**
+   * @brief Makes this a depthwise convolution: every input map is
+   *   convolved with its own kernel. The layer has as many output maps as
+   *   inputs, the number passed to the constructor is ignored. Call this
+   *   before the layer is added to a net.
+   */
+  void SetDepthwise();
+
+  inline unsigned int groups() const {
+    return groups_;
+  }
+
+  /**
+   * @brief Uses this algorithm instead of the fastest one, if it supports
+   *   the layer's settings. Call this before the first forward pass.
+   */
+  inline void SetAlgorithm (const ConvolutionAlgorithm algorithm) {
+    requested_algorithm_ = algorithm;
+    algorithm_requested_ = true;
+    algorithm_selected_ = false;
+  }
+
+  /**
+   * @brief Returns the algorithm selected on the first forward pass.
+   */
+  inline ConvolutionAlgorithm algorithm() const {
+    return algorithm_;
+  }
+
+  inline unsigned int stride_x() const {
+    return stride_x_;
+  }
+
+  inline unsigned int stride_y() const {
+    return stride_y_;
+  }
+
+  inline unsigned int dilation_x() const {
+    return dilation_x_;
+  }
+
+  inline unsigned int dilation_y() const {
+    return dilation_y_;
+  }
+
+  /**
+   * @brief Applies an activation function to the output while it is
+   *   computed, instead of in a separate NonLinearityLayer.
+   *
+   * The output then contains the activations and BackPropagate expects
+   * the gradient with respect to them.
+   */
+  void SetActivation (const ConvolutionActivation activation);
+
+  inline ConvolutionActivation activation() const {
+    return activation_;
+  }
+
+  /**
+   * @brief Max-pools the output in the same pass, instead of in a separate
+   *   MaxPoolingLayer. Call this before the layer is added to a net.
+   *
+   * The output then has the pooled size. The convolution is computed for a
+   * few samples at a time and pooled while it is still in the cache, so
+   * the unpooled output of the whole batch is never stored. A fused
+   * activation is applied after pooling, which gives the same result
+   * because all of them are monotonic.
+   */
+  void SetMaxPooling (const unsigned int region_width,
+                      const unsigned int region_height);
+
+  inline unsigned int pooling_width() const {
+    return pool_width_;
+  }
+
+  inline unsigned int pooling_height() const {
+    return pool_height_;
+  }
+
+  /**
+   * @brief Sums up the bias gradient while the weight gradient is
+   *   computed, instead of in a separate pass over the output gradient.
+   *   This is the default. It has no effect on the GEMM algorithm.
+   */
+  inline void SetFusedBiasGradient (const bool fuse_bias_gradient) {
+    fuse_bias_gradient_ = fuse_bias_gradient;
+  }
 private:
-  void im2colff();
-  void col2imff();
-  
-  void im2colbp();
-  void col2imbp();
-  
-  Tensor im2col_ff_buffer;
-  Tensor ff_output_buffer;
-  Tensor bp_deltax_buffer;
-  Tensor bp_deltay_buffer;
-  
-  Tensor ones_;
+  /**
+   * @brief Benchmarks the available algorithms for the shape (or looks up
+   *   the result of an earlier run) and sets up the fastest one.
+   *
+   * Called on the first forward pass, so it knows whether the input
+   * gradient is ever computed.
+   */
+  void SelectAlgorithm (const ConvolutionShape& shape);
+  void SetupAlgorithm (const ConvolutionShape& shape);
+  void ReleaseAlgorithm();
+
+  // These use the selected algorithm
+  void ConvolveForward (const ConvolutionShape& shape, const datum* input,
+                        datum* output);
+  void ConvolveBackwardData (const ConvolutionShape& shape,
+                             const datum* output_delta, datum* input_delta);
+  void ConvolveWeightGradient (const ConvolutionShape& shape,
+                               const datum* input, const datum* output_delta,
+                               datum* weights_delta, datum* bias_delta);
+
+  // Extent of the kernels in the input, including the gaps
+  inline unsigned int DilatedKernelWidth() const {
+    return dilation_x_ * (kernel_width_ - 1) + 1;
+  }
+
+  inline unsigned int DilatedKernelHeight() const {
+    return dilation_y_ * (kernel_height_ - 1) + 1;
+  }
+
+  // Forward and backward pass with a fused max-pooling
+  void FeedForwardPooled (const ConvolutionShape& shape);
+  void BackPropagatePooled (const ConvolutionShape& shape);
+
+  inline bool IsPooled() const {
+    return pool_width_ * pool_height_ > 1;
+  }
+
+  void ActivationBackward (datum* output_delta, const datum* output) const;
+  void UpdateWinogradKernels (const bool backward);
+
+  /**
+   * @brief Packs the weights for the direct or GEMM algorithm if they have
+   *   changed since the last call.
+   *
+   * @returns The size of the packed weights of one group, zero if the
+   *   algorithm does not use them
+   */
+  std::size_t UpdatePackedWeights (const ConvolutionShape& shape);
+  void GetShape (ConvolutionShape& shape, const unsigned int samples) const;
+
+  // True if every map is its own group
+  inline bool IsDepthwise() const {
+    return depthwise_ || (groups_ > 1 && groups_ == input_maps_ &&
+                          groups_ == output_maps_);
+  }
+
+  // Number of groups that are convolved one after another. The depthwise
+  // kernels do all maps at once.
+  inline unsigned int SequentialGroups() const {
+    return IsDepthwise() ? 1 : groups_;
+  }
+
+  // Tiled im2col and GEMM, only used with BLAS
+  Im2ColConvolution* im2col_ = nullptr;
+  std::size_t workspace_size_ = 2 * 1024 * 1024;
+
+  // Buffers for the direct convolution kernels. The packed weights of the
+  // forward pass (for the direct or the GEMM algorithm) are kept until the
+  // parameters change.
+  Tensor packed_weights_ff_;
+  bool packed_weights_valid_ = false;
+  unsigned int packed_weights_version_ = 0;
+  Tensor packed_weights_bp_;
+  Tensor padded_delta_bp_;
+  Tensor padded_input_;
+  Tensor padded_input_delta_;
+
+  // Weight and bias gradients of all but the first chunk of output rows
+  Tensor partial_gradients_;
+  bool fuse_bias_gradient_ = true;
+
+  ConvolutionAlgorithm algorithm_ = CONV_ALGORITHM_DIRECT;
+
+  // The algorithm is selected again if backpropagation was turned on or
+  // off since, because the benchmark depends on it
+  bool algorithm_selected_ = false;
+  bool algorithm_backprop_ = false;
+  bool algorithm_requested_ = false;
+  ConvolutionAlgorithm requested_algorithm_ = CONV_ALGORITHM_DIRECT;
+  ConvolutionActivation activation_ = CONV_ACTIVATION_NONE;
+
+  // Winograd transformations for the forward pass and the input gradient
+  WinogradConvolution* winograd_ff_ = nullptr;
+  WinogradConvolution* winograd_bp_ = nullptr;
+  bool winograd_ff_valid_ = false;
+  bool winograd_bp_valid_ = false;
+  unsigned int winograd_ff_version_ = 0;
+  unsigned int winograd_bp_version_ = 0;
   
   unsigned int input_maps_ = 0;
   unsigned int output_maps_ = 0;
   
   unsigned int kernel_width_ = 0;
   unsigned int kernel_height_ = 0;
+
+  unsigned int groups_ = 1;
+  bool depthwise_ = false;
+
+  unsigned int stride_x_ = 1;
+  unsigned int stride_y_ = 1;
+  unsigned int dilation_x_ = 1;
+  unsigned int dilation_y_ = 1;
+
+  // Fused max-pooling. The convolution's output (and its gradient) is
+  // computed for pooling_samples_ samples at a time in unpooled_.
+  unsigned int pool_width_ = 1;
+  unsigned int pool_height_ = 1;
+  unsigned int pooling_samples_ = 0;
+  Tensor unpooled_;
+  std::vector<unsigned char> maximum_;
+  Tensor pass_gradients_;
+
+  unsigned int border_x_ = 0;
+  unsigned int border_y_ = 0;
+  ConvolutionPadding padding_ = CONV_PADDING_ZERO;
   
   unsigned int input_width_ = 0;
   unsigned int input_height_ = 0;
   
+  // Size of the convolution's output, before pooling
   unsigned int output_width_ = 0;
   unsigned int output_height_ = 0;
   
@@ -9,6 +9,10 @@
  * @class DatasetInputLayer
  * @brief This layer outputs labeled data from a Dataset.
  *
+ * If CN24 is built with BUILD_PREFETCH, the batches are assembled by a
+ * background thread while the net works on the previous one. They come out
+ * in the same order and with the same loss sampling as without it.
+ *
  * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
  */
 
@@ -19,6 +23,14 @@
 #include <random>
 #include <iostream>
 
+#ifdef BUILD_PREFETCH
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#endif
+
 #include "Tensor.h"
 #include "CombinedTensor.h"
 
@@ -43,6 +55,18 @@ public:
 			const datum loss_sampling_p = 1.0,
       const unsigned int seed = 0
 		    );
+
+  ~DatasetInputLayer();
+
+  /**
+   * @brief Sets the number of batches to assemble in advance.
+   *
+   * Zero assembles every batch in FeedForward. This has no effect if CN24
+   * is built without BUILD_PREFETCH.
+   *
+   * @param batches Number of batches to keep ready
+   */
+  void SetPrefetchBatches (const unsigned int batches);
   
   // Implementations for Layer
   bool CreateOutputs (const std::vector< CombinedTensor* >& inputs,
@@ -61,6 +85,7 @@ public:
   inline datum GetLossSamplingProbability() {
     return loss_sampling_p_;
   }
+  double TakeLoaderWaitTime();
   inline unsigned int current_element() {
     return current_element_;
   }
@@ -99,6 +124,63 @@ private:
   unsigned int current_element_ = 0;
 
   unsigned int current_element_testing_ = 0;
+
+  // Seconds spent waiting for batches since the last TakeLoaderWaitTime
+  double loader_wait_ = 0;
+
+  unsigned int prefetch_batches_ = 2;
+
+#ifdef BUILD_PREFETCH
+  struct PrefetchSlot {
+    Tensor data;
+    Tensor label;
+    Tensor weight;
+
+    // Sampler state before this batch, to go back to if it is discarded.
+    // The permutation is only saved if the batch redoes it.
+    std::mt19937 generator;
+    unsigned int current_element;
+    unsigned int current_element_testing;
+    bool has_permutation;
+    std::vector<unsigned int> permutation;
+
+    // Set instead of the batch if assembling it failed
+    std::exception_ptr error;
+  };
+
+  // Ring of batches, filled by prefetch_thread_ and emptied by FeedForward.
+  // While the thread runs, it owns the sampler state above.
+  std::vector<PrefetchSlot> slots_;
+  std::atomic<unsigned int> produced_;
+  std::atomic<unsigned int> consumed_;
+  std::atomic<bool> stop_prefetching_;
+  std::thread prefetch_thread_;
+
+  // Only for sleeping while the ring is full or empty
+  std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_condition_;
+
+  /**
+   * @brief Starts the background thread.
+   */
+  void StartPrefetching();
+
+  /**
+   * @brief Stops the background thread and discards the batches that were
+   *   not used, so the next batch is the same as without prefetching.
+   */
+  void StopPrefetching();
+
+  /**
+   * @brief Body of the background thread.
+   */
+  void Prefetch();
+#endif
+
+  /**
+   * @brief Loads the next batch into the given Tensors.
+   */
+  void AssembleBatch (Tensor& data, Tensor& label, Tensor& weight);
   
   /**
    * @brief Clears the permutation vector and generates a new one.
@@ -0,0 +1,171 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file DeconvolutionLayer.h
+ * @class DeconvolutionLayer
+ * @brief Layer that learns a transposed ("fractionally strided")
+ *   convolution, which scales its input up by the stride.
+ *
+ * Every input pixel adds its value times the kernel to the output, with
+ * the kernels of neighbouring input pixels stride pixels apart. This is
+ * the operation that computes the input gradient of a strided
+ * ConvolutionLayer.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_DECONVOLUTIONLAYER_H
+#define CONV_DECONVOLUTIONLAYER_H
+
+#include <random>
+#include <vector>
+
+#include "Tensor.h"
+#include "SimpleLayer.h"
+
+namespace Conv {
+
+struct ConvolutionShape;
+
+class DeconvolutionLayer : public SimpleLayer {
+public:
+  /**
+   * @brief Constructs a DeconvolutionLayer.
+   *
+   * @param kwidth Width of the kernels
+   * @param kheight Height of the kernels
+   * @param output_maps Number of output feature maps
+   * @param seed Random seed for weight generation
+   */
+  DeconvolutionLayer(const unsigned int kwidth, const unsigned int kheight,
+                     const unsigned int output_maps, const int seed = 0);
+
+  // Implementations for SimpleLayer
+  bool CreateOutputs (const std::vector< CombinedTensor* >& inputs,
+                      std::vector< CombinedTensor* >& outputs);
+  bool Connect (const CombinedTensor* input, CombinedTensor* output);
+  void FeedForward();
+  void BackPropagate();
+
+  inline bool NeedsOutputData() { return false; }
+
+  /**
+   * @brief Initializes the weights randomly. If there are as many output
+   *   maps as input maps, every map is scaled up bilinearly instead, like
+   *   a BilinearUpscaleLayer would. Training starts from there.
+   */
+  void OnLayerConnect (Layer* next_layer);
+
+  inline unsigned int Gain() {
+    return kernel_width_ * kernel_height_ * input_maps_ /
+           (stride_x_ * stride_y_);
+  }
+
+  /**
+   * @brief Sets the upscaling factor. Call this before the layer is added
+   *   to a net. The kernels have to be at least as large as the stride.
+   */
+  void SetStride (const unsigned int stride_x, const unsigned int stride_y);
+
+  /**
+   * @brief Removes a border from the output. This is the transposed
+   *   version of ConvolutionLayer::SetPadding. Call this before the layer
+   *   is added to a net.
+   *
+   * The output is (input - 1) * stride + kernel size - border pixels wide.
+   * A border of kernel size - stride scales the input up by exactly the
+   * stride. The left and top parts of the border cannot be larger than the
+   * kernel size minus the stride.
+   *
+   * @param border_x Size of the complete horizontal border, half of it
+   *   (rounded down) is on the left
+   * @param border_y Size of the complete vertical border, half of it
+   *   (rounded down) is on the top
+   */
+  void SetPadding (const unsigned int border_x, const unsigned int border_y);
+
+private:
+  /*
+   * The pixels of every output phase (output pixels whose coordinates
+   * have the same remainders modulo the stride) are an ordinary
+   * convolution of the input, with every stride-th tap of the kernel.
+   * These are computed one phase at a time by DirectConvolution.
+   */
+  struct Phase {
+    // Remainders of the output coordinates
+    unsigned int x;
+    unsigned int y;
+
+    // First kernel tap and number of taps
+    unsigned int first_tap_x;
+    unsigned int first_tap_y;
+    unsigned int taps_x;
+    unsigned int taps_y;
+
+    // Padding of the input in the phase's convolution
+    unsigned int pad_x;
+    unsigned int pad_y;
+
+    // Size of the phase's output
+    unsigned int output_width;
+    unsigned int output_height;
+  };
+
+  void GetPhaseShape (const Phase& phase, ConvolutionShape& shape) const;
+
+  /*
+   * Copies the taps of a phase into phase_weights_ in the order of a
+   * ConvolutionLayer's weights
+   */
+  void GatherPhaseWeights (const Phase& phase);
+
+  /*
+   * Copies between the output and the contiguous buffer of a phase
+   */
+  void InterleavePhase (const Phase& phase, const datum* source, datum* target);
+  void DeinterleavePhase (const Phase& phase, const datum* source, datum* target);
+
+  // Settings
+  unsigned int output_maps_ = 0;
+  unsigned int kernel_width_ = 0;
+  unsigned int kernel_height_ = 0;
+  unsigned int stride_x_ = 1;
+  unsigned int stride_y_ = 1;
+  unsigned int border_x_ = 0;
+  unsigned int border_y_ = 0;
+
+  // Feature map dimensions
+  unsigned int input_maps_ = 0;
+  unsigned int input_width_ = 0;
+  unsigned int input_height_ = 0;
+  unsigned int output_width_ = 0;
+  unsigned int output_height_ = 0;
+
+  std::vector<Phase> phases_;
+
+  // Weights are stored like a ConvolutionLayer's: output maps x input
+  // maps x kernel height x kernel width
+  CombinedTensor* weights_ = nullptr;
+  CombinedTensor* bias_ = nullptr;
+
+  // Scratch memory for the phases
+  Tensor phase_weights_;
+  Tensor phase_gradient_;
+  Tensor phase_output_;
+  Tensor phase_input_delta_;
+  Tensor packed_weights_;
+  Tensor padded_input_;
+  Tensor padded_delta_;
+  Tensor padded_input_delta_;
+  Tensor partial_gradients_;
+
+  std::mt19937 rand_;
+};
+
+}
+
+#endif
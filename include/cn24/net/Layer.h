@@ -16,6 +16,7 @@
 #ifndef CONV_LAYER_H
 #define CONV_LAYER_H
 
+#include <algorithm>
 #include <vector>
 
 #include "Tensor.h"
@@ -82,6 +83,22 @@ public:
     backprop_enabled_ = backprop_enabled;
   }
 
+  /**
+   * @brief Returns true if the layer computes the gradients of its inputs.
+   */
+  inline bool backprop_enabled() const { return backprop_enabled_; }
+
+  /**
+   * @brief Tells the layer that it never backpropagates, so it can skip
+   *   the buffers for that.
+   *
+   * The net calls this before creating the outputs. The deltas of the
+   * inputs, outputs and parameters are empty then.
+   */
+  inline void SetInferenceOnly (const bool inference_only) {
+    inference_only_ = inference_only;
+  }
+
   /**
    * @brief This is called by the net when this layer has a child layer.
    */
@@ -102,6 +119,43 @@ public:
    * the GPU's.
    */
   virtual bool IsOpenCLAware() { return false; }
+
+  /**
+   * @brief Returns true if BackPropagate reads the data of the outputs.
+   *
+   * If this returns false, the net lets the next layer overwrite the
+   * output data, e.g. with an in-place activation function.
+   */
+  virtual bool NeedsOutputData() { return true; }
+
+  /**
+   * @brief Tells the layer that its parameters were changed from outside.
+   *
+   * Call this after writing to the parameters, e.g. in a training step or
+   * after loading them from a file. Layers that cache data derived from
+   * their parameters compare parameters_version() to decide when to
+   * update it.
+   */
+  inline void InvalidateParameters() {
+    for (CombinedTensor* parameter : parameters_)
+      parameter->data.Invalidate();
+  }
+
+  /**
+   * @brief Returns a number that changes whenever the parameters change.
+   *
+   * This is taken from the parameter Tensors, so it also changes when
+   * another layer whose parameters are shadowed by this one's is
+   * invalidated.
+   */
+  inline unsigned int parameters_version() const {
+    unsigned int version = 0;
+
+    for (CombinedTensor* parameter : parameters_)
+      version = std::max (version, parameter->data.version());
+
+    return version;
+  }
 protected:
   /**
    * @brief These CombinedTensors contain the weights and biases.
@@ -120,6 +174,11 @@ protected:
    */
   bool backprop_enabled_ = true;
 
+  /**
+   * @brief True if the layer never backpropagates.
+   */
+  bool inference_only_ = false;
+
   unsigned int gain = 0;
 };
 
@@ -15,6 +15,8 @@
 #ifndef CONV_MAXPOOLINGLAYER_H
 #define CONV_MAXPOOLINGLAYER_H
 
+#include <vector>
+
 #include "Tensor.h"
 #include "SimpleLayer.h"
 
@@ -31,6 +33,16 @@ public:
    */
   MaxPoolingLayer(const unsigned int region_width,
                   const unsigned int region_height);
+
+  /**
+   * @brief Sets the distance between neighbouring regions. The default is
+   *   the region size. Regions overlap if this is smaller.
+   *
+   * Call this before the layer is added to a net. The input dimensions
+   * minus the region dimensions have to be divisible by the stride.
+   */
+  void SetStride (const unsigned int stride_width,
+                  const unsigned int stride_height);
   
   // Implementations for SimpleLayer
   bool CreateOutputs (const std::vector< CombinedTensor* >& inputs, std::vector< CombinedTensor* >& outputs);
@@ -43,10 +55,13 @@ public:
   }
   
   bool IsOpenCLAware();
+  inline bool NeedsOutputData() { return false; }
 private:
   // Settings
   unsigned int region_width_ = 0;
   unsigned int region_height_ = 0;
+  unsigned int stride_width_ = 0;
+  unsigned int stride_height_ = 0;
   
   // Feature map dimensions
   unsigned int input_width_ = 0;
@@ -57,8 +72,9 @@ private:
   unsigned int maps_ = 0;
   
   Tensor maximum_mask_;
-  Tensor maximum_ix_;
-  Tensor maximum_iy_;
+
+  // Position of every maximum in its region, see MaxPooling::IndexSize
+  std::vector<unsigned char> maximum_;
 };
 
 }
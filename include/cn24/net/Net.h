@@ -44,6 +44,15 @@ class Net {
   friend class Trainer;
   friend class GradientTester;
 public:
+  /**
+   * @brief Constructs an empty network.
+   *
+   * @param inference_only Set this to true for a net that only runs
+   *   forward passes. Its CombinedTensors have no deltas and the layers
+   *   skip the buffers for backpropagation.
+   */
+  explicit Net (const bool inference_only = false);
+
   /**
    * @brief Adds a layer to the network.
    *
@@ -68,6 +77,18 @@ public:
    */
   void InitializeWeights();
   
+  /**
+   * @brief Lets the outputs of the layers share memory for forward passes.
+   *
+   * Every output is only needed from the layer that writes it to the last
+   * layer that reads it. Outputs that don't overlap in this sense are
+   * placed in the same arena. The inputs of the loss function and stat
+   * layers and outputs that no layer reads are kept for the whole pass.
+   * Call this after adding all layers. The net can't backpropagate
+   * afterwards.
+   */
+  void PlanMemory();
+
   /**
    * @brief Complete forward pass.
    * 
@@ -85,7 +106,8 @@ public:
   /**
    * @brief Complete backward pass.
    * 
-   * Calls every Layer's BackPropagate function.
+   * Calls every Layer's BackPropagate function. Not available for
+   * inference-only nets.
    */
   void BackPropagate();
   
@@ -160,6 +182,13 @@ public:
   inline CombinedTensor* buffer(int layer_id, int buffer_id = 0) const {
     return buffers_[layer_id][buffer_id];
   }
+
+  /**
+   * @brief Returns true if the net only runs forward passes
+   */
+  inline bool inference_only() const {
+    return inference_only_;
+  }
   
   /**
    * @brief Enables or disables the binary stat layer
@@ -185,8 +214,48 @@ public:
     layer_view_enabled_ = enabled;
   }
 
+  /**
+   * @brief Lets the net compute activation functions in place when their
+   *   input isn't needed anywhere else. This is on by default.
+   *
+   * Layers that were set to work in place explicitly still do if possible.
+   * The net decides this before the first pass, when all layers are known.
+   */
+  inline void SetInPlaceActivationsEnabled(const bool enabled = true) {
+    LOGDEBUG << "In-place activations enabled: " << enabled;
+    in_place_activations_enabled_ = enabled;
+  }
+
   void PrintAndResetLayerTime(datum samples);
 private:
+  /**
+   * @brief Returns true if the layer may overwrite its input, i.e. no
+   *   other layer reads it.
+   */
+  bool CanOverwrite(const unsigned int layer) const;
+
+  /**
+   * @brief Decides which activation functions work in place and lets
+   *   their outputs share the memory of their inputs.
+   */
+  void DecideInPlace();
+
+  /**
+   * @brief Returns the buffer whose memory an in-place output uses, or the
+   *   buffer itself.
+   */
+  CombinedTensor* MemoryOwner(CombinedTensor* buffer) const;
+
+  /**
+   * @brief Allocates the deltas that are read during backpropagation.
+   *
+   * A delta is needed if the layer that writes the data has parameters or
+   * passes the gradient on to an input whose delta is needed. The other
+   * deltas stay empty, and layers without a needed output delta are
+   * skipped in BackPropagate. Called before the first forward pass.
+   */
+  void AllocateDeltas();
+
   TrainingLayer* training_layer_ = nullptr; 
   LossFunctionLayer* lossfunction_layer_ = nullptr;
   BinaryStatLayer* binary_stat_layer_ = nullptr;
@@ -197,7 +266,17 @@ private:
   std::vector<std::vector<CombinedTensor*>> inputs_;
   std::vector<std::pair<Layer*, Layer*>> weight_connections_;
   
+  bool inference_only_ = false;
+  bool deltas_allocated_ = false;
+  std::vector<bool> backprop_layers_;
   bool layer_view_enabled_ = false;
+  bool in_place_activations_enabled_ = true;
+  bool in_place_decided_ = false;
+  std::vector<bool> in_place_wanted_;
+  std::vector<bool> in_place_layers_;
+
+  // Shared memory for the outputs, see PlanMemory
+  std::vector<Tensor*> arenas_;
   
   std::chrono::duration<double>* forward_durations_ = nullptr;
   std::chrono::duration<double>* backward_durations_ = nullptr;
@@ -9,6 +9,9 @@
  * @class NonLinearityLayer
  * @brief This layer introduces a non-linearity (activation function)
  *
+ * In place, the output shares the memory of the input, so the layer doesn't
+ * need memory of its own. The net decides if this is possible.
+ *
  * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
  */
 
@@ -49,6 +52,21 @@ public:
   virtual void FeedForward() = 0;
   virtual void BackPropagate() = 0;
 
+  /**
+   * @brief Makes the layer overwrite its input instead of using memory of
+   *   its own. Call this before adding the layer to a net.
+   *
+   * The net turns this off again if the input is needed elsewhere.
+   */
+  inline void SetInPlace (const bool in_place) { in_place_ = in_place; }
+
+  /**
+   * @brief Returns true if the layer overwrites its input.
+   */
+  inline bool in_place() const { return in_place_; }
+
+protected:
+  bool in_place_ = false;
 };
 
 NL_LAYER(Tanh)
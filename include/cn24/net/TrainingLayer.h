@@ -46,6 +46,14 @@ public:
    * @brief Gets the probability for loss sampling
    */
   virtual datum GetLossSamplingProbability() = 0;
+
+  /**
+   * @brief Gets the time in seconds the net spent waiting for data since
+   *   the last call.
+   */
+  virtual double TakeLoaderWaitTime() {
+    return 0;
+  }
   
 };
 
@@ -39,6 +39,8 @@ public:
   bool Connect (const CombinedTensor* input, CombinedTensor* output);
   void FeedForward();
   void BackPropagate();
+
+  inline bool NeedsOutputData() { return false; }
   
 private:
   // Settings
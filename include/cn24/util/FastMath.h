@@ -0,0 +1,57 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file FastMath.h
+ * @brief Accuracy setting for exp, sigmoid, tanh and softmax.
+ *
+ * The activation functions can use vectorized polynomial approximations
+ * of exp instead of the C library. These are a lot faster on large
+ * feature maps.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_FASTMATH_H
+#define CONV_FASTMATH_H
+
+namespace Conv {
+
+/*
+ * The approximations clamp the argument of exp to [-87.3, 88.3]. So e^x
+ * saturates at about 2.2e38 instead of infinity and never underflows to
+ * zero or a denormal.
+ */
+enum MathAccuracy {
+  MATH_EXACT = 0,    // C library, one element at a time
+  MATH_PRECISE = 1,  // Relative error around 1e-6
+  MATH_FAST = 2      // Relative error around 1e-3
+};
+
+class FastMath {
+public:
+  /**
+   * @brief Returns the current accuracy.
+   *
+   * The default is MATH_EXACT. It can be changed by setting the
+   * environment variable CN24_MATH to "exact", "precise" or "fast".
+   */
+  static MathAccuracy Accuracy();
+
+  /**
+   * @brief Changes the accuracy. Don't call this while a net is running.
+   */
+  static void SetAccuracy (const MathAccuracy accuracy);
+
+  /**
+   * @brief Returns a readable name for the accuracy.
+   */
+  static const char* AccuracyName (const MathAccuracy accuracy);
+};
+
+}
+
+#endif
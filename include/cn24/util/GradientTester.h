@@ -25,6 +25,16 @@ public:
    * Only call this function on nets with a constant input!
    */
   static void TestGradient(Net& net);
+
+  /**
+   * @brief Compares the activations and gradients computed with the
+   *   approximate math kernels (see FastMath) to the exact ones.
+   *
+   * Only call this function on nets with a constant input!
+   *
+   * @returns True if the errors are within the expected range
+   */
+  static bool TestAccuracy(Net& net);
 };
   
   
@@ -99,6 +99,39 @@ public:
    */
   void Shadow (Tensor& tensor);
 
+  /**
+   * @brief Uses the beginning of another Tensor's memory, keeping the size.
+   *
+   * The content is lost.
+   *
+   * @param tensor Tensor to shadow, needs at least as many elements
+   * @returns False if the other Tensor is too small
+   */
+  bool ShadowMemory (Tensor& tensor);
+
+  /**
+   * @brief Exchanges memory and size with another Tensor without copying.
+   *
+   * Neither Tensor may be a shadow or shadowed by another Tensor.
+   *
+   * @param tensor Tensor to swap with
+   */
+  void Swap (Tensor& tensor);
+
+  /**
+   * @brief Marks the content as changed, see version().
+   */
+  void Invalidate();
+
+  /**
+   * @brief Returns a number that changes whenever Invalidate is called on
+   *   this Tensor or on a Tensor that shares its memory.
+   *
+   * A shadow returns the version of the Tensor it shadows, so caches
+   *   derived from the content notice changes made through either one.
+   */
+  unsigned int version() const;
+
   /**
    * @brief Resizes the Tensor with data loss.
    */
@@ -278,11 +311,19 @@ public:
     return elements_;
   }
 
+  /**
+   * @brief Returns true if the Tensor uses another Tensor's memory.
+   */
+  inline bool is_shadow() const {
+    return is_shadow_;
+  }
+
 private:
   // Pointer to the actual data
   datum* data_ptr_ = nullptr;
   bool is_shadow_ = false;
   Tensor* shadow_target_ = nullptr;
+  unsigned int version_ = 0;
 
   // Sizes
   std::size_t samples_ = 0;
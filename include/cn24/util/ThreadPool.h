@@ -0,0 +1,120 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file ThreadPool.h
+ * @brief Worker threads for the parallel loops of the layers and kernels.
+ *
+ * The iterations of a loop are split evenly between the threads. A thread
+ * that runs out of work steals half of the remaining iterations of another
+ * thread. The calling thread takes part in every loop.
+ *
+ * Loops started from inside a loop, from a thread marked with
+ * SetThreadSerial, or from a second thread while the pool is busy, run on
+ * the calling thread alone. This keeps nested parallelism from
+ * oversubscribing the cores. For the same reason, BLAS calls inside a loop
+ * are single-threaded with MKL. Between loops the workers sleep, so the
+ * BLAS threads get the cores to themselves.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_THREADPOOL_H
+#define CONV_THREADPOOL_H
+
+#include <cstddef>
+
+namespace Conv {
+
+class ThreadPool {
+public:
+  /**
+   * @brief Returns the number of threads, including the calling thread.
+   *
+   * The default is the number of cores this process may run on. It can be
+   * changed by setting the environment variable CN24_THREADS.
+   */
+  static unsigned int Threads();
+
+  /**
+   * @brief Changes the number of threads. Don't call this while a net is
+   *   running.
+   *
+   * With MKL, this is also the number of threads BLAS uses.
+   */
+  static void SetThreads (const unsigned int threads);
+
+  /**
+   * @brief Returns true if the workers are pinned to cores.
+   *
+   * The default is false. It can be changed by setting the environment
+   * variable CN24_AFFINITY to "1".
+   */
+  static bool Affinity();
+
+  /**
+   * @brief Pins every worker to its own core, or unpins them. The calling
+   *   thread is never pinned. Does nothing on systems other than Linux.
+   */
+  static void SetAffinity (const bool affinity);
+
+  /**
+   * @brief Makes the loops started by the calling thread run on it alone.
+   *
+   * This is for background threads, so they don't take the workers away
+   * from the net.
+   */
+  static void SetThreadSerial (const bool serial);
+
+  /**
+   * @brief Calls function (index) for every index in [0, count).
+   *
+   * @param grain Number of consecutive iterations a thread takes at once
+   */
+  template <typename Function>
+  static void ParallelFor (const std::size_t count, const Function& function,
+                           const std::size_t grain = 1) {
+    ParallelRange (count, [&function] (const std::size_t begin,
+                                       const std::size_t end,
+                                       const unsigned int) {
+      for (std::size_t i = begin; i < end; i++)
+        function (i);
+    }, grain);
+  }
+
+  /**
+   * @brief Calls function (begin, end, thread) for consecutive ranges that
+   *   cover [0, count).
+   *
+   * The thread index is below Threads() and no two calls with the same
+   * thread index run at the same time. Use it for per-thread scratch
+   * memory.
+   *
+   * @param grain The ranges are multiples of this, except the last one
+   */
+  template <typename Function>
+  static void ParallelRange (const std::size_t count, const Function& function,
+                             const std::size_t grain = 1) {
+    Run (count, grain, &CallRange<Function>, (void*) &function);
+  }
+
+  typedef void (*RangeCall) (void* context, const std::size_t begin,
+                             const std::size_t end, const unsigned int thread);
+
+private:
+  template <typename Function>
+  static void CallRange (void* context, const std::size_t begin,
+                         const std::size_t end, const unsigned int thread) {
+    (* (const Function*) context) (begin, end, thread);
+  }
+
+  static void Run (const std::size_t count, const std::size_t grain,
+                   RangeCall call, void* context);
+};
+
+}
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file AveragePooling.h
+ * @brief Average-pooling kernels for AveragePoolingLayer.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_AVERAGEPOOLING_H
+#define CONV_AVERAGEPOOLING_H
+
+#include "Config.h"
+
+namespace Conv {
+
+class AveragePooling {
+public:
+  /**
+   * @brief Computes the mean of every region of every map.
+   *
+   * A region starts every stride_x pixels horizontally and every stride_y
+   * pixels vertically, so the output is
+   * ((input_width - region_width) / stride_x + 1) pixels wide.
+   *
+   * @param maps Number of maps in input and output, over all samples
+   */
+  static void Forward (const datum* input, datum* output,
+                       const unsigned int maps,
+                       const unsigned int input_width,
+                       const unsigned int input_height,
+                       const unsigned int region_width,
+                       const unsigned int region_height,
+                       const unsigned int stride_x,
+                       const unsigned int stride_y);
+
+  /**
+   * @brief Spreads the gradient of every region evenly over its pixels and
+   *   sets the rest of input_delta to zero, so input_delta doesn't have to
+   *   be cleared first. Gradients of overlapping regions are added up.
+   */
+  static void Backward (const datum* output_delta, datum* input_delta,
+                        const unsigned int maps,
+                        const unsigned int input_width,
+                        const unsigned int input_height,
+                        const unsigned int region_width,
+                        const unsigned int region_height,
+                        const unsigned int stride_x,
+                        const unsigned int stride_y);
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file CPUFeatures.h
+ * @brief Runtime detection of the SIMD instruction sets the CPU supports.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_CPUFEATURES_H
+#define CONV_CPUFEATURES_H
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CN24_X86
+#endif
+
+/*
+ * Functions using instructions that the compiler is not allowed to emit
+ * for the whole build (e.g. AVX2 on a generic x86-64 target) need to be
+ * marked with this. MSVC allows all intrinsics everywhere.
+ */
+#if defined(CN24_X86) && defined(__GNUC__)
+#define CN24_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CN24_TARGET(isa)
+#endif
+
+#include <string>
+
+namespace Conv {
+
+enum SIMDLevel {
+  SIMD_SCALAR = 0,
+  SIMD_SSE = 1,      // SSE4.2
+  SIMD_AVX2 = 2,
+  SIMD_AVX512 = 3
+};
+
+class CPUFeatures {
+public:
+  /**
+   * @brief Returns the best instruction set supported by both CPU and OS.
+   *
+   * The result can be capped by setting the environment variable CN24_SIMD
+   * to "scalar", "sse4.2", "avx2" or "avx512".
+   */
+  static SIMDLevel Level();
+
+  /**
+   * @brief Returns a readable name for the instruction set.
+   */
+  static const char* LevelName (const SIMDLevel level);
+
+  /**
+   * @brief Returns the processor's brand string, or "unknown".
+   */
+  static const std::string& Model();
+};
+
+}
+
+#endif
@@ -25,6 +25,7 @@ void ParseDatumIfPossible ( std::string line, std::string identifier, datum& val
 void ParseUIntIfPossible ( std::string line, std::string identifier, unsigned int& value ) ;
 void ParseKernelSizeIfPossible ( std::string line, std::string identifier, unsigned int& kx, unsigned int& ky );
 void ParseCountIfPossible ( std::string line, std::string identifier, unsigned int& k );
+void ParseSizeIfPossible ( std::string line, std::string identifier, unsigned int& x, unsigned int& y );
 void ParseDatumParamIfPossible ( std::string line, std::string identifier, datum& k );
 
 }
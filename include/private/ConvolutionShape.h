@@ -0,0 +1,133 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file ConvolutionShape.h
+ * @brief Shape description shared by the convolution implementations.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_CONVOLUTIONSHAPE_H
+#define CONV_CONVOLUTIONSHAPE_H
+
+#include <cstddef>
+
+#include "Config.h"
+
+namespace Conv {
+
+/**
+ * @brief Function that is applied to parts of the output right after they
+ *   are computed, while they are still in the cache. This is used to fuse
+ *   activation functions into the convolution.
+ */
+typedef void (*ConvolutionEpilogue) (datum* data, const std::size_t count);
+
+/**
+ * @brief Describes a 'valid' convolution of a batch of feature maps.
+ *
+ * All tensors use the usual CN24 layout (x fastest, then y, map, sample).
+ * Weights are stored as output_maps x input_maps x kernel_height x
+ * kernel_width, just like ConvolutionLayer's weight tensor.
+ *
+ * Output pixel (x, y) is computed from the input pixels
+ * (x * stride_x + kx * dilation_x - pad_x,
+ *  y * stride_y + ky * dilation_y - pad_y).
+ * Pixels outside of the input are zero, or mirrored back into it if
+ * mirror_padding is set. Padding on the right and bottom is implied by
+ * the output size.
+ */
+struct ConvolutionShape {
+  unsigned int samples;
+  unsigned int input_width;
+  unsigned int input_height;
+  unsigned int input_maps;
+  unsigned int output_width;
+  unsigned int output_height;
+  unsigned int output_maps;
+  unsigned int kernel_width;
+  unsigned int kernel_height;
+  unsigned int stride_x = 1;
+  unsigned int stride_y = 1;
+  unsigned int dilation_x = 1;
+  unsigned int dilation_y = 1;
+  unsigned int pad_x = 0;
+  unsigned int pad_y = 0;
+  bool mirror_padding = false;
+
+  // Distance between two samples in the input and output tensors, zero if
+  // they follow each other directly. Setting these makes it possible to
+  // convolve a group of maps in a larger tensor.
+  std::size_t input_sample_stride = 0;
+  std::size_t output_sample_stride = 0;
+
+  inline std::size_t input_stride() const {
+    return input_sample_stride > 0 ? input_sample_stride :
+           (std::size_t) input_maps * input_width * input_height;
+  }
+
+  inline std::size_t output_stride() const {
+    return output_sample_stride > 0 ? output_sample_stride :
+           (std::size_t) output_maps * output_width * output_height;
+  }
+
+  inline bool padded() const {
+    return pad_x > 0 || pad_y > 0 ||
+           (output_width - 1) * stride_x + dilation_x * (kernel_width - 1) + 1 > input_width ||
+           (output_height - 1) * stride_y + dilation_y * (kernel_height - 1) + 1 > input_height;
+  }
+};
+
+/**
+ * @brief Number of entries in the kernel tables indexed by
+ *   SpecializedKernel.
+ */
+const unsigned int specialized_kernels = 5;
+
+/**
+ * @brief Selects a kernel that was compiled for the kernel size of the
+ *   shape. Square 1x1, 3x3, 5x5 and 7x7 kernels have their own kernels
+ *   (index 1 to 4), everything else uses the generic one (index 0).
+ */
+inline unsigned int SpecializedKernel (const ConvolutionShape& shape) {
+  if (shape.kernel_width != shape.kernel_height)
+    return 0;
+
+  switch (shape.kernel_width) {
+  case 1:
+    return 1;
+  case 3:
+    return 2;
+  case 5:
+    return 3;
+  case 7:
+    return 4;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Maps a coordinate outside of [0, size) back into it by
+ *   reflecting it at the first and last pixel.
+ */
+inline int MirrorIndex (int i, const int size) {
+  if (size == 1)
+    return 0;
+
+  const int period = 2 * (size - 1);
+  i %= period;
+
+  if (i < 0)
+    i += period;
+
+  return i < size ? i : period - i;
+}
+
+}
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file DepthwiseConvolution.h
+ * @brief Depthwise convolution, where every map has its own kernel.
+ *
+ * Output map i only reads input map i, so input_maps and output_maps of
+ * the shape have to be the same. The weights are stored as maps x
+ * kernel_height x kernel_width, which is ConvolutionLayer's weight tensor
+ * with groups set to the number of maps.
+ *
+ * There is only one kernel per map, so there is nothing to share between
+ * maps like in DirectConvolution. Instead, the kernels keep several
+ * vectors of output pixels in registers and reuse every weight for all of
+ * them.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_DEPTHWISECONVOLUTION_H
+#define CONV_DEPTHWISECONVOLUTION_H
+
+#include "Config.h"
+#include "Tensor.h"
+#include "ConvolutionShape.h"
+
+namespace Conv {
+
+class DepthwiseConvolution {
+public:
+  /**
+   * @brief Computes output = weight_factor * (input * weights) + bias.
+   *
+   * A padded input is copied into padded_input first.
+   *
+   * @param epilogue Applied to every output row, may be nullptr
+   */
+  static void Forward (const ConvolutionShape& shape, const datum* input,
+                       const datum* weights, const datum* bias,
+                       const datum weight_factor, datum* output,
+                       Tensor& padded_input,
+                       const ConvolutionEpilogue epilogue = nullptr);
+
+  /**
+   * @brief Computes the input gradient by "full"-convolving the output
+   *   gradient with the flipped kernels. input_delta is overwritten.
+   *
+   * @param flipped_weights Receives the flipped kernels
+   * @param padded_delta Receives the zero-padded output gradient
+   * @param padded_input_delta Receives the gradient of the padded copy of
+   *   a padded input
+   */
+  static void BackwardData (const ConvolutionShape& shape,
+                            const datum* output_delta, const datum* weights,
+                            datum* input_delta, Tensor& flipped_weights,
+                            Tensor& padded_delta, Tensor& padded_input_delta);
+
+  /**
+   * @brief Computes the weight gradient. weights_delta is overwritten.
+   *
+   * @param bias_delta If not nullptr, receives the bias gradient, which is
+   *   computed in the same pass
+   * @param padded_input Receives the padded copy of a padded input
+   */
+  static void WeightGradient (const ConvolutionShape& shape,
+                              const datum* input, const datum* output_delta,
+                              datum* weights_delta, datum* bias_delta,
+                              Tensor& padded_input);
+};
+
+}
+
+#endif
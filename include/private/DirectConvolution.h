@@ -0,0 +1,160 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file DirectConvolution.h
+ * @brief Register-blocked direct convolution without im2col.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_DIRECTCONVOLUTION_H
+#define CONV_DIRECTCONVOLUTION_H
+
+#include "Config.h"
+#include "Tensor.h"
+#include "ConvolutionShape.h"
+
+namespace Conv {
+
+class DirectConvolution {
+public:
+  /**
+   * @brief Computes output = weight_factor * (input * weights) + bias.
+   *
+   * The weights are repacked into packed_weights on every call, so
+   * changes to the weights are always picked up. The kernels cannot
+   * read outside of the input, so a padded input is copied into
+   * padded_input first.
+   *
+   * @param epilogue Applied to every output row, may be nullptr
+   */
+  static void Forward (const ConvolutionShape& shape, const datum* input,
+                       const datum* weights, const datum* bias,
+                       const datum weight_factor, datum* output,
+                       Tensor& packed_weights, Tensor& padded_input,
+                       const ConvolutionEpilogue epilogue = nullptr);
+
+  /**
+   * @brief Like Forward, but with weights that were packed by PackWeights
+   *   beforehand. Use this if the weights don't change between calls.
+   */
+  static void ForwardPrepacked (const ConvolutionShape& shape,
+                                const datum* input,
+                                const datum* packed_weights,
+                                const datum* bias, datum* output,
+                                Tensor& padded_input,
+                                const ConvolutionEpilogue epilogue = nullptr);
+
+  /**
+   * @brief Returns the number of datums PackWeights writes.
+   */
+  static std::size_t PackedSize (const ConvolutionShape& shape);
+
+  /**
+   * @brief Interleaves the kernels of neighboring output maps so that the
+   *   forward kernel can broadcast them from consecutive addresses.
+   */
+  static void PackWeights (const ConvolutionShape& shape, const datum* weights,
+                           const datum weight_factor, datum* packed);
+
+  /**
+   * @brief Like ForwardPrepacked, for a shape that does not need
+   *   padding.
+   *
+   * @param parallel Set this to false when calling from a parallel region
+   */
+  static void ForwardPacked (const ConvolutionShape& shape, const datum* input,
+                             const datum* packed_weights, const datum* bias,
+                             datum* output,
+                             const ConvolutionEpilogue epilogue = nullptr,
+                             const bool parallel = true);
+
+  /**
+   * @brief Computes the input gradient by "full"-convolving the output
+   *   gradient with the flipped kernels.
+   *
+   * The output gradient is zero-padded into padded_delta first, so the
+   * same kernels as in Forward can be used. input_delta is overwritten.
+   * For a padded input, the gradient of the padded copy is computed in
+   * padded_input_delta and then added up into input_delta.
+   */
+  static void BackwardData (const ConvolutionShape& shape,
+                            const datum* output_delta, const datum* weights,
+                            datum* input_delta, Tensor& packed_weights,
+                            Tensor& padded_delta, Tensor& padded_input_delta);
+
+  /**
+   * @brief Computes the weight gradient by cross-correlating the input
+   *   with the output gradient. weights_delta is overwritten.
+   *
+   * If there are too few maps to keep all threads busy, the output rows
+   * are split into chunks that are reduced pairwise afterwards. The
+   * result does not depend on the number of threads.
+   *
+   * @param bias_delta If not nullptr, receives the bias gradient, which is
+   *   computed in the same pass
+   * @param padded_input Receives the padded copy of a padded input
+   * @param partial_gradients Receives the gradients of all but the first
+   *   chunk
+   */
+  static void WeightGradient (const ConvolutionShape& shape,
+                              const datum* input, const datum* output_delta,
+                              datum* weights_delta, datum* bias_delta,
+                              Tensor& padded_input, Tensor& partial_gradients);
+
+  /**
+   * @brief Sums up the output gradient of every map. bias_delta is
+   *   overwritten.
+   */
+  static void BiasGradient (const ConvolutionShape& shape,
+                            const datum* output_delta, datum* bias_delta);
+
+  /*
+   * Helpers for padding, also used by DepthwiseConvolution
+   */
+
+  /**
+   * @brief Returns the shape of the same convolution on an explicitly
+   *   padded input.
+   */
+  static ConvolutionShape PaddedShape (const ConvolutionShape& shape);
+
+  /**
+   * @brief Copies the input into a buffer of the padded shape.
+   */
+  static void PadInput (const ConvolutionShape& shape,
+                        const ConvolutionShape& padded_shape,
+                        const datum* input, Tensor& padded_input);
+
+  /**
+   * @brief Adds the gradient of the padded input to the input pixels it
+   *   was copied from. input_delta is overwritten.
+   */
+  static void FoldPadding (const ConvolutionShape& shape,
+                           const ConvolutionShape& padded_shape,
+                           const datum* padded_delta, datum* input_delta);
+
+  /**
+   * @brief Returns the shape of the 'valid' convolution that computes the
+   *   input gradient of an unpadded convolution from the output gradient
+   *   spread out by SpreadOutputDelta.
+   */
+  static ConvolutionShape FullShape (const ConvolutionShape& shape);
+
+  /**
+   * @brief Copies the output gradient into a zero-padded buffer of the
+   *   full shape's input, leaving stride - 1 zeros between the pixels.
+   */
+  static void SpreadOutputDelta (const ConvolutionShape& shape,
+                                 const ConvolutionShape& full,
+                                 const datum* output_delta,
+                                 Tensor& padded_delta);
+};
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file GEMM.h
+ * @brief Built-in single precision matrix multiplication for BLAS-less builds.
+ *
+ * The interface mirrors cblas_sgemm so that MKLHelper.h can map the GEMM
+ * macro to it without changing any of the callers.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_GEMM_H
+#define CONV_GEMM_H
+
+#include <cstddef>
+
+#include "Config.h"
+
+#ifdef BLAS_INTERNAL
+/*
+ * These are the same values that cblas.h uses, so code written against
+ * a real CBLAS compiles unchanged.
+ */
+enum CBLAS_ORDER { CblasRowMajor = 101, CblasColMajor = 102 };
+enum CBLAS_TRANSPOSE { CblasNoTrans = 111, CblasTrans = 112, CblasConjTrans = 113 };
+#endif
+
+namespace Conv {
+
+/**
+ * @brief Computes C = alpha * op(A) * op(B) + beta * C.
+ *
+ * This is a cache-blocked implementation that packs panels of A and B
+ * into contiguous buffers and runs a register-blocked SIMD micro-kernel
+ * on them. Macro tiles of C are distributed over the threads of the
+ * ThreadPool. If there are fewer tiles than threads (e.g. weight
+ * gradients, where k is very large), the k dimension is split instead and
+ * the partial products are summed up in a fixed order.
+ *
+ * @see cblas_sgemm for parameter documentation
+ */
+void SGEMM (const int order, const int trans_a, const int trans_b,
+            const int m, const int n, const int k,
+            const datum alpha, const datum* a, const int lda,
+            const datum* b, const int ldb,
+            const datum beta, datum* c, const int ldc);
+
+/**
+ * @brief Returns the number of datums SGEMMPackA writes for an m x k
+ *   matrix.
+ */
+std::size_t SGEMMPackedSize (const int m, const int k);
+
+/**
+ * @brief Packs alpha * op(A) into the panels that SGEMM would copy it into
+ *   on every call.
+ *
+ * Use this for matrices that are multiplied many times without changing,
+ * like the weights of a layer during inference.
+ */
+void SGEMMPackA (const int trans_a, const int m, const int k,
+                 const datum alpha, const datum* a, const int lda,
+                 datum* packed);
+
+/**
+ * @brief Computes row major C = A * op(B) + beta * C for an A that was
+ *   packed by SGEMMPackA.
+ */
+void SGEMMPacked (const int m, const int n, const int k,
+                  const datum* packed_a, const int trans_b, const datum* b,
+                  const int ldb, const datum beta, datum* c, const int ldc);
+
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file Im2ColConvolution.h
+ * @class Im2ColConvolution
+ * @brief Convolution as im2col and GEMM over tiles of output rows.
+ *
+ * Instead of unrolling the whole input at once, a few output rows of one
+ * sample are unrolled at a time. The number of rows is chosen so that the
+ * unrolled tile fits into a fixed workspace, so memory use does not grow
+ * with the image size and the tile can stay in the cache.
+ *
+ * The GEMMs read from and write to the tensors directly, there are no
+ * copies of the output or the output gradient. 1x1 convolutions without
+ * a stride don't need to be unrolled at all, so they run on the input and
+ * the input gradient directly, one sample at a time, without a workspace.
+ *
+ * Padding is applied while unrolling, so there is no padded copy of the
+ * input.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_IM2COLCONVOLUTION_H
+#define CONV_IM2COLCONVOLUTION_H
+
+#include <cstddef>
+
+#include "Config.h"
+#include "Tensor.h"
+#include "ConvolutionShape.h"
+
+namespace Conv {
+
+class Im2ColConvolution {
+public:
+  /**
+   * @brief Prepares the workspace for the specified convolution.
+   *
+   * @param shape Shape of the convolution
+   * @param workspace_size Size of the workspace in bytes. At least one
+   *   output row is unrolled at a time, even if it does not fit.
+   */
+  Im2ColConvolution (const ConvolutionShape& shape,
+                     const std::size_t workspace_size);
+
+  /**
+   * @brief Computes output = weight_factor * (input * weights) + bias.
+   *
+   * @param epilogue Applied to every tile of every output map, may be
+   *   nullptr
+   */
+  void Forward (const datum* input, const datum* weights, const datum* bias,
+                const datum weight_factor, datum* output,
+                const ConvolutionEpilogue epilogue = nullptr);
+
+  /**
+   * @brief Returns the number of datums PackWeights writes.
+   */
+  std::size_t PackedSize() const;
+
+  /**
+   * @brief Prepares weight_factor * weights for ForwardPacked. With the
+   *   built-in GEMM, they are packed like the GEMM would pack them on
+   *   every call.
+   */
+  void PackWeights (const datum* weights, const datum weight_factor,
+                    datum* packed) const;
+
+  /**
+   * @brief Like Forward, but with weights that were prepared by
+   *   PackWeights. Use this if the weights don't change between calls.
+   */
+  void ForwardPacked (const datum* input, const datum* packed_weights,
+                      const datum* bias, datum* output,
+                      const ConvolutionEpilogue epilogue = nullptr);
+
+  /**
+   * @brief Computes the input gradient. input_delta is overwritten.
+   */
+  void BackwardData (const datum* output_delta, const datum* weights,
+                     datum* input_delta);
+
+  /**
+   * @brief Computes the weight gradient. weights_delta is overwritten.
+   */
+  void WeightGradient (const datum* input, const datum* output_delta,
+                       datum* weights_delta);
+
+  inline unsigned int tile_rows() const {
+    return tile_rows_;
+  }
+
+private:
+  void ForwardTiles (const datum* input, const datum* weights,
+                     const datum weight_factor, const bool packed,
+                     const datum* bias, datum* output,
+                     const ConvolutionEpilogue epilogue);
+  void Im2Col (const datum* input, const unsigned int y0,
+               const unsigned int rows);
+  void Col2Im (datum* input_delta, const unsigned int y0,
+               const unsigned int rows) const;
+  datum PaddingValue (const datum* row, const int x) const;
+
+  ConvolutionShape shape_;
+
+  // True for 1x1 kernels without a stride or padding
+  bool pointwise_;
+
+  // Number of output rows per tile
+  unsigned int tile_rows_;
+
+  // kernel_width * kernel_height * input_maps rows, one column per
+  // output pixel in the tile
+  Tensor workspace_;
+};
+
+}
+
+#endif
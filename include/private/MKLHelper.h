@@ -47,6 +47,14 @@ extern "C" {
 
 #endif
 
+#ifdef BLAS_INTERNAL
+
+#include "GEMM.h"
+
+#define GEMM Conv::SGEMM
+
+#endif
+
 
 #else
 
@@ -0,0 +1,73 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file MaxPooling.h
+ * @brief Max-pooling kernels for MaxPoolingLayer.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_MAXPOOLING_H
+#define CONV_MAXPOOLING_H
+
+#include <cstddef>
+
+#include "Config.h"
+
+namespace Conv {
+
+class MaxPooling {
+public:
+  /**
+   * @brief Returns the number of bytes Forward stores for every maximum.
+   *
+   * The maxima are stored as their position inside the region, row by
+   * row. This is an unsigned char if the region has at most 256 pixels and
+   * an int32 otherwise.
+   */
+  static std::size_t IndexSize (const unsigned int region_width,
+                                const unsigned int region_height);
+
+  /**
+   * @brief Finds the maximum of every region of every map.
+   *
+   * A region starts every stride_x pixels horizontally and every stride_y
+   * pixels vertically, so the output is
+   * ((input_width - region_width) / stride_x + 1) pixels wide. Ties go to
+   * the first pixel when scanning the region column by column.
+   *
+   * @param maps Number of maps in input and output, over all samples
+   * @param maximum Receives the position of every maximum, IndexSize bytes
+   *   per output element
+   */
+  static void Forward (const datum* input, datum* output, void* maximum,
+                       const unsigned int maps,
+                       const unsigned int input_width,
+                       const unsigned int input_height,
+                       const unsigned int region_width,
+                       const unsigned int region_height,
+                       const unsigned int stride_x,
+                       const unsigned int stride_y);
+
+  /**
+   * @brief Sends the gradient of every region to its maximum and sets the
+   *   rest of input_delta to zero, so input_delta doesn't have to be
+   *   cleared first. Gradients of overlapping regions are added up.
+   */
+  static void Backward (const datum* output_delta, const void* maximum,
+                        datum* input_delta, const unsigned int maps,
+                        const unsigned int input_width,
+                        const unsigned int input_height,
+                        const unsigned int region_width,
+                        const unsigned int region_height,
+                        const unsigned int stride_x,
+                        const unsigned int stride_y);
+};
+
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file TuningCache.h
+ * @class TuningCache
+ * @brief Remembers autotuning results across runs.
+ *
+ * The results are stored as "key<TAB>value" lines in a text file. By
+ * default, this is .cn24_tuning in the user's home directory. The
+ * environment variable CN24_TUNING_CACHE overrides the location; if it
+ * is set to an empty string, nothing is read or written.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_TUNINGCACHE_H
+#define CONV_TUNINGCACHE_H
+
+#include <string>
+
+namespace Conv {
+
+class TuningCache {
+public:
+  /**
+   * @brief Looks up a stored result.
+   *
+   * @param key Description of the tuned problem, including the machine
+   * @param value Receives the result if there is one
+   * @returns True if there is a result for the key
+   */
+  static bool Lookup (const std::string& key, std::string& value);
+
+  /**
+   * @brief Stores a result in memory and appends it to the cache file.
+   */
+  static void Store (const std::string& key, const std::string& value);
+};
+
+}
+
+#endif
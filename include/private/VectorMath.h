@@ -0,0 +1,128 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file VectorMath.h
+ * @brief Element-wise operations on arrays of datums.
+ *
+ * These are the inner loops of the activation functions, the loss function
+ * and some Tensor operations. The kernels are selected for the CPU at
+ * runtime. Long arrays are split between the threads of the ThreadPool.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_VECTORMATH_H
+#define CONV_VECTORMATH_H
+
+#include <cstddef>
+
+#include "Config.h"
+
+namespace Conv {
+
+class VectorMath {
+public:
+  /**
+   * @brief Sets every element to value.
+   */
+  static void Fill (datum* data, const datum value, const std::size_t count);
+
+  /**
+   * @brief Computes y += x.
+   */
+  static void Add (const datum* x, datum* y, const std::size_t count);
+
+  /**
+   * @brief Computes y += alpha * x.
+   */
+  static void Axpy (const datum alpha, const datum* x, datum* y,
+                    const std::size_t count);
+
+  /**
+   * @brief Computes output = first + weight * (second - first). Works in
+   *   place.
+   */
+  static void Lerp (const datum* first, const datum* second,
+                    const datum weight, datum* output,
+                    const std::size_t count);
+
+  /**
+   * @brief Computes output = max(0, input). Works in place.
+   */
+  static void ReLU (const datum* input, datum* output, const std::size_t count);
+
+  /**
+   * @brief Computes output = e^input. Works in place.
+   *
+   * This and the other functions using exp are computed with the accuracy
+   * selected by FastMath::SetAccuracy.
+   */
+  static void Exp (const datum* input, datum* output, const std::size_t count);
+
+  /**
+   * @brief Computes output = 1 / (1 + e^-input). Works in place.
+   */
+  static void Sigmoid (const datum* input, datum* output,
+                       const std::size_t count);
+
+  /**
+   * @brief Computes output = tanh(input). Works in place.
+   */
+  static void Tanh (const datum* input, datum* output, const std::size_t count);
+
+  /**
+   * @brief Computes output = e^input / sum(e^input). Works in place.
+   *
+   * This is meant for short arrays, like the outputs of one sample, and is
+   * never split between threads.
+   */
+  static void Softmax (const datum* input, datum* output,
+                       const std::size_t count);
+
+  /**
+   * @brief Computes the input gradient of a ReLU. Works in place.
+   *
+   * @param data Input or output of the ReLU, they have the same sign
+   */
+  static void ReLUBackward (const datum* data, const datum* output_delta,
+                            datum* input_delta, const std::size_t count);
+
+  /**
+   * @brief Computes the input gradient of a sigmoid from its output.
+   *   Works in place.
+   */
+  static void SigmoidBackward (const datum* output, const datum* output_delta,
+                               datum* input_delta, const std::size_t count);
+
+  /**
+   * @brief Computes the input gradient of a tanh from its output.
+   *   Works in place.
+   */
+  static void TanhBackward (const datum* output, const datum* output_delta,
+                            datum* input_delta, const std::size_t count);
+
+  /**
+   * @brief Computes delta = weight * (first - second).
+   *
+   * @param weight May be nullptr, in which case all weights are one
+   */
+  static void WeightedDifference (const datum* first, const datum* second,
+                                  const datum* weight, datum* delta,
+                                  const std::size_t count);
+
+  /**
+   * @brief Returns the sum of weight * (first - second)^2.
+   *
+   * @param weight May be nullptr, in which case all weights are one
+   */
+  static long double WeightedSquaredError (const datum* first,
+      const datum* second, const datum* weight, const std::size_t count);
+};
+
+}
+
+#endif
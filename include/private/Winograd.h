@@ -0,0 +1,118 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file Winograd.h
+ * @class WinogradConvolution
+ * @brief Fast convolution with Winograd's minimal filtering algorithms.
+ *
+ * Implements F(2x2,3x3), F(4x4,3x3) and F(2x2,5x5) as described by
+ * Lavin and Gray, "Fast Algorithms for Convolutional Neural Networks".
+ * The output is split into m x m tiles. Input tiles and kernels are
+ * transformed, multiplied element-wise (as a batch of small GEMMs over
+ * the maps) and transformed back.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifndef CONV_WINOGRAD_H
+#define CONV_WINOGRAD_H
+
+#include "Config.h"
+#include "Tensor.h"
+#include "ConvolutionShape.h"
+
+namespace Conv {
+
+class WinogradConvolution {
+public:
+  /**
+   * @brief Checks if there is a Winograd algorithm for the kernel size.
+   */
+  static bool Supports (const unsigned int kernel_width,
+                        const unsigned int kernel_height);
+
+  /**
+   * @brief Checks if the Winograd algorithm is likely to be faster than
+   *   direct convolution.
+   *
+   * The transformations cost a fixed amount of work per map, so there
+   * have to be enough maps for the cheaper products to make up for it.
+   */
+  static bool Profitable (const ConvolutionShape& shape);
+
+  /**
+   * @brief Prepares the transformation for the specified convolution.
+   *
+   * @param shape Shape of the convolution
+   * @param pad_x Implicit zero padding left and right of the input
+   * @param pad_y Implicit zero padding above and below the input
+   */
+  WinogradConvolution (const ConvolutionShape& shape,
+                       const unsigned int pad_x = 0,
+                       const unsigned int pad_y = 0);
+
+  /**
+   * @brief Transforms the kernels. Call this whenever they change.
+   *
+   * @param weights Kernels in ConvolutionLayer's layout
+   * @param weight_factor Factor to apply to the weights
+   * @param flip If true, the kernels are rotated by 180 degrees and
+   *   input and output maps are swapped. Use this for the input gradient,
+   *   with weights in the layout of the forward convolution.
+   */
+  void TransformKernels (const datum* weights, const datum weight_factor,
+                         const bool flip = false);
+
+  /**
+   * @brief Convolves the input with the transformed kernels.
+   *
+   * @param bias Bias per output map, may be nullptr
+   * @param epilogue Applied to every output tile, may be nullptr
+   */
+  void Forward (const datum* input, const datum* bias, datum* output,
+                const ConvolutionEpilogue epilogue = nullptr) const;
+
+  inline unsigned int tile_size() const {
+    return m_;
+  }
+
+private:
+  void TransformInputTile (const datum* input, const unsigned int x0,
+                           const unsigned int y0, datum* target,
+                           const std::size_t stride) const;
+  void TransformOutputTile (const datum* source, const std::size_t stride,
+                            const datum bias, datum* output,
+                            const unsigned int x0, const unsigned int y0,
+                            const ConvolutionEpilogue epilogue) const;
+
+  ConvolutionShape shape_;
+  unsigned int pad_x_;
+  unsigned int pad_y_;
+
+  // Output tile size, kernel size and input tile size
+  unsigned int m_;
+  unsigned int r_;
+  unsigned int alpha_;
+
+  unsigned int tiles_x_;
+  unsigned int tiles_y_;
+
+  // Transformation matrices, row major
+  datum at_[6 * 6];
+  datum g_[6 * 6];
+  datum bt_[6 * 6];
+
+  // Shape of the element-wise products over one chunk of tiles
+  ConvolutionShape product_shape_;
+
+  // alpha^2 blocks of kernels packed for DirectConvolution
+  Tensor transformed_kernels_;
+};
+
+}
+
+#endif
@@ -11,8 +11,11 @@
 #include "ConvolutionLayer.h"
 #include "ResizeLayer.h"
 #include "MaxPoolingLayer.h"
+#include "AveragePoolingLayer.h"
 #include "NonLinearityLayer.h"
 #include "UpscaleLayer.h"
+#include "BilinearUpscaleLayer.h"
+#include "DeconvolutionLayer.h"
 #include "SpatialPriorLayer.h"
 #include "ConfigParsing.h"
  
@@ -20,7 +23,72 @@
 
 namespace Conv {
 
+/*
+ * The OpenCL convolution kernels don't support fused activations
+ */
+static inline bool FuseActivations() {
+#ifdef BUILD_OPENCL
+  return false;
+#else
+  return true;
+#endif
+}
+
+/*
+ * The OpenCL convolution kernels don't support padding either
+ */
+static inline bool PadInLayers() {
+#ifdef BUILD_OPENCL
+  return false;
+#else
+  return true;
+#endif
+}
+
+/*
+ * Neither do they support fused pooling
+ */
+static inline bool FusePooling() {
+#ifdef BUILD_OPENCL
+  return false;
+#else
+  return true;
+#endif
+}
+
+/*
+ * Returns the next layer in the file that is not an activation function,
+ * without the question mark, or an empty string. The file position is not
+ * changed.
+ */
+static std::string PeekLayer ( std::istream& file ) {
+  const std::streampos position = file.tellg();
+  std::string layer;
+
+  if ( position == std::streampos ( -1 ) )
+    return layer;
+
+  while ( ! file.eof() ) {
+    std::string line;
+    std::getline ( file, line );
+
+    if ( line.compare ( 0,1,"?" ) != 0 )
+      continue;
 
+    line = line.substr ( 1 );
+
+    if ( !StartsWithIdentifier ( line, "sigm" ) &&
+         !StartsWithIdentifier ( line, "relu" ) &&
+         !StartsWithIdentifier ( line, "tanh" ) ) {
+      layer = line;
+      break;
+    }
+  }
+
+  file.clear();
+  file.seekg ( position );
+  return layer;
+}
 
 ConfigurableFactory::ConfigurableFactory ( std::istream& file, const unsigned int seed, bool is_training_factory ) :
 		  seed_ ( seed ), file_ ( file ), method_ ( FCN ) {
@@ -40,6 +108,27 @@ ConfigurableFactory::ConfigurableFactory ( std::istream& file, const unsigned in
     
     std::string method;
     ParseStringParamIfPossible(line, "method", method);
+    ParseUIntIfPossible ( line, "workspace", workspace_kb_ );
+    if ( StartsWithIdentifier ( line, "padding" ) ) {
+      ParseStringParamIfPossible ( line, "padding", padding_ );
+      if ( padding_.compare ( "zero" ) != 0 && padding_.compare ( "mirror" ) != 0 ) {
+        LOGWARN << "Unknown padding \"" << padding_ << "\", using a ResizeLayer";
+        padding_ = "";
+      } else if ( !PadInLayers() ) {
+        LOGWARN << "Padding in layers is not supported with OpenCL, using a ResizeLayer";
+        padding_ = "";
+      }
+    }
+    if ( StartsWithIdentifier ( line, "upscaling" ) ) {
+      ParseStringParamIfPossible ( line, "upscaling", upscaling_ );
+      if ( upscaling_.compare ( "nearest" ) == 0 ) {
+        upscaling_ = "";
+      } else if ( upscaling_.compare ( "bilinear" ) != 0 &&
+                  upscaling_.compare ( "deconvolution" ) != 0 ) {
+        LOGWARN << "Unknown upscaling \"" << upscaling_ << "\", using an UpscaleLayer";
+        upscaling_ = "";
+      }
+    }
     if(method.compare(0,5,"patch") == 0) {
       if(is_training_factory) {
         method_ = PATCH;
@@ -50,21 +139,48 @@ ConfigurableFactory::ConfigurableFactory ( std::istream& file, const unsigned in
     if ( line.compare ( 0,1,"?" ) == 0 ) {
       line=line.substr ( 1 );
 
-      if ( StartsWithIdentifier ( line, "convolutional" ) ) {
-        unsigned int kx, ky;
+      // Depthwise convolutions have the same receptive field
+      if ( StartsWithIdentifier ( line, "convolutional" ) ||
+           StartsWithIdentifier ( line, "depthwise" ) ) {
+        unsigned int kx, ky, sx = 1, sy = 1, dx = 1, dy = 1;
         ParseKernelSizeIfPossible ( line, "size", kx, ky );
+        ParseSizeIfPossible ( line, "stride", sx, sy );
+        ParseSizeIfPossible ( line, "dilation", dx, dy );
         LOGDEBUG << "Adding convolutional layer to receptive field (" << kx << "," << ky << ")";
-        receptive_field_x_ += factorx * ( kx - 1 );
-        receptive_field_y_ += factory * ( ky - 1 );
+        receptive_field_x_ += factorx * dx * ( kx - 1 );
+        receptive_field_y_ += factory * dy * ( ky - 1 );
+
+        // A strided convolution subsamples just like a pooling layer
+        factorx *= sx;
+        factory *= sy;
       }
 
-      if ( StartsWithIdentifier ( line, "maxpooling" ) ) {
-        unsigned int kx, ky;
-        LOGDEBUG << "Convolutional layer";
+      if ( StartsWithIdentifier ( line, "maxpooling" ) ||
+           StartsWithIdentifier ( line, "avgpooling" ) ) {
+        unsigned int kx = 1, ky = 1;
         ParseKernelSizeIfPossible ( line, "size", kx, ky );
-        LOGDEBUG << "Adding maxpooling layer to receptive field (" << kx << "," << ky << ")";
-        factorx *= kx;
-        factory *= ky;
+        unsigned int sx = kx, sy = ky;
+        ParseSizeIfPossible ( line, "stride", sx, sy );
+        LOGDEBUG << "Adding pooling layer to receptive field (" << kx << "," << ky << ")";
+
+        // Overlapping regions need some more context
+        receptive_field_x_ += factorx * ( (int) kx - (int) sx );
+        receptive_field_y_ += factory * ( (int) ky - (int) sy );
+        factorx *= sx;
+        factory *= sy;
+      }
+
+      // A deconvolution undoes some of the subsampling
+      if ( StartsWithIdentifier ( line, "deconvolution" ) ) {
+        unsigned int sx = 1, sy = 1;
+        ParseSizeIfPossible ( line, "stride", sx, sy );
+
+        if ( factorx % sx != 0 || factory % sy != 0 ) {
+          LOGWARN << "Deconvolution stride does not divide the subsampling factor";
+        } else {
+          factorx /= sx;
+          factory /= sy;
+        }
       }
     }
   }
@@ -102,12 +218,24 @@ int ConfigurableFactory::AddLayers ( Net& net, Connection data_layer_connection,
     llr_factor /= patch_field_y_;
 #endif
     LOGINFO << "Local learning rate factor is (initially): " << llr_factor;
-    last_layer_id = net.AddLayer ( new ResizeLayer ( receptive_field_x_, receptive_field_y_ ), { data_layer_connection } );
-    last_layer_output = 0;
+    if ( padding_.length() == 0 ) {
+      last_layer_id = net.AddLayer ( new ResizeLayer ( receptive_field_x_, receptive_field_y_ ), { data_layer_connection } );
+      last_layer_output = 0;
+    } else {
+      LOGDEBUG << "Padding in every convolutional layer (" << padding_ << ")";
+    }
   }
 
   bool first_layer = true;
 
+  // Activation functions directly after a convolutional layer are fused
+  // into it. The others overwrite their input if the net allows it.
+  ConvolutionLayer* last_convolution = nullptr;
+
+  // Max-pooling after a convolutional layer (maybe with an activation
+  // function in between) is fused into it as well
+  ConvolutionLayer* pooling_convolution = nullptr;
+
   while ( ! file_.eof() ) {
     std::string line;
     std::getline ( file_,line );
@@ -143,21 +271,63 @@ int ConfigurableFactory::AddLayers ( Net& net, Connection data_layer_connection,
     if ( line.compare ( 0,1,"?" ) == 0 ) {
       line=line.substr ( 1 );
       LOGDEBUG << "Parsing layer: " << line;
+
+      ConvolutionLayer* previous_convolution = last_convolution;
+      last_convolution = nullptr;
       
-      if ( StartsWithIdentifier ( line, "convolutional" ) ) {
-        unsigned int kx = 1, ky = 1, k = 1;
+      const bool depthwise = StartsWithIdentifier ( line, "depthwise" );
+
+      if ( StartsWithIdentifier ( line, "convolutional" ) || depthwise ) {
+        unsigned int kx = 1, ky = 1, k = 1, groups = 1;
+        unsigned int sx = 1, sy = 1, dx = 1, dy = 1;
+        unsigned int workspace_kb = workspace_kb_;
         datum llr = 1;
         ParseKernelSizeIfPossible ( line, "size", kx, ky );
+        ParseSizeIfPossible ( line, "stride", sx, sy );
+        ParseSizeIfPossible ( line, "dilation", dx, dy );
         ParseCountIfPossible ( line, "kernels", k );
+        ParseCountIfPossible ( line, "groups", groups );
+        ParseCountIfPossible ( line, "workspace", workspace_kb );
         ParseDatumParamIfPossible ( line,"llr", llr );
 
-        ConvolutionLayer* cl = new ConvolutionLayer ( kx, ky, k, rand() );
+        // A depthwise convolution has as many kernels as input maps
+        ConvolutionLayer* cl = new ConvolutionLayer ( kx, ky, depthwise ? 0 : k, rand() );
+        if ( depthwise )
+          cl->SetDepthwise();
+        else if ( groups != 1 )
+          cl->SetGroups ( groups );
+        cl->SetStride ( sx, sy );
+        cl->SetDilation ( dx, dy );
+        if ( method_ == FCN && padding_.length() > 0 )
+          cl->SetPadding ( dx * ( kx - 1 ), dy * ( ky - 1 ),
+                           padding_.compare ( "mirror" ) == 0 ? CONV_PADDING_MIRROR : CONV_PADDING_ZERO );
+        if ( workspace_kb > 0 )
+          cl->SetWorkspaceSize ( (std::size_t) workspace_kb * 1024 );
+
+        // This has to be known before the layer is added, because it
+        // changes the output size
+        const std::string next_layer = PeekLayer ( file_ );
+        if ( FusePooling() && StartsWithIdentifier ( next_layer, "maxpooling" ) ) {
+          unsigned int px = 1, py = 1;
+          ParseKernelSizeIfPossible ( next_layer, "size", px, py );
+          unsigned int psx = px, psy = py;
+          ParseSizeIfPossible ( next_layer, "stride", psx, psy );
+
+          // Only non-overlapping regions can be fused
+          if ( psx == px && psy == py ) {
+            cl->SetMaxPooling ( px, py );
+            pooling_convolution = cl;
+          }
+        }
         if(method_ == FCN) {
           LOGDEBUG << "LLR factor: " << llr_factor << ", RFX: " << current_receptive_field_x;
           cl->SetLocalLearningRate ( llr * llr_factor * (datum)current_receptive_field_x * (datum)current_receptive_field_y);
 #ifdef CN24_EMULATE_PATCH_LEARNING
-          current_receptive_field_x -= (kx - 1);
-          current_receptive_field_y -= (ky - 1);
+          current_receptive_field_x -= dx * (kx - 1);
+          current_receptive_field_y -= dy * (ky - 1);
+          current_receptive_field_x /= sx;
+          current_receptive_field_y /= sy;
+          llr_factor *= (datum)(sx * sy);
 #endif
         } else {
           cl->SetLocalLearningRate ( llr * llr_factor);
@@ -170,46 +340,121 @@ int ConfigurableFactory::AddLayers ( Net& net, Connection data_layer_connection,
         { Connection ( last_layer_id, last_layer_output ) } );
         last_layer_output = 0;
         first_layer = false;
+        last_convolution = cl;
 
       }
 
-      if ( StartsWithIdentifier ( line, "maxpooling" ) ) {
+      const bool average = StartsWithIdentifier ( line, "avgpooling" );
+
+      if ( StartsWithIdentifier ( line, "maxpooling" ) || average ) {
         unsigned int kx = 1, ky = 1;
         ParseKernelSizeIfPossible ( line, "size", kx, ky );
+        unsigned int sx = kx, sy = ky;
+        ParseSizeIfPossible ( line, "stride", sx, sy );
 
         if(method_ == FCN) {
 #ifdef CN24_EMULATE_PATCH_LEARNING
-          current_receptive_field_x /= kx;
-          current_receptive_field_y /= ky;
-          llr_factor *= (datum)(kx * ky);
+          current_receptive_field_x -= (int) kx - (int) sx;
+          current_receptive_field_y -= (int) ky - (int) sy;
+          current_receptive_field_x /= sx;
+          current_receptive_field_y /= sy;
+          llr_factor *= (datum)(sx * sy);
 #endif
         }
 
-        MaxPoolingLayer* mp = new MaxPoolingLayer ( kx, ky );
-        last_layer_id = net.AddLayer ( mp ,
+        if ( pooling_convolution != nullptr ) {
+          // Already done by the convolutional layer. An activation function
+          // after this can still be fused into it.
+          if ( pooling_convolution->activation() == CONV_ACTIVATION_NONE )
+            last_convolution = pooling_convolution;
+          pooling_convolution = nullptr;
+        } else {
+          // Without a ResizeLayer at the beginning, the context for
+          // overlapping regions has to be added here
+          if ( method_ == FCN && padding_.length() > 0 && ( kx > sx || ky > sy ) ) {
+            last_layer_id = net.AddLayer ( new ResizeLayer ( kx > sx ? kx - sx : 0,
+                                           ky > sy ? ky - sy : 0 ),
+            { Connection ( last_layer_id, last_layer_output ) } );
+            last_layer_output = 0;
+          }
+
+          Layer* pl;
+          if ( average ) {
+            AveragePoolingLayer* ap = new AveragePoolingLayer ( kx, ky );
+            ap->SetStride ( sx, sy );
+            pl = ap;
+          } else {
+            MaxPoolingLayer* mp = new MaxPoolingLayer ( kx, ky );
+            if ( sx != kx || sy != ky )
+              mp->SetStride ( sx, sy );
+            pl = mp;
+          }
+          last_layer_id = net.AddLayer ( pl ,
+          { Connection ( last_layer_id, last_layer_output ) } );
+          last_layer_output = 0;
+        }
+      }
+
+      if ( StartsWithIdentifier ( line, "deconvolution" ) ) {
+        unsigned int sx = 1, sy = 1, k = 0;
+        datum llr = 1;
+        ParseSizeIfPossible ( line, "stride", sx, sy );
+        unsigned int kx = 2 * sx - sx % 2, ky = 2 * sy - sy % 2;
+        ParseKernelSizeIfPossible ( line, "size", kx, ky );
+        ParseCountIfPossible ( line, "kernels", k );
+        ParseDatumParamIfPossible ( line,"llr", llr );
+
+        // Keep the number of maps unless told otherwise
+        if ( k == 0 )
+          k = net.buffer ( last_layer_id, last_layer_output )->data.maps();
+
+        DeconvolutionLayer* dl = new DeconvolutionLayer ( kx, ky, k, rand() );
+        dl->SetStride ( sx, sy );
+
+        // Crop the output to exactly stride times the input
+        dl->SetPadding ( kx > sx ? kx - sx : 0, ky > sy ? ky - sy : 0 );
+        dl->SetLocalLearningRate ( llr * llr_factor );
+
+        last_layer_id = net.AddLayer ( dl ,
         { Connection ( last_layer_id, last_layer_output ) } );
         last_layer_output = 0;
+        first_layer = false;
       }
 
       if ( StartsWithIdentifier ( line, "sigm" ) ) {
-        SigmoidLayer* l = new SigmoidLayer();
-        last_layer_id = net.AddLayer ( l ,
-        { Connection ( last_layer_id, last_layer_output ) } );
-        last_layer_output = 0;
+        if ( previous_convolution != nullptr && FuseActivations() ) {
+          previous_convolution->SetActivation ( CONV_ACTIVATION_SIGMOID );
+        } else {
+          SigmoidLayer* l = new SigmoidLayer();
+          l->SetInPlace ( true );
+          last_layer_id = net.AddLayer ( l ,
+          { Connection ( last_layer_id, last_layer_output ) } );
+          last_layer_output = 0;
+        }
       }
 
       if ( StartsWithIdentifier ( line, "relu" ) ) {
-        ReLULayer* l = new ReLULayer();
-        last_layer_id = net.AddLayer ( l ,
-        { Connection ( last_layer_id, last_layer_output ) } );
-        last_layer_output = 0;
+        if ( previous_convolution != nullptr && FuseActivations() ) {
+          previous_convolution->SetActivation ( CONV_ACTIVATION_RELU );
+        } else {
+          ReLULayer* l = new ReLULayer();
+          l->SetInPlace ( true );
+          last_layer_id = net.AddLayer ( l ,
+          { Connection ( last_layer_id, last_layer_output ) } );
+          last_layer_output = 0;
+        }
       }
 
       if ( StartsWithIdentifier ( line, "tanh" ) ) {
-        TanhLayer* l = new TanhLayer();
-        last_layer_id = net.AddLayer ( l ,
-        { Connection ( last_layer_id, last_layer_output ) } );
-        last_layer_output = 0;
+        if ( previous_convolution != nullptr && FuseActivations() ) {
+          previous_convolution->SetActivation ( CONV_ACTIVATION_TANH );
+        } else {
+          TanhLayer* l = new TanhLayer();
+          l->SetInPlace ( true );
+          last_layer_id = net.AddLayer ( l ,
+          { Connection ( last_layer_id, last_layer_output ) } );
+          last_layer_output = 0;
+        }
       }
 
       if ( StartsWithIdentifier ( line,"spatialprior" ) ) {
@@ -224,7 +469,24 @@ int ConfigurableFactory::AddLayers ( Net& net, Connection data_layer_connection,
   }
 
   if ( method_ == FCN && ( factorx != 1 || factory != 1 ) ) {
-    last_layer_id = net.AddLayer ( new UpscaleLayer ( factorx, factory ),
+    Layer* ul;
+    if ( upscaling_.compare ( "bilinear" ) == 0 ) {
+      ul = new BilinearUpscaleLayer ( factorx, factory );
+    } else if ( upscaling_.compare ( "deconvolution" ) == 0 ) {
+      // Kernels that are large enough to interpolate bilinearly, which is
+      // also how they are initialized
+      const unsigned int kx = 2 * factorx - factorx % 2;
+      const unsigned int ky = 2 * factory - factory % 2;
+      DeconvolutionLayer* dl = new DeconvolutionLayer ( kx, ky,
+          net.buffer ( last_layer_id, last_layer_output )->data.maps(), rand() );
+      dl->SetStride ( factorx, factory );
+      dl->SetPadding ( kx - factorx, ky - factory );
+      dl->SetLocalLearningRate ( llr_factor );
+      ul = dl;
+    } else {
+      ul = new UpscaleLayer ( factorx, factory );
+    }
+    last_layer_id = net.AddLayer ( ul,
     { Connection ( last_layer_id, last_layer_output ) } );
     last_layer_output = 0;
     LOGDEBUG << "Added upscaling layer for FCN";
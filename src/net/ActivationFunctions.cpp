@@ -17,6 +17,8 @@
 
 
 #include "CLHelper.h"
+#include "VectorMath.h"
+#include "ThreadPool.h"
 #include "NonLinearityLayer.h"
 
 namespace Conv {
@@ -66,14 +68,9 @@ void SigmoidLayer::FeedForward () {
 #endif
 
 #else
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements(); element++) {
-    const datum input_data = input_->data.data_ptr_const() [element];
-
-    // Calculate sigmoid: sigm(x) = 1.0 / (1.0 + e^-x)
-    const datum output_data = 1.0 / (1.0 + exp (-input_data));
-    output_->data.data_ptr() [element] = output_data;
-  }
+  // Calculate sigmoid: sigm(x) = 1.0 / (1.0 + e^-x)
+  VectorMath::Sigmoid (input_->data.data_ptr_const(), output_->data.data_ptr(),
+                       input_->data.elements());
 #endif
 }
 
@@ -111,21 +108,16 @@ void SigmoidLayer::BackPropagate () {
  
   
 #else
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements (); element++) {
-    const datum output_delta = output_->delta.data_ptr_const ()[element];
-    const datum output_data = output_->data.data_ptr_const ()[element];
-
-    // sigm'(x) = sigm(x) * (1.0 - sigm(x))
-    // sigm(x) = output
-    // this is why we use output_data here (so we don't need to calculate
-    // sigm(x) twice).
-    // This may be slower for wide networks and large batches
-    // because of cache limitations.
-
-    const datum input_delta = (datum) (output_delta * output_data * (1.0 - output_data));
-    input_->delta.data_ptr ()[element] = input_delta;
-  }
+  // sigm'(x) = sigm(x) * (1.0 - sigm(x))
+  // sigm(x) = output
+  // this is why we use output_data here (so we don't need to calculate
+  // sigm(x) twice).
+  // This may be slower for wide networks and large batches
+  // because of cache limitations.
+  VectorMath::SigmoidBackward (output_->data.data_ptr_const(),
+                               output_->delta.data_ptr_const(),
+                               input_->delta.data_ptr(),
+                               input_->data.elements());
 #endif
 }
 
@@ -158,14 +150,9 @@ void TanhLayer::FeedForward () {
 #endif
 
 #else
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements(); element++) {
-    const datum input_data = input_->data.data_ptr_const() [element];
-
-    // Calculate hyperbolic tangent: tanh(x) = 1.0 - 2.0 / (e^(2*x) + 1)
-    const datum output_data = 1.0 - 2.0 / (exp (2.0 * input_data) + 1.0);
-    output_->data.data_ptr() [element] = output_data;
-  }
+  // Calculate hyperbolic tangent: tanh(x) = 1.0 - 2.0 / (e^(2*x) + 1)
+  VectorMath::Tanh (input_->data.data_ptr_const(), output_->data.data_ptr(),
+                    input_->data.elements());
 #endif
 }
 
@@ -202,66 +189,51 @@ void TanhLayer::BackPropagate () {
 
   
 #else
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements (); element++) {
-    const datum output_delta = output_->delta.data_ptr_const ()[element];
-    const datum output_data = output_->data.data_ptr_const ()[element];
-
-    // tanh'(x) = 1 - (tanh(x))^2
-    // tanh(x) = output
-    // see SigmoidLayer::BackPropagate for an explanation
-
-    const datum input_delta = (datum) (output_delta * (1.0 - output_data * output_data));
-    input_->delta.data_ptr ()[element] = input_delta;
-  }
+  // tanh'(x) = 1 - (tanh(x))^2
+  // tanh(x) = output
+  // see SigmoidLayer::BackPropagate for an explanation
+  VectorMath::TanhBackward (output_->data.data_ptr_const(),
+                            output_->delta.data_ptr_const(),
+                            input_->delta.data_ptr(),
+                            input_->data.elements());
 #endif
 }
 
 void ReLULayer::FeedForward () {
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements (); element++) {
-    const datum input_data = input_->data.data_ptr_const ()[element];
-
-    // max(0, x)
-    const datum output_data = input_data > 0 ? input_data : 0;
-    output_->data.data_ptr ()[element] = output_data;
-  }
+  // max(0, x)
+  VectorMath::ReLU (input_->data.data_ptr_const(), output_->data.data_ptr(),
+                    input_->data.elements());
 }
 
 void ReLULayer::BackPropagate () {
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements (); element++) {
-    const datum output_delta = output_->delta.data_ptr_const ()[element];
-    const datum input_data = input_->data.data_ptr_const ()[element];
-
-    // There is more than one way to do this. max(0,x) is not differentiable
-    // at x=0 so we have to make a choice. It doesn't affect the learning in
-    // any meaningful way.
-    const datum input_delta = (input_data > 0 ? output_delta : 0);
-    input_->delta.data_ptr ()[element] = input_delta;
-  }
+  // There is more than one way to do this. max(0,x) is not differentiable
+  // at x=0 so we have to make a choice. It doesn't affect the learning in
+  // any meaningful way.
+  // In place, the input data is the output, but it has the same sign.
+  VectorMath::ReLUBackward (input_->data.data_ptr_const(),
+                            output_->delta.data_ptr_const(),
+                            input_->delta.data_ptr(), input_->data.elements());
 }
 
 void SoftmaxLayer::FeedForward () {
-#pragma omp parallel for default(shared)
-  for (std::size_t sample = 0; sample < input_->data.samples (); sample++) {
-    float sum = 0.0f;
-    for(std::size_t element = 0; element < input_->data.width (); element++) {
-      sum += exp (*input_->data.data_ptr (element,0,0,sample));
-    }
-    for (std::size_t element = 0; element < input_->data.width () ; element++) {
-      *output_->data.data_ptr(element,0,0,sample) =
-          (datum) exp (*input_->data.data_ptr (element,0,0,sample)) / sum;
-    }
-  }
+  const std::size_t width = input_->data.width ();
+
+  // Computed row by row, with the accuracy set in FastMath
+  ThreadPool::ParallelFor (input_->data.samples (), [&] (const int sample) {
+    VectorMath::Softmax (input_->data.data_ptr_const (0, 0, 0, sample),
+                         output_->data.data_ptr (0, 0, 0, sample), width);
+  });
 }
 
 void SoftmaxLayer::BackPropagate () {
-#pragma omp parallel for default(shared)
-  for (std::size_t element = 0; element < input_->data.elements (); element++) {
+  // Nothing to copy in place
+  if (input_->delta.data_ptr_const() == output_->delta.data_ptr_const())
+    return;
+
+  ThreadPool::ParallelFor (input_->data.elements (), [&] (const std::size_t element) {
     const datum output_delta = output_->delta.data_ptr_const ()[element];
     input_->delta.data_ptr ()[element] = output_delta;
-  }
+  }, 16384);
 }
 
 }
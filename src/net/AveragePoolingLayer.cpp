@@ -0,0 +1,110 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+#include "Log.h"
+#include "AveragePooling.h"
+#include "AveragePoolingLayer.h"
+
+namespace Conv {
+
+AveragePoolingLayer::AveragePoolingLayer (const unsigned int region_width,
+    const unsigned int region_height) :
+  region_width_ (region_width), region_height_ (region_height),
+  stride_width_ (region_width), stride_height_ (region_height) {
+  LOGDEBUG << "Instance created: " << region_width_ << "x" << region_height_ <<
+           " pooling.";
+}
+
+void AveragePoolingLayer::SetStride (const unsigned int stride_width,
+                                     const unsigned int stride_height) {
+  if (stride_width == 0 || stride_height == 0) {
+    FATAL ("Stride must not be zero!");
+  }
+
+  stride_width_ = stride_width;
+  stride_height_ = stride_height;
+  LOGDEBUG << "Stride: " << stride_width_ << "x" << stride_height_;
+}
+
+bool AveragePoolingLayer::CreateOutputs (
+  const std::vector< CombinedTensor* >& inputs,
+  std::vector< CombinedTensor* >& outputs) {
+  // This is a simple layer, only one input
+  if (inputs.size() != 1) {
+    LOGERROR << "Only one input supported!";
+    return false;
+  }
+
+  // Save input node pointer
+  CombinedTensor* input = inputs[0];
+
+  // Check if input node pointer is null
+  if (input == nullptr) {
+    LOGERROR << "Null pointer input node!";
+    return false;
+  }
+
+  // Validate dimensions
+  if (input->data.width() < region_width_ ||
+      input->data.height() < region_height_ ||
+      ( (input->data.width() - region_width_) % stride_width_) != 0 ||
+      ( (input->data.height() - region_height_) % stride_height_) != 0) {
+    LOGERROR << "Input dimensions don't fit region dimensions and stride!";
+    return false;
+  }
+
+  // Create output
+  CombinedTensor* output = new CombinedTensor (input->data.samples(),
+      (input->data.width() - region_width_) / stride_width_ + 1,
+      (input->data.height() - region_height_) / stride_height_ + 1,
+      input->data.maps());
+
+  // Tell network about the output
+  outputs.push_back (output);
+
+  return true;
+}
+
+bool AveragePoolingLayer::Connect (const CombinedTensor* input,
+                                   CombinedTensor* output) {
+  bool valid = input->data.samples() == output->data.samples() &&
+               input->data.maps() == output->data.maps() &&
+               (input->data.width() - region_width_) / stride_width_ + 1 ==
+               output->data.width() &&
+               (input->data.height() - region_height_) / stride_height_ + 1 ==
+               output->data.height();
+
+  if (!valid) {
+    LOGERROR << "Invalid dimensions!";
+    return false;
+  }
+
+  // Save dimensions
+  input_width_ = input->data.width();
+  input_height_ = input->data.height();
+
+  maps_ = input->data.maps();
+
+  return true;
+}
+
+void AveragePoolingLayer::FeedForward() {
+  AveragePooling::Forward (input_->data.data_ptr_const(),
+                           output_->data.data_ptr(),
+                           input_->data.samples() * maps_, input_width_,
+                           input_height_, region_width_, region_height_,
+                           stride_width_, stride_height_);
+}
+
+void AveragePoolingLayer::BackPropagate() {
+  AveragePooling::Backward (output_->delta.data_ptr_const(),
+                            input_->delta.data_ptr(),
+                            input_->data.samples() * maps_, input_width_,
+                            input_height_, region_width_, region_height_,
+                            stride_width_, stride_height_);
+}
+
+}
@@ -0,0 +1,187 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "Log.h"
+#include "VectorMath.h"
+#include "ThreadPool.h"
+
+#include "BilinearUpscaleLayer.h"
+
+namespace Conv {
+
+/*
+ * Fills the interpolation tables for one dimension. Output pixel o has
+ * its center at input coordinate (o + 0.5) / factor - 0.5.
+ */
+static void InterpolationTable (const unsigned int input_size,
+                                const unsigned int factor,
+                                std::vector<unsigned int>& first,
+                                std::vector<unsigned int>& second,
+                                std::vector<datum>& weight) {
+  const unsigned int output_size = input_size * factor;
+  first.resize (output_size);
+  second.resize (output_size);
+  weight.resize (output_size);
+
+  for (unsigned int o = 0; o < output_size; o++) {
+    double position = ( (double) o + 0.5) / (double) factor - 0.5;
+    position = std::max (0.0, std::min (position, (double) (input_size - 1)));
+
+    first[o] = (unsigned int) std::floor (position);
+    second[o] = std::min (first[o] + 1, input_size - 1);
+    weight[o] = (datum) (position - first[o]);
+  }
+}
+
+BilinearUpscaleLayer::BilinearUpscaleLayer (const unsigned int region_width,
+    const unsigned int region_height) :
+  region_width_ (region_width), region_height_ (region_height) {
+  if (region_width_ == 0 || region_height_ == 0) {
+    FATAL ("Scaling factors cannot be zero");
+  }
+
+  LOGDEBUG << "Instance created: " << region_width_ << "x" << region_height_ <<
+           " bilinear upscaling.";
+}
+
+bool BilinearUpscaleLayer::CreateOutputs (
+  const std::vector< CombinedTensor* >& inputs,
+  std::vector< CombinedTensor* >& outputs) {
+  // This is a simple layer, only one input
+  if (inputs.size() != 1) {
+    LOGERROR << "Only one input supported!";
+    return false;
+  }
+
+  // Save input node pointer
+  CombinedTensor* input = inputs[0];
+
+  // Check if input node pointer is null
+  if (input == nullptr) {
+    LOGERROR << "Null pointer input node!";
+    return false;
+  }
+
+  // Create output
+  CombinedTensor* output = new CombinedTensor (input->data.samples(),
+      input->data.width() * region_width_, input->data.height() * region_height_,
+      input->data.maps());
+
+  // Tell network about the output
+  outputs.push_back (output);
+
+  return true;
+}
+
+bool BilinearUpscaleLayer::Connect (const CombinedTensor* input,
+                                    CombinedTensor* output) {
+  bool valid = input->data.samples() == output->data.samples() &&
+               input->data.maps() == output->data.maps() &&
+               input->data.width() * region_width_ == output->data.width() &&
+               input->data.height() * region_height_ == output->data.height() &&
+               input->data.width() > 0 && input->data.height() > 0;
+
+  if (!valid) {
+    LOGERROR << "Invalid dimensions!";
+    return false;
+  }
+
+  // Save dimensions
+  input_width_ = input->data.width();
+  input_height_ = input->data.height();
+  output_width_ = output->data.width();
+  output_height_ = output->data.height();
+
+  maps_ = input->data.maps();
+
+  InterpolationTable (input_width_, region_width_, first_x_, second_x_, weight_x_);
+  InterpolationTable (input_height_, region_height_, first_y_, second_y_, weight_y_);
+
+  horizontal_.Resize (input->data.samples(), output_width_, input_height_, maps_);
+
+  return true;
+}
+
+void BilinearUpscaleLayer::FeedForward() {
+  const int input_rows = (int) (input_->data.samples() * maps_ * input_height_);
+  const int output_rows = (int) (input_->data.samples() * maps_ * output_height_);
+
+  // Interpolate between columns, this is only done for the input rows
+  ThreadPool::ParallelFor (input_rows, [&] (const int row) {
+    const datum* input_row = input_->data.data_ptr_const() +
+                             (std::size_t) row * input_width_;
+    datum* horizontal_row = horizontal_.data_ptr() + (std::size_t) row * output_width_;
+
+    for (unsigned int ox = 0; ox < output_width_; ox++) {
+      const datum first = input_row[first_x_[ox]];
+      horizontal_row[ox] = first + weight_x_[ox] * (input_row[second_x_[ox]] - first);
+    }
+  });
+
+  // Interpolate between rows, which is done for whole rows at once
+  ThreadPool::ParallelFor (output_rows, [&] (const int row) {
+    const unsigned int oy = row % output_height_;
+    const std::size_t map = row / output_height_;
+    const datum* horizontal_map = horizontal_.data_ptr_const() +
+                                  map * input_height_ * output_width_;
+
+    VectorMath::Lerp (horizontal_map + (std::size_t) first_y_[oy] * output_width_,
+                      horizontal_map + (std::size_t) second_y_[oy] * output_width_,
+                      weight_y_[oy],
+                      output_->data.data_ptr() + (std::size_t) row * output_width_,
+                      output_width_);
+  });
+}
+
+void BilinearUpscaleLayer::BackPropagate() {
+  const int input_rows = (int) (input_->data.samples() * maps_ * input_height_);
+
+  // The gradient of every horizontally scaled row is gathered from the
+  // output rows that were interpolated from it. These are less than a
+  // region away.
+  ThreadPool::ParallelFor (input_rows, [&] (const int row) {
+    const unsigned int iy = row % input_height_;
+    const std::size_t map = row / input_height_;
+    const datum* output_map = output_->delta.data_ptr_const() +
+                              map * output_height_ * output_width_;
+    datum* horizontal_row = horizontal_.data_ptr() + (std::size_t) row * output_width_;
+
+    std::fill (horizontal_row, horizontal_row + output_width_, (datum) 0);
+
+    const unsigned int begin = iy > 0 ? (iy - 1) * region_height_ : 0;
+    const unsigned int end = std::min (output_height_, (iy + 2) * region_height_);
+
+    for (unsigned int oy = begin; oy < end; oy++) {
+      const datum* output_row = output_map + (std::size_t) oy * output_width_;
+
+      if (first_y_[oy] == iy)
+        VectorMath::Axpy (1 - weight_y_[oy], output_row, horizontal_row,
+                          output_width_);
+
+      if (second_y_[oy] == iy)
+        VectorMath::Axpy (weight_y_[oy], output_row, horizontal_row,
+                          output_width_);
+    }
+  });
+
+  ThreadPool::ParallelFor (input_rows, [&] (const int row) {
+    const datum* horizontal_row = horizontal_.data_ptr_const() +
+                                  (std::size_t) row * output_width_;
+    datum* input_row = input_->delta.data_ptr() + (std::size_t) row * input_width_;
+
+    std::fill (input_row, input_row + input_width_, (datum) 0);
+
+    for (unsigned int ox = 0; ox < output_width_; ox++) {
+      input_row[first_x_[ox]] += (1 - weight_x_[ox]) * horizontal_row[ox];
+      input_row[second_x_[ox]] += weight_x_[ox] * horizontal_row[ox];
+    }
+  });
+}
+
+}
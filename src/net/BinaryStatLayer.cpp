@@ -6,6 +6,7 @@
  */  
 #include "Log.h"
 #include "Init.h"
+#include "ThreadPool.h"
 
 #include "BinaryStatLayer.h"
 
@@ -104,8 +105,7 @@ void BinaryStatLayer::FeedForward() {
   if ( disabled_ )
     return;
 
-  #pragma omp parallel for default(shared)
-  for ( unsigned int t = 0; t < thresholds_; t++ ) {
+  ThreadPool::ParallelFor (thresholds_, [&] (const unsigned int t) {
     for ( std::size_t s = 0; s < first_->data.elements(); s++ ) {
       const bool sign = first_->data ( s ) > threshold_values_[t];
       const bool expected_sign = second_->data ( s ) > 0; //threshold_values_[t];
@@ -123,7 +123,7 @@ void BinaryStatLayer::FeedForward() {
       if ( !sign && !expected_sign )
         true_negatives_[t] += weight;
     }
-  }
+  });
 }
 
 void BinaryStatLayer::BackPropagate() {
@@ -4,7 +4,12 @@
  *
  * For licensing information, see the LICENSE file included with this project.
  */  
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <sstream>
+#include <vector>
 
 #ifdef BUILD_OPENCL
 #define BUILD_OPENCL_CONV
@@ -17,7 +22,15 @@
 #include "Config.h"
 #include "Log.h"
 #include "CLHelper.h"
-#include "MKLHelper.h"
+#include "DirectConvolution.h"
+#include "DepthwiseConvolution.h"
+#include "Winograd.h"
+#include "Im2ColConvolution.h"
+#include "MaxPooling.h"
+#include "CPUFeatures.h"
+#include "TuningCache.h"
+#include "ThreadPool.h"
+#include "VectorMath.h"
 
 #include "ConvolutionLayer.h"
 
@@ -47,6 +60,52 @@ ConvolutionLayer::ConvolutionLayer (const unsigned int kwidth,
            kernel_width_ << "x" << kernel_height_ << " kernels.";
 }
 
+ConvolutionLayer::~ConvolutionLayer() {
+  ReleaseAlgorithm();
+}
+
+// Upper limit for the unpooled output of the samples that are convolved
+// at a time with a fused pooling (in bytes)
+const std::size_t pooling_scratch_size = 2 * 1024 * 1024;
+
+/*
+ * Number of kernel positions along one dimension of a 'valid' convolution
+ */
+static inline unsigned int OutputSize (const unsigned int input_size,
+                                       const unsigned int dilated_kernel_size,
+                                       const unsigned int stride) {
+  return (input_size - dilated_kernel_size) / stride + 1;
+}
+
+/*
+ * Fused activation functions. These are the same as in
+ * ActivationFunctions.cpp.
+ */
+static void ReLUEpilogue (datum* data, const std::size_t count) {
+  VectorMath::ReLU (data, data, count);
+}
+
+static void SigmoidEpilogue (datum* data, const std::size_t count) {
+  VectorMath::Sigmoid (data, data, count);
+}
+
+static void TanhEpilogue (datum* data, const std::size_t count) {
+  VectorMath::Tanh (data, data, count);
+}
+
+static ConvolutionEpilogue ActivationEpilogue (const ConvolutionActivation activation) {
+  switch (activation) {
+  case CONV_ACTIVATION_RELU:
+    return ReLUEpilogue;
+  case CONV_ACTIVATION_SIGMOID:
+    return SigmoidEpilogue;
+  case CONV_ACTIVATION_TANH:
+    return TanhEpilogue;
+  default:
+    return nullptr;
+  }
+}
+
 bool ConvolutionLayer::CreateOutputs (
   const std::vector< CombinedTensor* >& inputs,
   std::vector< CombinedTensor* >& outputs) {
@@ -71,15 +130,38 @@ bool ConvolutionLayer::CreateOutputs (
   // For MNIST recognition, LeCun says that 'same' convolutions perform better
   // as a first layer. He adds a border around the training and test sets to
   // achieve the same thing without changing the code.
-  if (input->data.height() < kernel_height_ || input->data.width() < kernel_width_) {
+  if (input->data.height() + border_y_ < DilatedKernelHeight() ||
+      input->data.width() + border_x_ < DilatedKernelWidth()) {
     LOGERROR << "Unsupported input dimensions " << input->data;
     return false;
   }
 
+  // A depthwise convolution has a group and an output map per input map
+  if (depthwise_) {
+    groups_ = input->data.maps();
+    output_maps_ = input->data.maps();
+  }
+
+  if (input->data.maps() % groups_ != 0 || output_maps_ % groups_ != 0) {
+    LOGERROR << "Cannot split " << input->data.maps() << " input and " <<
+             output_maps_ << " output maps into " << groups_ << " groups";
+    return false;
+  }
+
+  const unsigned int width = OutputSize (input->data.width() + border_x_,
+                                         DilatedKernelWidth(), stride_x_);
+  const unsigned int height = OutputSize (input->data.height() + border_y_,
+                                          DilatedKernelHeight(), stride_y_);
+
+  if (width % pool_width_ != 0 || height % pool_height_ != 0) {
+    LOGERROR << "Output dimensions " << width << "x" << height <<
+             " not divisible by pooling region dimensions!";
+    return false;
+  }
+
   // Create output
   CombinedTensor* output = new CombinedTensor (input->data.samples(),
-      input->data.width() - (kernel_width_ - 1), input->data.height() - (kernel_height_ - 1),
-      output_maps_);
+      width / pool_width_, height / pool_height_, output_maps_);
 
   // Tell network about the output
   outputs.push_back (output);
@@ -89,10 +171,18 @@ bool ConvolutionLayer::CreateOutputs (
 
 bool ConvolutionLayer::Connect (const CombinedTensor* input,
                                 CombinedTensor* output) {
+  if (input->data.width() + border_x_ < DilatedKernelWidth() ||
+      input->data.height() + border_y_ < DilatedKernelHeight())
+    return false;
+
+  const unsigned int width = OutputSize (input->data.width() + border_x_,
+                                         DilatedKernelWidth(), stride_x_);
+  const unsigned int height = OutputSize (input->data.height() + border_y_,
+                                          DilatedKernelHeight(), stride_y_);
   bool valid =
-    input->data.width() >= kernel_width_ && input->data.height() >=  kernel_height_ &&
-    output->data.width() == input->data.width() - (kernel_width_ - 1) &&
-    output->data.height() == input->data.height() - (kernel_height_ - 1);
+    output->data.width() * pool_width_ == width &&
+    output->data.height() * pool_height_ == height &&
+    input->data.maps() % groups_ == 0 && output_maps_ % groups_ == 0;
 
   if (!valid) {
     return false;
@@ -102,43 +192,24 @@ bool ConvolutionLayer::Connect (const CombinedTensor* input,
   input_maps_ = input->data.maps();
   input_width_ = input->data.width();
   input_height_ = input->data.height();
-  output_width_ = output->data.width();
-  output_height_ = output->data.height();
+  output_width_ = width;
+  output_height_ = height;
 
   /*LOGDEBUG << "Local learning rate setting was " << local_lr_;
   local_lr_ /= (datum)(output_width_ * output_height_);*/
   LOGDEBUG << "Local learning rate is now " << local_lr_;
-#ifdef BUILD_BLAS
-  // Create im2col output buffer
-  im2col_ff_buffer.Resize (input->data.samples(), kernel_width_ * kernel_height_, input_maps_,
-                           output_width_ * output_height_);
-
-  // Create FeedForward output buffer
-  ff_output_buffer.Resize (output_maps_, output_width_, output_height_,
-                           input->data.samples());
-
-  // Create backpropagation input buffer
-  bp_deltay_buffer.Resize (output_maps_, output_width_, output_height_,
-                           input->data.samples());
-
-  bp_deltax_buffer.Resize (input->data.samples(), kernel_width_ * kernel_height_, input_maps_,
-                           output_width_ * output_height_);
-
-  // This is faster than adding manually...
-  ones_.Resize (1, output_width_ * output_height_ * input->data.samples());
-  for (unsigned int i = 0; i < ones_.elements(); i++) {
-    ones_[i] = 1;
-  }
-#endif
 
 #ifdef BUILD_OPENCL_CONV
   // Create folding buffers for OpenCL
-  delta_buffer_.Resize (input->data.samples(), kernel_width_, kernel_height_, input_maps_ * output_maps_);
-  bias_buffer_.Resize (input->data.samples(), output_maps_);
+  if (!inference_only_) {
+    delta_buffer_.Resize (input->data.samples(), kernel_width_, kernel_height_, input_maps_ * output_maps_);
+    bias_buffer_.Resize (input->data.samples(), output_maps_);
+  }
 #endif
 
-  // Create kernels
-  weights_ = new CombinedTensor (output_maps_, kernel_width_, kernel_height_, input_maps_);
+  // Create kernels, every output map only sees the input maps of its group
+  weights_ = new CombinedTensor (output_maps_, kernel_width_, kernel_height_,
+                                 input_maps_ / groups_);
   bias_ = new CombinedTensor (1, output_maps_);
 
   // Initialize weights to zero so the net won't work if Net::InitializeWeights
@@ -150,14 +221,40 @@ bool ConvolutionLayer::Connect (const CombinedTensor* input,
   parameters_.push_back (weights_);
   parameters_.push_back (bias_);
 
+#ifndef BUILD_OPENCL_CONV
+  // With a fused pooling, convolve as many samples at a time as fit into
+  // the scratch buffer
+  if (IsPooled()) {
+    const std::size_t sample_size = sizeof (datum) * output_maps_ *
+                                    output_width_ * output_height_;
+    pooling_samples_ = 1;
+
+    for (unsigned int samples = 2; samples <= input->data.samples(); samples++) {
+      if (input->data.samples() % samples == 0 &&
+          samples * sample_size <= pooling_scratch_size)
+        pooling_samples_ = samples;
+    }
+
+    LOGDEBUG << "Pooling " << pooling_samples_ << " samples at a time";
+    unpooled_.Resize (pooling_samples_, output_width_, output_height_,
+                      output_maps_);
+    maximum_.resize (output->data.elements() *
+                     MaxPooling::IndexSize (pool_width_, pool_height_));
+  }
+
+  // The convolution algorithm is picked on the first forward pass, when
+  // the net has decided whether this layer backpropagates
+  algorithm_selected_ = false;
+#endif
+
   return true;
 }
 
 void ConvolutionLayer::FeedForward() {
+#ifdef BUILD_OPENCL_CONV
   // Because we add every input map
   output_->data.Clear();
 
-#ifdef BUILD_OPENCL_CONV
   cl_uint error = 0;
   input_->data.MoveToGPU();
   weights_->data.MoveToGPU();
@@ -197,63 +294,94 @@ void ConvolutionLayer::FeedForward() {
 #endif
 
 #else
-#ifdef BUILD_BLAS
-  im2colff();
+  ConvolutionShape shape;
+  GetShape (shape, IsPooled() ? pooling_samples_ : input_->data.samples());
 
-  const datum* W = weights_->data.data_ptr_const();
-  const datum* X = im2col_ff_buffer.data_ptr_const();
-  const datum* b = bias_->data.data_ptr_const();
-  datum* Y = ff_output_buffer.data_ptr();
+  // Benchmark the algorithms for the passes that actually run
+  if (!algorithm_selected_ || algorithm_backprop_ != backprop_enabled_)
+    SelectAlgorithm (shape);
 
-  // Convolve
-  GEMM (CblasRowMajor, CblasNoTrans, CblasTrans, output_maps_,
-        output_width_ * output_height_ * input_->data.samples(),
-        kernel_width_ * kernel_height_ * input_maps_,
-        weight_factor_ , W, kernel_width_ * kernel_height_ * input_maps_,
-        X, kernel_width_ * kernel_height_ * input_maps_, 0.0,
-        Y, output_width_ * output_height_ * input_->data.samples());
+  if (IsPooled()) {
+    FeedForwardPooled (shape);
+    return;
+  }
 
-  // Add bias
-  GEMM (CblasRowMajor, CblasNoTrans, CblasNoTrans, output_maps_,
-        output_width_ * output_height_ * input_->data.samples(), 1, 1.0, b, 1,
-        ones_.data_ptr_const(), output_width_ * output_height_ * input_->data.samples(),
-        1.0, Y, output_width_ * output_height_ * input_->data.samples());
+  ConvolveForward (shape, input_->data.data_ptr_const(), output_->data.data_ptr());
+#endif // else BUILD_OPENCL
+}
 
+void ConvolutionLayer::FeedForwardPooled (const ConvolutionShape& shape) {
+  const ConvolutionEpilogue epilogue = ActivationEpilogue (activation_);
+  const std::size_t input_pass = (std::size_t) shape.samples * input_maps_ *
+                                 input_width_ * input_height_;
+  const std::size_t output_pass = (std::size_t) shape.samples * output_maps_ *
+                                  output_->data.width() * output_->data.height();
+  const std::size_t maximum_pass = output_pass *
+                                   MaxPooling::IndexSize (pool_width_, pool_height_);
+
+  for (unsigned int sample = 0; sample < input_->data.samples();
+       sample += shape.samples) {
+    const std::size_t pass = sample / shape.samples;
+    datum* output = output_->data.data_ptr() + pass * output_pass;
+
+    ConvolveForward (shape, input_->data.data_ptr_const() + pass * input_pass,
+                     unpooled_.data_ptr());
+    MaxPooling::Forward (unpooled_.data_ptr_const(), output,
+                         maximum_.data() + pass * maximum_pass,
+                         shape.samples * output_maps_, output_width_,
+                         output_height_, pool_width_, pool_height_,
+                         pool_width_, pool_height_);
+
+    // The activation functions are monotonic, so they can be applied to
+    // the maxima only
+    if (epilogue != nullptr)
+      epilogue (output, output_pass);
+  }
+}
 
-  col2imff();
-#else
-  // i * k = o
-  // The kernels are always "flipped", so this is an actual convolution
-  #pragma omp parallel for default(shared)
-  for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int omap = 0; omap < output_maps_; omap++) {
-      datum bias = bias_->data (omap);
-      for (unsigned int oy = 0; oy < output_height_; oy++) {
-        for (unsigned int ox = 0; ox < output_width_; ox++) {
-          datum* oval =
-            output_->data.data_ptr (ox, oy, omap, sample);
-          for (unsigned int ky = 0; ky < kernel_height_; ky++) {
-            unsigned int iy = oy + ky;
-            for (unsigned int kx = 0; kx < kernel_width_; kx++) {
-              unsigned int ix = ox + kx;
-              for (unsigned int imap = 0; imap < input_maps_; imap++) {
-                const datum weight =
-                  *weights_->data.data_ptr_const (kx, ky, imap, omap);
-                const datum ival =
-                  *input_->data.data_ptr_const (ix, iy, imap, sample);
-
-                *oval += weight_factor_ * weight * ival;
-              }
-            }
-          }
-          *oval += bias;
-        }
-      }
+void ConvolutionLayer::BackPropagatePooled (const ConvolutionShape& shape) {
+  const std::size_t input_pass = (std::size_t) shape.samples * input_maps_ *
+                                 input_width_ * input_height_;
+  const std::size_t output_pass = (std::size_t) shape.samples * output_maps_ *
+                                  output_->data.width() * output_->data.height();
+  const std::size_t maximum_pass = output_pass *
+                                   MaxPooling::IndexSize (pool_width_, pool_height_);
+  const std::size_t weights_size = weights_->delta.elements();
+
+  // The gradients of all but the first pass are computed here and added up
+  pass_gradients_.Resize (weights_size + output_maps_);
+
+  for (unsigned int sample = 0; sample < input_->data.samples();
+       sample += shape.samples) {
+    const std::size_t pass = sample / shape.samples;
+
+    // Gradient with respect to the unpooled output
+    MaxPooling::Backward (output_->delta.data_ptr_const() + pass * output_pass,
+                          maximum_.data() + pass * maximum_pass,
+                          unpooled_.data_ptr(), shape.samples * output_maps_,
+                          output_width_, output_height_, pool_width_,
+                          pool_height_, pool_width_, pool_height_);
+
+    if (backprop_enabled_)
+      ConvolveBackwardData (shape, unpooled_.data_ptr_const(),
+                            input_->delta.data_ptr() + pass * input_pass);
+
+    if (pass == 0) {
+      ConvolveWeightGradient (shape, input_->data.data_ptr_const(),
+                              unpooled_.data_ptr_const(),
+                              weights_->delta.data_ptr(), bias_->delta.data_ptr());
+    } else {
+      ConvolveWeightGradient (shape,
+                              input_->data.data_ptr_const() + pass * input_pass,
+                              unpooled_.data_ptr_const(),
+                              pass_gradients_.data_ptr(),
+                              pass_gradients_.data_ptr() + weights_size);
+      VectorMath::Add (pass_gradients_.data_ptr_const(),
+                       weights_->delta.data_ptr(), weights_size);
+      VectorMath::Add (pass_gradients_.data_ptr_const() + weights_size,
+                       bias_->delta.data_ptr(), output_maps_);
     }
   }
-
-#endif // else BUILD_BLAS
-#endif // else BUILD_OPENCL
 }
 
 void ConvolutionLayer::BackPropagate() {
@@ -261,13 +389,21 @@ void ConvolutionLayer::BackPropagate() {
     static datum one = 1.0;
 
 #ifndef BUILD_OPENCL_CONV
-#ifndef BUILD_BLAS
-  weights_->delta.Clear();
-  input_->delta.Clear();
-#endif
+  ConvolutionShape shape;
+  GetShape (shape, IsPooled() ? pooling_samples_ : input_->data.samples());
+
+  // With a fused activation, the gradient is with respect to the
+  // activations. Everything below needs it with respect to the
+  // convolution's result.
+  if (activation_ != CONV_ACTIVATION_NONE)
+    ActivationBackward (output_->delta.data_ptr(), output_->data.data_ptr_const());
+
+  if (IsPooled()) {
+    BackPropagatePooled (shape);
+    return;
+  }
 #endif
 
-
   /*
    * 1. Backpropagation
    */
@@ -313,67 +449,9 @@ void ConvolutionLayer::BackPropagate() {
 
   }
 #else
-#ifdef BUILD_BLAS
-  im2colbp();
-
-  const datum* W = weights_->data.data_ptr_const();
-  datum* dX = bp_deltax_buffer.data_ptr();
-  const datum* dY = bp_deltay_buffer.data_ptr_const();
-  const datum* X = im2col_ff_buffer.data_ptr_const();
-  datum* dW = weights_->delta.data_ptr();
-
-  if (backprop_enabled_) {
-    GEMM (CblasRowMajor, CblasTrans, CblasNoTrans,
-          output_width_ * output_height_ * input_->data.samples(),
-          kernel_width_ * kernel_height_ * input_maps_, output_maps_, 1.0,
-          dY, output_width_ * output_height_ * input_->data.samples(),
-          W, kernel_width_ * kernel_height_ * input_maps_, 0.0,
-          dX, kernel_width_ * kernel_height_ * input_maps_);
-
-
-    input_->delta.Clear();
-    col2imbp();
-  }
-#else
-
-  const unsigned int inner_nh_x = kernel_width_ - 1;
-  const unsigned int inner_nh_y = kernel_height_ - 1;
-
-  // Backpropagate by "full"-convolving the output gradient with the
-  // flipped filter.
-  if (backprop_enabled_) {
-    #pragma omp parallel for default(shared)
-    for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-      for (unsigned int imap = 0; imap < input_maps_; imap++) {
-        for (unsigned int diy = 0; diy < input_height_; diy++) {
-          for (unsigned int dix = 0; dix < input_width_; dix++) {
-            for (unsigned int ky = 0; ky < kernel_height_; ky++) {
-              int doy = ky + diy - inner_nh_y;
-              for (unsigned int kx = 0; kx < kernel_width_; kx++) {
-                int dox = kx + dix - inner_nh_x;
-                for (unsigned int omap = 0; omap < output_maps_; omap++) {
-                  if (dox >= 0 && doy >= 0 && dox < (int) output_width_ &&
-                      doy < (int) output_height_) {
-                    const datum weight =
-                      *weights_->data.data_ptr_const (kernel_width_ - (kx + 1),
-                                                      kernel_height_ - (ky + 1), imap,
-                                                      omap);
-                    const datum doval =
-                      *output_->delta.data_ptr_const (dox, doy, omap, sample);
-
-                    datum* dival = input_->delta.data_ptr (dix, diy, imap, sample);
-
-                    *dival += doval * weight;
-                  }
-                }
-              }
-            }
-          }
-        }
-      }
-    }
-  }
-#endif // BUILD_BLAS
+  if (backprop_enabled_)
+    ConvolveBackwardData (shape, output_->delta.data_ptr_const(),
+                          input_->delta.data_ptr());
 #endif // BUILD_OPENCL
 
   /*
@@ -458,41 +536,10 @@ void ConvolutionLayer::BackPropagate() {
   }
 
 #else
-#ifdef BUILD_BLAS
-  GEMM (CblasRowMajor, CblasNoTrans, CblasNoTrans, output_maps_,
-        kernel_width_ * kernel_height_ * input_maps_,
-        output_width_ * output_height_ * input_->data.samples(),
-        1.0, dY, output_width_ * output_height_ * input_->data.samples(),
-        X, kernel_width_ * kernel_height_ * input_maps_,
-        0.0, dW, kernel_width_ * kernel_height_ * input_maps_);
-#else
-  // Calculate gradients via x-correlation i * do = k
-  for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int imap = 0; imap < input_maps_; imap++) {
-      for (unsigned int ky = 0; ky < kernel_height_; ky++) {
-        for (unsigned int kx = 0; kx < kernel_width_; kx++) {
-          for (unsigned int doy = 0; doy < output_height_; doy++) {
-            unsigned int iy = ky + doy;
-            for (unsigned int dox = 0; dox < output_width_; dox++) {
-              unsigned int ix = kx + dox;
-              for (unsigned int omap = 0; omap < output_maps_; omap++) {
-                const datum doval =
-                  *output_->delta.data_ptr_const (dox, doy, omap, sample);
-                const datum ival =
-                  *input_->data.data_ptr_const (ix, iy, imap, sample);
-                // Don't flip here
-                datum* kval =
-                  weights_->delta.data_ptr (kx, ky, imap, omap);
-
-                *kval += doval * ival;
-              }
-            }
-          }
-        }
-      }
-    }
-  }
-#endif // BUILD_BLAS
+  // This computes the bias gradient as well
+  ConvolveWeightGradient (shape, input_->data.data_ptr_const(),
+                          output_->delta.data_ptr_const(),
+                          weights_->delta.data_ptr(), bias_->delta.data_ptr());
 #endif // BUILD_OPENCL
   /*
   * 3. Bias gradient calculation
@@ -561,28 +608,12 @@ void ConvolutionLayer::BackPropagate() {
 #endif
 
   }
-#else
-  bias_->delta.Clear();
-
-  #pragma omp parallel for default(shared)
-  for (unsigned int omap = 0; omap < output_maps_; omap++) {
-    for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-//      for (unsigned int imap = 0; imap < input_maps_; imap++) {
-        for (unsigned int doy = 0; doy < output_height_; doy++) {
-          for (unsigned int dox = 0; dox < output_width_; dox++) {
-            const datum doval =
-              *output_->delta.data_ptr_const (dox, doy, omap, sample);
-            bias_->delta[omap] += doval; //* 2.0f;
-          }
-        }
-//      }
-    }
-  }
 #endif
 }
 
 void ConvolutionLayer::OnLayerConnect (Layer* next_layer) {
-  unsigned int next_layer_gain = next_layer->Gain();
+  // Like a MaxPoolingLayer in between would
+  unsigned int next_layer_gain = next_layer->Gain() / (pool_width_ * pool_height_);
   unsigned int this_layer_gain = Gain();
 
   const datum range = sqrt (6) / sqrt (next_layer_gain + this_layer_gain);
@@ -595,71 +626,555 @@ void ConvolutionLayer::OnLayerConnect (Layer* next_layer) {
     weights_->data[i] = dist_weights (rand_);
   }
 
+  InvalidateParameters();
+
   LOGDEBUG << "Updating weights: " << this_layer_gain << " -> "
            << next_layer_gain;
 }
 
-void ConvolutionLayer::im2colff() {
-  #pragma omp parallel for default(shared)
-  for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int imap = 0; imap < input_maps_; imap++) {
-      for (unsigned int oy = 0; oy < output_height_; oy++) {
-        for (unsigned int ox = 0; ox < output_width_; ox++) {
-          // Maybe putting y on the outside will help with large kernels
-          // and short cache lines?
-          for (unsigned int ky = 0; ky < kernel_height_; ky++) {
-            unsigned int iy = oy + ky;
-            const datum* source = input_->data.data_ptr_const (ox, iy, imap, sample);
-            datum* target = im2col_ff_buffer.data_ptr (kernel_width_ * ky,
-                            imap, oy *
-                            output_width_ +
-                            ox, sample);
-
-            std::memcpy (target, source, sizeof (datum) * kernel_width_);
-          }
-        }
+void ConvolutionLayer::SetGroups (const unsigned int groups) {
+  if (groups == 0) {
+    FATAL ("Number of groups cannot be zero");
+  }
+#ifdef BUILD_OPENCL_CONV
+  if (groups != 1) {
+    FATAL ("Grouped convolutions are not supported with OpenCL");
+  }
+#endif
+  groups_ = groups;
+  depthwise_ = false;
+  LOGDEBUG << "Using " << groups_ << " groups";
+}
+
+void ConvolutionLayer::SetDepthwise() {
+#ifdef BUILD_OPENCL_CONV
+  FATAL ("Depthwise convolutions are not supported with OpenCL");
+#endif
+  depthwise_ = true;
+  LOGDEBUG << "Depthwise convolution";
+}
+
+void ConvolutionLayer::SetStride (const unsigned int stride_x,
+                                  const unsigned int stride_y) {
+  if (stride_x == 0 || stride_y == 0) {
+    FATAL ("Stride cannot be zero");
+  }
+#ifdef BUILD_OPENCL_CONV
+  if (stride_x != 1 || stride_y != 1) {
+    FATAL ("Strided convolutions are not supported with OpenCL");
+  }
+#endif
+  stride_x_ = stride_x;
+  stride_y_ = stride_y;
+  LOGDEBUG << "Stride is " << stride_x_ << "x" << stride_y_;
+}
+
+void ConvolutionLayer::SetDilation (const unsigned int dilation_x,
+                                    const unsigned int dilation_y) {
+  if (dilation_x == 0 || dilation_y == 0) {
+    FATAL ("Dilation cannot be zero");
+  }
+#ifdef BUILD_OPENCL_CONV
+  if (dilation_x != 1 || dilation_y != 1) {
+    FATAL ("Dilated convolutions are not supported with OpenCL");
+  }
+#endif
+  dilation_x_ = dilation_x;
+  dilation_y_ = dilation_y;
+  LOGDEBUG << "Dilation is " << dilation_x_ << "x" << dilation_y_;
+}
+
+void ConvolutionLayer::SetPadding (const unsigned int border_x,
+                                   const unsigned int border_y,
+                                   const ConvolutionPadding padding) {
+#ifdef BUILD_OPENCL_CONV
+  if (border_x != 0 || border_y != 0) {
+    FATAL ("Padding is not supported with OpenCL");
+  }
+#endif
+  border_x_ = border_x;
+  border_y_ = border_y;
+  padding_ = padding;
+  LOGDEBUG << "Border is " << border_x_ << "x" << border_y_ <<
+           (padding_ == CONV_PADDING_MIRROR ? " (mirror)" : " (zero)");
+}
+
+void ConvolutionLayer::SetActivation (const ConvolutionActivation activation) {
+#ifdef BUILD_OPENCL_CONV
+  if (activation != CONV_ACTIVATION_NONE) {
+    FATAL ("Fused activations are not supported with OpenCL");
+  }
+#endif
+  activation_ = activation;
+}
+
+void ConvolutionLayer::SetMaxPooling (const unsigned int region_width,
+                                      const unsigned int region_height) {
+  if (region_width == 0 || region_height == 0) {
+    FATAL ("Pooling regions cannot have zero dimensions");
+  }
+#ifdef BUILD_OPENCL_CONV
+  if (region_width != 1 || region_height != 1) {
+    FATAL ("Fused pooling is not supported with OpenCL");
+  }
+#endif
+  pool_width_ = region_width;
+  pool_height_ = region_height;
+  LOGDEBUG << "Fused " << pool_width_ << "x" << pool_height_ << " max-pooling";
+}
+
+void ConvolutionLayer::ActivationBackward (datum* output_delta,
+    const datum* output) const {
+  const std::size_t elements = output_->data.elements();
+
+  // The derivatives are expressed in terms of the activations, just like
+  // in the NonLinearityLayers
+  switch (activation_) {
+  case CONV_ACTIVATION_RELU:
+    VectorMath::ReLUBackward (output, output_delta, output_delta, elements);
+    break;
+  case CONV_ACTIVATION_SIGMOID:
+    VectorMath::SigmoidBackward (output, output_delta, output_delta, elements);
+    break;
+  case CONV_ACTIVATION_TANH:
+    VectorMath::TanhBackward (output, output_delta, output_delta, elements);
+    break;
+  default:
+    break;
+  }
+}
+
+static const char* AlgorithmName (const ConvolutionAlgorithm algorithm) {
+  switch (algorithm) {
+  case CONV_ALGORITHM_GEMM:
+    return "gemm";
+  case CONV_ALGORITHM_WINOGRAD:
+    return "winograd";
+  case CONV_ALGORITHM_DEPTHWISE:
+    return "depthwise";
+  default:
+    return "direct";
+  }
+}
+
+void ConvolutionLayer::SelectAlgorithm (const ConvolutionShape& shape) {
+  // Direct convolution and GEMMs would waste most of their work on a
+  // single map per group
+  if (IsDepthwise()) {
+    algorithm_ = CONV_ALGORITHM_DEPTHWISE;
+    LOGDEBUG << "Using depthwise convolution";
+    SetupAlgorithm (shape);
+    return;
+  }
+
+  std::vector<ConvolutionAlgorithm> candidates;
+  candidates.push_back (CONV_ALGORITHM_DIRECT);
+#ifdef BUILD_BLAS
+  candidates.push_back (CONV_ALGORITHM_GEMM);
+#endif
+
+  // The Winograd transformations assume neighboring taps and outputs and
+  // a single group. They can only pad with zeros, and the input gradient
+  // needs at least as much padding on the left as the forward pass.
+  const bool winograd = groups_ == 1 && stride_x_ == 1 && stride_y_ == 1 &&
+                        dilation_x_ == 1 && dilation_y_ == 1 &&
+                        (!shape.padded() || padding_ == CONV_PADDING_ZERO) &&
+                        shape.pad_x <= kernel_width_ - 1 &&
+                        shape.pad_y <= kernel_height_ - 1 &&
+                        WinogradConvolution::Supports (kernel_width_, kernel_height_);
+
+  if (winograd)
+    candidates.push_back (CONV_ALGORITHM_WINOGRAD);
+
+  if (algorithm_requested_) {
+    for (unsigned int c = 0; c < candidates.size(); c++) {
+      if (candidates[c] == requested_algorithm_) {
+        algorithm_ = requested_algorithm_;
+        LOGDEBUG << "Using " << AlgorithmName (algorithm_) << " convolution (requested)";
+        SetupAlgorithm (shape);
+        return;
       }
     }
+
+    LOGDEBUG << "Cannot use " << AlgorithmName (requested_algorithm_) <<
+             " convolution for this layer";
+  }
+
+  // Setting CN24_AUTOTUNE to 0 falls back to a simple rule of thumb
+  const char* autotune = std::getenv ("CN24_AUTOTUNE");
+
+  if (candidates.size() == 1 ||
+      (autotune != nullptr && std::strcmp (autotune, "0") == 0)) {
+    if (winograd && WinogradConvolution::Profitable (shape))
+      algorithm_ = CONV_ALGORITHM_WINOGRAD;
+    else
+      algorithm_ = candidates.size() > 1 && candidates[1] == CONV_ALGORITHM_GEMM ?
+                   CONV_ALGORITHM_GEMM : CONV_ALGORITHM_DIRECT;
+
+    SetupAlgorithm (shape);
+    return;
+  }
+
+  // The best algorithm depends on the machine as well as the shape
+  std::stringstream key;
+  key << CPUFeatures::Model() << " " <<
+      CPUFeatures::LevelName (CPUFeatures::Level()) << " threads=" <<
+      ThreadPool::Threads() <<
+      " conv " << shape.samples << "x" << shape.input_width << "x" <<
+      shape.input_height << "x" << shape.input_maps << " kernel " <<
+      shape.kernel_width << "x" << shape.kernel_height << "x" <<
+      shape.output_maps << " stride " << shape.stride_x << "x" <<
+      shape.stride_y << " dilation " << shape.dilation_x << "x" <<
+      shape.dilation_y << " pad " << shape.pad_x << "x" << shape.pad_y <<
+      (shape.mirror_padding ? " mirror" : "") << " groups " << groups_ <<
+      (inference_only_ ? " inference" : backprop_enabled_ ? " backprop" : "");
+
+  std::string cached;
+
+  if (TuningCache::Lookup (key.str(), cached)) {
+    for (unsigned int c = 0; c < candidates.size(); c++) {
+      if (cached.compare (AlgorithmName (candidates[c])) == 0) {
+        algorithm_ = candidates[c];
+        LOGDEBUG << "Using " << cached << " convolution (cached)";
+        SetupAlgorithm (shape);
+        return;
+      }
+    }
+  }
+
+  // Benchmark everything a training iteration does with this layer, or
+  // only the forward pass for inference
+  Tensor input (shape.samples, shape.input_width, shape.input_height, input_maps_);
+  Tensor output (shape.samples, shape.output_width, shape.output_height, output_maps_);
+  Tensor input_delta, output_delta, weights_delta, bias_delta;
+
+  if (!inference_only_) {
+    input_delta.Resize (input);
+    output_delta.Resize (output);
+    weights_delta.Resize (weights_->data);
+    bias_delta.Resize (bias_->data);
+  }
+
+  for (std::size_t i = 0; i < input.elements(); i++)
+    input[i] = 0.5;
+
+  for (std::size_t i = 0; i < output_delta.elements(); i++)
+    output_delta[i] = 0.5;
+
+  double best_time = 0;
+
+  for (unsigned int c = 0; c < candidates.size(); c++) {
+    algorithm_ = candidates[c];
+    SetupAlgorithm (shape);
+
+    // The first run is not timed, it includes one-time setup costs
+    double time = 0;
+
+    for (unsigned int run = 0; run < 3; run++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      ConvolveForward (shape, input.data_ptr_const(), output.data_ptr());
+
+      if (backprop_enabled_ && !inference_only_)
+        ConvolveBackwardData (shape, output_delta.data_ptr_const(),
+                              input_delta.data_ptr());
+
+      if (!inference_only_)
+        ConvolveWeightGradient (shape, input.data_ptr_const(),
+                                output_delta.data_ptr_const(),
+                                weights_delta.data_ptr(), bias_delta.data_ptr());
+
+      const double run_time = std::chrono::duration<double> (
+                                std::chrono::steady_clock::now() - start).count();
+
+      if (run == 1 || (run > 1 && run_time < time))
+        time = run_time;
+    }
+
+    LOGDEBUG << AlgorithmName (candidates[c]) << " convolution: " <<
+             time * 1000.0 << "ms";
+
+    if (c == 0 || time < best_time) {
+      best_time = time;
+      cached = AlgorithmName (candidates[c]);
+    }
   }
+
+  for (unsigned int c = 0; c < candidates.size(); c++) {
+    if (cached.compare (AlgorithmName (candidates[c])) == 0)
+      algorithm_ = candidates[c];
+  }
+
+  LOGDEBUG << "Using " << cached << " convolution";
+  TuningCache::Store (key.str(), cached);
+  SetupAlgorithm (shape);
+}
+
+void ConvolutionLayer::SetupAlgorithm (const ConvolutionShape& shape) {
+  ReleaseAlgorithm();
+  algorithm_selected_ = true;
+  algorithm_backprop_ = backprop_enabled_;
+
+  if (algorithm_ == CONV_ALGORITHM_WINOGRAD) {
+    winograd_ff_ = new WinogradConvolution (shape, shape.pad_x, shape.pad_y);
+
+    if (inference_only_)
+      return;
+
+    // The input gradient is the 'full' convolution of the output gradient
+    // with the flipped kernels, i.e. a 'valid' one with padding
+    ConvolutionShape full_shape = shape;
+    full_shape.input_width = shape.output_width;
+    full_shape.input_height = shape.output_height;
+    full_shape.input_maps = shape.output_maps;
+    full_shape.output_width = shape.input_width;
+    full_shape.output_height = shape.input_height;
+    full_shape.output_maps = shape.input_maps;
+    winograd_bp_ = new WinogradConvolution (full_shape,
+                                            shape.kernel_width - 1 - shape.pad_x,
+                                            shape.kernel_height - 1 - shape.pad_y);
+  }
+
+#ifdef BUILD_BLAS
+  if (algorithm_ == CONV_ALGORITHM_GEMM)
+    im2col_ = new Im2ColConvolution (shape, workspace_size_);
+#endif
+}
+
+void ConvolutionLayer::ReleaseAlgorithm() {
+  delete winograd_ff_;
+  delete winograd_bp_;
+  delete im2col_;
+  winograd_ff_ = nullptr;
+  winograd_bp_ = nullptr;
+  im2col_ = nullptr;
+  winograd_ff_valid_ = false;
+  winograd_bp_valid_ = false;
+  packed_weights_valid_ = false;
 }
 
-void ConvolutionLayer::col2imff() {
-  for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int omap = 0; omap < output_maps_; omap++) {
-      Tensor::CopyMap (ff_output_buffer, omap, sample, output_->data,
-                       sample, omap);
+void ConvolutionLayer::ConvolveForward (const ConvolutionShape& shape,
+                                        const datum* input, datum* output) {
+  // With a fused pooling, the activation is applied to the pooled output
+  const ConvolutionEpilogue epilogue = IsPooled() ? nullptr :
+                                       ActivationEpilogue (activation_);
+  const std::size_t input_group = (std::size_t) shape.input_maps *
+                                  shape.input_width * shape.input_height;
+  const std::size_t output_group = (std::size_t) shape.output_maps *
+                                   shape.output_width * shape.output_height;
+  const std::size_t weights_group = (std::size_t) shape.output_maps *
+                                    shape.input_maps * shape.kernel_width * shape.kernel_height;
+
+  // The direct and GEMM algorithms use packed copies of the weights
+  const std::size_t packed_group = UpdatePackedWeights (shape);
+
+  for (unsigned int group = 0; group < SequentialGroups(); group++) {
+    const datum* group_input = input + group * input_group;
+    const datum* group_weights = weights_->data.data_ptr_const() + group * weights_group;
+    const datum* group_packed = packed_weights_ff_.data_ptr_const() + group * packed_group;
+    const datum* group_bias = bias_->data.data_ptr_const() + group * shape.output_maps;
+    datum* group_output = output + group * output_group;
+
+    switch (algorithm_) {
+#ifdef BUILD_BLAS
+    case CONV_ALGORITHM_GEMM:
+      im2col_->ForwardPacked (group_input, group_packed, group_bias,
+                              group_output, epilogue);
+      break;
+#endif
+    case CONV_ALGORITHM_WINOGRAD:
+      UpdateWinogradKernels (false);
+      winograd_ff_->Forward (group_input, group_bias, group_output, epilogue);
+      break;
+    case CONV_ALGORITHM_DEPTHWISE:
+      DepthwiseConvolution::Forward (shape, group_input, group_weights,
+                                     group_bias, weight_factor_, group_output,
+                                     padded_input_, epilogue);
+      break;
+    default:
+      DirectConvolution::ForwardPrepacked (shape, group_input, group_packed,
+                                           group_bias, group_output,
+                                           padded_input_, epilogue);
     }
   }
 }
 
-void ConvolutionLayer::im2colbp() {
-  for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int omap = 0; omap < output_maps_; omap++) {
-      Tensor::CopyMap (output_->delta, sample, omap, bp_deltay_buffer,
-                       omap, sample);
+void ConvolutionLayer::ConvolveBackwardData (const ConvolutionShape& shape,
+    const datum* output_delta,
+    datum* input_delta) {
+  const std::size_t input_group = (std::size_t) shape.input_maps *
+                                  shape.input_width * shape.input_height;
+  const std::size_t output_group = (std::size_t) shape.output_maps *
+                                   shape.output_width * shape.output_height;
+  const std::size_t weights_group = (std::size_t) shape.output_maps *
+                                    shape.input_maps * shape.kernel_width * shape.kernel_height;
+
+  for (unsigned int group = 0; group < SequentialGroups(); group++) {
+    const datum* group_output_delta = output_delta + group * output_group;
+    const datum* group_weights = weights_->data.data_ptr_const() + group * weights_group;
+    datum* group_input_delta = input_delta + group * input_group;
+
+    switch (algorithm_) {
+#ifdef BUILD_BLAS
+    case CONV_ALGORITHM_GEMM:
+      im2col_->BackwardData (group_output_delta, group_weights,
+                             group_input_delta);
+      break;
+#endif
+    case CONV_ALGORITHM_WINOGRAD:
+      UpdateWinogradKernels (true);
+      winograd_bp_->Forward (group_output_delta, nullptr, group_input_delta);
+      break;
+    case CONV_ALGORITHM_DEPTHWISE:
+      DepthwiseConvolution::BackwardData (shape, group_output_delta,
+                                          group_weights, group_input_delta,
+                                          packed_weights_bp_, padded_delta_bp_,
+                                          padded_input_delta_);
+      break;
+    default:
+      DirectConvolution::BackwardData (shape, group_output_delta, group_weights,
+                                       group_input_delta, packed_weights_bp_,
+                                       padded_delta_bp_, padded_input_delta_);
     }
   }
 }
 
-void ConvolutionLayer::col2imbp() {
-  #pragma omp parallel for default(shared)
-  for (unsigned int sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int imap = 0; imap < input_maps_; imap++) {
-      for (unsigned int dxx = 0; dxx < output_width_; dxx++) {
-        for (unsigned int dxy = 0; dxy < output_height_; dxy++) {
-          for (unsigned int ky = 0; ky < kernel_height_; ky++) {
-            const datum* kernel_line = bp_deltax_buffer.data_ptr_const (
-                                         kernel_width_ * ky, imap, dxy * output_width_ + dxx, sample);
-            datum* target_line = input_->delta.data_ptr (
-                                   dxx, dxy + ky, imap, sample);
-
-            for (unsigned int kx = 0; kx < kernel_width_; kx++) {
-              target_line[kx] += kernel_line[kx];
-            }
-          }
-        }
-      }
+void ConvolutionLayer::ConvolveWeightGradient (const ConvolutionShape& shape,
+    const datum* input,
+    const datum* output_delta,
+    datum* weights_delta,
+    datum* bias_delta) {
+  const std::size_t input_group = (std::size_t) shape.input_maps *
+                                  shape.input_width * shape.input_height;
+  const std::size_t output_group = (std::size_t) shape.output_maps *
+                                   shape.output_width * shape.output_height;
+  const std::size_t weights_group = (std::size_t) shape.output_maps *
+                                    shape.input_maps * shape.kernel_width * shape.kernel_height;
+
+  for (unsigned int group = 0; group < SequentialGroups(); group++) {
+    const datum* group_input = input + group * input_group;
+    const datum* group_output_delta = output_delta + group * output_group;
+    datum* group_weights_delta = weights_delta + group * weights_group;
+    datum* group_bias_delta = bias_delta + group * shape.output_maps;
+
+#ifdef BUILD_BLAS
+    if (algorithm_ == CONV_ALGORITHM_GEMM) {
+      im2col_->WeightGradient (group_input, group_output_delta,
+                               group_weights_delta);
+      DirectConvolution::BiasGradient (shape, group_output_delta,
+                                       group_bias_delta);
+      continue;
+    }
+#endif
+
+    if (algorithm_ == CONV_ALGORITHM_DEPTHWISE) {
+      DepthwiseConvolution::WeightGradient (shape, group_input,
+                                            group_output_delta,
+                                            group_weights_delta,
+                                            fuse_bias_gradient_ ? group_bias_delta : nullptr,
+                                            padded_input_);
+    } else {
+      // The other algorithms don't keep anything useful for this around
+      DirectConvolution::WeightGradient (shape, group_input, group_output_delta,
+                                         group_weights_delta,
+                                         fuse_bias_gradient_ ? group_bias_delta : nullptr,
+                                         padded_input_, partial_gradients_);
     }
+
+    if (!fuse_bias_gradient_)
+      DirectConvolution::BiasGradient (shape, group_output_delta,
+                                       group_bias_delta);
+  }
+}
+
+std::size_t ConvolutionLayer::UpdatePackedWeights (const ConvolutionShape& shape) {
+  std::size_t packed_group = 0;
+
+#ifdef BUILD_BLAS
+  if (algorithm_ == CONV_ALGORITHM_GEMM)
+    packed_group = im2col_->PackedSize();
+#endif
+
+  if (algorithm_ == CONV_ALGORITHM_DIRECT)
+    packed_group = DirectConvolution::PackedSize (shape);
+
+  // Only pack the weights again if they have changed since, here or in a
+  // layer that shares them. During inference, this happens once.
+  const unsigned int version = parameters_version();
+
+  if (packed_group == 0 ||
+      (packed_weights_valid_ && packed_weights_version_ == version))
+    return packed_group;
+
+  const std::size_t weights_group = (std::size_t) shape.output_maps *
+                                    shape.input_maps * shape.kernel_width * shape.kernel_height;
+  packed_weights_ff_.Resize (packed_group * SequentialGroups());
+
+  for (unsigned int group = 0; group < SequentialGroups(); group++) {
+    const datum* group_weights = weights_->data.data_ptr_const() + group * weights_group;
+    datum* group_packed = packed_weights_ff_.data_ptr() + group * packed_group;
+
+#ifdef BUILD_BLAS
+    if (algorithm_ == CONV_ALGORITHM_GEMM) {
+      im2col_->PackWeights (group_weights, weight_factor_, group_packed);
+      continue;
+    }
+#endif
+
+    DirectConvolution::PackWeights (shape, group_weights, weight_factor_,
+                                    group_packed);
+  }
+
+  packed_weights_valid_ = true;
+  packed_weights_version_ = version;
+  return packed_group;
+}
+
+void ConvolutionLayer::UpdateWinogradKernels (const bool backward) {
+  bool& valid = backward ? winograd_bp_valid_ : winograd_ff_valid_;
+  unsigned int& version = backward ? winograd_bp_version_ : winograd_ff_version_;
+
+  // Only transform the kernels again if they have changed since, here or
+  // in a layer that shares them
+  const unsigned int current_version = parameters_version();
+
+  if (valid && version == current_version)
+    return;
+
+  if (backward)
+    winograd_bp_->TransformKernels (weights_->data.data_ptr_const(), 1.0, true);
+  else
+    winograd_ff_->TransformKernels (weights_->data.data_ptr_const(), weight_factor_);
+
+  valid = true;
+  version = current_version;
+}
+
+void ConvolutionLayer::GetShape (ConvolutionShape& shape,
+                                 const unsigned int samples) const {
+  shape.samples = samples;
+  shape.input_width = input_width_;
+  shape.input_height = input_height_;
+  shape.input_maps = input_maps_ / SequentialGroups();
+  shape.output_width = output_width_;
+  shape.output_height = output_height_;
+  shape.output_maps = output_maps_ / SequentialGroups();
+  shape.kernel_width = kernel_width_;
+  shape.kernel_height = kernel_height_;
+  shape.stride_x = stride_x_;
+  shape.stride_y = stride_y_;
+  shape.dilation_x = dilation_x_;
+  shape.dilation_y = dilation_y_;
+  shape.pad_x = border_x_ / 2;
+  shape.pad_y = border_y_ / 2;
+  shape.mirror_padding = padding_ == CONV_PADDING_MIRROR;
+
+  // Groups are convolved one at a time, in place in the whole tensors
+  if (SequentialGroups() > 1) {
+    shape.input_sample_stride = (std::size_t) input_maps_ * input_width_ *
+                                input_height_;
+    shape.output_sample_stride = (std::size_t) output_maps_ * output_width_ *
+                                 output_height_;
   }
 }
 
@@ -15,8 +15,11 @@
 #include <array>
 #include <random>
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 
+#include "ThreadPool.h"
+
 #include "DatasetInputLayer.h"
 
 namespace Conv {
@@ -53,6 +56,25 @@ DatasetInputLayer::DatasetInputLayer (Dataset& dataset,
   }
 
   RedoPermutation();
+
+#ifdef BUILD_PREFETCH
+  produced_ = 0;
+  consumed_ = 0;
+  stop_prefetching_ = false;
+#endif
+}
+
+DatasetInputLayer::~DatasetInputLayer() {
+#ifdef BUILD_PREFETCH
+  StopPrefetching();
+#endif
+}
+
+void DatasetInputLayer::SetPrefetchBatches (const unsigned int batches) {
+#ifdef BUILD_PREFETCH
+  StopPrefetching();
+#endif
+  prefetch_batches_ = batches;
 }
 
 bool DatasetInputLayer::CreateOutputs (const std::vector< CombinedTensor* >& inputs,
@@ -133,13 +155,86 @@ bool DatasetInputLayer::Connect (const std::vector< CombinedTensor* >& inputs,
   return valid;
 }
 
+#ifdef BUILD_PREFETCH
+/*
+ * Hands a prefetched batch to an output, by swapping the memory if the
+ * output has its own.
+ */
+static void TakeBatch (Tensor& batch, Tensor& output) {
+#ifdef BUILD_OPENCL
+  output.MoveToCPU (true);
+#endif
+
+  if (output.is_shadow())
+    std::memcpy (output.data_ptr(), batch.data_ptr_const(),
+                 output.elements() * sizeof (datum));
+  else
+    output.Swap (batch);
+}
+#endif
+
 void DatasetInputLayer::FeedForward() {
+  auto t_begin = std::chrono::steady_clock::now();
+
+#ifdef BUILD_PREFETCH
+  if (prefetch_batches_ > 0) {
+    if (!prefetch_thread_.joinable())
+      StartPrefetching();
+
+    // Wait for the background thread if it isn't done with the next batch
+    const unsigned int consumed = consumed_.load (std::memory_order_relaxed);
+
+    if (produced_.load (std::memory_order_acquire) == consumed) {
+      std::unique_lock<std::mutex> lock (prefetch_mutex_);
+      prefetch_condition_.wait (lock, [this, consumed] {
+        return produced_.load (std::memory_order_acquire) != consumed;
+      });
+    }
+
+    std::chrono::duration<double> t_wait =
+      std::chrono::steady_clock::now() - t_begin;
+    loader_wait_ += t_wait.count();
+
+    PrefetchSlot& slot = slots_[consumed % slots_.size()];
+
+    // The batch is discarded, so the next try assembles it again
+    if (slot.error) {
+      std::exception_ptr error = slot.error;
+      StopPrefetching();
+      std::rethrow_exception (error);
+    }
+
+    TakeBatch (slot.data, data_output_->data);
+    TakeBatch (slot.label, label_output_->data);
+    TakeBatch (slot.weight, localized_error_output_->data);
+
+    // Give the slot back
+    consumed_.store (consumed + 1, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock (prefetch_mutex_);
+    }
+    prefetch_condition_.notify_all();
+    return;
+  }
+#endif
+
 #ifdef BUILD_OPENCL
   data_output_->data.MoveToCPU (true);
   label_output_->data.MoveToCPU (true);
   localized_error_output_->data.MoveToCPU (true);
 #endif
 
+  AssembleBatch (data_output_->data, label_output_->data,
+                 localized_error_output_->data);
+
+  // Without prefetching, the net waits for the whole batch
+  std::chrono::duration<double> t_wait =
+    std::chrono::steady_clock::now() - t_begin;
+  loader_wait_ += t_wait.count();
+}
+
+void DatasetInputLayer::AssembleBatch (Tensor& data, Tensor& label,
+                                       Tensor& weight) {
   for (std::size_t sample = 0; sample < batch_size_; sample++) {
     unsigned int selected_element = 0;
     bool force_no_weight = false;
@@ -173,9 +268,9 @@ void DatasetInputLayer::FeedForward() {
     bool success;
 
     if (testing_)
-      success = dataset_.GetTestingSample (data_output_->data, label_output_->data, localized_error_output_->data, sample, selected_element);
+      success = dataset_.GetTestingSample (data, label, weight, sample, selected_element);
     else
-      success = dataset_.GetTrainingSample (data_output_->data, label_output_->data, localized_error_output_->data, sample, selected_element);
+      success = dataset_.GetTrainingSample (data, label, weight, sample, selected_element);
 
     if (!success) {
       FATAL ("Cannot load samples from Dataset!");
@@ -183,17 +278,14 @@ void DatasetInputLayer::FeedForward() {
 
     if (!testing_ && !force_no_weight && dataset_.GetMethod() == FCN) {
       // Perform loss sampling
-#ifdef BUILD_OPENCL
-      localized_error_output_->data.MoveToGPU();
-#endif
       const unsigned int block_size = 12;
 
-      for (unsigned int y = 0; y < localized_error_output_->data.height(); y += block_size) {
-        for (unsigned int x = 0; x < localized_error_output_->data.width(); x += block_size) {
+      for (unsigned int y = 0; y < weight.height(); y += block_size) {
+        for (unsigned int x = 0; x < weight.width(); x += block_size) {
           if (dist_ (generator_) > loss_sampling_p_) {
-            for (unsigned int iy = y; iy < y + block_size && iy < localized_error_output_->data.height(); iy++) {
-              for (unsigned int ix = x; ix < x + block_size && ix < localized_error_output_->data.width(); ix++) {
-                *localized_error_output_->data.data_ptr (ix, iy, 0, sample) = 0;
+            for (unsigned int iy = y; iy < y + block_size && iy < weight.height(); iy++) {
+              for (unsigned int ix = x; ix < x + block_size && ix < weight.width(); ix++) {
+                *weight.data_ptr (ix, iy, 0, sample) = 0;
               }
             }
           }
@@ -203,7 +295,7 @@ void DatasetInputLayer::FeedForward() {
 
     // Copy localized error
     if (force_no_weight)
-      localized_error_output_->data.Clear (0.0, sample);
+      weight.Clear (0.0, sample);
   }
 }
 
@@ -228,8 +320,19 @@ void DatasetInputLayer::RedoPermutation() {
   std::shuffle (perm_.begin(), perm_.end(), generator_);
 }
 
+double DatasetInputLayer::TakeLoaderWaitTime() {
+  const double loader_wait = loader_wait_;
+  loader_wait_ = 0;
+  return loader_wait;
+}
+
 void DatasetInputLayer::SetTestingMode (bool testing) {
   if (testing != testing_) {
+#ifdef BUILD_PREFETCH
+    // The prefetched batches are from the wrong subset
+    StopPrefetching();
+#endif
+
     if (testing) {
       LOGDEBUG << "Enabled testing mode.";
 
@@ -243,6 +346,112 @@ void DatasetInputLayer::SetTestingMode (bool testing) {
   testing_ = testing;
 }
 
+#ifdef BUILD_PREFETCH
+void DatasetInputLayer::StartPrefetching() {
+  slots_.resize (prefetch_batches_);
+
+  for (unsigned int b = 0; b < slots_.size(); b++) {
+    slots_[b].data.Resize (data_output_->data);
+    slots_[b].label.Resize (label_output_->data);
+    slots_[b].weight.Resize (localized_error_output_->data);
+  }
+
+  produced_ = 0;
+  consumed_ = 0;
+  stop_prefetching_ = false;
+  prefetch_thread_ = std::thread (&DatasetInputLayer::Prefetch, this);
+  LOGDEBUG << "Prefetching " << slots_.size() << " batches.";
+}
+
+void DatasetInputLayer::StopPrefetching() {
+  if (!prefetch_thread_.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock (prefetch_mutex_);
+    stop_prefetching_ = true;
+  }
+  prefetch_condition_.notify_all();
+  prefetch_thread_.join();
+
+  // Go back to the state before the first unused batch
+  const unsigned int consumed = consumed_;
+  const unsigned int produced = produced_;
+
+  if (consumed != produced) {
+    const PrefetchSlot& first = slots_[consumed % slots_.size()];
+    generator_ = first.generator;
+    current_element_ = first.current_element;
+    current_element_testing_ = first.current_element_testing;
+
+    // Only the batches that redo the permutation have saved it, so the
+    // first of them has the old one
+    for (unsigned int b = consumed; b != produced; b++) {
+      const PrefetchSlot& slot = slots_[b % slots_.size()];
+
+      if (slot.has_permutation) {
+        perm_ = slot.permutation;
+        break;
+      }
+    }
+  }
+
+  produced_ = 0;
+  consumed_ = 0;
+}
+
+void DatasetInputLayer::Prefetch() {
+  // Leave the workers to the net
+  ThreadPool::SetThreadSerial (true);
+
+  while (true) {
+    const unsigned int produced = produced_.load (std::memory_order_relaxed);
+
+    // Wait for a free slot
+    if (produced - consumed_.load (std::memory_order_acquire) >= slots_.size()) {
+      std::unique_lock<std::mutex> lock (prefetch_mutex_);
+      prefetch_condition_.wait (lock, [this, produced] {
+        return stop_prefetching_ ||
+               produced - consumed_.load (std::memory_order_acquire) < slots_.size();
+      });
+    }
+
+    if (stop_prefetching_)
+      return;
+
+    PrefetchSlot& slot = slots_[produced % slots_.size()];
+    slot.generator = generator_;
+    slot.current_element = current_element_;
+    slot.current_element_testing = current_element_testing_;
+    slot.has_permutation = !testing_ &&
+                           current_element_ + batch_size_ >= perm_.size();
+
+    if (slot.has_permutation)
+      slot.permutation = perm_;
+
+    slot.error = nullptr;
+
+    try {
+      AssembleBatch (slot.data, slot.label, slot.weight);
+    } catch (...) {
+      // FeedForward throws this again when it gets to the batch
+      slot.error = std::current_exception();
+    }
+
+    const bool failed = (bool) slot.error;
+
+    produced_.store (produced + 1, std::memory_order_release);
+    {
+      std::lock_guard<std::mutex> lock (prefetch_mutex_);
+    }
+    prefetch_condition_.notify_all();
+
+    if (failed)
+      return;
+  }
+}
+#endif
+
 bool DatasetInputLayer::IsOpenCLAware() {
 #ifdef BUILD_OPENCL
   return true;
@@ -0,0 +1,445 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "Config.h"
+#include "Log.h"
+#include "ConvolutionShape.h"
+#include "DirectConvolution.h"
+#include "ThreadPool.h"
+#include "VectorMath.h"
+
+#include "DeconvolutionLayer.h"
+
+namespace Conv {
+
+DeconvolutionLayer::DeconvolutionLayer (const unsigned int kwidth,
+                                        const unsigned int kheight,
+                                        const unsigned int output_maps,
+                                        const int seed) :
+  output_maps_ (output_maps), kernel_width_ (kwidth), kernel_height_ (kheight),
+  rand_ (seed) {
+  if (kernel_width_ == 0 || kernel_height_ == 0) {
+    FATAL ("Kernels cannot have zero dimensions");
+  }
+
+  if (output_maps_ == 0) {
+    FATAL ("Number of output maps cannot be zero");
+  }
+
+  if (seed == 0) {
+    LOGWARN << "Random seed is zero";
+  }
+
+  LOGDEBUG << "Instance created. " << output_maps_ << " output maps with " <<
+           kernel_width_ << "x" << kernel_height_ << " kernels.";
+}
+
+void DeconvolutionLayer::SetStride (const unsigned int stride_x,
+                                    const unsigned int stride_y) {
+  if (stride_x == 0 || stride_y == 0) {
+    FATAL ("Stride cannot be zero");
+  }
+
+  stride_x_ = stride_x;
+  stride_y_ = stride_y;
+}
+
+void DeconvolutionLayer::SetPadding (const unsigned int border_x,
+                                     const unsigned int border_y) {
+  border_x_ = border_x;
+  border_y_ = border_y;
+}
+
+/*
+ * Returns the size of the output without the border
+ */
+static unsigned int DeconvolutionOutputSize (const unsigned int input_size,
+    const unsigned int kernel_size, const unsigned int stride,
+    const unsigned int border) {
+  const unsigned int full = (input_size - 1) * stride + kernel_size;
+  return full > border ? full - border : 0;
+}
+
+bool DeconvolutionLayer::CreateOutputs (
+  const std::vector< CombinedTensor* >& inputs,
+  std::vector< CombinedTensor* >& outputs) {
+  // This is a simple layer, only one input
+  if (inputs.size() != 1) {
+    LOGERROR << "Only one input supported!";
+    return false;
+  }
+
+  // Save input node pointer
+  CombinedTensor* input = inputs[0];
+
+  // Check if input node pointer is null
+  if (input == nullptr) {
+    LOGERROR << "Null pointer input node!";
+    return false;
+  }
+
+  const unsigned int width = DeconvolutionOutputSize (input->data.width(),
+                             kernel_width_, stride_x_, border_x_);
+  const unsigned int height = DeconvolutionOutputSize (input->data.height(),
+                              kernel_height_, stride_y_, border_y_);
+
+  if (input->data.width() == 0 || input->data.height() == 0 ||
+      width == 0 || height == 0) {
+    LOGERROR << "Unsupported input dimensions " << input->data;
+    return false;
+  }
+
+  // Create output
+  CombinedTensor* output = new CombinedTensor (input->data.samples(),
+      width, height, output_maps_);
+
+  // Tell network about the output
+  outputs.push_back (output);
+
+  return true;
+}
+
+/*
+ * Computes the phase with remainder r of one dimension. Returns false if
+ * the phase would have to skip input pixels on the left, which happens
+ * when the kernel is smaller than the stride or the border is too large.
+ */
+static bool GetPhase (const unsigned int r, const unsigned int kernel_size,
+                      const unsigned int stride, const unsigned int pad,
+                      const unsigned int output_size, unsigned int& first_tap,
+                      unsigned int& taps, unsigned int& conv_pad,
+                      unsigned int& phase_output_size) {
+  // Output pixel q * stride + r gets the input pixels q + a - m weighted
+  // with the kernel taps first_tap + m * stride
+  first_tap = (r + pad) % stride;
+  const unsigned int a = (r + pad) / stride;
+
+  if (first_tap >= kernel_size)
+    return false;
+
+  taps = (kernel_size - first_tap + stride - 1) / stride;
+
+  if (a > taps - 1)
+    return false;
+
+  conv_pad = taps - 1 - a;
+  phase_output_size = r < output_size ? (output_size - r + stride - 1) / stride : 0;
+  return true;
+}
+
+bool DeconvolutionLayer::Connect (const CombinedTensor* input,
+                                  CombinedTensor* output) {
+  const unsigned int width = DeconvolutionOutputSize (input->data.width(),
+                             kernel_width_, stride_x_, border_x_);
+  const unsigned int height = DeconvolutionOutputSize (input->data.height(),
+                              kernel_height_, stride_y_, border_y_);
+
+  bool valid = input->data.samples() == output->data.samples() &&
+               output->data.maps() == output_maps_ &&
+               output->data.width() == width && output->data.height() == height &&
+               width > 0 && height > 0;
+
+  if (!valid) {
+    LOGERROR << "Invalid dimensions!";
+    return false;
+  }
+
+  // Save dimensions
+  input_maps_ = input->data.maps();
+  input_width_ = input->data.width();
+  input_height_ = input->data.height();
+  output_width_ = width;
+  output_height_ = height;
+
+  // Split the output into phases
+  phases_.clear();
+  std::size_t max_taps = 0, max_output = 0;
+
+  for (unsigned int ry = 0; ry < stride_y_; ry++) {
+    for (unsigned int rx = 0; rx < stride_x_; rx++) {
+      Phase phase;
+      phase.x = rx;
+      phase.y = ry;
+
+      if (!GetPhase (rx, kernel_width_, stride_x_, border_x_ / 2, output_width_,
+                     phase.first_tap_x, phase.taps_x, phase.pad_x,
+                     phase.output_width) ||
+          !GetPhase (ry, kernel_height_, stride_y_, border_y_ / 2, output_height_,
+                     phase.first_tap_y, phase.taps_y, phase.pad_y,
+                     phase.output_height)) {
+        LOGERROR << "Unsupported border of " << border_x_ << "x" << border_y_ <<
+                 " for " << kernel_width_ << "x" << kernel_height_ <<
+                 " kernels with stride " << stride_x_ << "x" << stride_y_;
+        return false;
+      }
+
+      // Phases without output pixels only occur in tiny outputs
+      if (phase.output_width == 0 || phase.output_height == 0)
+        continue;
+
+      phases_.push_back (phase);
+      max_taps = std::max (max_taps, (std::size_t) phase.taps_x * phase.taps_y);
+      max_output = std::max (max_output, (std::size_t) phase.output_width *
+                             phase.output_height);
+    }
+  }
+
+  phase_weights_.Resize (max_taps * input_maps_ * output_maps_);
+  phase_output_.Resize (max_output * output_maps_ * input->data.samples());
+
+  if (!inference_only_) {
+    phase_gradient_.Resize (max_taps * input_maps_ * output_maps_);
+
+    if (phases_.size() > 1)
+      phase_input_delta_.Resize (input->data);
+  }
+
+  // Create kernels
+  weights_ = new CombinedTensor (output_maps_, kernel_width_, kernel_height_,
+                                 input_maps_);
+  bias_ = new CombinedTensor (1, output_maps_);
+
+  // Initialize weights to zero so the net won't work if Net::InitializeWeights
+  // is not called. Random memory junk may work but is certainly not optimal.
+  bias_->data.Clear();
+  weights_->data.Clear();
+
+  // Tell the net about our parameters
+  parameters_.push_back (weights_);
+  parameters_.push_back (bias_);
+
+  LOGDEBUG << "Split into " << phases_.size() << " phases";
+
+  return true;
+}
+
+void DeconvolutionLayer::GetPhaseShape (const Phase& phase,
+                                        ConvolutionShape& shape) const {
+  shape.samples = input_->data.samples();
+  shape.input_width = input_width_;
+  shape.input_height = input_height_;
+  shape.input_maps = input_maps_;
+  shape.output_width = phase.output_width;
+  shape.output_height = phase.output_height;
+  shape.output_maps = output_maps_;
+  shape.kernel_width = phase.taps_x;
+  shape.kernel_height = phase.taps_y;
+  shape.pad_x = phase.pad_x;
+  shape.pad_y = phase.pad_y;
+}
+
+void DeconvolutionLayer::GatherPhaseWeights (const Phase& phase) {
+  const datum* weights = weights_->data.data_ptr_const();
+  datum* phase_weights = phase_weights_.data_ptr();
+
+  // The phase's convolution reads the input from left to right, so the
+  // taps are flipped
+  for (unsigned int kernel = 0; kernel < output_maps_ * input_maps_; kernel++) {
+    const datum* source = weights + (std::size_t) kernel * kernel_width_ *
+                          kernel_height_;
+
+    for (unsigned int jy = 0; jy < phase.taps_y; jy++) {
+      const unsigned int ky = phase.first_tap_y + (phase.taps_y - 1 - jy) * stride_y_;
+
+      for (unsigned int jx = 0; jx < phase.taps_x; jx++) {
+        const unsigned int kx = phase.first_tap_x + (phase.taps_x - 1 - jx) * stride_x_;
+        *phase_weights++ = source[ky * kernel_width_ + kx];
+      }
+    }
+  }
+}
+
+void DeconvolutionLayer::InterleavePhase (const Phase& phase,
+    const datum* source, datum* target) {
+  const int rows = (int) (input_->data.samples() * output_maps_ *
+                          phase.output_height);
+
+  ThreadPool::ParallelFor (rows, [&] (const int row) {
+    const unsigned int qy = row % phase.output_height;
+    const std::size_t map = row / phase.output_height;
+    const datum* source_row = source + (std::size_t) row * phase.output_width;
+    datum* target_row = target + (map * output_height_ + qy * stride_y_ + phase.y) *
+                        output_width_ + phase.x;
+
+    for (unsigned int qx = 0; qx < phase.output_width; qx++)
+      target_row[qx * stride_x_] = source_row[qx];
+  });
+}
+
+void DeconvolutionLayer::DeinterleavePhase (const Phase& phase,
+    const datum* source, datum* target) {
+  const int rows = (int) (input_->data.samples() * output_maps_ *
+                          phase.output_height);
+
+  ThreadPool::ParallelFor (rows, [&] (const int row) {
+    const unsigned int qy = row % phase.output_height;
+    const std::size_t map = row / phase.output_height;
+    const datum* source_row = source + (map * output_height_ + qy * stride_y_ +
+                                        phase.y) * output_width_ + phase.x;
+    datum* target_row = target + (std::size_t) row * phase.output_width;
+
+    for (unsigned int qx = 0; qx < phase.output_width; qx++)
+      target_row[qx] = source_row[qx * stride_x_];
+  });
+}
+
+void DeconvolutionLayer::FeedForward() {
+#ifdef BUILD_OPENCL
+  weights_->data.MoveToCPU();
+  bias_->data.MoveToCPU();
+#endif
+
+  for (const Phase& phase : phases_) {
+    ConvolutionShape shape;
+    GetPhaseShape (phase, shape);
+    GatherPhaseWeights (phase);
+
+    if (stride_x_ == 1 && stride_y_ == 1) {
+      // The only phase is the whole output
+      DirectConvolution::Forward (shape, input_->data.data_ptr_const(),
+                                  phase_weights_.data_ptr_const(),
+                                  bias_->data.data_ptr_const(), 1,
+                                  output_->data.data_ptr(), packed_weights_,
+                                  padded_input_);
+      continue;
+    }
+
+    DirectConvolution::Forward (shape, input_->data.data_ptr_const(),
+                                phase_weights_.data_ptr_const(),
+                                bias_->data.data_ptr_const(), 1,
+                                phase_output_.data_ptr(), packed_weights_,
+                                padded_input_);
+    InterleavePhase (phase, phase_output_.data_ptr_const(),
+                     output_->data.data_ptr());
+  }
+}
+
+void DeconvolutionLayer::BackPropagate() {
+#ifdef BUILD_OPENCL
+  weights_->data.MoveToCPU();
+  weights_->delta.MoveToCPU();
+  bias_->delta.MoveToCPU();
+#endif
+
+  // Taps of phases without output pixels only move cropped pixels
+  if (phases_.size() < stride_x_ * stride_y_)
+    weights_->delta.Clear();
+
+  bool first_phase = true;
+
+  for (const Phase& phase : phases_) {
+    ConvolutionShape shape;
+    GetPhaseShape (phase, shape);
+
+    const datum* phase_delta = output_->delta.data_ptr_const();
+
+    if (stride_x_ != 1 || stride_y_ != 1) {
+      DeinterleavePhase (phase, output_->delta.data_ptr_const(),
+                         phase_output_.data_ptr());
+      phase_delta = phase_output_.data_ptr_const();
+    }
+
+    // The phases' input gradients are added up
+    if (backprop_enabled_) {
+      GatherPhaseWeights (phase);
+      datum* input_delta = first_phase ? input_->delta.data_ptr() :
+                           phase_input_delta_.data_ptr();
+      DirectConvolution::BackwardData (shape, phase_delta,
+                                       phase_weights_.data_ptr_const(),
+                                       input_delta, packed_weights_,
+                                       padded_delta_, padded_input_delta_);
+
+      if (!first_phase)
+        VectorMath::Add (phase_input_delta_.data_ptr_const(),
+                         input_->delta.data_ptr(), input_->delta.elements());
+    }
+
+    // Every kernel tap belongs to exactly one phase
+    DirectConvolution::WeightGradient (shape, input_->data.data_ptr_const(),
+                                       phase_delta, phase_gradient_.data_ptr(),
+                                       nullptr, padded_input_,
+                                       partial_gradients_);
+
+    datum* weights_delta = weights_->delta.data_ptr();
+    const datum* phase_gradient = phase_gradient_.data_ptr_const();
+
+    for (unsigned int kernel = 0; kernel < output_maps_ * input_maps_; kernel++) {
+      datum* target = weights_delta + (std::size_t) kernel * kernel_width_ *
+                      kernel_height_;
+
+      for (unsigned int jy = 0; jy < phase.taps_y; jy++) {
+        const unsigned int ky = phase.first_tap_y + (phase.taps_y - 1 - jy) * stride_y_;
+
+        for (unsigned int jx = 0; jx < phase.taps_x; jx++) {
+          const unsigned int kx = phase.first_tap_x + (phase.taps_x - 1 - jx) * stride_x_;
+          target[ky * kernel_width_ + kx] = *phase_gradient++;
+        }
+      }
+    }
+
+    first_phase = false;
+  }
+
+  ConvolutionShape shape;
+  GetPhaseShape (phases_[0], shape);
+  shape.output_width = output_width_;
+  shape.output_height = output_height_;
+  shape.output_maps = output_maps_;
+  DirectConvolution::BiasGradient (shape, output_->delta.data_ptr_const(),
+                                   bias_->delta.data_ptr());
+}
+
+void DeconvolutionLayer::OnLayerConnect (Layer* next_layer) {
+#ifdef BUILD_OPENCL
+  weights_->data.MoveToCPU();
+#endif
+
+  if (input_maps_ == output_maps_) {
+    // Bilinear interpolation of every map on its own. The kernel's center
+    // is where the input pixel lands in the output.
+    weights_->data.Clear();
+
+    const datum factor_x = (kernel_width_ + 1) / 2;
+    const datum factor_y = (kernel_height_ + 1) / 2;
+    const datum center_x = kernel_width_ % 2 == 1 ? factor_x - 1 : factor_x - 0.5;
+    const datum center_y = kernel_height_ % 2 == 1 ? factor_y - 1 : factor_y - 0.5;
+
+    for (unsigned int map = 0; map < output_maps_; map++) {
+      datum* kernel = weights_->data.data_ptr() + ( (std::size_t) map *
+                      input_maps_ + map) * kernel_width_ * kernel_height_;
+
+      for (unsigned int ky = 0; ky < kernel_height_; ky++) {
+        for (unsigned int kx = 0; kx < kernel_width_; kx++) {
+          kernel[ky * kernel_width_ + kx] =
+            (1 - std::fabs (kx - center_x) / factor_x) *
+            (1 - std::fabs (ky - center_y) / factor_y);
+        }
+      }
+    }
+
+    LOGDEBUG << "Initialized bilinear kernels";
+  } else {
+    unsigned int next_layer_gain = next_layer->Gain();
+    unsigned int this_layer_gain = Gain();
+
+    const datum range = sqrt (6) / sqrt (next_layer_gain + this_layer_gain);
+
+    std::uniform_real_distribution<datum> dist_weights (-range , range);
+    for (std::size_t i = 0; i < weights_->data.elements(); i++) {
+      weights_->data[i] = dist_weights (rand_);
+    }
+
+    LOGDEBUG << "Updating weights: " << this_layer_gain << " -> "
+             << next_layer_gain;
+  }
+
+  InvalidateParameters();
+}
+
+}
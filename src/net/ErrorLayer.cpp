@@ -8,6 +8,7 @@
 
 #include "Log.h"
 #include "CombinedTensor.h"
+#include "VectorMath.h"
 
 #include "ErrorLayer.h"
 
@@ -88,44 +89,26 @@ void ErrorLayer::FeedForward() {
   // CalculateLossFunction() is called before BackPropagate().
   // We don't precalculate the loss because it is not calculated for every
   // batch.
-  //pragma omp parallel for default(shared)
-  for ( unsigned int sample = 0; sample < first_->data.samples(); sample++ ) {
-    for ( unsigned int map = 0; map < first_->data.maps(); map++ ) {
-      for ( unsigned int y = 0; y < first_->data.height(); y++ ) {
-        for ( unsigned int x = 0; x < first_->data.width(); x++ ) {
-          const datum first =
-            *first_->data.data_ptr_const ( x, y, map, sample );
-          const datum second =
-            *second_->data.data_ptr_const ( x, y, map, sample );
+  // Without layers to train below, no one needs the deltas.
+  if (first_->delta.elements() == 0)
+    return;
 
-          const datum diff = first - second;
+  const std::size_t plane = first_->data.width() * first_->data.height();
 
+  for ( unsigned int sample = 0; sample < first_->data.samples(); sample++ ) {
+    for ( unsigned int map = 0; map < first_->data.maps(); map++ ) {
 #ifdef ERROR_LAYER_IGNORE_WEIGHTS
-          const datum weight = 1.0;
+      const datum* weight = nullptr;
 #else
-		  const datum weight =
-            *third_->data.data_ptr_const ( x,y,0,sample );
+      // Every map of a sample has the same weights
+      const datum* weight = third_->data.data_ptr_const ( 0, 0, 0, sample );
 #endif
-	  *first_->delta.data_ptr(x,y,map,sample) = diff * weight;
-        }
-      }
+      VectorMath::WeightedDifference (
+        first_->data.data_ptr_const ( 0, 0, map, sample ),
+        second_->data.data_ptr_const ( 0, 0, map, sample ), weight,
+        first_->delta.data_ptr ( 0, 0, map, sample ), plane );
     }
   }
-
-
-/*  for ( std::size_t i = 0; i < first_->data.elements(); i++ ) {
-    const datum first = first_->data.data_ptr_const() [i];
-    const datum second = second_->data.data_ptr_const() [i];
-    const datum diff = first_->data.data_ptr_const() [i] -
-                       second_->data.data_ptr_const() [i];
-#ifdef ERROR_LAYER_IGNORE_WEIGHTS
-    const datum weight = 1.0;
-#else
-    const datum weight = third_->data.data_ptr_const() [i];
-#endif
-    first_->delta.data_ptr() [i] = diff * weight;
-  }
-*/
 }
 
 void ErrorLayer::BackPropagate() {
@@ -134,30 +117,22 @@ void ErrorLayer::BackPropagate() {
 }
 
 datum ErrorLayer::CalculateLossFunction() {
+  const std::size_t plane = first_->data.width() * first_->data.height();
   long double error = 0;
 
   // Add up the squared error
   for (unsigned int sample = 0; sample < first_->data.samples(); sample++) {
-	  for (unsigned int map = 0; map < first_->data.maps(); map++) {
-		  for (unsigned int y = 0; y < first_->data.height(); y++) {
-			  for (unsigned int x = 0; x < first_->data.width(); x++) {
-				  const datum first =
-					  *first_->data.data_ptr_const(x, y, map, sample);
-				  const datum second =
-					  *second_->data.data_ptr_const(x, y, map, sample);
-
-				  const datum diff = first - second;
-
+    for (unsigned int map = 0; map < first_->data.maps(); map++) {
 #ifdef ERROR_LAYER_IGNORE_WEIGHTS
-				  const datum weight = 1.0;
+      const datum* weight = nullptr;
 #else
-				  const datum weight = 
-					*third_->data.data_ptr_const ( x,y,0,sample );
+      const datum* weight = third_->data.data_ptr_const (0, 0, 0, sample);
 #endif
-				  error += ((long double)diff) * ((long double)diff) * ((long double)weight);
-			  }
-		  }
-	  }
+      error += VectorMath::WeightedSquaredError (
+                 first_->data.data_ptr_const (0, 0, map, sample),
+                 second_->data.data_ptr_const (0, 0, map, sample), weight,
+                 plane);
+    }
   }
 
   return error / 2.0;
@@ -4,10 +4,9 @@
  *
  * For licensing information, see the LICENSE file included with this project.
  */  
-#include <limits>
-
 #include "Log.h"
 #include "CLHelper.h"
+#include "MaxPooling.h"
 #include "MaxPoolingLayer.h"
 
 #ifdef BUILD_OPENCL
@@ -18,11 +17,29 @@ namespace Conv {
 
 MaxPoolingLayer::MaxPoolingLayer (const unsigned int region_width,
                                   const unsigned int region_height) :
-  region_width_ (region_width), region_height_ (region_height) {
+  region_width_ (region_width), region_height_ (region_height),
+  stride_width_ (region_width), stride_height_ (region_height) {
   LOGDEBUG << "Instance created: " << region_width_ << "x" << region_height_ <<
            " pooling.";
 }
 
+void MaxPoolingLayer::SetStride (const unsigned int stride_width,
+                                 const unsigned int stride_height) {
+  if (stride_width == 0 || stride_height == 0) {
+    FATAL ("Stride must not be zero!");
+  }
+
+#ifdef BUILD_OPENCL_MAX
+  if (stride_width != region_width_ || stride_height != region_height_) {
+    FATAL ("Strided max-pooling is not supported with OpenCL!");
+  }
+#endif
+
+  stride_width_ = stride_width;
+  stride_height_ = stride_height;
+  LOGDEBUG << "Stride: " << stride_width_ << "x" << stride_height_;
+}
+
 bool MaxPoolingLayer::CreateOutputs (
   const std::vector< CombinedTensor* >& inputs,
   std::vector< CombinedTensor* >& outputs) {
@@ -42,15 +59,18 @@ bool MaxPoolingLayer::CreateOutputs (
   }
 
   // Validate dimensions
-  if ( (input->data.width() % region_width_) != 0 ||
-       (input->data.height() % region_height_) != 0) {
-    LOGERROR << "Input dimensions not divisible by region dimensions!";
+  if (input->data.width() < region_width_ ||
+      input->data.height() < region_height_ ||
+      ( (input->data.width() - region_width_) % stride_width_) != 0 ||
+      ( (input->data.height() - region_height_) % stride_height_) != 0) {
+    LOGERROR << "Input dimensions don't fit region dimensions and stride!";
     return false;
   }
 
   // Create output
   CombinedTensor* output = new CombinedTensor (input->data.samples(),
-      input->data.width() / region_width_, input->data.height() / region_height_,
+      (input->data.width() - region_width_) / stride_width_ + 1,
+      (input->data.height() - region_height_) / stride_height_ + 1,
       input->data.maps());
 
   // Tell network about the output
@@ -81,11 +101,9 @@ bool MaxPoolingLayer::Connect (const CombinedTensor* input,
   maximum_mask_.Resize (input->data.samples(), input_width_,
 			input_height_, maps_);
 #else
-  // Create maximum Tensor
-  maximum_ix_.Resize (input->data.samples(), output_width_,
-                      output_height_, maps_);
-  maximum_iy_.Resize (input->data.samples(), output_width_,
-                      output_height_, maps_);
+  // Allocate space for the maxima
+  maximum_.resize (output->data.elements() *
+                   MaxPooling::IndexSize (region_width_, region_height_));
 #endif
 
   return true;
@@ -128,41 +146,10 @@ void MaxPoolingLayer::FeedForward() {
 #endif
 
 #else
-#pragma omp parallel for default(shared)
-  for (std::size_t sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int map = 0; map < maps_; map++) {
-      for (unsigned int ox = 0; ox < output_width_; ox++) {
-        for (unsigned int oy = 0; oy < output_height_; oy++) {
-          // Find maximum in region
-          datum maximum = std::numeric_limits<datum>::lowest();
-          unsigned int mix = 0;
-          unsigned int miy = 0;
-          for (unsigned int ix = ox * region_width_;
-               ix < (ox + 1) * region_width_; ix++) {
-            for (unsigned int iy = oy * region_height_;
-                 iy < (oy + 1) *region_height_; iy++) {
-              const datum ival =
-                *input_->data.data_ptr_const (ix, iy, map, sample);
-              if (ival > maximum) {
-                maximum = ival;
-                mix = ix;
-                miy = iy;
-		// mix = ox * region_width_;
-		// miy = oy * region_height_;
-              }
-            }
-          }
-          
-          // Found maximum, save
-          *maximum_ix_.data_ptr(ox, oy, map, sample) = mix;
-          *maximum_iy_.data_ptr(ox, oy, map, sample) = miy;
-          
-          // Feed forward
-          *output_->data.data_ptr(ox, oy, map, sample) = maximum;
-        }
-      }
-    }
-  }
+  MaxPooling::Forward (input_->data.data_ptr_const(), output_->data.data_ptr(),
+                       maximum_.data(), input_->data.samples() * maps_,
+                       input_width_, input_height_, region_width_,
+                       region_height_, stride_width_, stride_height_);
 #endif
 }
 
@@ -203,24 +190,11 @@ void MaxPoolingLayer::BackPropagate() {
 #endif
 
 #else
-  input_->delta.Clear();
-  
-#pragma omp parallel for default(shared)
-  for(std::size_t sample = 0; sample < input_->data.samples(); sample++) {
-    for (unsigned int map = 0; map < maps_; map++) {
-      for (unsigned int ox = 0; ox < output_width_; ox++) {
-        for (unsigned int oy = 0; oy < output_height_; oy++) {
-          unsigned int ix = *maximum_ix_.data_ptr_const(ox, oy, map, sample);
-          unsigned int iy = *maximum_iy_.data_ptr_const(ox, oy, map, sample);
-          *(input_->delta.data_ptr(ix, iy, map, sample)) = 
-             *output_->delta.data_ptr_const(ox, oy, map, sample);
-        }
-      }
-    }
-  }
-  
-  return;
-  
+  MaxPooling::Backward (output_->delta.data_ptr_const(), maximum_.data(),
+                        input_->delta.data_ptr(),
+                        input_->data.samples() * maps_, input_width_,
+                        input_height_, region_width_, region_height_,
+                        stride_width_, stride_height_);
 #endif
 }
 
@@ -10,11 +10,19 @@
 #include "TensorViewer.h"
 
 #include <sstream>
+#include <algorithm>
 
+#include "NonLinearityLayer.h"
 #include "Net.h"
 
 namespace Conv {
 
+Net::Net (const bool inference_only) : inference_only_ (inference_only) {
+  if (inference_only_) {
+    LOGDEBUG << "Inference only";
+  }
+}
+
 int Net::AddLayer (Layer* layer, const std::vector< Connection >& connections) {
   // Check for null pointer
   if (layer == nullptr) {
@@ -22,6 +30,11 @@ int Net::AddLayer (Layer* layer, const std::vector< Connection >& connections) {
     return -1;
   }
 
+  if (arenas_.size() > 0) {
+    FATAL ("Cannot add layers after planning the memory");
+    return -1;
+  }
+
   // Determine Layer's id
   int layer_id = layers_.size();
 
@@ -46,6 +59,8 @@ int Net::AddLayer (Layer* layer, const std::vector< Connection >& connections) {
   // and inputs contains the input buffers for the currently added layer.
   inputs_.push_back (inputs);
 
+  layer->SetInferenceOnly (inference_only_);
+
   // Ask the layer to create an output buffer
   std::vector<CombinedTensor*> outputs;
   bool result = layer->CreateOutputs (inputs, outputs);
@@ -67,9 +82,34 @@ int Net::AddLayer (Layer* layer, const std::vector< Connection >& connections) {
     return -1;
   }
 
+  // The deltas of the outputs are allocated once it is clear which ones
+  // are needed. Without backpropagation, no delta is ever touched.
+  for (unsigned int i = 0; i < outputs.size(); i++)
+    outputs[i]->delta.DeleteIfPossible();
+
+  if (inference_only_) {
+    for (unsigned int p = 0; p < layer->parameters().size(); p++)
+      layer->parameters() [p]->delta.DeleteIfPossible();
+  }
+
+  deltas_allocated_ = false;
+
   // Save outputs
   buffers_.push_back (outputs);
 
+  // Activation functions may overwrite their input. Whether they can is
+  // decided once all layers are added, until then they share its memory.
+  NonLinearityLayer* nl_layer = dynamic_cast<NonLinearityLayer*> (layer);
+  const bool in_place = nl_layer != nullptr && inputs.size() == 1 &&
+                        (nl_layer->in_place() || in_place_activations_enabled_);
+  in_place_wanted_.push_back (in_place);
+  in_place_layers_.push_back (in_place);
+
+  if (in_place)
+    outputs[0]->data.Shadow (inputs[0]->data);
+
+  in_place_decided_ = false;
+
   LOGDEBUG << "Layer " << layer_id << " added.";
 
 #ifdef BUILD_OPENCL
@@ -143,6 +183,71 @@ int Net::AddLayer (Layer* layer, const std::vector< Connection >& connections) {
   return layer_id;
 }
 
+bool Net::CanOverwrite (const unsigned int layer) const {
+  const CombinedTensor* buffer = inputs_[layer][0];
+
+  // Find the layer that writes the buffer
+  unsigned int source = 0;
+  while (std::find (buffers_[source].begin(), buffers_[source].end(), buffer) ==
+         buffers_[source].end())
+    source++;
+
+  // Input layers hand out memory that isn't theirs or replace it between
+  // batches
+  if (inputs_[source].size() == 0)
+    return false;
+
+  // The layer below may need its output for backpropagation
+  if (!inference_only_ && layers_[source]->NeedsOutputData())
+    return false;
+
+  // Other layers may read it
+  for (unsigned int l = 0; l < inputs_.size(); l++) {
+    for (unsigned int i = 0; i < inputs_[l].size(); i++) {
+      if (inputs_[l][i] == buffer && l != layer)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+void Net::DecideInPlace() {
+  in_place_decided_ = true;
+
+  // In order, so the memory of the inputs is known
+  for (unsigned int l = 0; l < layers_.size(); l++) {
+    if (!in_place_wanted_[l])
+      continue;
+
+    NonLinearityLayer* nl_layer = dynamic_cast<NonLinearityLayer*> (layers_[l]);
+    Tensor& data = buffers_[l][0]->data;
+    const bool in_place = CanOverwrite (l);
+
+    if (in_place) {
+      LOGDEBUG << "Layer " << l << " works in place";
+      data.Shadow (inputs_[l][0]->data);
+    } else if (in_place_layers_[l]) {
+      LOGDEBUG << "Layer " << l << " cannot overwrite its input";
+      data.DeleteIfPossible();
+      data.Resize (inputs_[l][0]->data);
+      buffers_[l][0]->delta.DeleteIfPossible();
+    }
+
+    in_place_layers_[l] = in_place;
+    nl_layer->SetInPlace (in_place);
+  }
+}
+
+CombinedTensor* Net::MemoryOwner (CombinedTensor* buffer) const {
+  for (unsigned int l = 0; l < layers_.size(); l++) {
+    if (in_place_layers_[l] && buffers_[l][0] == buffer)
+      return MemoryOwner (inputs_[l][0]);
+  }
+
+  return buffer;
+}
+
 int Net::AddLayer (Layer* layer, const int input_layer) {
   return AddLayer (layer, {Connection (input_layer) });
 }
@@ -156,8 +261,228 @@ void Net::InitializeWeights() {
 }
 
 
+void Net::PlanMemory() {
+  if (arenas_.size() > 0)
+    return;
+
+  if (!in_place_decided_)
+    DecideInPlace();
+
+  // Find the layers that write and read every output. In-place layers
+  // write their input again.
+  const unsigned int end = layers_.size();
+  std::vector<CombinedTensor*> tensors;
+  std::vector<unsigned int> first_write, last_write;
+  std::vector<int> last_read;
+
+  for (unsigned int l = 0; l < end; l++) {
+    for (unsigned int b = 0; b < buffers_[l].size(); b++) {
+      CombinedTensor* buffer = MemoryOwner (buffers_[l][b]);
+      const unsigned int t = std::find (tensors.begin(), tensors.end(), buffer)
+                             - tensors.begin();
+      if (t == tensors.size()) {
+        tensors.push_back (buffer);
+        first_write.push_back (l);
+        last_write.push_back (l);
+        last_read.push_back (-1);
+      } else {
+        last_write[t] = l;
+      }
+    }
+  }
+
+  for (unsigned int l = 0; l < end; l++) {
+    // These are asked for their results after the forward pass
+    const bool reads_later = dynamic_cast<LossFunctionLayer*> (layers_[l]) != NULL ||
+                             dynamic_cast<StatLayer*> (layers_[l]) != NULL;
+
+    for (unsigned int i = 0; i < inputs_[l].size(); i++) {
+      CombinedTensor* input = MemoryOwner (inputs_[l][i]);
+      if (in_place_layers_[l])
+        continue;
+
+      const unsigned int t = std::find (tensors.begin(), tensors.end(), input)
+                             - tensors.begin();
+      last_read[t] = std::max (last_read[t], (int) (reads_later ? end : l));
+    }
+  }
+
+  // Outputs that are never read have to survive the forward pass
+  std::vector<unsigned int> last_use (tensors.size());
+  for (unsigned int t = 0; t < tensors.size(); t++)
+    last_use[t] = last_read[t] < (int) last_write[t] ? end :
+                  (unsigned int) last_read[t];
+
+  // Assign the largest tensors first. Every tensor goes into the smallest
+  // arena that isn't in use while it is needed, so the large arenas are
+  // left for large tensors.
+  std::vector<unsigned int> order;
+  std::size_t naive_bytes = 0;
+
+  for (unsigned int t = 0; t < tensors.size(); t++) {
+    const Tensor& data = tensors[t]->data;
+
+    // Leave memory that belongs to someone else alone
+    if (data.is_shadow() || data.elements() == 0)
+      continue;
+
+    order.push_back (t);
+    naive_bytes += data.elements() * sizeof (datum);
+  }
+
+  std::stable_sort (order.begin(), order.end(),
+  [&] (const unsigned int a, const unsigned int b) {
+    return tensors[a]->data.elements() > tensors[b]->data.elements();
+  });
+
+  std::vector<std::size_t> arena_elements;
+  std::vector<std::vector<unsigned int>> arena_tensors;
+  std::vector<int> tensor_arena (tensors.size(), -1);
+
+  for (unsigned int o = 0; o < order.size(); o++) {
+    const unsigned int t = order[o];
+    int arena = -1;
+
+    for (unsigned int a = 0; a < arena_elements.size(); a++) {
+      bool overlaps = false;
+
+      for (unsigned int i = 0; i < arena_tensors[a].size(); i++) {
+        const unsigned int other = arena_tensors[a][i];
+        if (first_write[t] <= last_use[other] &&
+            first_write[other] <= last_use[t])
+          overlaps = true;
+      }
+
+      if (!overlaps && (arena == -1 || arena_elements[a] < arena_elements[arena]))
+        arena = a;
+    }
+
+    if (arena == -1) {
+      arena = arena_elements.size();
+      arena_elements.push_back (tensors[t]->data.elements());
+      arena_tensors.push_back (std::vector<unsigned int>());
+    }
+
+    arena_tensors[arena].push_back (t);
+    tensor_arena[t] = arena;
+    LOGDEBUG << "Output of layer " << first_write[t] << " needed until layer "
+             << last_use[t] << ", arena " << arena;
+  }
+
+  // Release the deltas again if they were allocated already
+  deltas_allocated_ = false;
+
+  std::size_t planned_bytes = 0;
+  for (unsigned int a = 0; a < arena_elements.size(); a++) {
+    arenas_.push_back (new Tensor (arena_elements[a]));
+    planned_bytes += arena_elements[a] * sizeof (datum);
+  }
+
+  for (unsigned int t = 0; t < tensors.size(); t++) {
+    if (tensor_arena[t] >= 0)
+      tensors[t]->data.ShadowMemory (*arenas_[tensor_arena[t]]);
+  }
+
+  // The in-place outputs follow their inputs into the arenas
+  for (unsigned int l = 0; l < end; l++) {
+    if (in_place_layers_[l])
+      buffers_[l][0]->data.Shadow (inputs_[l][0]->data);
+  }
+
+  LOGINFO << "Output memory: " << (datum) planned_bytes / 1048576.0 <<
+          " MB in " << arenas_.size() << " arenas instead of " <<
+          (datum) naive_bytes / 1048576.0 << " MB";
+}
+
+void Net::AllocateDeltas() {
+  deltas_allocated_ = true;
+
+  if (!in_place_decided_)
+    DecideInPlace();
+
+  // Nets that don't backpropagate need none at all
+  const bool backprop = !inference_only_ && arenas_.size() == 0;
+
+  std::vector<CombinedTensor*> tensors;
+  std::vector<bool> needed;
+  backprop_layers_.assign (layers_.size(), true);
+
+  for (unsigned int l = 0; l < layers_.size(); l++) {
+    Layer* layer = layers_[l];
+    bool input_needed = false;
+
+    for (unsigned int i = 0; i < inputs_[l].size(); i++) {
+      const unsigned int t = std::find (tensors.begin(), tensors.end(),
+                                        MemoryOwner (inputs_[l][i])) - tensors.begin();
+      input_needed |= t < tensors.size() && needed[t];
+    }
+
+    // Computing input gradients that no one reads is a waste of time
+    if (backprop && layer->parameters().size() > 0 && !input_needed &&
+        inputs_[l].size() > 0 && layer->backprop_enabled()) {
+      LOGDEBUG << "Layer " << l << " doesn't need to backpropagate";
+      layer->SetBackpropagationEnabled (false);
+    }
+
+    const bool output_delta_read = layer->parameters().size() > 0 ||
+                                   (layer->backprop_enabled() && input_needed);
+    bool output_needed = buffers_[l].size() == 0;
+
+    for (unsigned int b = 0; b < buffers_[l].size(); b++) {
+      // In place, the output is the input and already known
+      CombinedTensor* buffer = MemoryOwner (buffers_[l][b]);
+      const unsigned int t = std::find (tensors.begin(), tensors.end(),
+                                        buffer) - tensors.begin();
+      if (t == tensors.size()) {
+        tensors.push_back (buffer);
+        needed.push_back (backprop && output_delta_read);
+      }
+
+      output_needed |= needed[t];
+    }
+
+    backprop_layers_[l] = output_needed;
+  }
+
+  std::size_t all_bytes = 0;
+  std::size_t needed_bytes = 0;
+
+  for (unsigned int t = 0; t < tensors.size(); t++) {
+    Tensor& data = tensors[t]->data;
+    Tensor& delta = tensors[t]->delta;
+    all_bytes += data.elements() * sizeof (datum);
+
+    if (needed[t]) {
+      needed_bytes += data.elements() * sizeof (datum);
+      delta.Resize (data);
+    } else {
+      delta.DeleteIfPossible();
+    }
+  }
+
+  // The in-place layers compute their gradients in place as well
+  for (unsigned int l = 0; l < layers_.size(); l++) {
+    if (!in_place_layers_[l])
+      continue;
+
+    Tensor& delta = buffers_[l][0]->delta;
+
+    if (inputs_[l][0]->delta.elements() > 0)
+      delta.Shadow (inputs_[l][0]->delta);
+    else
+      delta.DeleteIfPossible();
+  }
+
+  if (backprop) {
+    LOGINFO << "Gradient memory: " << (datum) needed_bytes / 1048576.0 <<
+            " MB instead of " << (datum) all_bytes / 1048576.0 << " MB";
+  }
+}
 
 void Net::FeedForward() {
+  if (!deltas_allocated_)
+    AllocateDeltas();
+
 #ifdef LAYERTIME
   if (forward_durations_ == nullptr) {
     forward_durations_ = new std::chrono::duration<double>[layers_.size()];
@@ -215,6 +540,9 @@ void Net::FeedForward() {
 }
 
 void Net::FeedForward (const unsigned int last) {
+  if (!deltas_allocated_)
+    AllocateDeltas();
+
   for (unsigned int l = 0; l <= last; l++) {
     Layer* layer = layers_[l];
 #ifdef BUILD_OPENCL
@@ -236,9 +564,24 @@ void Net::FeedForward (const unsigned int last) {
 
 
 void Net::BackPropagate() {
+  if (inference_only_) {
+    FATAL ("Cannot backpropagate in an inference-only net");
+  }
+
+  if (arenas_.size() > 0) {
+    FATAL ("Cannot backpropagate after planning the memory");
+  }
+
+  if (!deltas_allocated_)
+    AllocateDeltas();
+
   for (int l = (layers_.size() - 1); l >= 0; l--) {
     Layer* layer = layers_[l];
 
+    // Nothing reads the gradients this layer would compute
+    if (!backprop_layers_[l])
+      continue;
+
 #ifdef LAYERTIME
     auto t_begin = std::chrono::system_clock::now();
 #endif
@@ -296,6 +639,7 @@ void Net::DeserializeParameters (std::istream& input, unsigned int last_layer) {
       LOGINFO << "Loaded parameters for layer " << l << " parameter set " << p << ": " << layer->parameters()[p]->data;
       input.peek();
     }
+    layer->InvalidateParameters();
   }
 }
 
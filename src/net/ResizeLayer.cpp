@@ -10,10 +10,7 @@
 
 #include "ResizeLayer.h"
 #include "Init.h"
-
-#ifdef BUILD_OPENMP
-#include <omp.h>
-#endif
+#include "ThreadPool.h"
 
 namespace Conv {
 
@@ -77,8 +74,7 @@ void ResizeLayer::FeedForward() {
 #endif
   
   output_->data.Clear(0.0);
-#pragma omp parallel for default(shared)
-  for(unsigned int sample = 0; sample < input_->data.samples(); sample++) {
+  ThreadPool::ParallelFor (input_->data.samples(), [&] (const unsigned int sample) {
     for(unsigned int map = 0; map < input_->data.maps(); map++) {
       for(unsigned int y = 0; y < input_->data.height(); y++) {
 	const datum* const source =
@@ -89,7 +85,7 @@ void ResizeLayer::FeedForward() {
 	std::memcpy(target, source, sizeof(datum) * input_->data.width());
       }
     }
-  }
+  });
 }
 
 void ResizeLayer::BackPropagate() {
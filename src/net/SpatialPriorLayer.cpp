@@ -6,6 +6,7 @@
  */
 
 #include "SpatialPriorLayer.h"
+#include "ThreadPool.h"
 namespace Conv {
 SpatialPriorLayer::SpatialPriorLayer() {
   LOGDEBUG << "Instance created.";
@@ -60,8 +61,7 @@ bool SpatialPriorLayer::Connect ( const CombinedTensor* input,
 void SpatialPriorLayer::FeedForward() {
   output_->data.Clear ( 1.0 );
   
-  #pragma omp parallel for default(shared)
-  for ( unsigned int sample = 0; sample < input_->data.samples(); sample++ ) {
+  ThreadPool::ParallelFor (input_->data.samples(), [&] (const unsigned int sample) {
     for ( unsigned int map = 2; map < input_->data.maps() + 2; map++ ) {
       for ( unsigned int y = 0; y < input_->data.height(); y++ ) {
         Tensor::CopyMap ( input_->data, sample, map-2,
@@ -77,19 +77,18 @@ void SpatialPriorLayer::FeedForward() {
         *output_->data.data_ptr ( x,y,1,sample ) = ( ( datum ) y ) / ( ( datum ) input_->data.height() );
       }
     }
-  }
+  });
 }
 
 void SpatialPriorLayer::BackPropagate() {
-  #pragma omp parallel for default(shared)
-  for ( unsigned int sample = 0; sample < input_->data.samples(); sample++ ) {
+  ThreadPool::ParallelFor (input_->data.samples(), [&] (const unsigned int sample) {
     for ( unsigned int map = 2; map < input_->data.maps() + 2; map++ ) {
       for ( unsigned int y = 0; y < input_->data.height(); y++ ) {
         Tensor::CopyMap ( output_->delta, sample, map,
                           input_->delta, sample, map - 2 );
       }
     }
-  }
+  });
 }
 
 
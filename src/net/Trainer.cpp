@@ -10,6 +10,7 @@
 
 #include "Log.h"
 #include "Net.h"
+#include "VectorMath.h"
 
 #include "StatLayer.h"
 
@@ -89,6 +90,7 @@ datum Trainer::Test() {
   LOGDEBUG << "Testing, iterations: " << iterations <<
            ", batch size: " << batchsize;
 
+  training_layer_->TakeLoaderWaitTime();
   auto t_begin = std::chrono::system_clock::now();
 
   for (unsigned int i = 0; i < iterations; i++) {
@@ -110,6 +112,9 @@ datum Trainer::Test() {
           1000000.0f * (datum) t_diff.count() /
           (datum) (training_layer_->GetBatchSize() * iterations) << " us";
 
+  LOGINFO << "Testing, loader wait: " <<
+          100.0 * training_layer_->TakeLoaderWaitTime() / t_diff.count() << "%";
+
   LOGDEBUG << "Testing, lps: " << loss_sum / (datum) (iterations * batchsize);
 
   for (unsigned int s = 0; s < stat_count; s++) {
@@ -163,6 +168,7 @@ void Trainer::Epoch() {
     stat_sum[s] = 0;
 
 
+  training_layer_->TakeLoaderWaitTime();
   auto t_begin = std::chrono::system_clock::now();
 
   for (unsigned int i = 0; i < iterations; i++) {
@@ -203,9 +209,9 @@ void Trainer::Epoch() {
           gradients.MoveToCPU();
 #endif
 
-          for (unsigned int e = 0; e < gradients.elements(); e++) {
-            (* (accumulated_gradients_[np])) [e] += gradients[e];
-          }
+          VectorMath::Add (gradients.data_ptr_const(),
+                           accumulated_gradients_[np]->data_ptr(),
+                           gradients.elements());
 
           np++;
         }
@@ -232,6 +238,9 @@ void Trainer::Epoch() {
           (datum) (training_layer_->GetBatchSize() * settings_.sbatchsize
                    * training_layer_->GetLossSamplingProbability() * iterations) << " us";
 
+  LOGINFO << "Training, loader wait: " <<
+          100.0 * training_layer_->TakeLoaderWaitTime() / t_diff.count() << "%";
+
   // Display training epoch_error
   LOGDEBUG << "Training, lps: " << epoch_error / (datum) (iterations * batchsize
            * training_layer_->GetLossSamplingProbability());
@@ -299,6 +308,8 @@ void Trainer::ApplyGradients (datum lr) {
 
       dp++;
     }
+
+    net_.layers_[l]->InvalidateParameters();
   }
 }
 
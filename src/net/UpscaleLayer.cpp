@@ -4,10 +4,12 @@
  *
  * For licensing information, see the LICENSE file included with this project.
  */  
+#include <cstring>
 #include <limits>
 
 #include "Log.h"
 #include "Init.h"
+#include "ThreadPool.h"
 
 #include "UpscaleLayer.h"
 
@@ -70,48 +72,46 @@ bool UpscaleLayer::Connect ( const CombinedTensor* input,
 }
 
 void UpscaleLayer::FeedForward() {
-  #pragma omp parallel for default(shared)
-
-  for ( std::size_t sample = 0; sample < input_->data.samples(); sample++ ) {
-    for ( unsigned int map = 0; map < maps_; map++ ) {
-      for ( unsigned int ox = 0; ox < output_width_; ox++ ) {
-        for ( unsigned int oy = 0; oy < output_height_; oy++ ) {
-          const unsigned int ix = ox / region_width_;
-          const unsigned int iy = oy / region_height_;
-          const datum ival = *input_->data.data_ptr_const ( ix, iy, map, sample );
-          // Feed forward
-          *output_->data.data_ptr ( ox, oy, map, sample ) = ival;
-        }
-      }
+  const int rows = (int) ( input_->data.samples() * maps_ * input_height_ );
+
+  // Every input row becomes region_height_ identical output rows
+  ThreadPool::ParallelFor (rows, [&] (const int row) {
+    const datum* input_row = input_->data.data_ptr_const() +
+                             ( std::size_t ) row * input_width_;
+    datum* output_row = output_->data.data_ptr() +
+                        ( std::size_t ) row * region_height_ * output_width_;
+
+    for ( unsigned int ix = 0; ix < input_width_; ix++ ) {
+      for ( unsigned int rx = 0; rx < region_width_; rx++ )
+        output_row[ix * region_width_ + rx] = input_row[ix];
     }
-  }
+
+    for ( unsigned int ry = 1; ry < region_height_; ry++ )
+      std::memcpy ( output_row + ( std::size_t ) ry * output_width_, output_row,
+                    sizeof ( datum ) * output_width_ );
+  });
 }
 
 void UpscaleLayer::BackPropagate() {
-  #pragma omp parallel for default(shared)
+  const int rows = (int) ( input_->data.samples() * maps_ * input_height_ );
+
+  ThreadPool::ParallelFor (rows, [&] (const int row) {
+    datum* input_row = input_->delta.data_ptr() + ( std::size_t ) row * input_width_;
+    const datum* output_rows = output_->delta.data_ptr_const() +
+                               ( std::size_t ) row * region_height_ * output_width_;
+
+    for ( unsigned int ix = 0; ix < input_width_; ix++ )
+      input_row[ix] = 0;
+
+    for ( unsigned int ry = 0; ry < region_height_; ry++ ) {
+      const datum* output_row = output_rows + ( std::size_t ) ry * output_width_;
 
-  for ( std::size_t sample = 0; sample < input_->data.samples(); sample++ ) {
-    for ( unsigned int map = 0; map < maps_; map++ ) {
       for ( unsigned int ix = 0; ix < input_width_; ix++ ) {
-        for ( unsigned int iy = 0; iy < input_height_; iy++ ) {
-          const unsigned int ox = ix * region_width_;
-          const unsigned int oy = iy * region_height_;
-          datum sum = 0;
-
-          for ( unsigned int ry = 0; ry < region_height_; ry++ ) {
-            for ( unsigned int rx = 0; rx < region_width_; rx++ ) {
-              sum += *output_->delta.data_ptr_const ( ox + rx, oy +ry, map, sample );
-            }
-          }
-
-          *input_->delta.data_ptr ( ix,iy,map,sample ) = sum; // (datum)(region_width_ * region_height_);
-        }
+        for ( unsigned int rx = 0; rx < region_width_; rx++ )
+          input_row[ix] += output_row[ix * region_width_ + rx];
       }
     }
-  }
-
-  return;
-
+  });
 }
 
 }
@@ -0,0 +1,190 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file AveragePooling.cpp
+ * @brief Average-pooling kernels with runtime instruction set selection.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include <algorithm>
+#include <cstddef>
+
+#include "Config.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "AveragePooling.h"
+
+#ifdef CN24_X86
+#include <immintrin.h>
+#endif
+
+namespace Conv {
+
+typedef void (*AverageMapKernel) (const datum* input, datum* output,
+                                  const unsigned int input_width,
+                                  const unsigned int output_width,
+                                  const unsigned int output_height,
+                                  const unsigned int region_width,
+                                  const unsigned int region_height,
+                                  const unsigned int stride_x,
+                                  const unsigned int stride_y);
+
+struct AveragePoolingKernels {
+  // The generic kernel first, then one for every size in pooling_sizes
+  AverageMapKernel average_map[3];
+};
+
+/*
+ * Region sizes with their own kernel
+ */
+static const struct {
+  unsigned int width;
+  unsigned int height;
+} pooling_sizes[] = {
+  { 2, 2 },
+  { 3, 3 }
+};
+
+#define CN24_SIMD_KERNELS "AveragePoolingKernels.inl"
+#include "SIMDKernels.inl"
+#undef CN24_SIMD_KERNELS
+
+static AveragePoolingKernels SelectKernels() {
+  AveragePoolingKernels kernels;
+  SIMDScalar::GetKernels (kernels);
+
+#ifdef CN24_X86
+  switch (CPUFeatures::Level()) {
+  case SIMD_AVX512:
+    SIMDAVX512::GetKernels (kernels);
+    break;
+  case SIMD_AVX2:
+    SIMDAVX2::GetKernels (kernels);
+    break;
+  case SIMD_SSE:
+    SIMDSSE::GetKernels (kernels);
+    break;
+  default:
+    break;
+  }
+#endif
+
+  return kernels;
+}
+
+static const AveragePoolingKernels& Kernels() {
+  static const AveragePoolingKernels kernels = SelectKernels();
+  return kernels;
+}
+
+/*
+ * Spreads the gradient of one map. If the regions tile the map, every
+ * input pixel is written once, row by row. Otherwise, the map is cleared
+ * first and the gradients are added up.
+ */
+static void UnaverageMap (const datum* output_delta, datum* input_delta,
+                          const unsigned int input_width,
+                          const unsigned int input_height,
+                          const unsigned int output_width,
+                          const unsigned int output_height,
+                          const unsigned int region_width,
+                          const unsigned int region_height,
+                          const unsigned int stride_x,
+                          const unsigned int stride_y) {
+  const datum scale = (datum) 1 / (datum) (region_width * region_height);
+
+  if (stride_x == region_width && stride_y == region_height) {
+    for (unsigned int oy = 0; oy < output_height; oy++) {
+      const datum* output_row = output_delta + (std::size_t) oy * output_width;
+
+      for (unsigned int ky = 0; ky < region_height; ky++) {
+        datum* input_row = input_delta +
+                           ( (std::size_t) oy * region_height + ky) * input_width;
+
+        for (unsigned int ox = 0; ox < output_width; ox++) {
+          const datum delta = output_row[ox] * scale;
+
+          for (unsigned int kx = 0; kx < region_width; kx++)
+            input_row[ox * region_width + kx] = delta;
+        }
+      }
+    }
+
+    return;
+  }
+
+  std::fill (input_delta, input_delta + (std::size_t) input_width * input_height,
+             (datum) 0);
+
+  for (unsigned int oy = 0; oy < output_height; oy++) {
+    const datum* output_row = output_delta + (std::size_t) oy * output_width;
+
+    for (unsigned int ky = 0; ky < region_height; ky++) {
+      datum* input_row = input_delta +
+                         ( (std::size_t) oy * stride_y + ky) * input_width;
+
+      for (unsigned int ox = 0; ox < output_width; ox++) {
+        const datum delta = output_row[ox] * scale;
+
+        for (unsigned int kx = 0; kx < region_width; kx++)
+          input_row[ox * stride_x + kx] += delta;
+      }
+    }
+  }
+}
+
+void AveragePooling::Forward (const datum* input, datum* output,
+                              const unsigned int maps,
+                              const unsigned int input_width,
+                              const unsigned int input_height,
+                              const unsigned int region_width,
+                              const unsigned int region_height,
+                              const unsigned int stride_x,
+                              const unsigned int stride_y) {
+  const unsigned int output_width = (input_width - region_width) / stride_x + 1;
+  const unsigned int output_height = (input_height - region_height) / stride_y + 1;
+
+  // Pick a kernel for the region size
+  AverageMapKernel average_map = Kernels().average_map[0];
+
+  for (unsigned int k = 0; k < sizeof (pooling_sizes) / sizeof (pooling_sizes[0]); k++) {
+    if (pooling_sizes[k].width == region_width &&
+        pooling_sizes[k].height == region_height)
+      average_map = Kernels().average_map[k + 1];
+  }
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    const std::size_t input_offset = (std::size_t) map * input_width * input_height;
+    const std::size_t output_offset = (std::size_t) map * output_width * output_height;
+    average_map (input + input_offset, output + output_offset, input_width,
+                 output_width, output_height, region_width, region_height,
+                 stride_x, stride_y);
+  });
+}
+
+void AveragePooling::Backward (const datum* output_delta, datum* input_delta,
+                               const unsigned int maps,
+                               const unsigned int input_width,
+                               const unsigned int input_height,
+                               const unsigned int region_width,
+                               const unsigned int region_height,
+                               const unsigned int stride_x,
+                               const unsigned int stride_y) {
+  const unsigned int output_width = (input_width - region_width) / stride_x + 1;
+  const unsigned int output_height = (input_height - region_height) / stride_y + 1;
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    const std::size_t input_offset = (std::size_t) map * input_width * input_height;
+    const std::size_t output_offset = (std::size_t) map * output_width * output_height;
+    UnaverageMap (output_delta + output_offset, input_delta + input_offset,
+                  input_width, input_height, output_width, output_height,
+                  region_width, region_height, stride_x, stride_y);
+  });
+}
+
+}
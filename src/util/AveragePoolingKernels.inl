@@ -0,0 +1,78 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * Average-pooling kernels, included once per instruction set by
+ * SIMDKernels.inl.
+ */
+
+namespace CN24_SIMD_NAMESPACE {
+
+/*
+ * Computes the mean of every region of one map. If fixed_width and
+ * fixed_height are not zero, they are the region size.
+ *
+ * The output is computed row by row, a vector of neighbouring regions at
+ * a time. The pixels of a region are added up in the same order for the
+ * vectors and the remaining regions, so the result doesn't depend on the
+ * instruction set.
+ */
+template <unsigned int fixed_width, unsigned int fixed_height>
+CN24_SIMD_TARGET
+static void AverageMap (const datum* input, datum* output,
+                        const unsigned int input_width,
+                        const unsigned int output_width,
+                        const unsigned int output_height,
+                        const unsigned int region_width,
+                        const unsigned int region_height,
+                        const unsigned int stride_x,
+                        const unsigned int stride_y) {
+  const unsigned int width = CN24_SIMD_WIDTH;
+  const unsigned int rw = fixed_width > 0 ? fixed_width : region_width;
+  const unsigned int rh = fixed_height > 0 ? fixed_height : region_height;
+  const datum scale = (datum) 1 / (datum) (rw * rh);
+
+  for (unsigned int oy = 0; oy < output_height; oy++) {
+    const datum* input_row = input + (std::size_t) oy * stride_y * input_width;
+    datum* output_row = output + (std::size_t) oy * output_width;
+    unsigned int ox = 0;
+
+    for (; ox + width <= output_width; ox += width) {
+      CN24_SIMD_TYPE sum = CN24_SIMD_ZERO();
+
+      for (unsigned int ky = 0; ky < rh; ky++) {
+        for (unsigned int kx = 0; kx < rw; kx++)
+          sum = CN24_SIMD_ADD (sum, CN24_SIMD_LOAD_STRIDED (
+                                 input_row + ky * input_width + ox * stride_x + kx,
+                                 stride_x));
+      }
+
+      CN24_SIMD_STORE (output_row + ox, CN24_SIMD_MUL (sum, CN24_SIMD_SET1 (scale)));
+    }
+
+    for (; ox < output_width; ox++) {
+      datum sum = 0;
+
+      for (unsigned int ky = 0; ky < rh; ky++) {
+        for (unsigned int kx = 0; kx < rw; kx++)
+          sum += input_row[ky * input_width + ox * stride_x + kx];
+      }
+
+      output_row[ox] = sum * scale;
+    }
+  }
+}
+
+/*
+ * Fills the kernel table with the kernels for this instruction set
+ */
+static void GetKernels (AveragePoolingKernels& kernels) {
+  kernels.average_map[0] = AverageMap<0, 0>;
+  kernels.average_map[1] = AverageMap<2, 2>;
+  kernels.average_map[2] = AverageMap<3, 3>;
+}
+
+}
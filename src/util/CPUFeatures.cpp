@@ -0,0 +1,162 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+#include <cstdlib>
+#include <cstring>
+
+#include "Log.h"
+#include "CPUFeatures.h"
+
+#ifdef CN24_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace Conv {
+
+#ifdef CN24_X86
+static void CPUID (const unsigned int leaf, const unsigned int subleaf,
+                   unsigned int registers[4]) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuidex (info, (int) leaf, (int) subleaf);
+  for (unsigned int r = 0; r < 4; r++)
+    registers[r] = (unsigned int) info[r];
+#else
+  __cpuid_count (leaf, subleaf, registers[0], registers[1], registers[2],
+                 registers[3]);
+#endif
+}
+
+static unsigned long long XGETBV() {
+#ifdef _MSC_VER
+  return _xgetbv (0);
+#else
+  unsigned int eax, edx;
+  __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return ((unsigned long long) edx << 32) | eax;
+#endif
+}
+
+static SIMDLevel DetectLevel() {
+  unsigned int regs[4] = {0, 0, 0, 0};
+  CPUID (0, 0, regs);
+  const unsigned int max_leaf = regs[0];
+
+  if (max_leaf < 1)
+    return SIMD_SCALAR;
+
+  CPUID (1, 0, regs);
+  const bool sse42 = (regs[2] & (1u << 20)) != 0;
+  const bool fma = (regs[2] & (1u << 12)) != 0;
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  const bool avx = (regs[2] & (1u << 28)) != 0;
+
+  if (!sse42)
+    return SIMD_SCALAR;
+
+  // The OS has to save the YMM (and ZMM) registers on context switches
+  if (!osxsave || !avx)
+    return SIMD_SSE;
+
+  const unsigned long long xcr0 = XGETBV();
+
+  if ((xcr0 & 0x6) != 0x6 || max_leaf < 7)
+    return SIMD_SSE;
+
+  CPUID (7, 0, regs);
+  const bool avx2 = (regs[1] & (1u << 5)) != 0;
+  const bool avx512f = (regs[1] & (1u << 16)) != 0;
+
+  if (!avx2 || !fma)
+    return SIMD_SSE;
+
+  if (avx512f && (xcr0 & 0xE0) == 0xE0)
+    return SIMD_AVX512;
+
+  return SIMD_AVX2;
+}
+#endif
+
+static std::string DetectModel() {
+#ifdef CN24_X86
+  unsigned int regs[4] = {0, 0, 0, 0};
+  CPUID (0x80000000, 0, regs);
+
+  if (regs[0] >= 0x80000004) {
+    char brand[49];
+
+    for (unsigned int leaf = 0; leaf < 3; leaf++) {
+      CPUID (0x80000002 + leaf, 0, regs);
+      std::memcpy (brand + 16 * leaf, regs, 16);
+    }
+
+    brand[48] = 0;
+
+    // Some vendors pad the brand string with spaces
+    std::string model (brand);
+    const std::size_t first = model.find_first_not_of (' ');
+    const std::size_t last = model.find_last_not_of (' ');
+
+    if (first != std::string::npos)
+      return model.substr (first, last - first + 1);
+  }
+#endif
+
+  return "unknown";
+}
+
+static SIMDLevel SelectLevel() {
+  SIMDLevel level = SIMD_SCALAR;
+
+#ifdef CN24_X86
+  level = DetectLevel();
+#endif
+
+  // Allow the user to cap the instruction set, e.g. for benchmarking
+  const char* cap = std::getenv ("CN24_SIMD");
+
+  if (cap != nullptr) {
+    for (int l = SIMD_SCALAR; l <= SIMD_AVX512; l++) {
+      if (std::strcmp (cap, CPUFeatures::LevelName ((SIMDLevel) l)) == 0) {
+        if (l < level)
+          level = (SIMDLevel) l;
+
+        break;
+      }
+    }
+  }
+
+  return level;
+}
+
+SIMDLevel CPUFeatures::Level() {
+  static const SIMDLevel level = SelectLevel();
+  return level;
+}
+
+const std::string& CPUFeatures::Model() {
+  static const std::string model = DetectModel();
+  return model;
+}
+
+const char* CPUFeatures::LevelName (const SIMDLevel level) {
+  switch (level) {
+  case SIMD_SSE:
+    return "sse4.2";
+  case SIMD_AVX2:
+    return "avx2";
+  case SIMD_AVX512:
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+}
@@ -11,10 +11,6 @@
 #include "Config.h"
 #include "Tensor.h"
 
-#ifdef BUILD_OPENMP
-#include <omp.h>
-#endif
-
 #include <limits>
 
 namespace Conv {
@@ -124,6 +124,28 @@ void ParseCountIfPossible ( std::string line, std::string identifier, unsigned i
   k = std::atoi ( size.c_str() );
 }
 
+/*
+ * Accepts both "identifier=XxY" and "identifier=N", which sets x and y to N
+ */
+void ParseSizeIfPossible ( std::string line, std::string identifier, unsigned int& x, unsigned int& y ) {
+  std::size_t ilen = identifier.length() + 1;
+  std::size_t size_pos = line.find ( identifier + "=" );
+
+  if ( size_pos == std::string::npos )
+    return;
+
+  std::size_t end_pos = line.find ( " ", size_pos );
+
+  if ( end_pos != std::string::npos )
+    line = line.substr ( 0, end_pos );
+
+  std::string size = line.substr ( size_pos + ilen );
+  std::size_t x_pos = size.find ( "x" );
+
+  x = std::atoi ( size.c_str() );
+  y = x_pos == std::string::npos ? x : std::atoi ( size.substr ( x_pos + 1 ).c_str() );
+}
+
 void ParseDatumParamIfPossible ( std::string line, std::string identifier, datum& k ) {
   std::size_t ilen = identifier.length() + 1;
   std::size_t size_pos = line.find ( identifier + "=" );
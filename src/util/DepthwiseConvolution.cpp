@@ -0,0 +1,187 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file DepthwiseConvolution.cpp
+ * @brief Depthwise convolution kernels with runtime instruction set
+ *   selection.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include "Config.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "DirectConvolution.h"
+#include "DepthwiseConvolution.h"
+
+#ifdef CN24_X86
+#include <immintrin.h>
+#endif
+
+namespace Conv {
+
+typedef void (*DepthwiseForwardRowKernel) (const ConvolutionShape& shape,
+    const datum* input, const datum* weights, const datum weight_factor,
+    const datum bias, datum* output, const unsigned int oy);
+
+struct DepthwiseConvolutionKernels {
+  // One for every kernel size in SpecializedKernel, the generic one first
+  DepthwiseForwardRowKernel forward_row[specialized_kernels];
+  void (*weight_gradient_row) (const ConvolutionShape& shape,
+                               const datum* input, const datum* output_delta,
+                               datum* weights_delta, datum* bias_delta,
+                               const unsigned int map, const unsigned int ky);
+};
+
+#define CN24_SIMD_KERNELS "DepthwiseConvolutionKernels.inl"
+#include "SIMDKernels.inl"
+#undef CN24_SIMD_KERNELS
+
+static DepthwiseConvolutionKernels SelectKernels() {
+  DepthwiseConvolutionKernels kernels;
+  SIMDScalar::GetKernels (kernels);
+
+#ifdef CN24_X86
+  switch (CPUFeatures::Level()) {
+  case SIMD_AVX512:
+    SIMDAVX512::GetKernels (kernels);
+    break;
+  case SIMD_AVX2:
+    SIMDAVX2::GetKernels (kernels);
+    break;
+  case SIMD_SSE:
+    SIMDSSE::GetKernels (kernels);
+    break;
+  default:
+    break;
+  }
+#endif
+
+  return kernels;
+}
+
+static const DepthwiseConvolutionKernels& Kernels() {
+  static const DepthwiseConvolutionKernels kernels = SelectKernels();
+  return kernels;
+}
+
+/*
+ * Forward pass on an input that does not need padding
+ */
+static void ForwardUnpadded (const ConvolutionShape& shape, const datum* input,
+                             const datum* weights, const datum* bias,
+                             const datum weight_factor, datum* output,
+                             const ConvolutionEpilogue epilogue) {
+  const DepthwiseForwardRowKernel forward_row =
+    Kernels().forward_row[SpecializedKernel (shape)];
+  const std::size_t input_plane = (std::size_t) shape.input_width * shape.input_height;
+  const std::size_t output_plane = (std::size_t) shape.output_width *
+                                   shape.output_height;
+  const unsigned int kernel_size = shape.kernel_width * shape.kernel_height;
+  const int rows = (int) (shape.samples * shape.output_maps * shape.output_height);
+
+  ThreadPool::ParallelFor (rows, [&] (const int row) {
+    const unsigned int oy = row % shape.output_height;
+    const unsigned int map = (row / shape.output_height) % shape.output_maps;
+    const unsigned int sample = row / (shape.output_height * shape.output_maps);
+    datum* output_map = output + sample * shape.output_stride() + map * output_plane;
+
+    forward_row (shape, input + sample * shape.input_stride() + map * input_plane,
+                 weights + (std::size_t) map * kernel_size, weight_factor,
+                 bias != nullptr ? bias[map] : 0, output_map, oy);
+
+    if (epilogue != nullptr)
+      epilogue (output_map + (std::size_t) oy * shape.output_width,
+                shape.output_width);
+  }, 4);
+}
+
+void DepthwiseConvolution::Forward (const ConvolutionShape& shape,
+                                    const datum* input, const datum* weights,
+                                    const datum* bias,
+                                    const datum weight_factor, datum* output,
+                                    Tensor& padded_input,
+                                    const ConvolutionEpilogue epilogue) {
+  if (shape.padded()) {
+    const ConvolutionShape padded_shape = DirectConvolution::PaddedShape (shape);
+    DirectConvolution::PadInput (shape, padded_shape, input, padded_input);
+    ForwardUnpadded (padded_shape, padded_input.data_ptr_const(), weights, bias,
+                     weight_factor, output, epilogue);
+    return;
+  }
+
+  ForwardUnpadded (shape, input, weights, bias, weight_factor, output, epilogue);
+}
+
+void DepthwiseConvolution::BackwardData (const ConvolutionShape& shape,
+    const datum* output_delta,
+    const datum* weights,
+    datum* input_delta,
+    Tensor& flipped_weights,
+    Tensor& padded_delta,
+    Tensor& padded_input_delta) {
+  if (shape.padded()) {
+    const ConvolutionShape padded_shape = DirectConvolution::PaddedShape (shape);
+    padded_input_delta.Resize (shape.samples, padded_shape.input_width,
+                               padded_shape.input_height, shape.input_maps);
+    BackwardData (padded_shape, output_delta, weights,
+                  padded_input_delta.data_ptr(), flipped_weights, padded_delta,
+                  padded_input_delta);
+    DirectConvolution::FoldPadding (shape, padded_shape,
+                                    padded_input_delta.data_ptr_const(),
+                                    input_delta);
+    return;
+  }
+
+  // Every map only depends on itself, so this is the same 'full'
+  // convolution as in DirectConvolution, just with one kernel per map
+  const ConvolutionShape full = DirectConvolution::FullShape (shape);
+  DirectConvolution::SpreadOutputDelta (shape, full, output_delta,
+                                        padded_delta);
+
+  const unsigned int kernel_size = shape.kernel_width * shape.kernel_height;
+  flipped_weights.Resize ((std::size_t) shape.output_maps * kernel_size);
+  datum* flipped = flipped_weights.data_ptr();
+
+  for (unsigned int map = 0; map < shape.output_maps; map++) {
+    for (unsigned int k = 0; k < kernel_size; k++)
+      flipped[map * kernel_size + k] = weights[map * kernel_size + (kernel_size - 1 - k)];
+  }
+
+  ForwardUnpadded (full, padded_delta.data_ptr_const(), flipped, nullptr, 1.0,
+                   input_delta, nullptr);
+}
+
+void DepthwiseConvolution::WeightGradient (const ConvolutionShape& shape,
+    const datum* input,
+    const datum* output_delta,
+    datum* weights_delta,
+    datum* bias_delta,
+    Tensor& padded_input) {
+  if (shape.padded()) {
+    const ConvolutionShape padded_shape = DirectConvolution::PaddedShape (shape);
+    DirectConvolution::PadInput (shape, padded_shape, input, padded_input);
+    WeightGradient (padded_shape, padded_input.data_ptr_const(), output_delta,
+                    weights_delta, bias_delta, padded_input);
+    return;
+  }
+
+  const DepthwiseConvolutionKernels& kernels = Kernels();
+  const int tasks = (int) (shape.output_maps * shape.kernel_height);
+
+  // Every task writes its own row of one kernel, the first row of every
+  // kernel sums up the bias gradient as well
+  ThreadPool::ParallelFor (tasks, [&] (const int task) {
+    const unsigned int ky = task % shape.kernel_height;
+    const unsigned int map = task / shape.kernel_height;
+
+    kernels.weight_gradient_row (shape, input, output_delta, weights_delta,
+                                 ky == 0 ? bias_delta : nullptr, map, ky);
+  });
+}
+
+}
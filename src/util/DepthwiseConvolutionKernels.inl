@@ -0,0 +1,221 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * Depthwise convolution kernels, included once per instruction set by
+ * SIMDKernels.inl.
+ */
+
+namespace CN24_SIMD_NAMESPACE {
+
+/*
+ * Computes row oy of one output map from the input map with the same
+ * index. Four vectors of output pixels are computed at once, so every
+ * weight is broadcast once for all of them. Without a horizontal stride,
+ * neighboring output pixels read neighboring input pixels, otherwise the
+ * scalar loop does all the work.
+ *
+ * Non-zero fixed_width and fixed_height are the kernel size, see
+ * ForwardRow in DirectConvolutionKernels.inl.
+ */
+template <unsigned int fixed_width, unsigned int fixed_height>
+CN24_SIMD_TARGET
+static void DepthwiseForwardRow (const ConvolutionShape& shape,
+                                 const datum* input, const datum* weights,
+                                 const datum weight_factor, const datum bias,
+                                 datum* output, const unsigned int oy) {
+  const unsigned int width = CN24_SIMD_WIDTH;
+  const unsigned int kernel_width = fixed_width > 0 ? fixed_width : shape.kernel_width;
+  const unsigned int kernel_height = fixed_height > 0 ? fixed_height : shape.kernel_height;
+  const unsigned int vector_end = shape.stride_x == 1 ? shape.output_width : 0;
+  const CN24_SIMD_TYPE bv = CN24_SIMD_SET1 (bias);
+  datum* out = output + (std::size_t) oy * shape.output_width;
+
+  unsigned int ox = 0;
+
+  for (; ox + 4 * width <= vector_end; ox += 4 * width) {
+    CN24_SIMD_TYPE a0 = bv, a1 = bv, a2 = bv, a3 = bv;
+    const datum* w = weights;
+
+    for (unsigned int ky = 0; ky < kernel_height; ky++) {
+      const datum* in = input + (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                        shape.input_width + ox;
+
+      for (unsigned int kx = 0; kx < kernel_width; kx++) {
+        const CN24_SIMD_TYPE wv = CN24_SIMD_SET1 (weight_factor * *w++);
+        a0 = CN24_SIMD_FMA (wv, CN24_SIMD_LOAD (in), a0);
+        a1 = CN24_SIMD_FMA (wv, CN24_SIMD_LOAD (in + width), a1);
+        a2 = CN24_SIMD_FMA (wv, CN24_SIMD_LOAD (in + 2 * width), a2);
+        a3 = CN24_SIMD_FMA (wv, CN24_SIMD_LOAD (in + 3 * width), a3);
+        in += shape.dilation_x;
+      }
+    }
+
+    CN24_SIMD_STORE (out + ox, a0);
+    CN24_SIMD_STORE (out + ox + width, a1);
+    CN24_SIMD_STORE (out + ox + 2 * width, a2);
+    CN24_SIMD_STORE (out + ox + 3 * width, a3);
+  }
+
+  for (; ox + width <= vector_end; ox += width) {
+    CN24_SIMD_TYPE a = bv;
+    const datum* w = weights;
+
+    for (unsigned int ky = 0; ky < kernel_height; ky++) {
+      const datum* in = input + (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                        shape.input_width + ox;
+
+      for (unsigned int kx = 0; kx < kernel_width; kx++) {
+        a = CN24_SIMD_FMA (CN24_SIMD_SET1 (weight_factor * *w++),
+                           CN24_SIMD_LOAD (in), a);
+        in += shape.dilation_x;
+      }
+    }
+
+    CN24_SIMD_STORE (out + ox, a);
+  }
+
+  // Remaining pixels
+  for (; ox < shape.output_width; ox++) {
+    datum acc = 0;
+    const datum* w = weights;
+
+    for (unsigned int ky = 0; ky < kernel_height; ky++) {
+      const datum* in = input + (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                        shape.input_width + ox * shape.stride_x;
+
+      for (unsigned int kx = 0; kx < kernel_width; kx++) {
+        acc += *w++ * *in;
+        in += shape.dilation_x;
+      }
+    }
+
+    out[ox] = weight_factor * acc + bias;
+  }
+}
+
+CN24_SIMD_TARGET
+static datum DepthwiseHorizontalSum (const CN24_SIMD_TYPE v) {
+  datum lanes[CN24_SIMD_WIDTH];
+  CN24_SIMD_STORE (lanes, v);
+
+  datum sum = 0;
+  for (unsigned int l = 0; l < CN24_SIMD_WIDTH; l++)
+    sum += lanes[l];
+
+  return sum;
+}
+
+/*
+ * Computes row ky of the weight gradient of one map over all output rows
+ * of all samples. Four horizontal kernel positions are handled at once,
+ * so each output gradient vector is loaded once for four products.
+ *
+ * If bias_delta is not nullptr, the bias gradient of the map is summed up
+ * while the output gradient is loaded anyway.
+ */
+CN24_SIMD_TARGET
+static void DepthwiseWeightGradientRow (const ConvolutionShape& shape,
+                                        const datum* input,
+                                        const datum* output_delta,
+                                        datum* weights_delta,
+                                        datum* bias_delta,
+                                        const unsigned int map,
+                                        const unsigned int ky) {
+  const unsigned int width = CN24_SIMD_WIDTH;
+  const std::size_t input_plane = (std::size_t) shape.input_width * shape.input_height;
+  const std::size_t output_plane = (std::size_t) shape.output_width * shape.output_height;
+  const unsigned int dx = shape.dilation_x;
+  const unsigned int vector_end = shape.stride_x == 1 ?
+                                  shape.output_width - shape.output_width % width : 0;
+
+  for (unsigned int kx0 = 0; kx0 < shape.kernel_width; kx0 += 4) {
+    const unsigned int kc = shape.kernel_width - kx0 < 4 ? shape.kernel_width - kx0 : 4;
+    const bool bias = bias_delta != nullptr && kx0 == 0;
+
+    CN24_SIMD_TYPE a0 = CN24_SIMD_ZERO(), a1 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a2 = CN24_SIMD_ZERO(), a3 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE b = CN24_SIMD_ZERO();
+    datum s[4] = {0};
+    datum t = 0;
+
+    for (unsigned int sample = 0; sample < shape.samples; sample++) {
+      for (unsigned int oy = 0; oy < shape.output_height; oy++) {
+        const datum* dy = output_delta + sample * shape.output_stride() +
+                          map * output_plane + (std::size_t) oy * shape.output_width;
+        const datum* xr = input + sample * shape.input_stride() + map * input_plane +
+                          (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                          shape.input_width + kx0 * dx;
+
+        if (kc == 4) {
+          for (unsigned int ox = 0; ox < vector_end; ox += width) {
+            const CN24_SIMD_TYPE d = CN24_SIMD_LOAD (dy + ox);
+            a0 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox), a0);
+            a1 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox + dx), a1);
+            a2 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox + 2 * dx), a2);
+            a3 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox + 3 * dx), a3);
+
+            if (bias)
+              b = CN24_SIMD_ADD (b, d);
+          }
+        } else {
+          // Don't read past the end of the row for narrow kernel tails
+          for (unsigned int ox = 0; ox < vector_end; ox += width) {
+            const CN24_SIMD_TYPE d = CN24_SIMD_LOAD (dy + ox);
+            a0 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox), a0);
+
+            if (kc > 1)
+              a1 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox + dx), a1);
+
+            if (kc > 2)
+              a2 = CN24_SIMD_FMA (d, CN24_SIMD_LOAD (xr + ox + 2 * dx), a2);
+
+            if (bias)
+              b = CN24_SIMD_ADD (b, d);
+          }
+        }
+
+        for (unsigned int ox = vector_end; ox < shape.output_width; ox++) {
+          const datum* xp = xr + ox * shape.stride_x;
+
+          for (unsigned int c = 0; c < kc; c++)
+            s[c] += dy[ox] * xp[c * dx];
+
+          if (bias)
+            t += dy[ox];
+        }
+      }
+    }
+
+    s[0] += DepthwiseHorizontalSum (a0);
+    s[1] += DepthwiseHorizontalSum (a1);
+    s[2] += DepthwiseHorizontalSum (a2);
+    s[3] += DepthwiseHorizontalSum (a3);
+
+    datum* dw = weights_delta + ((std::size_t) map * shape.kernel_height + ky) *
+                shape.kernel_width + kx0;
+
+    for (unsigned int c = 0; c < kc; c++)
+      dw[c] = s[c];
+
+    if (bias)
+      bias_delta[map] = t + DepthwiseHorizontalSum (b);
+  }
+}
+
+/*
+ * Fills the kernel table with the kernels for this instruction set
+ */
+static void GetKernels (DepthwiseConvolutionKernels& kernels) {
+  kernels.forward_row[0] = DepthwiseForwardRow<0, 0>;
+  kernels.forward_row[1] = DepthwiseForwardRow<1, 1>;
+  kernels.forward_row[2] = DepthwiseForwardRow<3, 3>;
+  kernels.forward_row[3] = DepthwiseForwardRow<5, 5>;
+  kernels.forward_row[4] = DepthwiseForwardRow<7, 7>;
+  kernels.weight_gradient_row = DepthwiseWeightGradientRow;
+}
+
+}
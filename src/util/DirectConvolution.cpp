@@ -0,0 +1,513 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file DirectConvolution.cpp
+ * @brief Direct convolution kernels with runtime instruction set selection.
+ *
+ * The kernels in DirectConvolutionKernels.inl are compiled once for every
+ * supported instruction set. The best one is picked on first use.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include <cstring>
+
+#include "Config.h"
+#include "Log.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "DirectConvolution.h"
+
+#ifdef CN24_X86
+#include <immintrin.h>
+#endif
+
+namespace Conv {
+
+// Number of output maps computed at once. The packed weights are
+// interleaved in blocks of this size.
+const unsigned int dc_block = 4;
+
+// The weight gradient is split into at least this many tasks if there are
+// enough output rows, each chunk of rows getting at least wg_chunk_rows
+const unsigned int wg_tasks = 256;
+const unsigned int wg_chunk_rows = 8;
+
+// Number of datums per task in the reduction of the chunks
+const unsigned int wg_reduce_block = 4096;
+
+typedef void (*ForwardRowKernel) (const ConvolutionShape& shape,
+                                  const datum* input, const datum* weights,
+                                  const datum* bias, datum* output,
+                                  const unsigned int maps,
+                                  const unsigned int oy);
+
+struct DirectConvolutionKernels {
+  // One for every kernel size in SpecializedKernel, the generic one first
+  ForwardRowKernel forward_row[specialized_kernels];
+  void (*weight_gradient_row) (const ConvolutionShape& shape,
+                               const datum* input, const datum* output_delta,
+                               datum* weights_delta, datum* bias_delta,
+                               const unsigned int omap,
+                               const unsigned int maps, const unsigned int imap,
+                               const unsigned int ky,
+                               const unsigned int row_begin,
+                               const unsigned int row_end);
+};
+
+#define CN24_SIMD_KERNELS "DirectConvolutionKernels.inl"
+#include "SIMDKernels.inl"
+#undef CN24_SIMD_KERNELS
+
+static DirectConvolutionKernels SelectKernels() {
+  DirectConvolutionKernels kernels;
+  SIMDScalar::GetKernels (kernels);
+
+#ifdef CN24_X86
+  switch (CPUFeatures::Level()) {
+  case SIMD_AVX512:
+    SIMDAVX512::GetKernels (kernels);
+    break;
+  case SIMD_AVX2:
+    SIMDAVX2::GetKernels (kernels);
+    break;
+  case SIMD_SSE:
+    SIMDSSE::GetKernels (kernels);
+    break;
+  default:
+    break;
+  }
+#endif
+
+  LOGDEBUG << "Using " << CPUFeatures::LevelName (CPUFeatures::Level()) <<
+           " kernels";
+  return kernels;
+}
+
+static const DirectConvolutionKernels& Kernels() {
+  static const DirectConvolutionKernels kernels = SelectKernels();
+  return kernels;
+}
+
+std::size_t DirectConvolution::PackedSize (const ConvolutionShape& shape) {
+  const unsigned int blocks = (shape.output_maps + dc_block - 1) / dc_block;
+  return (std::size_t) blocks * dc_block * shape.input_maps *
+         shape.kernel_width * shape.kernel_height;
+}
+
+void DirectConvolution::PackWeights (const ConvolutionShape& shape,
+                                     const datum* weights,
+                                     const datum weight_factor,
+                                     datum* packed) {
+  const unsigned int blocks = (shape.output_maps + dc_block - 1) / dc_block;
+  const unsigned int kernel_size = shape.kernel_width * shape.kernel_height;
+
+  for (unsigned int block = 0; block < blocks; block++) {
+    for (unsigned int imap = 0; imap < shape.input_maps; imap++) {
+      for (unsigned int k = 0; k < kernel_size; k++) {
+        for (unsigned int b = 0; b < dc_block; b++) {
+          const unsigned int omap = block * dc_block + b;
+          *packed++ = omap < shape.output_maps ?
+                      weight_factor * weights[ ((std::size_t) omap * shape.input_maps + imap) * kernel_size + k] : 0;
+        }
+      }
+    }
+  }
+}
+
+void DirectConvolution::ForwardPacked (const ConvolutionShape& shape,
+                                       const datum* input,
+                                       const datum* packed_weights,
+                                       const datum* bias, datum* output,
+                                       const ConvolutionEpilogue epilogue,
+                                       const bool parallel) {
+  const DirectConvolutionKernels& kernels = Kernels();
+  const ForwardRowKernel forward_row = kernels.forward_row[SpecializedKernel (shape)];
+  const unsigned int blocks = (shape.output_maps + dc_block - 1) / dc_block;
+  const std::size_t weights_per_block = (std::size_t) dc_block *
+                                        shape.input_maps * shape.kernel_width * shape.kernel_height;
+  const std::size_t input_sample = shape.input_stride();
+  const std::size_t output_plane = (std::size_t) shape.output_width *
+                                   shape.output_height;
+  const int rows = (int) (shape.samples * blocks * shape.output_height);
+
+  // A single block of all rows keeps the loop on this thread
+  ThreadPool::ParallelFor (rows, [&] (const int row) {
+    const unsigned int oy = row % shape.output_height;
+    const unsigned int block = (row / shape.output_height) % blocks;
+    const unsigned int sample = row / (shape.output_height * blocks);
+    const unsigned int omap = block * dc_block;
+    const unsigned int maps = shape.output_maps - omap < dc_block ?
+                              shape.output_maps - omap : dc_block;
+
+    datum block_bias[dc_block] = {0};
+
+    if (bias != nullptr) {
+      for (unsigned int b = 0; b < maps; b++)
+        block_bias[b] = bias[omap + b];
+    }
+
+    datum* block_output = output + sample * shape.output_stride() +
+                          (std::size_t) omap * output_plane;
+
+    forward_row (shape, input + sample * input_sample,
+                         packed_weights + block * weights_per_block, block_bias,
+                         block_output, maps, oy);
+
+    if (epilogue != nullptr) {
+      for (unsigned int b = 0; b < maps; b++)
+        epilogue (block_output + b * output_plane + (std::size_t) oy * shape.output_width,
+                  shape.output_width);
+    }
+  }, parallel ? 4 : (std::size_t) rows);
+}
+
+ConvolutionShape DirectConvolution::PaddedShape (const ConvolutionShape& shape) {
+  ConvolutionShape padded = shape;
+  padded.input_width = (shape.output_width - 1) * shape.stride_x +
+                       shape.dilation_x * (shape.kernel_width - 1) + 1;
+  padded.input_height = (shape.output_height - 1) * shape.stride_y +
+                        shape.dilation_y * (shape.kernel_height - 1) + 1;
+  padded.pad_x = 0;
+  padded.pad_y = 0;
+  padded.mirror_padding = false;
+  padded.input_sample_stride = 0;
+  return padded;
+}
+
+void DirectConvolution::PadInput (const ConvolutionShape& shape,
+                                  const ConvolutionShape& padded_shape,
+                                  const datum* input, Tensor& padded_input) {
+  padded_input.Resize (shape.samples, padded_shape.input_width,
+                       padded_shape.input_height, shape.input_maps);
+
+  const int maps = (int) (shape.samples * shape.input_maps);
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    const datum* source_map = input + (map / shape.input_maps) * shape.input_stride() +
+                              (std::size_t) (map % shape.input_maps) *
+                              shape.input_width * shape.input_height;
+
+    for (unsigned int py = 0; py < padded_shape.input_height; py++) {
+      datum* target = padded_input.data_ptr (0, py) + (std::size_t) map *
+                      padded_shape.input_width * padded_shape.input_height;
+      int iy = (int) py - (int) shape.pad_y;
+
+      if (iy < 0 || iy >= (int) shape.input_height) {
+        if (!shape.mirror_padding) {
+          std::memset (target, 0, sizeof (datum) * padded_shape.input_width);
+          continue;
+        }
+
+        iy = MirrorIndex (iy, (int) shape.input_height);
+      }
+
+      const datum* source = source_map + (std::size_t) iy * shape.input_width;
+
+      for (unsigned int px = 0; px < padded_shape.input_width; px++) {
+        const int ix = (int) px - (int) shape.pad_x;
+
+        if (ix >= 0 && ix < (int) shape.input_width)
+          target[px] = source[ix];
+        else
+          target[px] = shape.mirror_padding ?
+                       source[MirrorIndex (ix, (int) shape.input_width)] : 0;
+      }
+    }
+  });
+}
+
+void DirectConvolution::FoldPadding (const ConvolutionShape& shape,
+                                     const ConvolutionShape& padded_shape,
+                                     const datum* padded_delta,
+                                     datum* input_delta) {
+  const int maps = (int) (shape.samples * shape.input_maps);
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    datum* target_map = input_delta + (map / shape.input_maps) * shape.input_stride() +
+                        (std::size_t) (map % shape.input_maps) *
+                        shape.input_width * shape.input_height;
+    std::memset (target_map, 0, sizeof (datum) * shape.input_width *
+                 shape.input_height);
+
+    for (unsigned int py = 0; py < padded_shape.input_height; py++) {
+      const datum* source = padded_delta + ((std::size_t) map *
+                            padded_shape.input_height + py) * padded_shape.input_width;
+      int iy = (int) py - (int) shape.pad_y;
+
+      if (iy < 0 || iy >= (int) shape.input_height) {
+        if (!shape.mirror_padding)
+          continue;
+
+        iy = MirrorIndex (iy, (int) shape.input_height);
+      }
+
+      datum* target = target_map + (std::size_t) iy * shape.input_width;
+
+      for (unsigned int px = 0; px < padded_shape.input_width; px++) {
+        const int ix = (int) px - (int) shape.pad_x;
+
+        if (ix >= 0 && ix < (int) shape.input_width)
+          target[ix] += source[px];
+        else if (shape.mirror_padding)
+          target[MirrorIndex (ix, (int) shape.input_width)] += source[px];
+      }
+    }
+  });
+}
+
+ConvolutionShape DirectConvolution::FullShape (const ConvolutionShape& shape) {
+  // With a stride, the output gradient is spread out and the gaps are
+  // filled with zeros, so the convolution itself has no stride.
+  ConvolutionShape full;
+  full.samples = shape.samples;
+  full.input_width = shape.input_width + shape.dilation_x * (shape.kernel_width - 1);
+  full.input_height = shape.input_height + shape.dilation_y * (shape.kernel_height - 1);
+  full.input_maps = shape.output_maps;
+  full.output_width = shape.input_width;
+  full.output_height = shape.input_height;
+  full.output_maps = shape.input_maps;
+  full.kernel_width = shape.kernel_width;
+  full.kernel_height = shape.kernel_height;
+  full.dilation_x = shape.dilation_x;
+  full.dilation_y = shape.dilation_y;
+  full.output_sample_stride = shape.input_stride();
+  return full;
+}
+
+void DirectConvolution::SpreadOutputDelta (const ConvolutionShape& shape,
+                                           const ConvolutionShape& full,
+                                           const datum* output_delta,
+                                           Tensor& padded_delta) {
+  const unsigned int pad_x = full.input_width - shape.input_width;
+  const unsigned int pad_y = full.input_height - shape.input_height;
+
+  padded_delta.Resize (shape.samples, full.input_width, full.input_height,
+                       full.input_maps);
+  padded_delta.Clear();
+
+  const int maps = (int) (shape.samples * shape.output_maps);
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    for (unsigned int oy = 0; oy < shape.output_height; oy++) {
+      const datum* source = output_delta + (map / shape.output_maps) * shape.output_stride() +
+                            ((std::size_t) (map % shape.output_maps) * shape.output_height + oy) *
+                            shape.output_width;
+      datum* target = padded_delta.data_ptr (pad_x, pad_y + oy * shape.stride_y) +
+                      (std::size_t) map * full.input_width * full.input_height;
+
+      if (shape.stride_x == 1) {
+        std::memcpy (target, source, sizeof (datum) * shape.output_width);
+      } else {
+        for (unsigned int ox = 0; ox < shape.output_width; ox++)
+          target[ox * shape.stride_x] = source[ox];
+      }
+    }
+  });
+}
+
+void DirectConvolution::Forward (const ConvolutionShape& shape,
+                                 const datum* input, const datum* weights,
+                                 const datum* bias, const datum weight_factor,
+                                 datum* output, Tensor& packed_weights,
+                                 Tensor& padded_input,
+                                 const ConvolutionEpilogue epilogue) {
+  packed_weights.Resize (PackedSize (shape));
+  PackWeights (shape, weights, weight_factor, packed_weights.data_ptr());
+  ForwardPrepacked (shape, input, packed_weights.data_ptr_const(), bias, output,
+                    padded_input, epilogue);
+}
+
+void DirectConvolution::ForwardPrepacked (const ConvolutionShape& shape,
+    const datum* input,
+    const datum* packed_weights,
+    const datum* bias, datum* output,
+    Tensor& padded_input,
+    const ConvolutionEpilogue epilogue) {
+  if (shape.padded()) {
+    const ConvolutionShape padded_shape = PaddedShape (shape);
+    PadInput (shape, padded_shape, input, padded_input);
+    ForwardPacked (padded_shape, padded_input.data_ptr_const(), packed_weights,
+                   bias, output, epilogue);
+    return;
+  }
+
+  ForwardPacked (shape, input, packed_weights, bias, output, epilogue);
+}
+
+void DirectConvolution::BackwardData (const ConvolutionShape& shape,
+                                      const datum* output_delta,
+                                      const datum* weights, datum* input_delta,
+                                      Tensor& packed_weights,
+                                      Tensor& padded_delta,
+                                      Tensor& padded_input_delta) {
+  if (shape.padded()) {
+    const ConvolutionShape padded_shape = PaddedShape (shape);
+    padded_input_delta.Resize (shape.samples, padded_shape.input_width,
+                               padded_shape.input_height, shape.input_maps);
+    BackwardData (padded_shape, output_delta, weights,
+                  padded_input_delta.data_ptr(), packed_weights, padded_delta,
+                  padded_input_delta);
+    FoldPadding (shape, padded_shape, padded_input_delta.data_ptr_const(),
+                 input_delta);
+    return;
+  }
+
+  // The input gradient is a 'valid' convolution of the zero-padded output
+  // gradient with the flipped kernels, input and output maps swapped.
+  const ConvolutionShape full = FullShape (shape);
+  SpreadOutputDelta (shape, full, output_delta, padded_delta);
+
+  const unsigned int blocks = (full.output_maps + dc_block - 1) / dc_block;
+  const unsigned int kernel_size = shape.kernel_width * shape.kernel_height;
+
+  packed_weights.Resize (blocks * dc_block * full.input_maps * kernel_size);
+  datum* packed = packed_weights.data_ptr();
+
+  for (unsigned int block = 0; block < blocks; block++) {
+    for (unsigned int omap = 0; omap < shape.output_maps; omap++) {
+      for (unsigned int k = 0; k < kernel_size; k++) {
+        for (unsigned int b = 0; b < dc_block; b++) {
+          const unsigned int imap = block * dc_block + b;
+          *packed++ = imap < shape.input_maps ?
+                      weights[ ((std::size_t) omap * shape.input_maps + imap) * kernel_size + (kernel_size - 1 - k)] : 0;
+        }
+      }
+    }
+  }
+
+  ForwardPacked (full, padded_delta.data_ptr_const(),
+                 packed_weights.data_ptr_const(), nullptr, input_delta);
+}
+
+void DirectConvolution::WeightGradient (const ConvolutionShape& shape,
+                                        const datum* input,
+                                        const datum* output_delta,
+                                        datum* weights_delta,
+                                        datum* bias_delta,
+                                        Tensor& padded_input,
+                                        Tensor& partial_gradients) {
+  if (shape.padded()) {
+    const ConvolutionShape padded_shape = PaddedShape (shape);
+    PadInput (shape, padded_shape, input, padded_input);
+    WeightGradient (padded_shape, padded_input.data_ptr_const(), output_delta,
+                    weights_delta, bias_delta, padded_input, partial_gradients);
+    return;
+  }
+
+  const DirectConvolutionKernels& kernels = Kernels();
+
+  // Every task writes its own part of the weight gradient. With few maps,
+  // the output rows are split into chunks as well, each with its own
+  // gradient buffer. The number of chunks only depends on the shape and
+  // the buffers are added up in a fixed order, so the result does not
+  // depend on the number of threads.
+  const unsigned int pairs = (shape.output_maps + 1) / 2;
+  const unsigned int tasks = pairs * shape.input_maps * shape.kernel_height;
+  const unsigned int rows = shape.samples * shape.output_height;
+
+  unsigned int chunks = (wg_tasks + tasks - 1) / tasks;
+
+  if (chunks > rows / wg_chunk_rows)
+    chunks = rows / wg_chunk_rows;
+
+  if (chunks < 1)
+    chunks = 1;
+
+  const std::size_t weights_size = (std::size_t) shape.output_maps *
+                                   shape.input_maps * shape.kernel_width * shape.kernel_height;
+  const std::size_t bias_size = bias_delta != nullptr ? shape.output_maps : 0;
+  const std::size_t chunk_size = weights_size + bias_size;
+
+  // The first chunk goes into the result directly
+  if (chunks > 1)
+    partial_gradients.Resize ((chunks - 1) * chunk_size);
+
+  datum* partial = partial_gradients.data_ptr();
+  const int all_tasks = (int) (tasks * chunks);
+
+  ThreadPool::ParallelFor (all_tasks, [&] (const int task) {
+    const unsigned int chunk = task / tasks;
+    const unsigned int ky = (task % tasks) % shape.kernel_height;
+    const unsigned int imap = ((task % tasks) / shape.kernel_height) % shape.input_maps;
+    const unsigned int omap = ((task % tasks) / (shape.kernel_height * shape.input_maps)) * 2;
+    const unsigned int maps = shape.output_maps - omap < 2 ? shape.output_maps - omap : 2;
+
+    datum* chunk_weights = chunk == 0 ? weights_delta :
+                           partial + (chunk - 1) * chunk_size;
+    datum* chunk_bias = chunk == 0 ? bias_delta :
+                        partial + (chunk - 1) * chunk_size + weights_size;
+
+    // One task per output map pair sums up the bias gradient
+    const bool bias = bias_delta != nullptr && imap == 0 && ky == 0;
+
+    kernels.weight_gradient_row (shape, input, output_delta, chunk_weights,
+                                 bias ? chunk_bias : nullptr, omap, maps,
+                                 imap, ky, (unsigned int) ((std::size_t) rows * chunk / chunks),
+                                 (unsigned int) ((std::size_t) rows * (chunk + 1) / chunks));
+  });
+
+  // Pairwise tree reduction: chunk i receives chunk i + step
+  for (unsigned int step = 1; step < chunks; step *= 2) {
+    const unsigned int targets = (chunks - step + 2 * step - 1) / (2 * step);
+    const unsigned int blocks = (unsigned int) ((chunk_size + wg_reduce_block - 1) /
+                                wg_reduce_block);
+    const int reduce_tasks = (int) (targets * blocks);
+
+    ThreadPool::ParallelFor (reduce_tasks, [&] (const int task) {
+      const unsigned int target = (task / blocks) * 2 * step;
+      const std::size_t begin = (std::size_t) (task % blocks) * wg_reduce_block;
+      const std::size_t end = begin + wg_reduce_block < chunk_size ?
+                              begin + wg_reduce_block : chunk_size;
+      const datum* source = partial + (target + step - 1) * chunk_size;
+
+      if (target == 0) {
+        for (std::size_t i = begin; i < end && i < weights_size; i++)
+          weights_delta[i] += source[i];
+
+        for (std::size_t i = begin > weights_size ? begin : weights_size; i < end; i++)
+          bias_delta[i - weights_size] += source[i];
+      } else {
+        datum* destination = partial + (target - 1) * chunk_size;
+
+        for (std::size_t i = begin; i < end; i++)
+          destination[i] += source[i];
+      }
+    });
+  }
+}
+
+void DirectConvolution::BiasGradient (const ConvolutionShape& shape,
+                                      const datum* output_delta,
+                                      datum* bias_delta) {
+  const std::size_t output_plane = (std::size_t) shape.output_width *
+                                   shape.output_height;
+
+  ThreadPool::ParallelFor (shape.output_maps, [&] (const int omap) {
+    // Independent partial sums so that the loop can be vectorized
+    datum sums[8] = {0};
+
+    for (unsigned int sample = 0; sample < shape.samples; sample++) {
+      const datum* delta = output_delta + sample * shape.output_stride() +
+                           (std::size_t) omap * output_plane;
+      std::size_t i = 0;
+
+      for (; i + 8 <= output_plane; i += 8) {
+        for (unsigned int j = 0; j < 8; j++)
+          sums[j] += delta[i + j];
+      }
+
+      for (; i < output_plane; i++)
+        sums[0] += delta[i];
+    }
+
+    bias_delta[omap] = ((sums[0] + sums[1]) + (sums[2] + sums[3])) +
+                       ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+  });
+}
+
+}
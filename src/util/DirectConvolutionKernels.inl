@@ -0,0 +1,320 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * Direct convolution kernels, included once per instruction set by
+ * SIMDKernels.inl.
+ */
+
+namespace CN24_SIMD_NAMESPACE {
+
+/*
+ * Computes row oy of up to four output maps. The accumulators cover
+ * four maps times two vectors of output pixels, so each input vector is
+ * loaded once for four maps. Neighboring output pixels only read
+ * neighboring input pixels without a horizontal stride, otherwise the
+ * scalar loop does all the work.
+ *
+ * If fixed_width and fixed_height are not zero, they are the kernel size.
+ * The loops over the kernel then have a constant trip count and can be
+ * unrolled completely.
+ */
+template <unsigned int fixed_width, unsigned int fixed_height>
+CN24_SIMD_TARGET
+static void ForwardRow (const ConvolutionShape& shape, const datum* input,
+                        const datum* weights, const datum* bias,
+                        datum* output, const unsigned int maps,
+                        const unsigned int oy) {
+  const unsigned int width = CN24_SIMD_WIDTH;
+  const std::size_t input_plane = (std::size_t) shape.input_width * shape.input_height;
+  const std::size_t output_plane = (std::size_t) shape.output_width * shape.output_height;
+  const unsigned int kernel_width = fixed_width > 0 ? fixed_width : shape.kernel_width;
+  const unsigned int kernel_height = fixed_height > 0 ? fixed_height : shape.kernel_height;
+  const unsigned int kernel_size = kernel_width * kernel_height;
+  const unsigned int vector_end = shape.stride_x == 1 ? shape.output_width : 0;
+
+  datum* out[dc_block];
+  for (unsigned int b = 0; b < dc_block; b++)
+    out[b] = output + (b < maps ? b : 0) * output_plane + (std::size_t) oy * shape.output_width;
+
+  unsigned int ox = 0;
+
+  for (; ox + 2 * width <= vector_end; ox += 2 * width) {
+    CN24_SIMD_TYPE a00 = CN24_SIMD_ZERO(), a01 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a10 = CN24_SIMD_ZERO(), a11 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a20 = CN24_SIMD_ZERO(), a21 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a30 = CN24_SIMD_ZERO(), a31 = CN24_SIMD_ZERO();
+
+    for (unsigned int imap = 0; imap < shape.input_maps; imap++) {
+      const datum* w = weights + (std::size_t) imap * kernel_size * dc_block;
+
+      for (unsigned int ky = 0; ky < kernel_height; ky++) {
+        const datum* in = input + imap * input_plane +
+                          (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                          shape.input_width + ox * shape.stride_x;
+
+        for (unsigned int kx = 0; kx < kernel_width; kx++) {
+          const CN24_SIMD_TYPE v0 = CN24_SIMD_LOAD (in);
+          const CN24_SIMD_TYPE v1 = CN24_SIMD_LOAD (in + width);
+
+          CN24_SIMD_TYPE wv = CN24_SIMD_SET1 (w[0]);
+          a00 = CN24_SIMD_FMA (wv, v0, a00);
+          a01 = CN24_SIMD_FMA (wv, v1, a01);
+          wv = CN24_SIMD_SET1 (w[1]);
+          a10 = CN24_SIMD_FMA (wv, v0, a10);
+          a11 = CN24_SIMD_FMA (wv, v1, a11);
+          wv = CN24_SIMD_SET1 (w[2]);
+          a20 = CN24_SIMD_FMA (wv, v0, a20);
+          a21 = CN24_SIMD_FMA (wv, v1, a21);
+          wv = CN24_SIMD_SET1 (w[3]);
+          a30 = CN24_SIMD_FMA (wv, v0, a30);
+          a31 = CN24_SIMD_FMA (wv, v1, a31);
+
+          in += shape.dilation_x;
+          w += dc_block;
+        }
+      }
+    }
+
+    // Stores for missing maps all go to the first map and are
+    // overwritten by it afterwards
+    CN24_SIMD_TYPE bv = CN24_SIMD_SET1 (bias[3]);
+    CN24_SIMD_STORE (out[3] + ox, CN24_SIMD_ADD (a30, bv));
+    CN24_SIMD_STORE (out[3] + ox + width, CN24_SIMD_ADD (a31, bv));
+    bv = CN24_SIMD_SET1 (bias[2]);
+    CN24_SIMD_STORE (out[2] + ox, CN24_SIMD_ADD (a20, bv));
+    CN24_SIMD_STORE (out[2] + ox + width, CN24_SIMD_ADD (a21, bv));
+    bv = CN24_SIMD_SET1 (bias[1]);
+    CN24_SIMD_STORE (out[1] + ox, CN24_SIMD_ADD (a10, bv));
+    CN24_SIMD_STORE (out[1] + ox + width, CN24_SIMD_ADD (a11, bv));
+    bv = CN24_SIMD_SET1 (bias[0]);
+    CN24_SIMD_STORE (out[0] + ox, CN24_SIMD_ADD (a00, bv));
+    CN24_SIMD_STORE (out[0] + ox + width, CN24_SIMD_ADD (a01, bv));
+  }
+
+  for (; ox + width <= vector_end; ox += width) {
+    CN24_SIMD_TYPE a0 = CN24_SIMD_ZERO(), a1 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a2 = CN24_SIMD_ZERO(), a3 = CN24_SIMD_ZERO();
+
+    for (unsigned int imap = 0; imap < shape.input_maps; imap++) {
+      const datum* w = weights + (std::size_t) imap * kernel_size * dc_block;
+
+      for (unsigned int ky = 0; ky < kernel_height; ky++) {
+        const datum* in = input + imap * input_plane +
+                          (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                          shape.input_width + ox * shape.stride_x;
+
+        for (unsigned int kx = 0; kx < kernel_width; kx++) {
+          const CN24_SIMD_TYPE v = CN24_SIMD_LOAD (in);
+          a0 = CN24_SIMD_FMA (CN24_SIMD_SET1 (w[0]), v, a0);
+          a1 = CN24_SIMD_FMA (CN24_SIMD_SET1 (w[1]), v, a1);
+          a2 = CN24_SIMD_FMA (CN24_SIMD_SET1 (w[2]), v, a2);
+          a3 = CN24_SIMD_FMA (CN24_SIMD_SET1 (w[3]), v, a3);
+          in += shape.dilation_x;
+          w += dc_block;
+        }
+      }
+    }
+
+    CN24_SIMD_STORE (out[3] + ox, CN24_SIMD_ADD (a3, CN24_SIMD_SET1 (bias[3])));
+    CN24_SIMD_STORE (out[2] + ox, CN24_SIMD_ADD (a2, CN24_SIMD_SET1 (bias[2])));
+    CN24_SIMD_STORE (out[1] + ox, CN24_SIMD_ADD (a1, CN24_SIMD_SET1 (bias[1])));
+    CN24_SIMD_STORE (out[0] + ox, CN24_SIMD_ADD (a0, CN24_SIMD_SET1 (bias[0])));
+  }
+
+  // Remaining pixels
+  for (; ox < shape.output_width; ox++) {
+    datum acc[dc_block] = {0};
+
+    for (unsigned int imap = 0; imap < shape.input_maps; imap++) {
+      const datum* w = weights + (std::size_t) imap * kernel_size * dc_block;
+
+      for (unsigned int ky = 0; ky < kernel_height; ky++) {
+        const datum* in = input + imap * input_plane +
+                          (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                          shape.input_width + ox * shape.stride_x;
+
+        for (unsigned int kx = 0; kx < kernel_width; kx++) {
+          for (unsigned int b = 0; b < dc_block; b++)
+            acc[b] += w[b] * *in;
+
+          in += shape.dilation_x;
+          w += dc_block;
+        }
+      }
+    }
+
+    for (unsigned int b = maps; b > 0; b--)
+      out[b - 1][ox] = acc[b - 1] + bias[b - 1];
+  }
+}
+
+CN24_SIMD_TARGET
+static datum HorizontalSum (const CN24_SIMD_TYPE v) {
+  datum lanes[CN24_SIMD_WIDTH];
+  CN24_SIMD_STORE (lanes, v);
+
+  datum sum = 0;
+  for (unsigned int l = 0; l < CN24_SIMD_WIDTH; l++)
+    sum += lanes[l];
+
+  return sum;
+}
+
+/*
+ * Computes row ky of the weight gradient for input map imap and up to two
+ * output maps, starting at omap, over the output rows [row_begin,
+ * row_end) of all samples (counted across samples). Four horizontal
+ * kernel positions are handled at once, so each output gradient vector
+ * is loaded once for eight products.
+ *
+ * If bias_delta is not nullptr, the bias gradient of the output maps is
+ * summed up over the same rows while the output gradient is loaded anyway.
+ */
+CN24_SIMD_TARGET
+static void WeightGradientRow (const ConvolutionShape& shape,
+                               const datum* input, const datum* output_delta,
+                               datum* weights_delta, datum* bias_delta,
+                               const unsigned int omap,
+                               const unsigned int maps, const unsigned int imap,
+                               const unsigned int ky,
+                               const unsigned int row_begin,
+                               const unsigned int row_end) {
+  const unsigned int width = CN24_SIMD_WIDTH;
+  const std::size_t input_plane = (std::size_t) shape.input_width * shape.input_height;
+  const std::size_t output_plane = (std::size_t) shape.output_width * shape.output_height;
+  const unsigned int dx = shape.dilation_x;
+  const unsigned int vector_end = shape.stride_x == 1 ?
+                                  shape.output_width - shape.output_width % width : 0;
+
+  for (unsigned int kx0 = 0; kx0 < shape.kernel_width; kx0 += 4) {
+    const unsigned int kc = shape.kernel_width - kx0 < 4 ? shape.kernel_width - kx0 : 4;
+    const bool bias = bias_delta != nullptr && kx0 == 0;
+
+    CN24_SIMD_TYPE a00 = CN24_SIMD_ZERO(), a01 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a02 = CN24_SIMD_ZERO(), a03 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a10 = CN24_SIMD_ZERO(), a11 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE a12 = CN24_SIMD_ZERO(), a13 = CN24_SIMD_ZERO();
+    CN24_SIMD_TYPE b0 = CN24_SIMD_ZERO(), b1 = CN24_SIMD_ZERO();
+    datum s0[4] = {0}, s1[4] = {0};
+    datum t0 = 0, t1 = 0;
+
+    for (unsigned int row = row_begin; row < row_end; row++) {
+      const unsigned int sample = row / shape.output_height;
+      const unsigned int oy = row % shape.output_height;
+      const datum* dy0 = output_delta + sample * shape.output_stride() +
+                         (std::size_t) omap * output_plane +
+                         (std::size_t) oy * shape.output_width;
+      const datum* dy1 = maps > 1 ? dy0 + output_plane : dy0;
+      const datum* xr = input + sample * shape.input_stride() + imap * input_plane +
+                        (std::size_t) (oy * shape.stride_y + ky * shape.dilation_y) *
+                        shape.input_width + kx0 * dx;
+
+      if (kc == 4) {
+        for (unsigned int ox = 0; ox < vector_end; ox += width) {
+          const CN24_SIMD_TYPE d0 = CN24_SIMD_LOAD (dy0 + ox);
+          const CN24_SIMD_TYPE d1 = CN24_SIMD_LOAD (dy1 + ox);
+          CN24_SIMD_TYPE xv = CN24_SIMD_LOAD (xr + ox);
+          a00 = CN24_SIMD_FMA (d0, xv, a00);
+          a10 = CN24_SIMD_FMA (d1, xv, a10);
+          xv = CN24_SIMD_LOAD (xr + ox + dx);
+          a01 = CN24_SIMD_FMA (d0, xv, a01);
+          a11 = CN24_SIMD_FMA (d1, xv, a11);
+          xv = CN24_SIMD_LOAD (xr + ox + 2 * dx);
+          a02 = CN24_SIMD_FMA (d0, xv, a02);
+          a12 = CN24_SIMD_FMA (d1, xv, a12);
+          xv = CN24_SIMD_LOAD (xr + ox + 3 * dx);
+          a03 = CN24_SIMD_FMA (d0, xv, a03);
+          a13 = CN24_SIMD_FMA (d1, xv, a13);
+
+          if (bias) {
+            b0 = CN24_SIMD_ADD (b0, d0);
+            b1 = CN24_SIMD_ADD (b1, d1);
+          }
+        }
+      } else {
+        // Don't read past the end of the row for narrow kernel tails
+        for (unsigned int ox = 0; ox < vector_end; ox += width) {
+          const CN24_SIMD_TYPE d0 = CN24_SIMD_LOAD (dy0 + ox);
+          const CN24_SIMD_TYPE d1 = CN24_SIMD_LOAD (dy1 + ox);
+          CN24_SIMD_TYPE xv = CN24_SIMD_LOAD (xr + ox);
+          a00 = CN24_SIMD_FMA (d0, xv, a00);
+          a10 = CN24_SIMD_FMA (d1, xv, a10);
+
+          if (kc > 1) {
+            xv = CN24_SIMD_LOAD (xr + ox + dx);
+            a01 = CN24_SIMD_FMA (d0, xv, a01);
+            a11 = CN24_SIMD_FMA (d1, xv, a11);
+          }
+
+          if (kc > 2) {
+            xv = CN24_SIMD_LOAD (xr + ox + 2 * dx);
+            a02 = CN24_SIMD_FMA (d0, xv, a02);
+            a12 = CN24_SIMD_FMA (d1, xv, a12);
+          }
+
+          if (bias) {
+            b0 = CN24_SIMD_ADD (b0, d0);
+            b1 = CN24_SIMD_ADD (b1, d1);
+          }
+        }
+      }
+
+      for (unsigned int ox = vector_end; ox < shape.output_width; ox++) {
+        const datum* xp = xr + ox * shape.stride_x;
+
+        for (unsigned int c = 0; c < kc; c++) {
+          s0[c] += dy0[ox] * xp[c * dx];
+          s1[c] += dy1[ox] * xp[c * dx];
+        }
+
+        if (bias) {
+          t0 += dy0[ox];
+          t1 += dy1[ox];
+        }
+      }
+    }
+
+    s0[0] += HorizontalSum (a00);
+    s0[1] += HorizontalSum (a01);
+    s0[2] += HorizontalSum (a02);
+    s0[3] += HorizontalSum (a03);
+    s1[0] += HorizontalSum (a10);
+    s1[1] += HorizontalSum (a11);
+    s1[2] += HorizontalSum (a12);
+    s1[3] += HorizontalSum (a13);
+
+    for (unsigned int m = 0; m < maps; m++) {
+      datum* dw = weights_delta +
+                  (((std::size_t) (omap + m) * shape.input_maps + imap) *
+                   shape.kernel_height + ky) * shape.kernel_width + kx0;
+
+      for (unsigned int c = 0; c < kc; c++)
+        dw[c] = m == 0 ? s0[c] : s1[c];
+    }
+
+    if (bias) {
+      bias_delta[omap] = t0 + HorizontalSum (b0);
+
+      if (maps > 1)
+        bias_delta[omap + 1] = t1 + HorizontalSum (b1);
+    }
+  }
+}
+
+/*
+ * Fills the kernel table with the kernels for this instruction set
+ */
+static void GetKernels (DirectConvolutionKernels& kernels) {
+  kernels.forward_row[0] = ForwardRow<0, 0>;
+  kernels.forward_row[1] = ForwardRow<1, 1>;
+  kernels.forward_row[2] = ForwardRow<3, 3>;
+  kernels.forward_row[3] = ForwardRow<5, 5>;
+  kernels.forward_row[4] = ForwardRow<7, 7>;
+  kernels.weight_gradient_row = WeightGradientRow;
+}
+
+}
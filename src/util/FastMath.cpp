@@ -0,0 +1,61 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file FastMath.cpp
+ * @brief Accuracy setting for the activation function kernels.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include <cstdlib>
+#include <cstring>
+
+#include "Log.h"
+#include "FastMath.h"
+
+namespace Conv {
+
+static MathAccuracy InitialAccuracy() {
+  const char* setting = std::getenv ("CN24_MATH");
+
+  if (setting != nullptr) {
+    for (int a = MATH_EXACT; a <= MATH_FAST; a++) {
+      if (std::strcmp (setting, FastMath::AccuracyName ((MathAccuracy) a)) == 0)
+        return (MathAccuracy) a;
+    }
+
+    LOGWARN << "Unknown math accuracy \"" << setting << "\"";
+  }
+
+  return MATH_EXACT;
+}
+
+static MathAccuracy& CurrentAccuracy() {
+  static MathAccuracy accuracy = InitialAccuracy();
+  return accuracy;
+}
+
+MathAccuracy FastMath::Accuracy() {
+  return CurrentAccuracy();
+}
+
+void FastMath::SetAccuracy (const MathAccuracy accuracy) {
+  CurrentAccuracy() = accuracy;
+}
+
+const char* FastMath::AccuracyName (const MathAccuracy accuracy) {
+  switch (accuracy) {
+  case MATH_PRECISE:
+    return "precise";
+  case MATH_FAST:
+    return "fast";
+  default:
+    return "exact";
+  }
+}
+
+}
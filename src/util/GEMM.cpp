@@ -0,0 +1,409 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file GEMM.cpp
+ * @brief Built-in cache-blocked SGEMM.
+ *
+ * The structure follows the well-known Goto/BLIS scheme: C is split into
+ * MC x NC macro tiles, the k dimension into KC blocks. For every block,
+ * a MC x KC part of A and a KC x NC part of B are copied into contiguous
+ * panels (MR rows and NR columns wide, respectively). The micro-kernel
+ * then computes MR x NR tiles of C entirely in registers.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#ifdef BLAS_INTERNAL
+#include <algorithm>
+#include <vector>
+
+#include "Config.h"
+#include "Log.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+
+#include "GEMM.h"
+
+#ifdef CN24_X86
+#include <immintrin.h>
+#endif
+
+namespace Conv {
+
+// Register block sizes. 6x8 uses 12 of the 16 SSE registers for C, or
+// 6 of the 16 AVX registers.
+const int gemm_mr = 6;
+const int gemm_nr = 8;
+
+// Cache block sizes. A packed MC x KC block of A should stay in L2,
+// a KC x NR sliver of B in L1.
+const int gemm_mc = 96;
+const int gemm_kc = 256;
+const int gemm_nc = 2048;
+
+// Upper limit for the k-split scratch memory (in elements)
+const std::size_t gemm_max_split_elements = 16 * 1024 * 1024;
+
+struct GEMMOperands {
+  bool trans_a;
+  bool trans_b;
+  const datum* a;
+  int lda;
+  const datum* b;
+  int ldb;
+  datum alpha;
+
+  inline datum A (const int i, const int p) const {
+    return trans_a ? a[(std::size_t) p * lda + i] : a[(std::size_t) i * lda + p];
+  }
+
+  inline datum B (const int p, const int j) const {
+    return trans_b ? b[(std::size_t) j * ldb + p] : b[(std::size_t) p * ldb + j];
+  }
+};
+
+static inline int RoundUp (const int x, const int multiple) {
+  return ( (x + multiple - 1) / multiple) * multiple;
+}
+
+/*
+ * Copies the mc x kc block of alpha * A starting at (ic, pc) into row
+ * panels of height MR. Missing rows at the bottom are filled with zeros.
+ */
+static void PackA (const GEMMOperands& op, const int ic, const int pc,
+                   const int mc, const int kc, datum* packed) {
+  for (int ir = 0; ir < mc; ir += gemm_mr) {
+    const int mr = std::min (gemm_mr, mc - ir);
+
+    for (int p = 0; p < kc; p++) {
+      for (int i = 0; i < mr; i++)
+        packed[i] = op.alpha * op.A (ic + ir + i, pc + p);
+
+      for (int i = mr; i < gemm_mr; i++)
+        packed[i] = 0;
+
+      packed += gemm_mr;
+    }
+  }
+}
+
+/*
+ * Copies the kc x nc block of B starting at (pc, jc) into column panels
+ * of width NR. Missing columns on the right are filled with zeros.
+ */
+static void PackB (const GEMMOperands& op, const int pc, const int jc,
+                   const int kc, const int nc, datum* packed) {
+  for (int jr = 0; jr < nc; jr += gemm_nr) {
+    const int nr = std::min (gemm_nr, nc - jr);
+
+    for (int p = 0; p < kc; p++) {
+      for (int j = 0; j < nr; j++)
+        packed[j] = op.B (pc + p, jc + jr + j);
+
+      for (int j = nr; j < gemm_nr; j++)
+        packed[j] = 0;
+
+      packed += gemm_nr;
+    }
+  }
+}
+
+struct GEMMKernels {
+  void (*micro_kernel) (const int kc, const datum* a, const datum* b,
+                        datum* c, const int ldc);
+};
+
+#define CN24_SIMD_KERNELS "GEMMKernels.inl"
+#include "SIMDKernels.inl"
+#undef CN24_SIMD_KERNELS
+
+static GEMMKernels SelectKernels() {
+  GEMMKernels kernels;
+  SIMDScalar::GetKernels (kernels);
+
+#ifdef CN24_X86
+  switch (CPUFeatures::Level()) {
+  case SIMD_AVX512:
+  case SIMD_AVX2:
+    // The micro-tiles are too narrow for AVX-512 vectors
+    SIMDAVX2::GetKernels (kernels);
+    break;
+  case SIMD_SSE:
+    SIMDSSE::GetKernels (kernels);
+    break;
+  default:
+    break;
+  }
+#endif
+
+  return kernels;
+}
+
+static const GEMMKernels& Kernels() {
+  static const GEMMKernels kernels = SelectKernels();
+  return kernels;
+}
+
+static void ScaleBlock (datum* c, const int ldc, const int mc, const int nc,
+                        const datum beta) {
+  if (beta == 1)
+    return;
+
+  for (int i = 0; i < mc; i++) {
+    datum* row = c + (std::size_t) i * ldc;
+
+    // Don't multiply here, NaNs in C must not survive beta = 0
+    if (beta == 0) {
+      for (int j = 0; j < nc; j++)
+        row[j] = 0;
+    } else {
+      for (int j = 0; j < nc; j++)
+        row[j] *= beta;
+    }
+  }
+}
+
+/*
+ * Adds alpha * A(ic:ic+mc, k0:k1) * B(k0:k1, jc:jc+nc) to the block of C
+ * that c points to. If prepacked_a is not nullptr, it contains all of A
+ * as packed by SGEMMPackA and the panels are taken from there.
+ */
+static void MacroTile (const GEMMOperands& op, const int m, const int ic,
+                       const int mc, const int jc, const int nc, const int k0,
+                       const int k1, datum* c, const int ldc,
+                       const datum* prepacked_a,
+                       datum* packed_a, datum* packed_b) {
+  const GEMMKernels& kernels = Kernels();
+
+  for (int pc = k0; pc < k1; pc += gemm_kc) {
+    const int kc = std::min (gemm_kc, k1 - pc);
+
+    PackB (op, pc, jc, kc, nc, packed_b);
+
+    // Every block of kc columns of a prepacked A holds the panels of all
+    // rows
+    const datum* a_block = packed_a;
+
+    if (prepacked_a != nullptr) {
+      a_block = prepacked_a + (std::size_t) pc * RoundUp (m, gemm_mr) +
+                (std::size_t) ic * kc;
+    } else {
+      PackA (op, ic, pc, mc, kc, packed_a);
+    }
+
+    for (int jr = 0; jr < nc; jr += gemm_nr) {
+      const int nr = std::min (gemm_nr, nc - jr);
+
+      for (int ir = 0; ir < mc; ir += gemm_mr) {
+        const int mr = std::min (gemm_mr, mc - ir);
+        const datum* a_panel = a_block + (std::size_t) ir * kc;
+        const datum* b_panel = packed_b + (std::size_t) jr * kc;
+        datum* c_tile = c + (std::size_t) ir * ldc + jr;
+
+        if (mr == gemm_mr && nr == gemm_nr) {
+          kernels.micro_kernel (kc, a_panel, b_panel, c_tile, ldc);
+        } else {
+          // Edge tile, compute into a scratch tile and copy what's valid
+          datum tile[gemm_mr * gemm_nr] = {0};
+          kernels.micro_kernel (kc, a_panel, b_panel, tile, gemm_nr);
+
+          for (int i = 0; i < mr; i++) {
+            for (int j = 0; j < nr; j++) {
+              c_tile[(std::size_t) i * ldc + j] += tile[i * gemm_nr + j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+ * Computes C = op.alpha * op(A) * op(B) + beta * C for row major C
+ */
+static void Multiply (const GEMMOperands& op, const int m, const int n,
+                      const int k, const datum beta, datum* c, const int ldc,
+                      const datum* prepacked_a) {
+  const int m_blocks = (m + gemm_mc - 1) / gemm_mc;
+  const int n_blocks = (n + gemm_nc - 1) / gemm_nc;
+  const int tiles = m_blocks * n_blocks;
+  const int k_blocks = (k + gemm_kc - 1) / gemm_kc;
+
+  // Small products only need small packing buffers
+  const std::size_t packed_a_size = (std::size_t) std::min (k, gemm_kc) *
+                                    RoundUp (std::min (m, gemm_mc), gemm_mr);
+  const std::size_t packed_b_size = (std::size_t) std::min (k, gemm_kc) *
+                                    RoundUp (std::min (n, gemm_nc), gemm_nr);
+
+  const int threads = (int) ThreadPool::Threads();
+
+  // Split k if there is not enough work for every thread otherwise
+  int k_splits = 1;
+
+  if (tiles < threads && k_blocks > 1) {
+    k_splits = std::min (threads, k_blocks);
+
+    while (k_splits > 1 &&
+           (std::size_t) m * n * k_splits > gemm_max_split_elements)
+      k_splits--;
+  }
+
+  // Packing buffers for every thread, allocated on first use
+  std::vector<std::vector<datum>> packed_a_buffers (threads);
+  std::vector<std::vector<datum>> packed_b_buffers (threads);
+  const auto packing_buffers = [&] (const unsigned int thread) {
+    if (packed_b_buffers[thread].empty()) {
+      packed_a_buffers[thread].resize (prepacked_a == nullptr ? packed_a_size : 0);
+      packed_b_buffers[thread].resize (packed_b_size);
+    }
+  };
+
+  if (k_splits == 1) {
+    ThreadPool::ParallelRange (tiles, [&] (const std::size_t begin,
+                                           const std::size_t end,
+                                           const unsigned int thread) {
+      packing_buffers (thread);
+      std::vector<datum>& packed_a = packed_a_buffers[thread];
+      std::vector<datum>& packed_b = packed_b_buffers[thread];
+
+      for (int t = (int) begin; t < (int) end; t++) {
+        const int ic = (t / n_blocks) * gemm_mc;
+        const int jc = (t % n_blocks) * gemm_nc;
+        const int mc = std::min (gemm_mc, m - ic);
+        const int nc = std::min (gemm_nc, n - jc);
+        datum* c_block = c + (std::size_t) ic * ldc + jc;
+
+        ScaleBlock (c_block, ldc, mc, nc, beta);
+        MacroTile (op, m, ic, mc, jc, nc, 0, k, c_block, ldc, prepacked_a,
+                   packed_a.data(), &packed_b[0]);
+      }
+    });
+  } else {
+    std::vector<datum> partial ((std::size_t) m * n * k_splits);
+
+    ThreadPool::ParallelRange (tiles * k_splits, [&] (const std::size_t begin,
+                               const std::size_t end,
+                               const unsigned int thread) {
+      packing_buffers (thread);
+      std::vector<datum>& packed_a = packed_a_buffers[thread];
+      std::vector<datum>& packed_b = packed_b_buffers[thread];
+
+      for (int t = (int) begin; t < (int) end; t++) {
+        const int split = t / tiles;
+        const int tile = t % tiles;
+        const int ic = (tile / n_blocks) * gemm_mc;
+        const int jc = (tile % n_blocks) * gemm_nc;
+        const int mc = std::min (gemm_mc, m - ic);
+        const int nc = std::min (gemm_nc, n - jc);
+        const int k0 = ( (split * k_blocks) / k_splits) * gemm_kc;
+        const int k1 = std::min (k, ( ( (split + 1) * k_blocks) / k_splits) * gemm_kc);
+        datum* c_block = &partial[ (std::size_t) split * m * n] +
+                         (std::size_t) ic * n + jc;
+
+        ScaleBlock (c_block, n, mc, nc, 0);
+        MacroTile (op, m, ic, mc, jc, nc, k0, k1, c_block, n, prepacked_a,
+                   packed_a.data(), &packed_b[0]);
+      }
+    });
+
+    // Sum up the partial products in a fixed order so that the result
+    // does not depend on the scheduling
+    ThreadPool::ParallelFor (m, [&] (const int i) {
+      datum* row = c + (std::size_t) i * ldc;
+
+      for (int j = 0; j < n; j++) {
+        datum sum = 0;
+
+        for (int split = 0; split < k_splits; split++)
+          sum += partial[ (std::size_t) split * m * n + (std::size_t) i * n + j];
+
+        row[j] = (beta == 0) ? sum : beta * row[j] + sum;
+      }
+    });
+  }
+}
+
+
+void SGEMM (const int order, const int trans_a, const int trans_b,
+            const int m, const int n, const int k,
+            const datum alpha, const datum* a, const int lda,
+            const datum* b, const int ldb,
+            const datum beta, datum* c, const int ldc) {
+  // Column major C is row major C', and C' = B' * A'
+  if (order == CblasColMajor) {
+    SGEMM (CblasRowMajor, trans_b, trans_a, n, m, k, alpha, b, ldb, a, lda,
+           beta, c, ldc);
+    return;
+  }
+
+  if (m <= 0 || n <= 0)
+    return;
+
+  if (k <= 0 || alpha == 0) {
+    ScaleBlock (c, ldc, m, n, beta);
+    return;
+  }
+
+  GEMMOperands op;
+  op.trans_a = trans_a != CblasNoTrans;
+  op.trans_b = trans_b != CblasNoTrans;
+  op.a = a;
+  op.lda = lda;
+  op.b = b;
+  op.ldb = ldb;
+  op.alpha = alpha;
+
+  Multiply (op, m, n, k, beta, c, ldc, nullptr);
+}
+
+std::size_t SGEMMPackedSize (const int m, const int k) {
+  return (std::size_t) RoundUp (m, gemm_mr) * k;
+}
+
+void SGEMMPackA (const int trans_a, const int m, const int k,
+                 const datum alpha, const datum* a, const int lda,
+                 datum* packed) {
+  GEMMOperands op;
+  op.trans_a = trans_a != CblasNoTrans;
+  op.a = a;
+  op.lda = lda;
+  op.alpha = alpha;
+
+  // The same blocks of kc columns that MacroTile works on, each with the
+  // row panels of all of A
+  for (int pc = 0; pc < k; pc += gemm_kc) {
+    const int kc = std::min (gemm_kc, k - pc);
+    PackA (op, 0, pc, m, kc, packed + (std::size_t) pc * RoundUp (m, gemm_mr));
+  }
+}
+
+void SGEMMPacked (const int m, const int n, const int k,
+                  const datum* packed_a, const int trans_b, const datum* b,
+                  const int ldb, const datum beta, datum* c, const int ldc) {
+  if (m <= 0 || n <= 0)
+    return;
+
+  if (k <= 0) {
+    ScaleBlock (c, ldc, m, n, beta);
+    return;
+  }
+
+  GEMMOperands op;
+  op.trans_a = false;
+  op.trans_b = trans_b != CblasNoTrans;
+  op.a = nullptr;
+  op.lda = 0;
+  op.b = b;
+  op.ldb = ldb;
+  op.alpha = 1;
+
+  Multiply (op, m, n, k, beta, c, ldc, packed_a);
+}
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * SGEMM micro-kernels, included once per instruction set by
+ * SIMDKernels.inl. A row of a micro-tile is 8 wide, which is why there is
+ * nothing here for vectors wider than that.
+ */
+
+#if CN24_SIMD_WIDTH <= 8
+namespace CN24_SIMD_NAMESPACE {
+
+/*
+ * Adds the product of an MR x kc panel of A and a kc x NR panel of B
+ * to the MR x NR tile of C. The whole tile is kept in registers.
+ */
+CN24_SIMD_TARGET
+static void GEMMMicroKernel (const int kc, const datum* a, const datum* b,
+                             datum* c, const int ldc) {
+  const int width = CN24_SIMD_WIDTH;
+  const int vectors = gemm_nr / CN24_SIMD_WIDTH;
+  CN24_SIMD_TYPE acc[gemm_mr][gemm_nr / CN24_SIMD_WIDTH];
+
+  for (int i = 0; i < gemm_mr; i++) {
+    for (int v = 0; v < vectors; v++)
+      acc[i][v] = CN24_SIMD_ZERO();
+  }
+
+  for (int p = 0; p < kc; p++) {
+    CN24_SIMD_TYPE bv[gemm_nr / CN24_SIMD_WIDTH];
+
+    for (int v = 0; v < vectors; v++)
+      bv[v] = CN24_SIMD_LOAD (b + v * width);
+
+    for (int i = 0; i < gemm_mr; i++) {
+      const CN24_SIMD_TYPE ai = CN24_SIMD_SET1 (a[i]);
+
+      for (int v = 0; v < vectors; v++)
+        acc[i][v] = CN24_SIMD_FMA (ai, bv[v], acc[i][v]);
+    }
+
+    a += gemm_mr;
+    b += gemm_nr;
+  }
+
+  for (int i = 0; i < gemm_mr; i++) {
+    datum* row = c + (std::size_t) i * ldc;
+
+    for (int v = 0; v < vectors; v++)
+      CN24_SIMD_STORE (row + v * width,
+                       CN24_SIMD_ADD (CN24_SIMD_LOAD (row + v * width), acc[i][v]));
+  }
+}
+
+/*
+ * Fills the kernel table with the kernels for this instruction set
+ */
+static void GetKernels (GEMMKernels& kernels) {
+  kernels.micro_kernel = GEMMMicroKernel;
+}
+
+}
+#endif
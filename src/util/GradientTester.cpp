@@ -5,8 +5,13 @@
  * For licensing information, see the LICENSE file included with this project.
  */  
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "Log.h"
 #include "Net.h"
+#include "FastMath.h"
 #include "GradientTester.h"
 
 namespace Conv {
@@ -37,6 +42,7 @@ void GradientTester::TestGradient ( Net& net ) {
 	const datum old_param = param->data(e);
 	
 	param->data[e] = old_param + epsilon;
+	net.layers_[l]->InvalidateParameters();
 	net.FeedForward();
 	const double plus_loss = net.lossfunction_layer()->CalculateLossFunction();
 	
@@ -44,6 +50,7 @@ void GradientTester::TestGradient ( Net& net ) {
 	param->data.MoveToCPU();
 #endif
 	param->data[e] = old_param - epsilon;
+	net.layers_[l]->InvalidateParameters();
 	net.FeedForward();
 	const double minus_loss = net.lossfunction_layer()->CalculateLossFunction();
 	
@@ -69,6 +76,7 @@ void GradientTester::TestGradient ( Net& net ) {
 	param->data.MoveToCPU();
 #endif
 	param->data[e] = old_param;
+	net.layers_[l]->InvalidateParameters();
       }
       std::cout << "\n";
       if(passed) {
@@ -81,5 +89,89 @@ void GradientTester::TestGradient ( Net& net ) {
   }
 }
 
-  
-}
\ No newline at end of file
+/*
+ * Copies every layer's outputs and every parameter's gradient
+ */
+static void CollectResults ( std::vector<Tensor*>& tensors,
+                             std::vector<std::vector<datum>>& results ) {
+  results.resize ( tensors.size() );
+  for ( unsigned int t = 0; t < tensors.size(); t++ ) {
+#ifdef BUILD_OPENCL
+    tensors[t]->MoveToCPU();
+#endif
+    results[t].assign ( tensors[t]->data_ptr_const(),
+                        tensors[t]->data_ptr_const() + tensors[t]->elements() );
+  }
+}
+
+bool GradientTester::TestAccuracy ( Net& net ) {
+  const MathAccuracy old_accuracy = FastMath::Accuracy();
+
+  std::vector<Tensor*> tensors;
+  std::vector<std::string> names;
+  for ( unsigned int l = 0; l < net.layers_.size(); l++ ) {
+    for ( unsigned int b = 0; b < net.buffers_[l].size(); b++ ) {
+      tensors.push_back ( &net.buffers_[l][b]->data );
+      names.push_back ( "layer " + std::to_string ( l ) + ", output " +
+                        std::to_string ( b ) );
+    }
+    for ( unsigned int p = 0; p < net.layers_[l]->parameters().size(); p++ ) {
+      tensors.push_back ( &net.layers_[l]->parameters_[p]->delta );
+      names.push_back ( "layer " + std::to_string ( l ) + ", gradient " +
+                        std::to_string ( p ) );
+    }
+  }
+
+  LOGDEBUG << "Testing accuracy. Computing reference...";
+  FastMath::SetAccuracy ( MATH_EXACT );
+  net.FeedForward();
+  net.BackPropagate();
+  std::vector<std::vector<datum>> reference;
+  CollectResults ( tensors, reference );
+  const double reference_loss = net.lossfunction_layer()->CalculateLossFunction();
+
+  // The errors are relative to the largest value in each tensor. They grow
+  // a bit from layer to layer, so the tolerance is larger than the
+  // accuracy of a single function.
+  const MathAccuracy modes[] = { MATH_PRECISE, MATH_FAST };
+  const double tolerances[] = { 1e-4, 1e-2 };
+  bool passed = true;
+
+  for ( unsigned int m = 0; m < 2; m++ ) {
+    FastMath::SetAccuracy ( modes[m] );
+    net.FeedForward();
+    net.BackPropagate();
+    std::vector<std::vector<datum>> results;
+    CollectResults ( tensors, results );
+    const double loss = net.lossfunction_layer()->CalculateLossFunction();
+
+    double worst = 0;
+    for ( unsigned int t = 0; t < tensors.size(); t++ ) {
+      double scale = 0, error = 0;
+      for ( std::size_t e = 0; e < reference[t].size(); e++ ) {
+        scale = std::max ( scale, (double) std::fabs ( reference[t][e] ) );
+        error = std::max ( error, (double) std::fabs ( results[t][e] - reference[t][e] ) );
+      }
+      if ( scale > 0 )
+        error /= scale;
+
+      LOGDEBUG << FastMath::AccuracyName ( modes[m] ) << ", " << names[t] <<
+               ": " << error;
+      worst = std::max ( worst, error );
+    }
+
+    LOGINFO << "Accuracy \"" << FastMath::AccuracyName ( modes[m] ) <<
+            "\": largest relative error " << worst << ", loss " << loss <<
+            " instead of " << reference_loss;
+
+    if ( worst > tolerances[m] || !std::isfinite ( worst ) ) {
+      LOGERROR << "Failed!";
+      passed = false;
+    }
+  }
+
+  FastMath::SetAccuracy ( old_accuracy );
+  return passed;
+}
+
+}
@@ -0,0 +1,356 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+
+#ifdef BUILD_BLAS
+#include <cstring>
+
+#include "Config.h"
+#include "Log.h"
+#include "MKLHelper.h"
+#include "ThreadPool.h"
+
+#include "Im2ColConvolution.h"
+
+namespace Conv {
+
+Im2ColConvolution::Im2ColConvolution (const ConvolutionShape& shape,
+                                      const std::size_t workspace_size) :
+  shape_ (shape) {
+  pointwise_ = shape.kernel_width == 1 && shape.kernel_height == 1 &&
+               shape.stride_x == 1 && shape.stride_y == 1 && !shape.padded();
+
+  if (pointwise_) {
+    tile_rows_ = shape.output_height;
+    LOGDEBUG << "Using the input directly for 1x1 kernels";
+    return;
+  }
+
+  const std::size_t row_size = sizeof (datum) * shape.kernel_width *
+                               shape.kernel_height * shape.input_maps *
+                               shape.output_width;
+
+  tile_rows_ = (unsigned int) (workspace_size / row_size);
+
+  if (tile_rows_ < 1)
+    tile_rows_ = 1;
+
+  if (tile_rows_ > shape.output_height)
+    tile_rows_ = shape.output_height;
+
+  workspace_.Resize ( (std::size_t) shape.kernel_width * shape.kernel_height *
+                      shape.input_maps * shape.output_width * tile_rows_);
+
+  LOGDEBUG << "Unrolling " << tile_rows_ << " of " << shape.output_height <<
+           " rows at a time (" << workspace_.elements() * sizeof (datum) / 1024 <<
+           " KiB)";
+}
+
+std::size_t Im2ColConvolution::PackedSize() const {
+  const int k = (int) (shape_.kernel_width * shape_.kernel_height * shape_.input_maps);
+#ifdef BLAS_INTERNAL
+  return SGEMMPackedSize ((int) shape_.output_maps, k);
+#else
+  return (std::size_t) shape_.output_maps * k;
+#endif
+}
+
+void Im2ColConvolution::PackWeights (const datum* weights,
+                                     const datum weight_factor,
+                                     datum* packed) const {
+  const int k = (int) (shape_.kernel_width * shape_.kernel_height * shape_.input_maps);
+#ifdef BLAS_INTERNAL
+  SGEMMPackA (CblasNoTrans, (int) shape_.output_maps, k, weight_factor,
+              weights, k, packed);
+#else
+  // Other BLAS libraries have no portable interface for this, so at least
+  // the weight factor is applied in advance
+  const std::size_t elements = (std::size_t) shape_.output_maps * k;
+
+  for (std::size_t i = 0; i < elements; i++)
+    packed[i] = weight_factor * weights[i];
+#endif
+}
+
+void Im2ColConvolution::Forward (const datum* input, const datum* weights,
+                                 const datum* bias, const datum weight_factor,
+                                 datum* output,
+                                 const ConvolutionEpilogue epilogue) {
+  ForwardTiles (input, weights, weight_factor, false, bias, output, epilogue);
+}
+
+void Im2ColConvolution::ForwardPacked (const datum* input,
+                                       const datum* packed_weights,
+                                       const datum* bias, datum* output,
+                                       const ConvolutionEpilogue epilogue) {
+  ForwardTiles (input, packed_weights, 1.0, true, bias, output, epilogue);
+}
+
+void Im2ColConvolution::ForwardTiles (const datum* input, const datum* weights,
+                                      const datum weight_factor,
+                                      const bool packed, const datum* bias,
+                                      datum* output,
+                                      const ConvolutionEpilogue epilogue) {
+  const int k = (int) (shape_.kernel_width * shape_.kernel_height * shape_.input_maps);
+  const std::size_t input_sample = shape_.input_stride();
+  const std::size_t output_plane = (std::size_t) shape_.output_width *
+                                   shape_.output_height;
+
+  for (unsigned int sample = 0; sample < shape_.samples; sample++) {
+    for (unsigned int y0 = 0; y0 < shape_.output_height; y0 += tile_rows_) {
+      const unsigned int rows = (y0 + tile_rows_ <= shape_.output_height) ?
+                                tile_rows_ : shape_.output_height - y0;
+      const int n = (int) (rows * shape_.output_width);
+      datum* target = output + sample * shape_.output_stride() +
+                      (std::size_t) y0 * shape_.output_width;
+      const datum* col = input + sample * input_sample;
+      std::size_t ldcol = output_plane;
+
+      if (!pointwise_) {
+        Im2Col (input + sample * input_sample, y0, rows);
+        col = workspace_.data_ptr_const();
+        ldcol = n;
+      }
+
+      // Start with the bias, the GEMM adds the convolution
+      for (unsigned int omap = 0; omap < shape_.output_maps; omap++) {
+        datum* target_map = target + omap * output_plane;
+        for (int i = 0; i < n; i++)
+          target_map[i] = bias[omap];
+      }
+
+#ifdef BLAS_INTERNAL
+      if (packed)
+        SGEMMPacked (shape_.output_maps, n, k, weights, CblasNoTrans, col, ldcol,
+                     1.0, target, output_plane);
+      else
+#else
+      (void) packed;
+#endif
+        GEMM (CblasRowMajor, CblasNoTrans, CblasNoTrans, shape_.output_maps, n, k,
+              weight_factor, weights, k, col, ldcol, 1.0, target, output_plane);
+
+      if (epilogue != nullptr) {
+        ThreadPool::ParallelFor (shape_.output_maps, [&] (const int omap) {
+          epilogue (target + omap * output_plane, n);
+        });
+      }
+    }
+  }
+}
+
+void Im2ColConvolution::BackwardData (const datum* output_delta,
+                                      const datum* weights,
+                                      datum* input_delta) {
+  const int k = (int) (shape_.kernel_width * shape_.kernel_height * shape_.input_maps);
+  const std::size_t input_sample = shape_.input_stride();
+  const std::size_t output_plane = (std::size_t) shape_.output_width *
+                                   shape_.output_height;
+  datum* col = workspace_.data_ptr();
+
+  if (pointwise_) {
+    for (unsigned int sample = 0; sample < shape_.samples; sample++) {
+      GEMM (CblasRowMajor, CblasTrans, CblasNoTrans, k, output_plane,
+            shape_.output_maps, 1.0, weights, k,
+            output_delta + sample * shape_.output_stride(),
+            output_plane, 0.0, input_delta + sample * input_sample, output_plane);
+    }
+
+    return;
+  }
+
+  // Neighboring tiles overlap in the input, so everything is accumulated
+  for (unsigned int sample = 0; sample < shape_.samples; sample++)
+    std::memset (input_delta + sample * input_sample, 0, sizeof (datum) *
+                 shape_.input_maps * shape_.input_width * shape_.input_height);
+
+  for (unsigned int sample = 0; sample < shape_.samples; sample++) {
+    for (unsigned int y0 = 0; y0 < shape_.output_height; y0 += tile_rows_) {
+      const unsigned int rows = (y0 + tile_rows_ <= shape_.output_height) ?
+                                tile_rows_ : shape_.output_height - y0;
+      const int n = (int) (rows * shape_.output_width);
+      const datum* source = output_delta + sample * shape_.output_stride() +
+                            (std::size_t) y0 * shape_.output_width;
+
+      GEMM (CblasRowMajor, CblasTrans, CblasNoTrans, k, n, shape_.output_maps,
+            1.0, weights, k, source, output_plane, 0.0, col, n);
+
+      Col2Im (input_delta + sample * input_sample, y0, rows);
+    }
+  }
+}
+
+void Im2ColConvolution::WeightGradient (const datum* input,
+                                        const datum* output_delta,
+                                        datum* weights_delta) {
+  const int k = (int) (shape_.kernel_width * shape_.kernel_height * shape_.input_maps);
+  const std::size_t input_sample = shape_.input_stride();
+  const std::size_t output_plane = (std::size_t) shape_.output_width *
+                                   shape_.output_height;
+  bool first = true;
+
+  for (unsigned int sample = 0; sample < shape_.samples; sample++) {
+    for (unsigned int y0 = 0; y0 < shape_.output_height; y0 += tile_rows_) {
+      const unsigned int rows = (y0 + tile_rows_ <= shape_.output_height) ?
+                                tile_rows_ : shape_.output_height - y0;
+      const int n = (int) (rows * shape_.output_width);
+      const datum* source = output_delta + sample * shape_.output_stride() +
+                            (std::size_t) y0 * shape_.output_width;
+
+      const datum* col = input + sample * input_sample;
+      std::size_t ldcol = output_plane;
+
+      if (!pointwise_) {
+        Im2Col (input + sample * input_sample, y0, rows);
+        col = workspace_.data_ptr_const();
+        ldcol = n;
+      }
+
+      GEMM (CblasRowMajor, CblasNoTrans, CblasTrans, shape_.output_maps, k, n,
+            1.0, source, output_plane, col, ldcol, first ? 0.0 : 1.0,
+            weights_delta, k);
+      first = false;
+    }
+  }
+}
+
+/*
+ * Finds the output pixels [begin, end) of a row that read from inside the
+ * input row for a kernel tap at offset (relative to the input).
+ */
+static void InsideRange (const int offset, const unsigned int stride,
+                         const unsigned int input_size,
+                         const unsigned int output_size,
+                         unsigned int& begin, unsigned int& end) {
+  begin = offset >= 0 ? 0 : (unsigned int) ((-offset + (int) stride - 1) / (int) stride);
+
+  if (offset > (int) input_size - 1)
+    end = 0;
+  else
+    end = (unsigned int) (((int) input_size - 1 - offset) / (int) stride + 1);
+
+  if (end > output_size)
+    end = output_size;
+
+  if (begin > end)
+    begin = end;
+}
+
+datum Im2ColConvolution::PaddingValue (const datum* row, const int x) const {
+  return shape_.mirror_padding ? row[MirrorIndex (x, (int) shape_.input_width)] : 0;
+}
+
+void Im2ColConvolution::Im2Col (const datum* input, const unsigned int y0,
+                                const unsigned int rows) {
+  const unsigned int kernel_size = shape_.kernel_width * shape_.kernel_height;
+  const int k = (int) (kernel_size * shape_.input_maps);
+  const std::size_t n = (std::size_t) rows * shape_.output_width;
+  datum* col = workspace_.data_ptr();
+
+  ThreadPool::ParallelFor (k, [&] (const int row) {
+    const unsigned int imap = row / kernel_size;
+    const unsigned int ky = (row % kernel_size) / shape_.kernel_width;
+    const unsigned int kx = row % shape_.kernel_width;
+    const int offset_x = (int) (kx * shape_.dilation_x) - (int) shape_.pad_x;
+    datum* target = col + row * n;
+
+    unsigned int begin, end;
+    InsideRange (offset_x, shape_.stride_x, shape_.input_width,
+                 shape_.output_width, begin, end);
+
+    for (unsigned int y = 0; y < rows; y++) {
+      int iy = (int) ((y0 + y) * shape_.stride_y + ky * shape_.dilation_y) -
+               (int) shape_.pad_y;
+
+      if (iy < 0 || iy >= (int) shape_.input_height) {
+        if (!shape_.mirror_padding) {
+          std::memset (target, 0, sizeof (datum) * shape_.output_width);
+          target += shape_.output_width;
+          continue;
+        }
+
+        iy = MirrorIndex (iy, (int) shape_.input_height);
+      }
+
+      const datum* source = input + ( (std::size_t) imap * shape_.input_height + iy) *
+                            shape_.input_width;
+
+      if (shape_.stride_x == 1) {
+        std::memcpy (target + begin, source + begin + offset_x,
+                     sizeof (datum) * (end - begin));
+      } else {
+        for (unsigned int x = begin; x < end; x++)
+          target[x] = source[(int) (x * shape_.stride_x) + offset_x];
+      }
+
+      // Pixels in the padding
+      for (unsigned int x = 0; x < begin; x++)
+        target[x] = PaddingValue (source, (int) (x * shape_.stride_x) + offset_x);
+
+      for (unsigned int x = end; x < shape_.output_width; x++)
+        target[x] = PaddingValue (source, (int) (x * shape_.stride_x) + offset_x);
+
+      target += shape_.output_width;
+    }
+  });
+}
+
+void Im2ColConvolution::Col2Im (datum* input_delta, const unsigned int y0,
+                                const unsigned int rows) const {
+  const unsigned int kernel_size = shape_.kernel_width * shape_.kernel_height;
+  const std::size_t n = (std::size_t) rows * shape_.output_width;
+  const datum* col = workspace_.data_ptr_const();
+
+  // Different kernel positions hit the same input pixels, so only the
+  // maps can be processed in parallel
+  ThreadPool::ParallelFor (shape_.input_maps, [&] (const int imap) {
+    for (unsigned int ky = 0; ky < shape_.kernel_height; ky++) {
+      for (unsigned int kx = 0; kx < shape_.kernel_width; kx++) {
+        const int offset_x = (int) (kx * shape_.dilation_x) - (int) shape_.pad_x;
+        const datum* source = col + ( (std::size_t) imap * kernel_size +
+                                      ky * shape_.kernel_width + kx) * n;
+
+        unsigned int begin, end;
+        InsideRange (offset_x, shape_.stride_x, shape_.input_width,
+                     shape_.output_width, begin, end);
+
+        for (unsigned int y = 0; y < rows; y++, source += shape_.output_width) {
+          int iy = (int) ((y0 + y) * shape_.stride_y + ky * shape_.dilation_y) -
+                   (int) shape_.pad_y;
+
+          // Zero padding does not depend on the input, mirrored pixels
+          // pass their gradient on to the pixels they were copied from
+          if (iy < 0 || iy >= (int) shape_.input_height) {
+            if (!shape_.mirror_padding)
+              continue;
+
+            iy = MirrorIndex (iy, (int) shape_.input_height);
+          }
+
+          datum* target = input_delta + ( (std::size_t) imap * shape_.input_height + iy) *
+                          shape_.input_width;
+
+          for (unsigned int x = begin; x < end; x++)
+            target[(int) (x * shape_.stride_x) + offset_x] += source[x];
+
+          if (shape_.mirror_padding) {
+            for (unsigned int x = 0; x < begin; x++)
+              target[MirrorIndex ((int) (x * shape_.stride_x) + offset_x,
+                                  (int) shape_.input_width)] += source[x];
+
+            for (unsigned int x = end; x < shape_.output_width; x++)
+              target[MirrorIndex ((int) (x * shape_.stride_x) + offset_x,
+                                  (int) shape_.input_width)] += source[x];
+          }
+        }
+      }
+    }
+  });
+}
+
+}
+
+#endif
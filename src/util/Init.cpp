@@ -14,6 +14,9 @@
 #include "Init.h"
 #include "CLHelper.h"
 #include "Config.h"
+#include "CPUFeatures.h"
+#include "FastMath.h"
+#include "ThreadPool.h"
 #include "Log.h"
 
 #include <locale.h>
@@ -73,6 +76,14 @@ void System::Init() {
   GetExecutablePath(binary_path);
   LOGDEBUG << "Executable path: " << binary_path;
 
+  // Detect the instruction sets now, all kernel tables are filled from this
+  LOGINFO << "CPU: " << CPUFeatures::Model();
+  LOGINFO << "Using " << CPUFeatures::LevelName (CPUFeatures::Level()) <<
+          " kernels";
+  LOGINFO << "Math accuracy: " << FastMath::AccuracyName (FastMath::Accuracy());
+  LOGINFO << "Using " << ThreadPool::Threads() << " threads" <<
+          (ThreadPool::Affinity() ? ", pinned to cores" : "");
+
   CLHelper::Init();
 #ifdef BUILD_GUI
   if(!gtk_init_check ( nullptr, nullptr )) {
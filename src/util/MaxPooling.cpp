@@ -0,0 +1,234 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file MaxPooling.cpp
+ * @brief Max-pooling kernels with runtime instruction set selection.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "Config.h"
+#include "CPUFeatures.h"
+#include "ThreadPool.h"
+#include "MaxPooling.h"
+
+#ifdef CN24_X86
+#include <immintrin.h>
+#endif
+
+namespace Conv {
+
+typedef void (*PoolMapKernel) (const datum* input, datum* output,
+                               void* maximum,
+                               const unsigned int input_width,
+                               const unsigned int output_width,
+                               const unsigned int output_height,
+                               const unsigned int region_width,
+                               const unsigned int region_height,
+                               const unsigned int stride_x,
+                               const unsigned int stride_y);
+
+struct MaxPoolingKernels {
+  // The generic kernel first, then one for every size in pooling_sizes.
+  // These store the maxima as std::uint8_t.
+  PoolMapKernel pool_map[3];
+
+  // Generic kernel for regions that are too large for that
+  PoolMapKernel pool_map_wide;
+};
+
+/*
+ * Region sizes with their own kernel
+ */
+static const struct {
+  unsigned int width;
+  unsigned int height;
+} pooling_sizes[] = {
+  { 2, 2 },
+  { 3, 3 }
+};
+
+#define CN24_SIMD_KERNELS "MaxPoolingKernels.inl"
+#include "SIMDKernels.inl"
+#undef CN24_SIMD_KERNELS
+
+static MaxPoolingKernels SelectKernels() {
+  MaxPoolingKernels kernels;
+  SIMDScalar::GetKernels (kernels);
+
+#ifdef CN24_X86
+  switch (CPUFeatures::Level()) {
+  case SIMD_AVX512:
+    SIMDAVX512::GetKernels (kernels);
+    break;
+  case SIMD_AVX2:
+    SIMDAVX2::GetKernels (kernels);
+    break;
+  case SIMD_SSE:
+    SIMDSSE::GetKernels (kernels);
+    break;
+  default:
+    break;
+  }
+#endif
+
+  return kernels;
+}
+
+static const MaxPoolingKernels& Kernels() {
+  static const MaxPoolingKernels kernels = SelectKernels();
+  return kernels;
+}
+
+/*
+ * Scatters the gradient of one map. If the regions tile the map, the input
+ * rows of one output row are cleared right before the scatter, while they
+ * are in the cache anyway. Otherwise, the map is cleared first and the
+ * gradients are added up.
+ */
+template <unsigned int fixed_width, unsigned int fixed_height, typename Index>
+static void UnpoolMap (const datum* output_delta, const Index* maximum,
+                       datum* input_delta, const unsigned int input_width,
+                       const unsigned int input_height,
+                       const unsigned int output_width,
+                       const unsigned int output_height,
+                       const unsigned int region_width,
+                       const unsigned int region_height,
+                       const unsigned int stride_x,
+                       const unsigned int stride_y) {
+  const unsigned int rw = fixed_width > 0 ? fixed_width : region_width;
+  const unsigned int rh = fixed_height > 0 ? fixed_height : region_height;
+
+  if (stride_x == rw && stride_y == rh) {
+    for (unsigned int oy = 0; oy < output_height; oy++) {
+      const datum* output_row = output_delta + (std::size_t) oy * output_width;
+      const Index* maximum_row = maximum + (std::size_t) oy * output_width;
+      datum* input_rows = input_delta + (std::size_t) oy * rh * input_width;
+
+      std::fill (input_rows, input_rows + (std::size_t) rh * input_width, (datum) 0);
+
+      for (unsigned int ox = 0; ox < output_width; ox++) {
+        const unsigned int position = (unsigned int) maximum_row[ox];
+        input_rows[ (position / rw) * input_width + ox * rw + position % rw] =
+          output_row[ox];
+      }
+    }
+
+    return;
+  }
+
+  std::fill (input_delta, input_delta + (std::size_t) input_width * input_height,
+             (datum) 0);
+
+  for (unsigned int oy = 0; oy < output_height; oy++) {
+    const datum* output_row = output_delta + (std::size_t) oy * output_width;
+    const Index* maximum_row = maximum + (std::size_t) oy * output_width;
+    datum* input_rows = input_delta + (std::size_t) oy * stride_y * input_width;
+
+    for (unsigned int ox = 0; ox < output_width; ox++) {
+      const unsigned int position = (unsigned int) maximum_row[ox];
+      input_rows[ (position / rw) * input_width + ox * stride_x + position % rw] +=
+        output_row[ox];
+    }
+  }
+}
+
+template <unsigned int fixed_width, unsigned int fixed_height, typename Index>
+static void UnpoolMaps (const datum* output_delta, const void* maximum,
+                        datum* input_delta, const unsigned int maps,
+                        const unsigned int input_width,
+                        const unsigned int input_height,
+                        const unsigned int region_width,
+                        const unsigned int region_height,
+                        const unsigned int stride_x,
+                        const unsigned int stride_y) {
+  const unsigned int output_width = (input_width - region_width) / stride_x + 1;
+  const unsigned int output_height = (input_height - region_height) / stride_y + 1;
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    const std::size_t input_offset = (std::size_t) map * input_width * input_height;
+    const std::size_t output_offset = (std::size_t) map * output_width * output_height;
+    UnpoolMap<fixed_width, fixed_height, Index> (output_delta + output_offset,
+        (const Index*) maximum + output_offset, input_delta + input_offset,
+        input_width, input_height, output_width, output_height, region_width,
+        region_height, stride_x, stride_y);
+  });
+}
+
+std::size_t MaxPooling::IndexSize (const unsigned int region_width,
+                                   const unsigned int region_height) {
+  return region_width * region_height <= 256 ? sizeof (std::uint8_t) :
+         sizeof (std::int32_t);
+}
+
+void MaxPooling::Forward (const datum* input, datum* output, void* maximum,
+                          const unsigned int maps,
+                          const unsigned int input_width,
+                          const unsigned int input_height,
+                          const unsigned int region_width,
+                          const unsigned int region_height,
+                          const unsigned int stride_x,
+                          const unsigned int stride_y) {
+  const unsigned int output_width = (input_width - region_width) / stride_x + 1;
+  const unsigned int output_height = (input_height - region_height) / stride_y + 1;
+  const std::size_t output_plane = (std::size_t) output_width * output_height;
+  const std::size_t index_size = IndexSize (region_width, region_height);
+
+  // Pick a kernel for the region size
+  PoolMapKernel pool_map = Kernels().pool_map_wide;
+
+  if (index_size == sizeof (std::uint8_t)) {
+    pool_map = Kernels().pool_map[0];
+
+    for (unsigned int k = 0; k < sizeof (pooling_sizes) / sizeof (pooling_sizes[0]); k++) {
+      if (pooling_sizes[k].width == region_width &&
+          pooling_sizes[k].height == region_height)
+        pool_map = Kernels().pool_map[k + 1];
+    }
+  }
+
+  ThreadPool::ParallelFor (maps, [&] (const int map) {
+    const std::size_t input_offset = (std::size_t) map * input_width * input_height;
+    const std::size_t output_offset = (std::size_t) map * output_plane;
+    pool_map (input + input_offset, output + output_offset,
+              (char*) maximum + output_offset * index_size, input_width,
+              output_width, output_height, region_width, region_height,
+              stride_x, stride_y);
+  });
+}
+
+void MaxPooling::Backward (const datum* output_delta, const void* maximum,
+                           datum* input_delta, const unsigned int maps,
+                           const unsigned int input_width,
+                           const unsigned int input_height,
+                           const unsigned int region_width,
+                           const unsigned int region_height,
+                           const unsigned int stride_x,
+                           const unsigned int stride_y) {
+  if (IndexSize (region_width, region_height) != sizeof (std::uint8_t))
+    UnpoolMaps<0, 0, std::int32_t> (output_delta, maximum, input_delta, maps,
+                                    input_width, input_height, region_width,
+                                    region_height, stride_x, stride_y);
+  else if (region_width == 2 && region_height == 2)
+    UnpoolMaps<2, 2, std::uint8_t> (output_delta, maximum, input_delta, maps,
+                                    input_width, input_height, region_width,
+                                    region_height, stride_x, stride_y);
+  else if (region_width == 3 && region_height == 3)
+    UnpoolMaps<3, 3, std::uint8_t> (output_delta, maximum, input_delta, maps,
+                                    input_width, input_height, region_width,
+                                    region_height, stride_x, stride_y);
+  else
+    UnpoolMaps<0, 0, std::uint8_t> (output_delta, maximum, input_delta, maps,
+                                    input_width, input_height, region_width,
+                                    region_height, stride_x, stride_y);
+}
+
+}
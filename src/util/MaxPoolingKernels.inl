@@ -0,0 +1,101 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * Max-pooling kernels, included once per instruction set by
+ * SIMDKernels.inl.
+ */
+
+namespace CN24_SIMD_NAMESPACE {
+
+/*
+ * Finds the maximum of every region of one map and stores its position in
+ * the region. If fixed_width and fixed_height are not zero, they are the
+ * region size. The loops over the region then have a constant trip count
+ * and can be unrolled completely.
+ *
+ * Regions start every stride_x pixels horizontally and every stride_y
+ * pixels vertically. The output is computed row by row, a vector of
+ * neighbouring regions at a time. Inside a region, the pixels are compared column by column, so
+ * that ties go to the same pixel as always.
+ */
+template <unsigned int fixed_width, unsigned int fixed_height, typename Index>
+CN24_SIMD_TARGET
+static void PoolMap (const datum* input, datum* output, void* maximum,
+                     const unsigned int input_width,
+                     const unsigned int output_width,
+                     const unsigned int output_height,
+                     const unsigned int region_width,
+                     const unsigned int region_height,
+                     const unsigned int stride_x,
+                     const unsigned int stride_y) {
+  const unsigned int width = CN24_SIMD_WIDTH;
+  const unsigned int rw = fixed_width > 0 ? fixed_width : region_width;
+  const unsigned int rh = fixed_height > 0 ? fixed_height : region_height;
+  const datum lowest = std::numeric_limits<datum>::lowest();
+
+  for (unsigned int oy = 0; oy < output_height; oy++) {
+    const datum* input_row = input + (std::size_t) oy * stride_y * input_width;
+    datum* output_row = output + (std::size_t) oy * output_width;
+    Index* maximum_row = (Index*) maximum + (std::size_t) oy * output_width;
+    unsigned int ox = 0;
+
+    for (; ox + width <= output_width; ox += width) {
+      CN24_SIMD_TYPE value = CN24_SIMD_SET1 (lowest);
+      CN24_SIMD_TYPE position = CN24_SIMD_ZERO();
+
+      for (unsigned int kx = 0; kx < rw; kx++) {
+        for (unsigned int ky = 0; ky < rh; ky++) {
+          const CN24_SIMD_TYPE ival = CN24_SIMD_LOAD_STRIDED (
+                                        input_row + ky * input_width + ox * stride_x + kx,
+                                        stride_x);
+          position = CN24_SIMD_SELECT_GREATER (ival, value,
+                                               CN24_SIMD_SET1 ( (datum) (ky * rw + kx)),
+                                               position);
+          value = CN24_SIMD_SELECT_GREATER (ival, value, ival, value);
+        }
+      }
+
+      CN24_SIMD_STORE (output_row + ox, value);
+
+      datum lanes[CN24_SIMD_WIDTH];
+      CN24_SIMD_STORE (lanes, position);
+
+      for (unsigned int l = 0; l < width; l++)
+        maximum_row[ox + l] = (Index) lanes[l];
+    }
+
+    for (; ox < output_width; ox++) {
+      datum value = lowest;
+      unsigned int position = 0;
+
+      for (unsigned int kx = 0; kx < rw; kx++) {
+        for (unsigned int ky = 0; ky < rh; ky++) {
+          const datum ival = input_row[ky * input_width + ox * stride_x + kx];
+          if (ival > value) {
+            value = ival;
+            position = ky * rw + kx;
+          }
+        }
+      }
+
+      output_row[ox] = value;
+      maximum_row[ox] = (Index) position;
+    }
+  }
+}
+
+/*
+ * Fills the kernel table with the kernels for this instruction set
+ */
+static void GetKernels (MaxPoolingKernels& kernels) {
+  kernels.pool_map[0] = PoolMap<0, 0, std::uint8_t>;
+  kernels.pool_map[1] = PoolMap<2, 2, std::uint8_t>;
+  kernels.pool_map[2] = PoolMap<3, 3, std::uint8_t>;
+  kernels.pool_map_wide = PoolMap<0, 0, std::int32_t>;
+}
+
+}
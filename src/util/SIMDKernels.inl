@@ -0,0 +1,252 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * Compiles the kernels in the file named by CN24_SIMD_KERNELS once for
+ * every supported instruction set, in the namespaces SIMDScalar, SIMDSSE,
+ * SIMDAVX2 and SIMDAVX512 (the latter three only on x86). Include this
+ * inside namespace Conv, after CPUFeatures.h and, on x86, immintrin.h.
+ *
+ * The kernel file can use these macros:
+ *
+ *  CN24_SIMD_NAMESPACE     Namespace for this instruction set
+ *  CN24_SIMD_TARGET        Function attribute enabling the instructions
+ *  CN24_SIMD_WIDTH         Number of datums per vector
+ *  CN24_SIMD_TYPE          Vector type
+ *  CN24_SIMD_ZERO()        Zero vector
+ *  CN24_SIMD_LOAD(p)       Unaligned load
+ *  CN24_SIMD_STORE(p, v)   Unaligned store
+ *  CN24_SIMD_SET1(x)       Broadcast
+ *  CN24_SIMD_FMA(a, b, c)  a * b + c
+ *  CN24_SIMD_ADD(a, b)     a + b
+ *  CN24_SIMD_SUB(a, b)     a - b
+ *  CN24_SIMD_MUL(a, b)     a * b
+ *  CN24_SIMD_MAX(a, b)     a > b ? a : b, per element
+ *  CN24_SIMD_MIN(a, b)     a < b ? a : b, per element
+ *  CN24_SIMD_DIV(a, b)     a / b
+ *  CN24_SIMD_RCP(a)        Approximately 1 / a, relative error below 4e-4
+ *  CN24_SIMD_ROUND(a)      a rounded to the nearest integer
+ *  CN24_SIMD_SCALE2(a, n)  a * 2^n for integral n in [-126, 127]
+ *  CN24_SIMD_MASK_POSITIVE(m, v)  m > 0 ? v : 0, per element
+ *  CN24_SIMD_SELECT_GREATER(a, b, x, y)  a > b ? x : y, per element
+ *  CN24_SIMD_LOAD_STRIDED(p, s)  Loads p[0], p[s], p[2s], ...
+ */
+
+/*
+ * 2^n for the scalar CN24_SIMD_SCALE2, built from the exponent bits
+ */
+static inline datum SIMDScalarPow2 (const int n) {
+  union {
+    std::uint32_t bits;
+    datum value;
+  } result;
+  result.bits = (std::uint32_t) (n + 127) << 23;
+  return result.value;
+}
+
+// Scalar fallback
+#define CN24_SIMD_NAMESPACE SIMDScalar
+#define CN24_SIMD_TARGET
+#define CN24_SIMD_WIDTH 1
+#define CN24_SIMD_TYPE datum
+#define CN24_SIMD_ZERO() ((datum) 0)
+#define CN24_SIMD_LOAD(p) (*(p))
+#define CN24_SIMD_STORE(p, v) (*(p) = (v))
+#define CN24_SIMD_SET1(x) (x)
+#define CN24_SIMD_FMA(a, b, c) ((a) * (b) + (c))
+#define CN24_SIMD_ADD(a, b) ((a) + (b))
+#define CN24_SIMD_SUB(a, b) ((a) - (b))
+#define CN24_SIMD_MUL(a, b) ((a) * (b))
+#define CN24_SIMD_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define CN24_SIMD_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define CN24_SIMD_DIV(a, b) ((a) / (b))
+#define CN24_SIMD_RCP(a) ((datum) 1 / (a))
+#define CN24_SIMD_ROUND(a) ((datum) (int) ((a) + ((a) < 0 ? -0.5f : 0.5f)))
+#define CN24_SIMD_SCALE2(a, n) ((a) * SIMDScalarPow2 ((int) (n)))
+#define CN24_SIMD_MASK_POSITIVE(m, v) ((m) > 0 ? (v) : (datum) 0)
+#define CN24_SIMD_SELECT_GREATER(a, b, x, y) ((a) > (b) ? (x) : (y))
+#define CN24_SIMD_LOAD_STRIDED(p, s) (*(p))
+#include CN24_SIMD_KERNELS
+#undef CN24_SIMD_NAMESPACE
+#undef CN24_SIMD_TARGET
+#undef CN24_SIMD_WIDTH
+#undef CN24_SIMD_TYPE
+#undef CN24_SIMD_ZERO
+#undef CN24_SIMD_LOAD
+#undef CN24_SIMD_STORE
+#undef CN24_SIMD_SET1
+#undef CN24_SIMD_FMA
+#undef CN24_SIMD_ADD
+#undef CN24_SIMD_SUB
+#undef CN24_SIMD_MUL
+#undef CN24_SIMD_MAX
+#undef CN24_SIMD_MIN
+#undef CN24_SIMD_DIV
+#undef CN24_SIMD_RCP
+#undef CN24_SIMD_ROUND
+#undef CN24_SIMD_SCALE2
+#undef CN24_SIMD_MASK_POSITIVE
+#undef CN24_SIMD_SELECT_GREATER
+#undef CN24_SIMD_LOAD_STRIDED
+
+#ifdef CN24_X86
+// SSE4.2 (no FMA)
+#define CN24_SIMD_NAMESPACE SIMDSSE
+#define CN24_SIMD_TARGET CN24_TARGET("sse4.2")
+#define CN24_SIMD_WIDTH 4
+#define CN24_SIMD_TYPE __m128
+#define CN24_SIMD_ZERO() _mm_setzero_ps()
+#define CN24_SIMD_LOAD(p) _mm_loadu_ps (p)
+#define CN24_SIMD_STORE(p, v) _mm_storeu_ps (p, v)
+#define CN24_SIMD_SET1(x) _mm_set1_ps (x)
+#define CN24_SIMD_FMA(a, b, c) _mm_add_ps (_mm_mul_ps (a, b), c)
+#define CN24_SIMD_ADD(a, b) _mm_add_ps (a, b)
+#define CN24_SIMD_SUB(a, b) _mm_sub_ps (a, b)
+#define CN24_SIMD_MUL(a, b) _mm_mul_ps (a, b)
+#define CN24_SIMD_MAX(a, b) _mm_max_ps (a, b)
+#define CN24_SIMD_MIN(a, b) _mm_min_ps (a, b)
+#define CN24_SIMD_DIV(a, b) _mm_div_ps (a, b)
+#define CN24_SIMD_RCP(a) _mm_rcp_ps (a)
+#define CN24_SIMD_ROUND(a) \
+  _mm_round_ps (a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define CN24_SIMD_SCALE2(a, n) \
+  _mm_mul_ps (a, _mm_castsi128_ps (_mm_slli_epi32 (_mm_add_epi32 ( \
+              _mm_cvtps_epi32 (n), _mm_set1_epi32 (127)), 23)))
+#define CN24_SIMD_MASK_POSITIVE(m, v) \
+  _mm_and_ps (_mm_cmpgt_ps (m, _mm_setzero_ps()), v)
+#define CN24_SIMD_SELECT_GREATER(a, b, x, y) \
+  _mm_blendv_ps (y, x, _mm_cmpgt_ps (a, b))
+#define CN24_SIMD_LOAD_STRIDED(p, s) \
+  _mm_setr_ps ((p)[0], (p)[s], (p)[2 * (s)], (p)[3 * (s)])
+#include CN24_SIMD_KERNELS
+#undef CN24_SIMD_NAMESPACE
+#undef CN24_SIMD_TARGET
+#undef CN24_SIMD_WIDTH
+#undef CN24_SIMD_TYPE
+#undef CN24_SIMD_ZERO
+#undef CN24_SIMD_LOAD
+#undef CN24_SIMD_STORE
+#undef CN24_SIMD_SET1
+#undef CN24_SIMD_FMA
+#undef CN24_SIMD_ADD
+#undef CN24_SIMD_SUB
+#undef CN24_SIMD_MUL
+#undef CN24_SIMD_MAX
+#undef CN24_SIMD_MIN
+#undef CN24_SIMD_DIV
+#undef CN24_SIMD_RCP
+#undef CN24_SIMD_ROUND
+#undef CN24_SIMD_SCALE2
+#undef CN24_SIMD_MASK_POSITIVE
+#undef CN24_SIMD_SELECT_GREATER
+#undef CN24_SIMD_LOAD_STRIDED
+
+// AVX2 + FMA
+#define CN24_SIMD_NAMESPACE SIMDAVX2
+#define CN24_SIMD_TARGET CN24_TARGET("avx2,fma")
+#define CN24_SIMD_WIDTH 8
+#define CN24_SIMD_TYPE __m256
+#define CN24_SIMD_ZERO() _mm256_setzero_ps()
+#define CN24_SIMD_LOAD(p) _mm256_loadu_ps (p)
+#define CN24_SIMD_STORE(p, v) _mm256_storeu_ps (p, v)
+#define CN24_SIMD_SET1(x) _mm256_set1_ps (x)
+#define CN24_SIMD_FMA(a, b, c) _mm256_fmadd_ps (a, b, c)
+#define CN24_SIMD_ADD(a, b) _mm256_add_ps (a, b)
+#define CN24_SIMD_SUB(a, b) _mm256_sub_ps (a, b)
+#define CN24_SIMD_MUL(a, b) _mm256_mul_ps (a, b)
+#define CN24_SIMD_MAX(a, b) _mm256_max_ps (a, b)
+#define CN24_SIMD_MIN(a, b) _mm256_min_ps (a, b)
+#define CN24_SIMD_DIV(a, b) _mm256_div_ps (a, b)
+#define CN24_SIMD_RCP(a) _mm256_rcp_ps (a)
+#define CN24_SIMD_ROUND(a) \
+  _mm256_round_ps (a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define CN24_SIMD_SCALE2(a, n) \
+  _mm256_mul_ps (a, _mm256_castsi256_ps (_mm256_slli_epi32 (_mm256_add_epi32 ( \
+                 _mm256_cvtps_epi32 (n), _mm256_set1_epi32 (127)), 23)))
+#define CN24_SIMD_MASK_POSITIVE(m, v) \
+  _mm256_and_ps (_mm256_cmp_ps (m, _mm256_setzero_ps(), _CMP_GT_OQ), v)
+#define CN24_SIMD_SELECT_GREATER(a, b, x, y) \
+  _mm256_blendv_ps (y, x, _mm256_cmp_ps (a, b, _CMP_GT_OQ))
+#define CN24_SIMD_LOAD_STRIDED(p, s) \
+  _mm256_i32gather_ps (p, _mm256_mullo_epi32 (_mm256_set1_epi32 (s), \
+                       _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7)), 4)
+#include CN24_SIMD_KERNELS
+#undef CN24_SIMD_NAMESPACE
+#undef CN24_SIMD_TARGET
+#undef CN24_SIMD_WIDTH
+#undef CN24_SIMD_TYPE
+#undef CN24_SIMD_ZERO
+#undef CN24_SIMD_LOAD
+#undef CN24_SIMD_STORE
+#undef CN24_SIMD_SET1
+#undef CN24_SIMD_FMA
+#undef CN24_SIMD_ADD
+#undef CN24_SIMD_SUB
+#undef CN24_SIMD_MUL
+#undef CN24_SIMD_MAX
+#undef CN24_SIMD_MIN
+#undef CN24_SIMD_DIV
+#undef CN24_SIMD_RCP
+#undef CN24_SIMD_ROUND
+#undef CN24_SIMD_SCALE2
+#undef CN24_SIMD_MASK_POSITIVE
+#undef CN24_SIMD_SELECT_GREATER
+#undef CN24_SIMD_LOAD_STRIDED
+
+// AVX-512
+#define CN24_SIMD_NAMESPACE SIMDAVX512
+#define CN24_SIMD_TARGET CN24_TARGET("avx512f")
+#define CN24_SIMD_WIDTH 16
+#define CN24_SIMD_TYPE __m512
+#define CN24_SIMD_ZERO() _mm512_setzero_ps()
+#define CN24_SIMD_LOAD(p) _mm512_loadu_ps (p)
+#define CN24_SIMD_STORE(p, v) _mm512_storeu_ps (p, v)
+#define CN24_SIMD_SET1(x) _mm512_set1_ps (x)
+#define CN24_SIMD_FMA(a, b, c) _mm512_fmadd_ps (a, b, c)
+#define CN24_SIMD_ADD(a, b) _mm512_add_ps (a, b)
+#define CN24_SIMD_SUB(a, b) _mm512_sub_ps (a, b)
+#define CN24_SIMD_MUL(a, b) _mm512_mul_ps (a, b)
+// The zero-masked forms keep GCC from warning about the undefined source
+// vector of the unmasked intrinsics
+#define CN24_SIMD_MAX(a, b) _mm512_maskz_max_ps (0xFFFF, a, b)
+#define CN24_SIMD_MIN(a, b) _mm512_maskz_min_ps (0xFFFF, a, b)
+#define CN24_SIMD_DIV(a, b) _mm512_div_ps (a, b)
+#define CN24_SIMD_RCP(a) _mm512_maskz_rcp14_ps (0xFFFF, a)
+#define CN24_SIMD_ROUND(a) _mm512_maskz_roundscale_ps (0xFFFF, a, \
+                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define CN24_SIMD_SCALE2(a, n) _mm512_maskz_scalef_ps (0xFFFF, a, n)
+#define CN24_SIMD_MASK_POSITIVE(m, v) \
+  _mm512_maskz_mov_ps (_mm512_cmp_ps_mask (m, _mm512_setzero_ps(), _CMP_GT_OQ), v)
+#define CN24_SIMD_SELECT_GREATER(a, b, x, y) \
+  _mm512_mask_blend_ps (_mm512_cmp_ps_mask (a, b, _CMP_GT_OQ), y, x)
+#define CN24_SIMD_LOAD_STRIDED(p, s) \
+  _mm512_mask_i32gather_ps (_mm512_setzero_ps(), 0xFFFF, \
+                            _mm512_mullo_epi32 (_mm512_set1_epi32 (s), \
+                            _mm512_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7, 8, 9, \
+                                               10, 11, 12, 13, 14, 15)), p, 4)
+#include CN24_SIMD_KERNELS
+#undef CN24_SIMD_NAMESPACE
+#undef CN24_SIMD_TARGET
+#undef CN24_SIMD_WIDTH
+#undef CN24_SIMD_TYPE
+#undef CN24_SIMD_ZERO
+#undef CN24_SIMD_LOAD
+#undef CN24_SIMD_STORE
+#undef CN24_SIMD_SET1
+#undef CN24_SIMD_FMA
+#undef CN24_SIMD_ADD
+#undef CN24_SIMD_SUB
+#undef CN24_SIMD_MUL
+#undef CN24_SIMD_MAX
+#undef CN24_SIMD_MIN
+#undef CN24_SIMD_DIV
+#undef CN24_SIMD_RCP
+#undef CN24_SIMD_ROUND
+#undef CN24_SIMD_SCALE2
+#undef CN24_SIMD_MASK_POSITIVE
+#undef CN24_SIMD_SELECT_GREATER
+#undef CN24_SIMD_LOAD_STRIDED
+#endif
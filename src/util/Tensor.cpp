@@ -7,6 +7,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <limits>
@@ -25,6 +27,7 @@
 #include "Log.h"
 #include "Tensor.h"
 #include "CLHelper.h"
+#include "VectorMath.h"
 
 namespace Conv {
 
@@ -62,6 +65,7 @@ Tensor::Tensor ( Tensor && tensor ) {
   width_ = tensor.width_;
   height_ = tensor.height_;
   elements_ = tensor.elements_;
+  version_ = tensor.version_;
 
   tensor.data_ptr_ = nullptr;
   tensor.DeleteIfPossible();
@@ -79,14 +83,10 @@ Tensor::~Tensor() {
 
 void Tensor::Clear ( const datum value, const int sample ) {
   if ( sample == -1 ) {
-    for ( std::size_t element = 0; element < elements_; element++ ) {
-      data_ptr_[element] = value;
-    }
+    VectorMath::Fill ( data_ptr_, value, elements_ );
   } else {
-    for ( std::size_t element = ( width_ * height_ * maps_ * sample );
-          element < ( width_* height_ * maps_ * ( sample+1 ) ); element++ ) {
-      data_ptr_[element] = value;
-    }
+    VectorMath::Fill ( data_ptr_ + width_ * height_ * maps_ * sample, value,
+                       width_ * height_ * maps_ );
   }
 }
 
@@ -110,6 +110,54 @@ void Tensor::Shadow ( Tensor& tensor ) {
 #endif
 }
 
+bool Tensor::ShadowMemory ( Tensor& tensor ) {
+  if ( tensor.elements_ < elements_ )
+    return false;
+
+  const std::size_t samples = samples_, width = width_, height = height_,
+                    maps = maps_;
+
+  Shadow ( tensor );
+
+  samples_ = samples;
+  width_ = width;
+  height_ = height;
+  maps_ = maps;
+  elements_ = samples * width * height * maps;
+  return true;
+}
+
+void Tensor::Swap ( Tensor& tensor ) {
+  if ( is_shadow_ || tensor.is_shadow_ )
+    FATAL ( "Cannot swap a shadow Tensor!" );
+
+  std::swap ( data_ptr_, tensor.data_ptr_ );
+  std::swap ( samples_, tensor.samples_ );
+  std::swap ( maps_, tensor.maps_ );
+  std::swap ( width_, tensor.width_ );
+  std::swap ( height_, tensor.height_ );
+  std::swap ( elements_, tensor.elements_ );
+  std::swap ( version_, tensor.version_ );
+
+  std::swap ( cl_data_ptr_, tensor.cl_data_ptr_ );
+  std::swap ( cl_gpu_, tensor.cl_gpu_ );
+}
+
+void Tensor::Invalidate() {
+  if ( is_shadow_ ) {
+    shadow_target_->Invalidate();
+    return;
+  }
+
+  // Every call gets a new number, so two Tensors never share a version
+  // by accident
+  static std::atomic<unsigned int> last_version ( 0 );
+  version_ = ++last_version;
+}
+
+unsigned int Tensor::version() const {
+  return is_shadow_ ? shadow_target_->version() : version_;
+}
 
 void Tensor::Resize ( const std::size_t samples, const std::size_t width,
                       const std::size_t height, const std::size_t maps ) {
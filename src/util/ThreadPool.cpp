@@ -0,0 +1,421 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file ThreadPool.cpp
+ * @brief Work-stealing worker threads.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef BUILD_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef BLAS_MKL
+#include <mkl_service.h>
+#endif
+
+#include "Log.h"
+#include "ThreadPool.h"
+
+namespace Conv {
+
+/*
+ * A range of blocks that one thread works on, with the first block in the
+ * low half and the end in the high half, so both can be changed with one
+ * compare-and-swap. The owner takes blocks from the front, thieves take
+ * the back half.
+ */
+typedef std::uint64_t PackedRange;
+
+static inline PackedRange Pack (const std::uint32_t begin,
+                                const std::uint32_t end) {
+  return ( (PackedRange) end << 32) | begin;
+}
+
+static inline std::uint32_t RangeBegin (const PackedRange range) {
+  return (std::uint32_t) range;
+}
+
+static inline std::uint32_t RangeEnd (const PackedRange range) {
+  return (std::uint32_t) (range >> 32);
+}
+
+struct WorkerRange {
+  std::atomic<PackedRange> range;
+
+  // Keep every range on its own cache line
+  char padding[64 - sizeof (std::atomic<PackedRange>)];
+};
+
+// How long the workers keep polling for the next loop before they sleep
+const std::chrono::microseconds pool_spin_time (50);
+
+// Set while a thread works on a loop and for threads that shouldn't use
+// the workers
+static thread_local bool thread_serial = false;
+
+/*
+ * Returns the cores this process may run on
+ */
+static std::vector<int> AllowedCores() {
+  std::vector<int> cores;
+#ifdef BUILD_LINUX
+  cpu_set_t set;
+  CPU_ZERO (&set);
+
+  if (sched_getaffinity (0, sizeof (set), &set) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET (c, &set))
+        cores.push_back (c);
+    }
+  }
+#endif
+
+  if (cores.empty()) {
+    const unsigned int threads = std::thread::hardware_concurrency();
+
+    for (unsigned int c = 0; c < std::max (threads, 1u); c++)
+      cores.push_back ( (int) c);
+  }
+
+  return cores;
+}
+
+class Pool {
+public:
+  Pool (const unsigned int threads, const bool affinity);
+  ~Pool();
+
+  void Run (const std::size_t count, const std::size_t grain,
+            ThreadPool::RangeCall call, void* context);
+
+  unsigned int threads() const {
+    return threads_;
+  }
+  bool affinity() const {
+    return affinity_;
+  }
+
+private:
+  void Work (const unsigned int worker);
+  void Participate (const unsigned int thread);
+  bool Steal (const unsigned int thread);
+  void Execute (const std::uint32_t block, const unsigned int thread);
+
+  unsigned int threads_;
+  bool affinity_;
+  std::vector<std::thread> workers_;
+  std::unique_ptr<WorkerRange[]> ranges_;
+
+  // The current loop. Only one thread can start loops at a time.
+  std::mutex loop_mutex_;
+  ThreadPool::RangeCall call_ = nullptr;
+  void* context_ = nullptr;
+  std::size_t count_ = 0;
+  std::size_t grain_ = 1;
+  std::atomic<std::uint32_t> remaining_;
+
+  // Workers only touch the loop while it is open and they are counted
+  // as active
+  std::atomic<bool> open_;
+  std::atomic<unsigned int> active_;
+  std::atomic<unsigned int> generation_;
+  std::atomic<bool> shutdown_;
+
+  // Only for sleeping between loops
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<unsigned int> sleeping_;
+};
+
+Pool::Pool (const unsigned int threads, const bool affinity) :
+  threads_ (std::max (threads, 1u)), affinity_ (affinity),
+  ranges_ (new WorkerRange[std::max (threads, 1u)]) {
+  remaining_ = 0;
+  open_ = false;
+  active_ = 0;
+  generation_ = 0;
+  shutdown_ = false;
+  sleeping_ = 0;
+
+  for (unsigned int t = 0; t < threads_; t++)
+    ranges_[t].range = Pack (0, 0);
+
+#ifdef BLAS_MKL
+  mkl_set_num_threads ( (int) threads_);
+#endif
+
+  const std::vector<int> cores = AllowedCores();
+
+  for (unsigned int w = 1; w < threads_; w++) {
+    workers_.push_back (std::thread (&Pool::Work, this, w));
+
+#ifdef BUILD_LINUX
+    if (affinity_) {
+      // The calling thread keeps the first core
+      cpu_set_t set;
+      CPU_ZERO (&set);
+      CPU_SET (cores[w % cores.size()], &set);
+
+      if (pthread_setaffinity_np (workers_.back().native_handle(),
+                                  sizeof (set), &set) != 0)
+        LOGWARN << "Could not pin worker " << w << " to core " <<
+                cores[w % cores.size()];
+    }
+#endif
+  }
+}
+
+Pool::~Pool() {
+  {
+    std::lock_guard<std::mutex> lock (sleep_mutex_);
+    shutdown_ = true;
+  }
+  wake_.notify_all();
+
+  for (unsigned int w = 0; w < workers_.size(); w++)
+    workers_[w].join();
+}
+
+void Pool::Run (const std::size_t count, const std::size_t grain,
+                ThreadPool::RangeCall call, void* context) {
+  if (count == 0)
+    return;
+
+  // The block indices have to fit into a PackedRange
+  const std::size_t max_blocks = std::numeric_limits<std::uint32_t>::max();
+  const std::size_t block_size = std::max (std::max<std::size_t> (grain, 1),
+                                 (count + max_blocks - 1) / max_blocks);
+  const std::uint32_t blocks = (std::uint32_t) ( (count + block_size - 1) /
+                               block_size);
+
+  if (thread_serial || threads_ == 1 || blocks == 1 ||
+      !loop_mutex_.try_lock()) {
+    call (context, 0, count, 0);
+    return;
+  }
+
+  call_ = call;
+  context_ = context;
+  count_ = count;
+  grain_ = block_size;
+  remaining_ = blocks;
+
+  // Split the blocks evenly, the workers steal from each other if
+  // that was wrong
+  const std::uint32_t participants = std::min<std::uint32_t> (threads_, blocks);
+
+  for (std::uint32_t t = 0; t < threads_; t++) {
+    const std::uint32_t begin = t < participants ?
+                                (std::uint32_t) ( (std::uint64_t) blocks * t / participants) : 0;
+    const std::uint32_t end = t < participants ?
+                              (std::uint32_t) ( (std::uint64_t) blocks * (t + 1) / participants) : 0;
+    ranges_[t].range.store (Pack (begin, end), std::memory_order_relaxed);
+  }
+
+  open_ = true;
+  generation_++;
+
+  if (sleeping_ > 0) {
+    {
+      std::lock_guard<std::mutex> lock (sleep_mutex_);
+    }
+    wake_.notify_all();
+  }
+
+#ifdef BLAS_MKL
+  const int mkl_threads = mkl_set_num_threads_local (1);
+#endif
+
+  thread_serial = true;
+  Participate (0);
+  thread_serial = false;
+
+#ifdef BLAS_MKL
+  mkl_set_num_threads_local (mkl_threads);
+#endif
+
+  // Wait for the blocks the workers are still working on
+  while (remaining_.load (std::memory_order_acquire) > 0)
+    std::this_thread::yield();
+
+  open_ = false;
+
+  while (active_ > 0)
+    std::this_thread::yield();
+
+  loop_mutex_.unlock();
+}
+
+void Pool::Work (const unsigned int worker) {
+  thread_serial = true;
+#ifdef BLAS_MKL
+  mkl_set_num_threads_local (1);
+#endif
+
+  unsigned int seen = generation_;
+
+  while (true) {
+    // Poll for a while, the next loop usually follows right away
+    const auto spin_end = std::chrono::steady_clock::now() + pool_spin_time;
+
+    while (generation_ == seen && !shutdown_ &&
+           std::chrono::steady_clock::now() < spin_end)
+      std::this_thread::yield();
+
+    if (generation_ == seen && !shutdown_) {
+      std::unique_lock<std::mutex> lock (sleep_mutex_);
+      sleeping_++;
+      wake_.wait (lock, [this, seen] {
+        return generation_ != seen || shutdown_;
+      });
+      sleeping_--;
+    }
+
+    if (shutdown_)
+      return;
+
+    seen = generation_;
+
+    active_++;
+
+    if (open_)
+      Participate (worker);
+
+    active_--;
+  }
+}
+
+void Pool::Participate (const unsigned int thread) {
+  std::atomic<PackedRange>& own = ranges_[thread].range;
+
+  do {
+    PackedRange range = own.load (std::memory_order_acquire);
+
+    while (RangeBegin (range) < RangeEnd (range)) {
+      const std::uint32_t block = RangeBegin (range);
+
+      if (own.compare_exchange_weak (range, Pack (block + 1, RangeEnd (range)),
+                                     std::memory_order_acq_rel)) {
+        Execute (block, thread);
+        range = own.load (std::memory_order_acquire);
+      }
+    }
+  } while (Steal (thread));
+}
+
+bool Pool::Steal (const unsigned int thread) {
+  for (unsigned int v = 1; v < threads_; v++) {
+    std::atomic<PackedRange>& victim = ranges_[ (thread + v) % threads_].range;
+    PackedRange range = victim.load (std::memory_order_acquire);
+
+    while (RangeBegin (range) < RangeEnd (range)) {
+      const std::uint32_t begin = RangeBegin (range);
+      const std::uint32_t end = RangeEnd (range);
+
+      if (end - begin == 1) {
+        // Not worth splitting, just take it
+        if (victim.compare_exchange_weak (range, Pack (end, end),
+                                          std::memory_order_acq_rel)) {
+          Execute (begin, thread);
+          return true;
+        }
+      } else {
+        const std::uint32_t middle = begin + (end - begin) / 2;
+
+        if (victim.compare_exchange_weak (range, Pack (begin, middle),
+                                          std::memory_order_acq_rel)) {
+          ranges_[thread].range.store (Pack (middle, end),
+                                       std::memory_order_release);
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+void Pool::Execute (const std::uint32_t block, const unsigned int thread) {
+  const std::size_t begin = (std::size_t) block * grain_;
+  call_ (context_, begin, std::min (count_, begin + grain_), thread);
+  remaining_.fetch_sub (1, std::memory_order_release);
+}
+
+static unsigned int InitialThreads() {
+  const char* setting = std::getenv ("CN24_THREADS");
+
+  if (setting != nullptr) {
+    const int threads = std::atoi (setting);
+
+    if (threads > 0)
+      return (unsigned int) threads;
+
+    LOGWARN << "Invalid thread count \"" << setting << "\"";
+  }
+
+  return (unsigned int) AllowedCores().size();
+}
+
+static bool InitialAffinity() {
+  const char* setting = std::getenv ("CN24_AFFINITY");
+  return setting != nullptr && std::strcmp (setting, "1") == 0;
+}
+
+static std::unique_ptr<Pool>& CurrentPool() {
+  static std::unique_ptr<Pool> pool (new Pool (InitialThreads(),
+                                     InitialAffinity()));
+  return pool;
+}
+
+unsigned int ThreadPool::Threads() {
+  return CurrentPool()->threads();
+}
+
+void ThreadPool::SetThreads (const unsigned int threads) {
+  std::unique_ptr<Pool>& pool = CurrentPool();
+  const bool affinity = pool->affinity();
+  pool.reset();
+  pool.reset (new Pool (threads, affinity));
+}
+
+bool ThreadPool::Affinity() {
+  return CurrentPool()->affinity();
+}
+
+void ThreadPool::SetAffinity (const bool affinity) {
+  std::unique_ptr<Pool>& pool = CurrentPool();
+  const unsigned int threads = pool->threads();
+  pool.reset();
+  pool.reset (new Pool (threads, affinity));
+}
+
+void ThreadPool::SetThreadSerial (const bool serial) {
+  thread_serial = serial;
+}
+
+void ThreadPool::Run (const std::size_t count, const std::size_t grain,
+                      RangeCall call, void* context) {
+  CurrentPool()->Run (count, grain, call, context);
+}
+
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+#include "Log.h"
+
+#include "TuningCache.h"
+
+namespace Conv {
+
+static std::string CacheFileName() {
+  const char* file_name = std::getenv ("CN24_TUNING_CACHE");
+
+  if (file_name != nullptr)
+    return std::string (file_name);
+
+#ifdef BUILD_WIN32
+  const char* home = std::getenv ("USERPROFILE");
+#else
+  const char* home = std::getenv ("HOME");
+#endif
+
+  if (home == nullptr)
+    return "";
+
+  return std::string (home) + "/.cn24_tuning";
+}
+
+struct TuningCacheContents {
+  TuningCacheContents() : file_name (CacheFileName()) {
+    if (file_name.length() == 0)
+      return;
+
+    std::ifstream file (file_name, std::ios::in);
+
+    if (!file.good())
+      return;
+
+    // Later lines override earlier ones
+    while (!file.eof()) {
+      std::string line;
+      std::getline (file, line);
+
+      const std::size_t tab = line.find ('\t');
+
+      if (tab != std::string::npos)
+        entries[line.substr (0, tab)] = line.substr (tab + 1);
+    }
+
+    LOGDEBUG << "Loaded " << entries.size() << " tuning results from " <<
+             file_name;
+  }
+
+  std::string file_name;
+  std::map<std::string, std::string> entries;
+};
+
+static TuningCacheContents& Contents() {
+  static TuningCacheContents contents;
+  return contents;
+}
+
+bool TuningCache::Lookup (const std::string& key, std::string& value) {
+  TuningCacheContents& contents = Contents();
+  std::map<std::string, std::string>::const_iterator it = contents.entries.find (key);
+
+  if (it == contents.entries.end())
+    return false;
+
+  value = it->second;
+  return true;
+}
+
+void TuningCache::Store (const std::string& key, const std::string& value) {
+  TuningCacheContents& contents = Contents();
+  contents.entries[key] = value;
+
+  if (contents.file_name.length() == 0)
+    return;
+
+  std::ofstream file (contents.file_name, std::ios::out | std::ios::app);
+
+  if (!file.good()) {
+    LOGWARN << "Cannot write tuning results to " << contents.file_name;
+    return;
+  }
+
+  file << key << "\t" << value << "\n";
+}
+
+}
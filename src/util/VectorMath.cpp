@@ -0,0 +1,298 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file VectorMath.cpp
+ * @brief Element-wise kernels with runtime instruction set selection.
+ *
+ * @author Clemens-Alexander Brust (ikosa dot de at gmail dot com)
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Config.h"
+#include "CPUFeatures.h"
+#include "FastMath.h"
+#include "ThreadPool.h"
+#include "VectorMath.h"
+
+#ifdef CN24_X86
+#include <immintrin.h>
+#endif
+
+namespace Conv {
+
+struct VectorMathKernels {
+  void (*fill) (datum* data, const datum value, const std::size_t count);
+  void (*add) (const datum* x, datum* y, const std::size_t count);
+  void (*axpy) (const datum alpha, const datum* x, datum* y,
+                const std::size_t count);
+  void (*lerp) (const datum* first, const datum* second, const datum weight,
+                datum* output, const std::size_t count);
+  void (*relu) (const datum* input, datum* output, const std::size_t count);
+  void (*relu_backward) (const datum* data, const datum* output_delta,
+                         datum* input_delta, const std::size_t count);
+
+  // Approximations, MATH_PRECISE first, then MATH_FAST
+  void (*exp[2]) (const datum* input, datum* output, const std::size_t count);
+  void (*sigmoid[2]) (const datum* input, datum* output,
+                      const std::size_t count);
+  void (*tanh[2]) (const datum* input, datum* output, const std::size_t count);
+  void (*softmax[2]) (const datum* input, datum* output,
+                      const std::size_t count);
+
+  void (*sigmoid_backward) (const datum* output, const datum* output_delta,
+                            datum* input_delta, const std::size_t count);
+  void (*tanh_backward) (const datum* output, const datum* output_delta,
+                         datum* input_delta, const std::size_t count);
+  void (*weighted_difference) (const datum* first, const datum* second,
+                               const datum* weight, datum* delta,
+                               const std::size_t count);
+  datum (*weighted_squared_error) (const datum* first, const datum* second,
+                                   const datum* weight,
+                                   const std::size_t count);
+};
+
+#define CN24_SIMD_KERNELS "VectorMathKernels.inl"
+#include "SIMDKernels.inl"
+#undef CN24_SIMD_KERNELS
+
+static VectorMathKernels SelectKernels() {
+  VectorMathKernels kernels;
+  SIMDScalar::GetKernels (kernels);
+
+#ifdef CN24_X86
+  switch (CPUFeatures::Level()) {
+  case SIMD_AVX512:
+    SIMDAVX512::GetKernels (kernels);
+    break;
+  case SIMD_AVX2:
+    SIMDAVX2::GetKernels (kernels);
+    break;
+  case SIMD_SSE:
+    SIMDSSE::GetKernels (kernels);
+    break;
+  default:
+    break;
+  }
+#endif
+
+  return kernels;
+}
+
+static const VectorMathKernels& Kernels() {
+  static const VectorMathKernels kernels = SelectKernels();
+  return kernels;
+}
+
+// Elements per thread and call of a kernel. Shorter arrays are not split
+// at all. This is also the length of the partial sums in
+// WeightedSquaredError, so it shouldn't be too large.
+const std::size_t vector_chunk = 16384;
+
+/*
+ * Calls function (begin, count) for every chunk of the range
+ */
+template <typename Function>
+static void ForChunks (const std::size_t count, const Function& function) {
+  const int chunks = (int) ( (count + vector_chunk - 1) / vector_chunk);
+
+  if (chunks <= 1) {
+    function ( (std::size_t) 0, count);
+    return;
+  }
+
+  ThreadPool::ParallelFor (chunks, [&] (const int chunk) {
+    const std::size_t begin = (std::size_t) chunk * vector_chunk;
+    function (begin, std::min (vector_chunk, count - begin));
+  });
+}
+
+void VectorMath::Fill (datum* data, const datum value,
+                       const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.fill (data + begin, value, n);
+  });
+}
+
+void VectorMath::Add (const datum* x, datum* y, const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.add (x + begin, y + begin, n);
+  });
+}
+
+void VectorMath::Axpy (const datum alpha, const datum* x, datum* y,
+                       const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.axpy (alpha, x + begin, y + begin, n);
+  });
+}
+
+void VectorMath::Lerp (const datum* first, const datum* second,
+                       const datum weight, datum* output,
+                       const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.lerp (first + begin, second + begin, weight, output + begin, n);
+  });
+}
+
+void VectorMath::ReLU (const datum* input, datum* output,
+                       const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.relu (input + begin, output + begin, n);
+  });
+}
+
+void VectorMath::Exp (const datum* input, datum* output,
+                      const std::size_t count) {
+  const MathAccuracy accuracy = FastMath::Accuracy();
+
+  if (accuracy == MATH_EXACT) {
+    ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+      for (std::size_t i = begin; i < begin + n; i++)
+        output[i] = exp (input[i]);
+    });
+    return;
+  }
+
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.exp[accuracy - MATH_PRECISE] (input + begin, output + begin, n);
+  });
+}
+
+void VectorMath::Sigmoid (const datum* input, datum* output,
+                          const std::size_t count) {
+  const MathAccuracy accuracy = FastMath::Accuracy();
+
+  if (accuracy == MATH_EXACT) {
+    ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+      for (std::size_t i = begin; i < begin + n; i++)
+        output[i] = 1.0 / (1.0 + exp (-input[i]));
+    });
+    return;
+  }
+
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.sigmoid[accuracy - MATH_PRECISE] (input + begin, output + begin, n);
+  });
+}
+
+void VectorMath::Tanh (const datum* input, datum* output,
+                       const std::size_t count) {
+  const MathAccuracy accuracy = FastMath::Accuracy();
+
+  if (accuracy == MATH_EXACT) {
+    ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+      for (std::size_t i = begin; i < begin + n; i++)
+        output[i] = 1.0 - 2.0 / (exp (2.0 * input[i]) + 1.0);
+    });
+    return;
+  }
+
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.tanh[accuracy - MATH_PRECISE] (input + begin, output + begin, n);
+  });
+}
+
+void VectorMath::Softmax (const datum* input, datum* output,
+                          const std::size_t count) {
+  const MathAccuracy accuracy = FastMath::Accuracy();
+
+  if (count == 0)
+    return;
+
+  if (accuracy != MATH_EXACT) {
+    Kernels().softmax[accuracy - MATH_PRECISE] (input, output, count);
+    return;
+  }
+
+  const datum maximum = *std::max_element (input, input + count);
+  datum sum = 0;
+
+  for (std::size_t i = 0; i < count; i++) {
+    output[i] = exp (input[i] - maximum);
+    sum += output[i];
+  }
+
+  for (std::size_t i = 0; i < count; i++)
+    output[i] /= sum;
+}
+
+void VectorMath::ReLUBackward (const datum* data, const datum* output_delta,
+                               datum* input_delta, const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.relu_backward (data + begin, output_delta + begin,
+                           input_delta + begin, n);
+  });
+}
+
+void VectorMath::SigmoidBackward (const datum* output,
+                                  const datum* output_delta,
+                                  datum* input_delta,
+                                  const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.sigmoid_backward (output + begin, output_delta + begin,
+                              input_delta + begin, n);
+  });
+}
+
+void VectorMath::TanhBackward (const datum* output, const datum* output_delta,
+                               datum* input_delta, const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.tanh_backward (output + begin, output_delta + begin,
+                           input_delta + begin, n);
+  });
+}
+
+void VectorMath::WeightedDifference (const datum* first, const datum* second,
+                                     const datum* weight, datum* delta,
+                                     const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    kernels.weighted_difference (first + begin, second + begin,
+                                 weight != nullptr ? weight + begin : nullptr,
+                                 delta + begin, n);
+  });
+}
+
+long double VectorMath::WeightedSquaredError (const datum* first,
+    const datum* second,
+    const datum* weight,
+    const std::size_t count) {
+  const VectorMathKernels& kernels = Kernels();
+  std::vector<datum> partial_sums (std::max<std::size_t> (1,
+                                   (count + vector_chunk - 1) / vector_chunk));
+
+  ForChunks (count, [&] (const std::size_t begin, const std::size_t n) {
+    partial_sums[begin / vector_chunk] =
+      kernels.weighted_squared_error (first + begin, second + begin,
+                                      weight != nullptr ? weight + begin : nullptr, n);
+  });
+
+  // Add the partial sums in a fixed order, so the result doesn't depend
+  // on the number of threads
+  long double sum = 0;
+
+  for (std::size_t c = 0; c < partial_sums.size(); c++)
+    sum += partial_sums[c];
+
+  return sum;
+}
+
+}
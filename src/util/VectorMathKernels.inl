@@ -0,0 +1,393 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/*
+ * Element-wise kernels, included once per instruction set by
+ * SIMDKernels.inl. Every kernel does the vectors first and the remaining
+ * elements one by one.
+ */
+
+namespace CN24_SIMD_NAMESPACE {
+
+CN24_SIMD_TARGET
+static void VectorFill (datum* data, const datum value,
+                        const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE v = CN24_SIMD_SET1 (value);
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width)
+    CN24_SIMD_STORE (data + i, v);
+
+  for (; i < count; i++)
+    data[i] = value;
+}
+
+CN24_SIMD_TARGET
+static void VectorAdd (const datum* x, datum* y, const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width)
+    CN24_SIMD_STORE (y + i, CN24_SIMD_ADD (CN24_SIMD_LOAD (y + i),
+                                           CN24_SIMD_LOAD (x + i)));
+
+  for (; i < count; i++)
+    y[i] += x[i];
+}
+
+CN24_SIMD_TARGET
+static void VectorAxpy (const datum alpha, const datum* x, datum* y,
+                        const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE a = CN24_SIMD_SET1 (alpha);
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width)
+    CN24_SIMD_STORE (y + i, CN24_SIMD_FMA (a, CN24_SIMD_LOAD (x + i),
+                                           CN24_SIMD_LOAD (y + i)));
+
+  for (; i < count; i++)
+    y[i] += alpha * x[i];
+}
+
+CN24_SIMD_TARGET
+static void VectorLerp (const datum* first, const datum* second,
+                        const datum weight, datum* output,
+                        const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE w = CN24_SIMD_SET1 (weight);
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE a = CN24_SIMD_LOAD (first + i);
+    const CN24_SIMD_TYPE b = CN24_SIMD_LOAD (second + i);
+    CN24_SIMD_STORE (output + i, CN24_SIMD_FMA (w, CN24_SIMD_SUB (b, a), a));
+  }
+
+  for (; i < count; i++)
+    output[i] = first[i] + weight * (second[i] - first[i]);
+}
+
+CN24_SIMD_TARGET
+static void VectorReLU (const datum* input, datum* output,
+                        const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE zero = CN24_SIMD_ZERO();
+  std::size_t i = 0;
+
+  // max(x, 0) is 0 for NaNs, just like x > 0 ? x : 0
+  for (; i + width <= count; i += width)
+    CN24_SIMD_STORE (output + i, CN24_SIMD_MAX (CN24_SIMD_LOAD (input + i), zero));
+
+  for (; i < count; i++)
+    output[i] = input[i] > 0 ? input[i] : 0;
+}
+
+/*
+ * Approximates e^x. Arguments beyond about +-88 are clamped, so the result
+ * stays finite and normal. Accuracy is MATH_FAST if fast is set and
+ * MATH_PRECISE otherwise.
+ */
+template <bool fast>
+CN24_SIMD_TARGET
+static inline CN24_SIMD_TYPE ExpApprox (const CN24_SIMD_TYPE x) {
+  const CN24_SIMD_TYPE one = CN24_SIMD_SET1 (1);
+  // x86 min and max return their second argument for NaNs, so these are
+  // passed on
+  const CN24_SIMD_TYPE clamped = CN24_SIMD_MIN (CN24_SIMD_SET1 (88.3f),
+                                 CN24_SIMD_MAX (CN24_SIMD_SET1 (-87.3f), x));
+
+  // e^x = 2^n * e^r with n = round(x / ln 2) and |r| <= ln(2) / 2. ln 2 is
+  // subtracted in two parts, the first one is exact in single precision.
+  const CN24_SIMD_TYPE n = CN24_SIMD_ROUND (CN24_SIMD_MUL (clamped,
+                           CN24_SIMD_SET1 (1.44269504f)));
+  CN24_SIMD_TYPE r = CN24_SIMD_FMA (n, CN24_SIMD_SET1 (-0.693359375f), clamped);
+  r = CN24_SIMD_FMA (n, CN24_SIMD_SET1 (2.12194440e-4f), r);
+
+  CN24_SIMD_TYPE p;
+
+  if (fast) {
+    // Third order Taylor polynomial, relative error below 6e-4
+    p = CN24_SIMD_FMA (CN24_SIMD_SET1 (1.0f / 6.0f), r, CN24_SIMD_SET1 (0.5f));
+    p = CN24_SIMD_FMA (p, r, one);
+    p = CN24_SIMD_FMA (p, r, one);
+  } else {
+    // Minimax polynomial from the Cephes library's expf
+    p = CN24_SIMD_SET1 (1.9875691500e-4f);
+    p = CN24_SIMD_FMA (p, r, CN24_SIMD_SET1 (1.3981999507e-3f));
+    p = CN24_SIMD_FMA (p, r, CN24_SIMD_SET1 (8.3334519073e-3f));
+    p = CN24_SIMD_FMA (p, r, CN24_SIMD_SET1 (4.1665795894e-2f));
+    p = CN24_SIMD_FMA (p, r, CN24_SIMD_SET1 (1.6666665459e-1f));
+    p = CN24_SIMD_FMA (p, r, CN24_SIMD_SET1 (5.0000001201e-1f));
+    p = CN24_SIMD_FMA (CN24_SIMD_MUL (p, r), r, CN24_SIMD_ADD (r, one));
+  }
+
+  return CN24_SIMD_SCALE2 (p, n);
+}
+
+/*
+ * Approximates 1 / x, see ExpApprox
+ */
+template <bool fast>
+CN24_SIMD_TARGET
+static inline CN24_SIMD_TYPE ReciprocalApprox (const CN24_SIMD_TYPE x) {
+  return fast ? CN24_SIMD_RCP (x) : CN24_SIMD_DIV (CN24_SIMD_SET1 (1), x);
+}
+
+template <bool fast>
+CN24_SIMD_TARGET
+static void VectorExp (const datum* input, datum* output,
+                       const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width)
+    CN24_SIMD_STORE (output + i, ExpApprox<fast> (CN24_SIMD_LOAD (input + i)));
+
+  for (; i < count; i++)
+    output[i] = std::exp (input[i]);
+}
+
+template <bool fast>
+CN24_SIMD_TARGET
+static void VectorSigmoid (const datum* input, datum* output,
+                           const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE one = CN24_SIMD_SET1 (1);
+  std::size_t i = 0;
+
+  // sigm(x) = 1 / (1 + e^-x)
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE e = ExpApprox<fast> (CN24_SIMD_SUB (CN24_SIMD_ZERO(),
+                             CN24_SIMD_LOAD (input + i)));
+    CN24_SIMD_STORE (output + i, ReciprocalApprox<fast> (CN24_SIMD_ADD (one, e)));
+  }
+
+  for (; i < count; i++)
+    output[i] = 1.0 / (1.0 + std::exp (-input[i]));
+}
+
+template <bool fast>
+CN24_SIMD_TARGET
+static void VectorTanh (const datum* input, datum* output,
+                        const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE one = CN24_SIMD_SET1 (1);
+  const CN24_SIMD_TYPE two = CN24_SIMD_SET1 (2);
+  std::size_t i = 0;
+
+  // tanh(x) = 1 - 2 / (e^2x + 1). tanh(10) is 1 in single precision, so
+  // the argument is clamped to [-10, 10], which keeps the result of the
+  // division from becoming denormal.
+  const CN24_SIMD_TYPE low = CN24_SIMD_SET1 (-10);
+  const CN24_SIMD_TYPE high = CN24_SIMD_SET1 (10);
+
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE x = CN24_SIMD_MIN (high, CN24_SIMD_MAX (low,
+                                            CN24_SIMD_LOAD (input + i)));
+    const CN24_SIMD_TYPE e = ExpApprox<fast> (CN24_SIMD_MUL (two, x));
+    CN24_SIMD_STORE (output + i, CN24_SIMD_SUB (one, CN24_SIMD_MUL (two,
+                     ReciprocalApprox<fast> (CN24_SIMD_ADD (e, one)))));
+  }
+
+  for (; i < count; i++)
+    output[i] = 1.0 - 2.0 / (std::exp (2.0 * input[i]) + 1.0);
+}
+
+template <bool fast>
+CN24_SIMD_TARGET
+static void VectorSoftmax (const datum* input, datum* output,
+                           const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  datum lanes[CN24_SIMD_WIDTH];
+  std::size_t i;
+
+  // Subtracting the maximum keeps e^x from overflowing
+  datum maximum = input[0];
+  CN24_SIMD_TYPE max_acc = CN24_SIMD_SET1 (maximum);
+
+  for (i = 0; i + width <= count; i += width)
+    max_acc = CN24_SIMD_MAX (max_acc, CN24_SIMD_LOAD (input + i));
+
+  for (; i < count; i++)
+    maximum = std::max (maximum, input[i]);
+
+  CN24_SIMD_STORE (lanes, max_acc);
+
+  for (unsigned int l = 0; l < CN24_SIMD_WIDTH; l++)
+    maximum = std::max (maximum, lanes[l]);
+
+  const CN24_SIMD_TYPE shift = CN24_SIMD_SET1 (maximum);
+  CN24_SIMD_TYPE sum_acc = CN24_SIMD_ZERO();
+  datum sum = 0;
+
+  for (i = 0; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE e = ExpApprox<fast> (CN24_SIMD_SUB (
+                               CN24_SIMD_LOAD (input + i), shift));
+    CN24_SIMD_STORE (output + i, e);
+    sum_acc = CN24_SIMD_ADD (sum_acc, e);
+  }
+
+  for (; i < count; i++) {
+    output[i] = std::exp (input[i] - maximum);
+    sum += output[i];
+  }
+
+  CN24_SIMD_STORE (lanes, sum_acc);
+
+  for (unsigned int l = 0; l < CN24_SIMD_WIDTH; l++)
+    sum += lanes[l];
+
+  const CN24_SIMD_TYPE scale = CN24_SIMD_SET1 ((datum) 1 / sum);
+
+  for (i = 0; i + width <= count; i += width)
+    CN24_SIMD_STORE (output + i, CN24_SIMD_MUL (CN24_SIMD_LOAD (output + i), scale));
+
+  for (; i < count; i++)
+    output[i] /= sum;
+}
+
+CN24_SIMD_TARGET
+static void VectorReLUBackward (const datum* data, const datum* output_delta,
+                                datum* input_delta, const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width)
+    CN24_SIMD_STORE (input_delta + i,
+                     CN24_SIMD_MASK_POSITIVE (CN24_SIMD_LOAD (data + i),
+                                              CN24_SIMD_LOAD (output_delta + i)));
+
+  for (; i < count; i++)
+    input_delta[i] = data[i] > 0 ? output_delta[i] : 0;
+}
+
+CN24_SIMD_TARGET
+static void VectorSigmoidBackward (const datum* output,
+                                   const datum* output_delta,
+                                   datum* input_delta,
+                                   const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE one = CN24_SIMD_SET1 (1);
+  std::size_t i = 0;
+
+  // sigm'(x) = sigm(x) * (1 - sigm(x))
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE y = CN24_SIMD_LOAD (output + i);
+    const CN24_SIMD_TYPE dy = CN24_SIMD_LOAD (output_delta + i);
+    CN24_SIMD_STORE (input_delta + i,
+                     CN24_SIMD_MUL (CN24_SIMD_MUL (dy, y), CN24_SIMD_SUB (one, y)));
+  }
+
+  for (; i < count; i++)
+    input_delta[i] = output_delta[i] * output[i] * (1 - output[i]);
+}
+
+CN24_SIMD_TARGET
+static void VectorTanhBackward (const datum* output, const datum* output_delta,
+                                datum* input_delta, const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  const CN24_SIMD_TYPE one = CN24_SIMD_SET1 (1);
+  std::size_t i = 0;
+
+  // tanh'(x) = 1 - tanh(x)^2
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE y = CN24_SIMD_LOAD (output + i);
+    const CN24_SIMD_TYPE dy = CN24_SIMD_LOAD (output_delta + i);
+    CN24_SIMD_STORE (input_delta + i,
+                     CN24_SIMD_MUL (dy, CN24_SIMD_SUB (one, CN24_SIMD_MUL (y, y))));
+  }
+
+  for (; i < count; i++)
+    input_delta[i] = output_delta[i] * (1 - output[i] * output[i]);
+}
+
+CN24_SIMD_TARGET
+static void VectorWeightedDifference (const datum* first, const datum* second,
+                                      const datum* weight, datum* delta,
+                                      const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  std::size_t i = 0;
+
+  if (weight == nullptr) {
+    for (; i + width <= count; i += width)
+      CN24_SIMD_STORE (delta + i, CN24_SIMD_SUB (CN24_SIMD_LOAD (first + i),
+                       CN24_SIMD_LOAD (second + i)));
+
+    for (; i < count; i++)
+      delta[i] = first[i] - second[i];
+
+    return;
+  }
+
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE diff = CN24_SIMD_SUB (CN24_SIMD_LOAD (first + i),
+                                CN24_SIMD_LOAD (second + i));
+    CN24_SIMD_STORE (delta + i, CN24_SIMD_MUL (diff, CN24_SIMD_LOAD (weight + i)));
+  }
+
+  for (; i < count; i++)
+    delta[i] = (first[i] - second[i]) * weight[i];
+}
+
+CN24_SIMD_TARGET
+static datum VectorWeightedSquaredError (const datum* first,
+    const datum* second,
+    const datum* weight,
+    const std::size_t count) {
+  const std::size_t width = CN24_SIMD_WIDTH;
+  CN24_SIMD_TYPE acc = CN24_SIMD_ZERO();
+  datum sum = 0;
+  std::size_t i = 0;
+
+  for (; i + width <= count; i += width) {
+    const CN24_SIMD_TYPE diff = CN24_SIMD_SUB (CN24_SIMD_LOAD (first + i),
+                                CN24_SIMD_LOAD (second + i));
+    const CN24_SIMD_TYPE squared = CN24_SIMD_MUL (diff, diff);
+    acc = weight == nullptr ? CN24_SIMD_ADD (acc, squared) :
+          CN24_SIMD_FMA (squared, CN24_SIMD_LOAD (weight + i), acc);
+  }
+
+  for (; i < count; i++) {
+    const datum diff = first[i] - second[i];
+    sum += diff * diff * (weight == nullptr ? 1 : weight[i]);
+  }
+
+  datum lanes[CN24_SIMD_WIDTH];
+  CN24_SIMD_STORE (lanes, acc);
+
+  for (unsigned int l = 0; l < CN24_SIMD_WIDTH; l++)
+    sum += lanes[l];
+
+  return sum;
+}
+
+/*
+ * Fills the kernel table with the kernels for this instruction set
+ */
+static void GetKernels (VectorMathKernels& kernels) {
+  kernels.fill = VectorFill;
+  kernels.add = VectorAdd;
+  kernels.axpy = VectorAxpy;
+  kernels.lerp = VectorLerp;
+  kernels.relu = VectorReLU;
+  kernels.relu_backward = VectorReLUBackward;
+  kernels.exp[0] = VectorExp<false>;
+  kernels.exp[1] = VectorExp<true>;
+  kernels.sigmoid[0] = VectorSigmoid<false>;
+  kernels.sigmoid[1] = VectorSigmoid<true>;
+  kernels.tanh[0] = VectorTanh<false>;
+  kernels.tanh[1] = VectorTanh<true>;
+  kernels.softmax[0] = VectorSoftmax<false>;
+  kernels.softmax[1] = VectorSoftmax<true>;
+  kernels.sigmoid_backward = VectorSigmoidBackward;
+  kernels.tanh_backward = VectorTanhBackward;
+  kernels.weighted_difference = VectorWeightedDifference;
+  kernels.weighted_squared_error = VectorWeightedSquaredError;
+}
+
+}
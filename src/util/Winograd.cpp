@@ -0,0 +1,409 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "Config.h"
+#include "Log.h"
+#include "DirectConvolution.h"
+#include "ThreadPool.h"
+
+#include "Winograd.h"
+
+namespace Conv {
+
+// Number of tiles that are transformed and multiplied together
+const unsigned int winograd_chunk = 64;
+
+// Padding between the planes of the transformed tiles. Without it, the
+// alpha^2 values of a tile are a power of two apart and all compete for
+// the same cache sets.
+const unsigned int winograd_plane_padding = 16;
+
+/*
+ * Constructs the Cook-Toom matrices for F(m,r) from the interpolation
+ * points 0, 1, -1, 2, -2 and infinity. The scaling of the Lagrange
+ * polynomials goes into G, so AT and BT have small integer entries.
+ */
+static void BuildMatrices (const unsigned int m, const unsigned int r,
+                           datum* at, datum* g, datum* bt) {
+  const unsigned int alpha = m + r - 1;
+  const unsigned int n = alpha - 1;
+  const double points[] = { 0, 1, -1, 2, -2, 0.5, -0.5 };
+
+  // AT evaluates the output polynomial at the points
+  for (unsigned int i = 0; i < m; i++) {
+    for (unsigned int j = 0; j < n; j++)
+      at[i * alpha + j] = (datum) std::pow (points[j], (double) i);
+
+    at[i * alpha + n] = (i == m - 1) ? 1 : 0;
+  }
+
+  for (unsigned int j = 0; j < alpha; j++) {
+    // Coefficients of prod (x - p_l) for l != j, or for all l if j is
+    // the point at infinity
+    double poly[8] = { 1, 0, 0, 0, 0, 0, 0, 0 };
+    unsigned int degree = 0;
+    double scale = 1;
+
+    for (unsigned int l = 0; l < n; l++) {
+      if (l == j)
+        continue;
+
+      degree++;
+      for (unsigned int c = degree; c > 0; c--)
+        poly[c] = poly[c - 1] - points[l] * poly[c];
+      poly[0] = -points[l] * poly[0];
+
+      if (j < n)
+        scale *= points[j] - points[l];
+    }
+
+    for (unsigned int c = 0; c < alpha; c++)
+      bt[j * alpha + c] = (datum) poly[c];
+
+    for (unsigned int k = 0; k < r; k++) {
+      if (j < n)
+        g[j * r + k] = (datum) (std::pow (points[j], (double) k) / scale);
+      else
+        g[j * r + k] = (k == r - 1) ? 1 : 0;
+    }
+  }
+}
+
+/*
+ * The transformations are templates so that the compiler can unroll
+ * them completely for each tile size.
+ */
+template <unsigned int alpha>
+static inline void TransformInput (const datum* bt, const datum* tile,
+                                   datum* target, const std::size_t stride) {
+  datum temp[alpha * alpha];
+
+  // temp = BT * tile
+  for (unsigned int a = 0; a < alpha; a++) {
+    for (unsigned int c = 0; c < alpha; c++) {
+      datum sum = 0;
+      for (unsigned int b = 0; b < alpha; b++)
+        sum += bt[a * alpha + b] * tile[b * alpha + c];
+      temp[a * alpha + c] = sum;
+    }
+  }
+
+  // V = temp * B
+  for (unsigned int a = 0; a < alpha; a++) {
+    for (unsigned int e = 0; e < alpha; e++) {
+      datum sum = 0;
+      for (unsigned int c = 0; c < alpha; c++)
+        sum += temp[a * alpha + c] * bt[e * alpha + c];
+      target[(a * alpha + e) * stride] = sum;
+    }
+  }
+}
+
+template <unsigned int m, unsigned int alpha>
+static inline void TransformOutput (const datum* at, const datum* source,
+                                    const std::size_t stride, datum* tile) {
+  datum temp[m * alpha];
+
+  // temp = AT * M
+  for (unsigned int a = 0; a < m; a++) {
+    for (unsigned int c = 0; c < alpha; c++) {
+      datum sum = 0;
+      for (unsigned int b = 0; b < alpha; b++)
+        sum += at[a * alpha + b] * source[(b * alpha + c) * stride];
+      temp[a * alpha + c] = sum;
+    }
+  }
+
+  // Y = temp * A
+  for (unsigned int a = 0; a < m; a++) {
+    for (unsigned int e = 0; e < m; e++) {
+      datum sum = 0;
+      for (unsigned int c = 0; c < alpha; c++)
+        sum += temp[a * alpha + c] * at[e * alpha + c];
+      tile[a * m + e] = sum;
+    }
+  }
+}
+
+bool WinogradConvolution::Supports (const unsigned int kernel_width,
+                                    const unsigned int kernel_height) {
+  return kernel_width == kernel_height &&
+         (kernel_width == 3 || kernel_width == 5);
+}
+
+bool WinogradConvolution::Profitable (const ConvolutionShape& shape) {
+  if (!Supports (shape.kernel_width, shape.kernel_height))
+    return false;
+
+  const unsigned int maps = shape.input_maps < shape.output_maps ?
+                            shape.input_maps : shape.output_maps;
+
+  // F(2x2,5x5) saves less than F(4x4,3x3)
+  return maps >= (shape.kernel_width == 3 ? 16 : 48);
+}
+
+WinogradConvolution::WinogradConvolution (const ConvolutionShape& shape,
+    const unsigned int pad_x,
+    const unsigned int pad_y) :
+  shape_ (shape), pad_x_ (pad_x), pad_y_ (pad_y) {
+  if (!Supports (shape.kernel_width, shape.kernel_height)) {
+    FATAL ("No Winograd algorithm for " << shape.kernel_width << "x" <<
+           shape.kernel_height << " kernels");
+  }
+
+  r_ = shape.kernel_width;
+
+  // F(4x4,3x3) needs fewer multiplications, but wastes more work on
+  // partial tiles at the border of small maps
+  if (r_ == 3 && shape.output_width >= 8 && shape.output_height >= 8)
+    m_ = 4;
+  else
+    m_ = 2;
+
+  alpha_ = m_ + r_ - 1;
+  tiles_x_ = (shape.output_width + m_ - 1) / m_;
+  tiles_y_ = (shape.output_height + m_ - 1) / m_;
+
+  BuildMatrices (m_, r_, at_, g_, bt_);
+
+  // The element-wise products are summed over the input maps, so for
+  // every position in the tile, this is a 1x1 convolution over a chunk
+  // of tiles. It runs on the SIMD kernels of DirectConvolution.
+  product_shape_.samples = 1;
+  product_shape_.input_width = winograd_chunk;
+  product_shape_.input_height = 1;
+  product_shape_.input_maps = shape.input_maps;
+  product_shape_.output_width = winograd_chunk;
+  product_shape_.output_height = 1;
+  product_shape_.output_maps = shape.output_maps;
+  product_shape_.kernel_width = 1;
+  product_shape_.kernel_height = 1;
+
+  transformed_kernels_.Resize (alpha_ * alpha_ *
+                               DirectConvolution::PackedSize (product_shape_));
+
+  LOGDEBUG << "Using F(" << m_ << "x" << m_ << "," << r_ << "x" << r_ <<
+           ") for " << shape.output_width << "x" << shape.output_height <<
+           " outputs";
+}
+
+void WinogradConvolution::TransformKernels (const datum* weights,
+    const datum weight_factor,
+    const bool flip) {
+  const unsigned int r = r_;
+  const unsigned int alpha = alpha_;
+  const std::size_t plane = (std::size_t) shape_.output_maps * shape_.input_maps;
+
+  // alpha^2 x output_maps x input_maps
+  std::vector<datum> transformed (alpha * alpha * plane);
+  datum* target = &transformed[0];
+
+  ThreadPool::ParallelFor (plane, [&] (const int pair) {
+    const unsigned int omap = pair / shape_.input_maps;
+    const unsigned int imap = pair % shape_.input_maps;
+    datum kernel[5 * 5];
+    datum temp[6 * 5];
+
+    for (unsigned int ky = 0; ky < r; ky++) {
+      for (unsigned int kx = 0; kx < r; kx++) {
+        if (flip) {
+          kernel[ky * r + kx] = weight_factor * weights[
+                                  (((std::size_t) imap * shape_.output_maps + omap) * r +
+                                   (r - 1 - ky)) * r + (r - 1 - kx)];
+        } else {
+          kernel[ky * r + kx] = weight_factor * weights[
+                                  (((std::size_t) omap * shape_.input_maps + imap) * r +
+                                   ky) * r + kx];
+        }
+      }
+    }
+
+    // temp = G * kernel
+    for (unsigned int a = 0; a < alpha; a++) {
+      for (unsigned int c = 0; c < r; c++) {
+        datum sum = 0;
+        for (unsigned int b = 0; b < r; b++)
+          sum += g_[a * r + b] * kernel[b * r + c];
+        temp[a * r + c] = sum;
+      }
+    }
+
+    // U = temp * G'
+    for (unsigned int a = 0; a < alpha; a++) {
+      for (unsigned int e = 0; e < alpha; e++) {
+        datum sum = 0;
+        for (unsigned int c = 0; c < r; c++)
+          sum += temp[a * r + c] * g_[e * r + c];
+        target[(a * alpha + e) * plane + pair] = sum;
+      }
+    }
+  });
+
+  const std::size_t packed_size = DirectConvolution::PackedSize (product_shape_);
+
+  for (unsigned int xi = 0; xi < alpha * alpha; xi++) {
+    DirectConvolution::PackWeights (product_shape_, &transformed[xi * plane], 1.0,
+                                    transformed_kernels_.data_ptr() + xi * packed_size);
+  }
+}
+
+void WinogradConvolution::TransformInputTile (const datum* input,
+    const unsigned int x0,
+    const unsigned int y0,
+    datum* target,
+    const std::size_t stride) const {
+  const unsigned int alpha = alpha_;
+  datum tile[6 * 6];
+
+  // Coordinates are shifted by the padding so they stay unsigned
+  const bool inside = x0 >= pad_x_ && y0 >= pad_y_ &&
+                      x0 + alpha <= shape_.input_width + pad_x_ &&
+                      y0 + alpha <= shape_.input_height + pad_y_;
+
+  if (inside) {
+    for (unsigned int b = 0; b < alpha; b++) {
+      const datum* row = input + (std::size_t) (y0 + b - pad_y_) * shape_.input_width +
+                         (x0 - pad_x_);
+      for (unsigned int c = 0; c < alpha; c++)
+        tile[b * alpha + c] = row[c];
+    }
+  } else {
+    for (unsigned int b = 0; b < alpha; b++) {
+      const unsigned int y = y0 + b;
+      for (unsigned int c = 0; c < alpha; c++) {
+        const unsigned int x = x0 + c;
+        const bool valid = x >= pad_x_ && y >= pad_y_ &&
+                           x < shape_.input_width + pad_x_ &&
+                           y < shape_.input_height + pad_y_;
+        tile[b * alpha + c] = valid ?
+                              input[(std::size_t) (y - pad_y_) * shape_.input_width + (x - pad_x_)] : 0;
+      }
+    }
+  }
+
+  if (alpha == 4)
+    TransformInput<4> (bt_, tile, target, stride);
+  else
+    TransformInput<6> (bt_, tile, target, stride);
+}
+
+void WinogradConvolution::TransformOutputTile (const datum* source,
+    const std::size_t stride,
+    const datum bias, datum* output,
+    const unsigned int x0,
+    const unsigned int y0,
+    const ConvolutionEpilogue epilogue) const {
+  const unsigned int alpha = alpha_;
+  const unsigned int m = m_;
+  datum tile[4 * 4];
+
+  if (alpha == 4)
+    TransformOutput<2, 4> (at_, source, stride, tile);
+  else if (m == 2)
+    TransformOutput<2, 6> (at_, source, stride, tile);
+  else
+    TransformOutput<4, 6> (at_, source, stride, tile);
+
+  for (unsigned int i = 0; i < m * m; i++)
+    tile[i] += bias;
+
+  if (epilogue != nullptr)
+    epilogue (tile, m * m);
+
+  // Only the part that is inside the output is written
+  for (unsigned int a = 0; a < m && y0 + a < shape_.output_height; a++) {
+    datum* row = output + (std::size_t) (y0 + a) * shape_.output_width + x0;
+
+    for (unsigned int e = 0; e < m && x0 + e < shape_.output_width; e++)
+      row[e] = tile[a * m + e];
+  }
+}
+
+void WinogradConvolution::Forward (const datum* input, const datum* bias,
+                                   datum* output,
+                                   const ConvolutionEpilogue epilogue) const {
+  const unsigned int alpha2 = alpha_ * alpha_;
+  const unsigned int input_maps = shape_.input_maps;
+  const unsigned int output_maps = shape_.output_maps;
+  const std::size_t input_plane = (std::size_t) shape_.input_width * shape_.input_height;
+  const std::size_t output_plane = (std::size_t) shape_.output_width * shape_.output_height;
+  const unsigned int tiles_per_sample = tiles_x_ * tiles_y_;
+  const unsigned int tiles = tiles_per_sample * shape_.samples;
+  const int chunks = (int) ((tiles + winograd_chunk - 1) / winograd_chunk);
+  const datum* kernels = transformed_kernels_.data_ptr_const();
+  const std::size_t packed_size = DirectConvolution::PackedSize (product_shape_);
+
+  // V is alpha^2 x input_maps x chunk, M is alpha^2 x output_maps x chunk,
+  // one of each per thread
+  const std::size_t v_plane = (std::size_t) input_maps * winograd_chunk +
+                              winograd_plane_padding;
+  const std::size_t m_plane = (std::size_t) output_maps * winograd_chunk +
+                              winograd_plane_padding;
+  std::vector<std::vector<datum>> v_buffers (ThreadPool::Threads());
+  std::vector<std::vector<datum>> m_buffers (ThreadPool::Threads());
+
+  ThreadPool::ParallelRange (chunks, [&] (const std::size_t chunk_begin,
+                                          const std::size_t chunk_end,
+                                          const unsigned int thread) {
+    std::vector<datum>& v = v_buffers[thread];
+    std::vector<datum>& m = m_buffers[thread];
+
+    if (v.empty()) {
+      v.resize (alpha2 * v_plane);
+      m.resize (alpha2 * m_plane);
+    }
+
+    for (int chunk = (int) chunk_begin; chunk < (int) chunk_end; chunk++) {
+      const unsigned int first_tile = chunk * winograd_chunk;
+      const unsigned int chunk_tiles = tiles - first_tile < winograd_chunk ?
+                                       tiles - first_tile : winograd_chunk;
+
+      for (unsigned int t = 0; t < chunk_tiles; t++) {
+        const unsigned int tile = first_tile + t;
+        const unsigned int sample = tile / tiles_per_sample;
+        const unsigned int ty = (tile % tiles_per_sample) / tiles_x_;
+        const unsigned int tx = tile % tiles_x_;
+
+        for (unsigned int imap = 0; imap < input_maps; imap++) {
+          TransformInputTile (input + ((std::size_t) sample * input_maps + imap) * input_plane,
+                              tx * m_, ty * m_,
+                              &v[(std::size_t) imap * winograd_chunk + t], v_plane);
+        }
+      }
+
+      // One small matrix product per position in the transformed tile.
+      // Columns past chunk_tiles contain stale values and are ignored.
+      for (unsigned int xi = 0; xi < alpha2; xi++) {
+        DirectConvolution::ForwardPacked (product_shape_,
+                                          &v[xi * v_plane],
+                                          kernels + xi * packed_size, nullptr,
+                                          &m[xi * m_plane],
+                                          nullptr, false);
+      }
+
+      for (unsigned int t = 0; t < chunk_tiles; t++) {
+        const unsigned int tile = first_tile + t;
+        const unsigned int sample = tile / tiles_per_sample;
+        const unsigned int ty = (tile % tiles_per_sample) / tiles_x_;
+        const unsigned int tx = tile % tiles_x_;
+
+        for (unsigned int omap = 0; omap < output_maps; omap++) {
+          TransformOutputTile (&m[(std::size_t) omap * winograd_chunk + t],
+                               m_plane,
+                               bias != nullptr ? bias[omap] : 0,
+                               output + ((std::size_t) sample * output_maps + omap) * output_plane,
+                               tx * m_, ty * m_, epilogue);
+        }
+      }
+    }
+  });
+}
+
+}
@@ -72,7 +72,7 @@ int main (int argc, char* argv[]) {
   Conv::Tensor::CopySample(original_data_tensor, 0, data_tensor, 0);
 
   // Assemble net
-  Conv::Net net;
+  Conv::Net net(true);
   Conv::InputLayer input_layer(data_tensor);
 
   int data_layer_id = net.AddLayer(&input_layer);
@@ -81,6 +81,9 @@ int main (int argc, char* argv[]) {
 
   // Load network parameters
   net.DeserializeParameters(param_tensor_file);
+
+  // Only one forward pass, the outputs can share memory
+  net.PlanMemory();
   
   LOGINFO << "Classifying..." << std::flush;
   net.FeedForward();
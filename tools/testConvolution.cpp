@@ -0,0 +1,490 @@
+/*
+ * This file is part of the CN24 semantic segmentation software,
+ * copyright (C) 2015 Clemens-Alexander Brust (ikosa dot de at gmail dot com).
+ *
+ * For licensing information, see the LICENSE file included with this project.
+ */
+/**
+ * @file testConvolution.cpp
+ * @brief Checks the ThreadPool and every convolution algorithm against
+ *   simple reference implementations
+ *
+ * Everything runs once with one thread and once with the number of threads
+ * given on the command line. The default is the number of cores, but at
+ * least four.
+ *
+ * @author Clemens-A. Brust (ikosa.de@gmail.com)
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <cn24.h>
+
+using namespace Conv;
+
+struct TestCase {
+  int kernel_width, kernel_height, output_maps, input_maps;
+  int width, height, samples;
+  int stride_x, stride_y, dilation_x, dilation_y, border_x, border_y;
+  bool mirror;
+  int groups;
+  bool depthwise;
+  ConvolutionActivation activation;
+  int pooling_width, pooling_height;
+};
+
+const char* algorithm_names[] = { "gemm", "direct", "winograd", "depthwise" };
+
+std::mt19937 generator (42);
+
+datum Random() {
+  return std::uniform_real_distribution<datum> (-1, 1) (generator);
+}
+
+// Mirror padding repeats the image without its edge pixel
+int Mirror (int i, const int size) {
+  while (i < 0 || i >= size) {
+    if (i < 0)
+      i = -i;
+    if (i >= size)
+      i = 2 * (size - 1) - i;
+  }
+  return i;
+}
+
+double Activation (const ConvolutionActivation activation, const double x) {
+  switch (activation) {
+    case CONV_ACTIVATION_RELU:
+      return x > 0 ? x : 0;
+    case CONV_ACTIVATION_SIGMOID:
+      return 1.0 / (1.0 + std::exp (-x));
+    case CONV_ACTIVATION_TANH:
+      return std::tanh (x);
+    default:
+      return x;
+  }
+}
+
+// Derivative of the activation, given its output y
+double ActivationGradient (const ConvolutionActivation activation,
+                           const double y) {
+  switch (activation) {
+    case CONV_ACTIVATION_RELU:
+      return y > 0 ? 1 : 0;
+    case CONV_ACTIVATION_SIGMOID:
+      return y * (1.0 - y);
+    case CONV_ACTIVATION_TANH:
+      return 1.0 - y * y;
+    default:
+      return 1;
+  }
+}
+
+double RelativeError (const std::vector<double>& reference,
+                      const Tensor& tensor) {
+  const datum* data = tensor.data_ptr_const();
+  double error = 0, magnitude = 0;
+  for (std::size_t i = 0; i < reference.size(); i++) {
+    error = std::max (error, std::fabs (reference[i] - data[i]));
+    magnitude = std::max (magnitude, std::fabs (reference[i]));
+  }
+  return error / std::max (1.0, magnitude);
+}
+
+std::string Describe (const TestCase& c) {
+  std::stringstream ss;
+  ss << c.kernel_width << "x" << c.kernel_height << ", " << c.input_maps <<
+     "->" << c.output_maps << " maps, " << c.width << "x" << c.height << "x" <<
+     c.samples << ", stride " << c.stride_x << "," << c.stride_y <<
+     ", dilation " << c.dilation_x << "," << c.dilation_y << ", border " <<
+     c.border_x << "," << c.border_y << (c.mirror ? " mirror" : " zero") <<
+     ", groups " << c.groups << (c.depthwise ? ", depthwise" : "") <<
+     ", activation " << (int) c.activation << ", pooling " <<
+     c.pooling_width << "x" << c.pooling_height;
+  return ss.str();
+}
+
+/*
+ * Returns false if the algorithm gives wrong results. Algorithms that don't
+ * support the layer's settings are skipped.
+ */
+bool TestConvolution (const TestCase& c, const ConvolutionAlgorithm algorithm,
+                      unsigned int& tests) {
+  CombinedTensor input (c.samples, c.width, c.height, c.input_maps);
+  ConvolutionLayer layer (c.kernel_width, c.kernel_height, c.output_maps, 1);
+
+  if (c.stride_x > 1 || c.stride_y > 1)
+    layer.SetStride (c.stride_x, c.stride_y);
+  if (c.dilation_x > 1 || c.dilation_y > 1)
+    layer.SetDilation (c.dilation_x, c.dilation_y);
+  if (c.border_x > 0 || c.border_y > 0)
+    layer.SetPadding (c.border_x, c.border_y,
+                      c.mirror ? CONV_PADDING_MIRROR : CONV_PADDING_ZERO);
+  if (c.groups > 1)
+    layer.SetGroups (c.groups);
+  if (c.depthwise)
+    layer.SetDepthwise();
+  if (c.activation != CONV_ACTIVATION_NONE)
+    layer.SetActivation (c.activation);
+  if (c.pooling_width > 1 || c.pooling_height > 1)
+    layer.SetMaxPooling (c.pooling_width, c.pooling_height);
+  layer.SetAlgorithm (algorithm);
+
+  std::vector<CombinedTensor*> inputs = { &input };
+  std::vector<CombinedTensor*> outputs;
+  Layer* base = &layer;
+
+  if (!base->CreateOutputs (inputs, outputs) ||
+      !base->Connect (inputs, outputs)) {
+    LOGERROR << "Cannot connect layer: " << Describe (c);
+    return false;
+  }
+
+  CombinedTensor* output = outputs[0];
+  Tensor& weights = layer.parameters()[0]->data;
+  Tensor& bias = layer.parameters()[1]->data;
+
+  for (std::size_t i = 0; i < weights.elements(); i++)
+    weights[i] = Random() * 0.5;
+  for (std::size_t i = 0; i < bias.elements(); i++)
+    bias[i] = Random();
+  for (std::size_t i = 0; i < input.data.elements(); i++)
+    input.data[i] = Random();
+  layer.InvalidateParameters();
+
+  layer.FeedForward();
+
+  if (layer.algorithm() != algorithm) {
+    delete output;
+    return true;
+  }
+  tests++;
+
+  const int output_maps = output->data.maps();
+  const int groups = layer.groups();
+  const int group_input_maps = c.input_maps / groups;
+  const int group_output_maps = output_maps / groups;
+  const int pooled_width = output->data.width();
+  const int pooled_height = output->data.height();
+  const int output_width = pooled_width * c.pooling_width;
+  const int output_height = pooled_height * c.pooling_height;
+  const int pad_x = c.border_x / 2;
+  const int pad_y = c.border_y / 2;
+
+  auto input_index = [&] (int sample, int map, int x, int y,
+                          std::size_t& index) -> bool {
+    if (x < 0 || y < 0 || x >= c.width || y >= c.height) {
+      if (!c.mirror)
+        return false;
+      x = Mirror (x, c.width);
+      y = Mirror (y, c.height);
+    }
+    index = ((std::size_t) (sample * c.input_maps + map) * c.height + y) *
+            c.width + x;
+    return true;
+  };
+
+  auto weight_index = [&] (int output_map, int map, int kx, int ky) {
+    return ((std::size_t) (output_map * group_input_maps + map) *
+            c.kernel_height + ky) * c.kernel_width + kx;
+  };
+
+  // Forward: convolution, then pooling, then the activation
+  std::vector<double> convolution ((std::size_t) c.samples * output_maps *
+                                   output_height * output_width);
+  for (int n = 0; n < c.samples; n++)
+    for (int o = 0; o < output_maps; o++)
+      for (int y = 0; y < output_height; y++)
+        for (int x = 0; x < output_width; x++) {
+          const int group = o / group_output_maps;
+          double sum = bias[o];
+          for (int m = 0; m < group_input_maps; m++)
+            for (int ky = 0; ky < c.kernel_height; ky++)
+              for (int kx = 0; kx < c.kernel_width; kx++) {
+                std::size_t index;
+                if (input_index (n, group * group_input_maps + m,
+                                 x * c.stride_x + kx * c.dilation_x - pad_x,
+                                 y * c.stride_y + ky * c.dilation_y - pad_y,
+                                 index))
+                  sum += weights[weight_index (o, m, kx, ky)] *
+                         input.data[index];
+              }
+          convolution[((std::size_t) (n * output_maps + o) * output_height +
+                       y) * output_width + x] = sum;
+        }
+
+  std::vector<double> reference (output->data.elements());
+  std::vector<std::size_t> maximum (reference.size());
+  for (int n = 0; n < c.samples; n++)
+    for (int o = 0; o < output_maps; o++)
+      for (int y = 0; y < pooled_height; y++)
+        for (int x = 0; x < pooled_width; x++) {
+          double best = -INFINITY;
+          std::size_t best_index = 0;
+          for (int py = 0; py < c.pooling_height; py++)
+            for (int px = 0; px < c.pooling_width; px++) {
+              const std::size_t index = ((std::size_t) (n * output_maps + o) *
+                                         output_height + y * c.pooling_height +
+                                         py) * output_width +
+                                        x * c.pooling_width + px;
+              if (convolution[index] > best) {
+                best = convolution[index];
+                best_index = index;
+              }
+            }
+          const std::size_t index = ((std::size_t) (n * output_maps + o) *
+                                     pooled_height + y) * pooled_width + x;
+          reference[index] = Activation (c.activation, best);
+          maximum[index] = best_index;
+        }
+
+  const double forward_error = RelativeError (reference, output->data);
+
+  // Backward, with garbage in the deltas to catch missing overwrites
+  for (std::size_t i = 0; i < output->delta.elements(); i++)
+    output->delta[i] = Random();
+  for (std::size_t i = 0; i < input.delta.elements(); i++)
+    input.delta[i] = 777;
+  for (CombinedTensor* parameter : layer.parameters())
+    for (std::size_t i = 0; i < parameter->delta.elements(); i++)
+      parameter->delta[i] = 777;
+
+  // The layer may apply the activation's gradient to the output delta in
+  // place, so this has to come first
+  std::vector<double> convolution_delta (convolution.size(), 0.0);
+  for (std::size_t i = 0; i < reference.size(); i++)
+    convolution_delta[maximum[i]] += output->delta[i] *
+      ActivationGradient (c.activation, output->data[i]);
+
+  layer.BackPropagate();
+
+  std::vector<double> input_delta (input.data.elements(), 0.0);
+  std::vector<double> weights_delta (weights.elements(), 0.0);
+  std::vector<double> bias_delta (bias.elements(), 0.0);
+  for (int n = 0; n < c.samples; n++)
+    for (int o = 0; o < output_maps; o++)
+      for (int y = 0; y < output_height; y++)
+        for (int x = 0; x < output_width; x++) {
+          const int group = o / group_output_maps;
+          const double delta = convolution_delta[
+            ((std::size_t) (n * output_maps + o) * output_height + y) *
+            output_width + x];
+          bias_delta[o] += delta;
+          for (int m = 0; m < group_input_maps; m++)
+            for (int ky = 0; ky < c.kernel_height; ky++)
+              for (int kx = 0; kx < c.kernel_width; kx++) {
+                std::size_t index;
+                if (input_index (n, group * group_input_maps + m,
+                                 x * c.stride_x + kx * c.dilation_x - pad_x,
+                                 y * c.stride_y + ky * c.dilation_y - pad_y,
+                                 index)) {
+                  const std::size_t w = weight_index (o, m, kx, ky);
+                  weights_delta[w] += delta * input.data[index];
+                  input_delta[index] += delta * weights[w];
+                }
+              }
+        }
+
+  const double input_error = RelativeError (input_delta, input.delta);
+  const double weights_error = RelativeError (weights_delta,
+                               layer.parameters()[0]->delta);
+  const double bias_error = RelativeError (bias_delta,
+                            layer.parameters()[1]->delta);
+
+  delete output;
+
+  if (forward_error > 1e-4 || input_error > 2e-4 || weights_error > 2e-4 ||
+      bias_error > 2e-4) {
+    LOGERROR << algorithm_names[algorithm] << " convolution failed (" <<
+             Describe (c) << "): forward error " << forward_error <<
+             ", input delta error " << input_error <<
+             ", weights delta error " << weights_error <<
+             ", bias delta error " << bias_error;
+    return false;
+  }
+
+  LOGDEBUG << algorithm_names[algorithm] << " convolution OK (" <<
+           Describe (c) << ")";
+  return true;
+}
+
+/*
+ * Checks that ParallelRange covers every index once, with valid ranges and
+ * thread indices, and that no thread index is used twice at the same time.
+ */
+bool TestParallelRange (const std::size_t count, const std::size_t grain) {
+  std::vector<std::atomic<unsigned int>> hits (count);
+  std::vector<std::atomic<bool>> busy (ThreadPool::Threads());
+  std::atomic<bool> valid (true);
+
+  for (std::size_t i = 0; i < count; i++)
+    hits[i] = 0;
+  for (std::size_t t = 0; t < busy.size(); t++)
+    busy[t] = false;
+
+  ThreadPool::ParallelRange (count, [&] (const std::size_t begin,
+                                         const std::size_t end,
+                                         const unsigned int thread) {
+    if (thread >= busy.size() || busy[thread].exchange (true)) {
+      valid = false;
+      return;
+    }
+    if (begin >= end || end > count || begin % grain != 0 ||
+        (end % grain != 0 && end != count))
+      valid = false;
+    for (std::size_t i = begin; i < end; i++)
+      hits[i]++;
+    busy[thread] = false;
+  }, grain);
+
+  for (std::size_t i = 0; i < count; i++)
+    if (hits[i] != 1)
+      valid = false;
+
+  if (!valid)
+    LOGERROR << "ParallelRange failed (count " << count << ", grain " <<
+             grain << ")";
+  return valid;
+}
+
+// Loops inside loops, as the layers do when a Net runs them in parallel
+bool TestNestedLoops() {
+  const std::size_t outer = 8, inner = 1000;
+  std::vector<std::atomic<unsigned int>> hits (outer * inner);
+  for (std::size_t i = 0; i < hits.size(); i++)
+    hits[i] = 0;
+
+  ThreadPool::ParallelFor (outer, [&] (const std::size_t o) {
+    ThreadPool::ParallelFor (inner, [&] (const std::size_t i) {
+      hits[o * inner + i]++;
+    }, 16);
+  });
+
+  for (std::size_t i = 0; i < hits.size(); i++)
+    if (hits[i] != 1) {
+      LOGERROR << "Nested ParallelFor failed";
+      return false;
+    }
+  return true;
+}
+
+// Loops started by several threads at once, like a prefetch thread does
+bool TestConcurrentCallers() {
+  const unsigned int callers = 4, loops = 50;
+  const std::size_t count = 1000;
+  std::atomic<bool> valid (true);
+  std::vector<std::thread> threads;
+
+  for (unsigned int c = 0; c < callers; c++)
+    threads.emplace_back ([&] () {
+      std::vector<unsigned int> hits (count);
+      for (unsigned int l = 0; l < loops; l++) {
+        std::fill (hits.begin(), hits.end(), 0);
+        ThreadPool::ParallelFor (count, [&] (const std::size_t i) {
+          hits[i]++;
+        }, 8);
+        for (std::size_t i = 0; i < count; i++)
+          if (hits[i] != 1)
+            valid = false;
+      }
+    });
+
+  for (std::thread& thread : threads)
+    thread.join();
+
+  if (!valid)
+    LOGERROR << "Concurrent ParallelFor failed";
+  return valid;
+}
+
+int main (int argc, char** argv) {
+  Conv::System::Init();
+
+  unsigned int threads = std::max (ThreadPool::Threads(), 4u);
+  if (argc > 1)
+    threads = std::max (std::atoi (argv[1]), 1);
+
+  const std::vector<TestCase> cases = {
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 5, 5, 6, 3, 20, 16, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 7, 7, 4, 3, 23, 19, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 1, 1, 9, 7, 11, 10, 3, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 2, 2, 4, 3, 10, 10, 1, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 5, 4, 2, 12, 12, 1, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 33, 17, 40, 35, 2, 1, 1, 1, 1, 2, 2, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    // Stride, dilation and padding
+    { 3, 3, 8, 5, 17, 13, 2, 2, 2, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 2, 2, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 1, 1, 2, 2, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 5, 5, 8, 5, 17, 13, 2, 1, 1, 1, 1, 4, 4, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 4, 2, 9, 9, 1, 1, 1, 1, 1, 2, 2, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 5, 5, 4, 2, 7, 7, 1, 1, 1, 1, 1, 4, 4, false, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 1, 1, 2, 2, true, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 2, 2, 4, 4, true, 1, false, CONV_ACTIVATION_NONE, 1, 1 },
+    // Groups and depthwise
+    { 3, 3, 8, 6, 17, 13, 2, 1, 1, 1, 1, 0, 0, false, 2, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 8, 6, 17, 13, 2, 2, 1, 1, 2, 2, 4, false, 2, false, CONV_ACTIVATION_NONE, 1, 1 },
+    { 3, 3, 0, 6, 17, 13, 2, 1, 1, 1, 1, 2, 2, false, 1, true, CONV_ACTIVATION_NONE, 1, 1 },
+    { 5, 5, 0, 4, 17, 13, 2, 2, 2, 1, 1, 0, 0, false, 1, true, CONV_ACTIVATION_NONE, 1, 1 },
+    // Fused activation and pooling
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_RELU, 1, 1 },
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_SIGMOID, 1, 1 },
+    { 3, 3, 8, 5, 17, 13, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_TANH, 1, 1 },
+    { 3, 3, 8, 5, 18, 14, 2, 1, 1, 1, 1, 2, 2, false, 1, false, CONV_ACTIVATION_NONE, 2, 2 },
+    { 5, 5, 8, 5, 20, 16, 4, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_RELU, 2, 2 },
+    { 7, 7, 12, 3, 46, 38, 2, 1, 1, 1, 1, 0, 0, false, 1, false, CONV_ACTIVATION_NONE, 2, 2 },
+  };
+
+  const ConvolutionAlgorithm algorithms[] = {
+    CONV_ALGORITHM_GEMM, CONV_ALGORITHM_DIRECT, CONV_ALGORITHM_WINOGRAD,
+    CONV_ALGORITHM_DEPTHWISE
+  };
+
+  const std::size_t counts[] = { 0, 1, 7, 64, 1000, 100003 };
+  const std::size_t grains[] = { 1, 3, 64, 5000 };
+
+  unsigned int failures = 0;
+
+  for (const unsigned int t : { 1u, threads }) {
+    ThreadPool::SetThreads (t);
+    LOGINFO << "Testing with " << ThreadPool::Threads() << " thread(s)...";
+
+    unsigned int pool_failures = 0;
+    for (const std::size_t count : counts)
+      for (const std::size_t grain : grains)
+        if (!TestParallelRange (count, grain))
+          pool_failures++;
+    if (!TestNestedLoops())
+      pool_failures++;
+    if (!TestConcurrentCallers())
+      pool_failures++;
+    LOGINFO << "ThreadPool: " << pool_failures << " failure(s)";
+
+    for (const ConvolutionAlgorithm algorithm : algorithms) {
+      unsigned int tests = 0, algorithm_failures = 0;
+      for (const TestCase& c : cases)
+        if (!TestConvolution (c, algorithm, tests))
+          algorithm_failures++;
+      LOGINFO << algorithm_names[algorithm] << " convolution: " <<
+              tests << " layer(s), " << algorithm_failures << " failure(s)";
+      failures += algorithm_failures;
+    }
+
+    failures += pool_failures;
+  }
+
+  if (failures > 0)
+    LOGERROR << failures << " test(s) failed";
+  else
+    LOGINFO << "All tests passed";
+
+  LOGEND;
+  return failures > 0 ? -1 : 0;
+}
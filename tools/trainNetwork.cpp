@@ -154,6 +154,7 @@ int main (int argc, char* argv[]) {
   net.InitializeWeights();
 
   if (GRADIENT_CHECK) {
+    Conv::GradientTester::TestAccuracy (net);
     Conv::GradientTester::TestGradient (net);
   } else {
     Conv::Trainer trainer (net, settings);
@@ -167,7 +168,7 @@ int main (int argc, char* argv[]) {
       
       // Assemble testing net
       Conv::TensorStreamDataset* testing_dataset = Conv::TensorStreamDataset::CreateFromConfiguration (dataset_config_file, false, Conv::LOAD_TESTING_ONLY);
-      testing_net = new Conv::Net();
+      testing_net = new Conv::Net (true);
 
       int tdata_layer_id = 0;
 
@@ -218,6 +219,9 @@ int main (int argc, char* argv[]) {
         testing_ct->delta.Shadow (training_ct->delta);
       }
 
+      // The testing net only runs forward passes
+      testing_net->PlanMemory();
+
       Conv::TrainerSettings settings = tfactory->optimal_settings();
       settings.pbatchsize = 1;
       settings.sbatchsize = 1;